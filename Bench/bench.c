@@ -0,0 +1,129 @@
+/*
+ * File: bench.c
+ * Purpose: Benchmark harness for the fix path kernels. Built for the target in
+ *          place of main.c and run under the emulator by bench_run.c, which
+ *          counts instructions and cycles between each BENCH_Begin and BENCH_End
+ */
+#include "bench.h"
+#include "gps.h"
+#include "gpx.h"
+#include "simplify.h"
+#include "lz.h"
+#include <string.h>
+
+#define BENCH ((BENCH_PORT *) BENCH_PORT_ADDR)
+
+// Each kernel runs over the corpus this many times
+#define BENCH_ROUNDS 4
+
+// Receiver output covering the default sentence set and both hemispheres. The
+// GLGSV checksum is wrong on purpose
+static const char *corpus[] = {
+    "$GNRMC,083559.00,A,4717.11437,N,00833.91522,E,0.004,77.52,091202,,,A,V*33\r\n",
+    "$GNVTG,77.52,T,,M,0.004,N,0.008,K,A*18\r\n",
+    "$GNGGA,083559.00,4717.11437,N,00833.91522,E,1,08,1.01,499.6,M,48.0,M,,*46\r\n",
+    "$GNGSA,A,3,23,29,07,08,09,18,26,,,,,,1.94,1.18,1.54,1*04\r\n",
+    "$GPGSV,3,1,09,07,79,048,42,02,51,062,43,26,36,256,42,27,27,138,42,0*62\r\n",
+    "$GLGSV,1,1,02,72,45,120,40,79,30,200,38,1*7C\r\n",
+    "$GNGLL,4717.11364,N,00833.91565,E,092321.00,A,A*7E\r\n",
+    "$GNRMC,092321.00,A,3345.67812,S,15112.34567,E,12.337,181.20,150321,,,A,V*28\r\n",
+    "$GNRMC,180002.00,A,4036.81210,N,11152.19083,W,1.204,3.85,040720,,,D,V*10\r\n",
+    "$GNRMC,180003.00,A,4036.81290,N,11152.19101,W,1.198,3.91,040720,,,D,V*11\r\n",
+    "$GNTXT,01,01,02,u-blox AG - www.u-blox.com*4E\r\n",
+};
+
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+
+static char sentence[NMEA_MAX_LEN+3]; // room for <CR><LF> and the null
+static FIX fix;
+static char latstr[GPX_COORD_LEN], lonstr[GPX_COORD_LEN];
+static char trkpt[GPX_TRKPT_LEN];
+static FIX logged;
+
+volatile uint32_t benchSink;
+
+static inline void BENCH_Begin(BENCH_KERNEL kernel) {
+    BENCH->KERNEL = kernel;
+    BENCH->CMD = BENCH_CMD_BEGIN;
+}
+
+static inline void BENCH_End(uint32_t bytes) {
+    BENCH->BYTES = bytes;
+    BENCH->CMD = BENCH_CMD_END;
+}
+
+/*
+ * Copy corpus sentence i to RAM, where the firmware would have it.
+ * Returns its length
+ */
+static uint32_t BENCH_Load(uint32_t i) {
+    strcpy(sentence, corpus[i]);
+    return strlen(sentence);
+}
+
+/*
+ * True if corpus sentence i is a fix the logger would record
+ */
+static uint8_t BENCH_IsFix(uint32_t i) {
+    return strncmp(&corpus[i][3], NMEA_RMC, NMEA_MAX_LEN_SENTENCE) == 0;
+}
+
+int main(void) {
+    for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < CORPUS_SIZE; i++) {
+            uint32_t len = BENCH_Load(i);
+
+            BENCH_Begin(BENCH_OVERHEAD);
+            BENCH_End(0);
+
+            BENCH_Begin(BENCH_CHECKSUM);
+            benchSink = NMEA_VerifyChecksum(sentence);
+            BENCH_End(len);
+
+            BENCH_Begin(BENCH_PARSE);
+            fix = NMEA_ParseData(sentence);
+            BENCH_End(len);
+
+            // a block too full to take it is written out and the sentence
+            // compressed into the next, only the first try is measured
+            BENCH_Begin(BENCH_COMPRESS);
+            uint8_t full = LZ_Compress((uint8_t *) sentence, len);
+            BENCH_End(len);
+            if (full) {
+                LZ_Next();
+                LZ_Compress((uint8_t *) sentence, len);
+            }
+
+            if (!BENCH_IsFix(i)) continue;
+
+            BENCH_Begin(BENCH_CONVERT);
+            GPX_FormatCoord(fix.lat, latstr);
+            GPX_FormatCoord(fix.lon, lonstr);
+            BENCH_End(0);
+
+            BENCH_Begin(BENCH_FORMAT);
+            benchSink = GPX_FormatTrackPoint(&fix, trkpt, sizeof(trkpt));
+            BENCH_End(0);
+
+            len = BENCH_Load(i);
+            BENCH_Begin(BENCH_FIX);
+            fix = GPS_ParseData_NMEA(sentence);
+            benchSink = GPX_FormatTrackPoint(&fix, trkpt, sizeof(trkpt));
+            BENCH_End(len);
+
+            BENCH_Begin(BENCH_SIMPLIFY);
+            benchSink = SIMPLIFY_Push(&fix, &logged);
+            BENCH_End(0);
+        }
+    }
+
+    BENCH->CMD = BENCH_CMD_DONE;
+    while (1);
+}
+
+/*
+ * The clock setup in clock.c isn't run here
+ */
+void Error_Handler(void) {
+    while (1);
+}
@@ -0,0 +1,42 @@
+/*
+ * File: bench.h
+ * Purpose: Declares the benchmark kernels and the port the harness uses to tell
+ *          the emulator where each measured call starts and ends. Shared by
+ *          bench.c on the target and bench_run.c on the host
+ */
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdint.h>
+
+// Nothing is mapped here on the STM32F072, the runner traps writes to it
+#define BENCH_PORT_ADDR 0x60000000
+#define BENCH_PORT_SIZE 0x1000
+
+typedef struct {
+    volatile uint32_t KERNEL;   // kernel being measured
+    volatile uint32_t BYTES;    // input bytes handled by the call that just ended
+    volatile uint32_t CMD;      // writing starts or ends a measurement
+} BENCH_PORT;
+
+#define BENCH_CMD_BEGIN 1
+#define BENCH_CMD_END   2
+#define BENCH_CMD_DONE  3
+
+typedef enum {
+    BENCH_OVERHEAD,     // empty measurement, subtracted from the others
+    BENCH_CHECKSUM,     // NMEA_VerifyChecksum on a sentence
+    BENCH_PARSE,        // NMEA_ParseData on a sentence
+    BENCH_CONVERT,      // GPX_FormatCoord on the lat and lon of a fix
+    BENCH_FORMAT,       // GPX_FormatTrackPoint for a fix
+    BENCH_FIX,          // RMC sentence to <trkpt> line
+    BENCH_SIMPLIFY,     // SIMPLIFY_Push for a fix
+    BENCH_COMPRESS,     // LZ_Compress on a sentence for the raw log
+    BENCH_KERNELS
+} BENCH_KERNEL;
+
+// Indexed by BENCH_KERNEL, what one call of each kernel handles
+#define BENCH_KERNEL_NAMES { "overhead", "checksum", "parse", "convert", "format", "fix", "simplify", "compress" }
+#define BENCH_KERNEL_UNITS { "call", "sentence", "sentence", "fix", "fix", "fix", "fix", "sentence" }
+
+#endif /* __BENCH_H */
@@ -0,0 +1,394 @@
+/*
+ * File: bench_run.c
+ * Purpose: Runs the benchmark harness image under the Unicorn emulator as a
+ *          Cortex-M0 and counts instructions and cycles for each kernel. Writes
+ *          a JSON report, adds flash and RAM use from the firmware's map file
+ *          and fails if anything grew past the baseline
+ */
+#include "bench.h"
+#include <unicorn/unicorn.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// STM32F072RB memory, the peripherals are plain RAM as the kernels don't touch them
+#define BENCH_FLASH_ADDR  0x08000000
+#define BENCH_FLASH_SIZE  (128 * 1024)
+#define BENCH_SRAM_ADDR   0x20000000
+#define BENCH_SRAM_SIZE   (16 * 1024)
+#define BENCH_APB_ADDR    0x40000000
+#define BENCH_APB_SIZE    0x30000
+#define BENCH_GPIO_ADDR   0x48000000
+#define BENCH_GPIO_SIZE   0x2000
+#define BENCH_SCS_ADDR    0xE0000000
+#define BENCH_SCS_SIZE    0x100000
+
+// Give up on a harness that runs away
+#define BENCH_MAX_INSNS 200000000ULL
+
+#define BENCH_MAX_METRICS 32
+#define BENCH_MAX_LINE 256
+#define BENCH_DEFAULT_TOLERANCE 2.0 // percent
+
+typedef struct {
+    uint32_t calls;
+    uint64_t bytes;
+    uint64_t insns;
+    uint64_t cycles;
+} BENCH_RESULT;
+
+typedef struct {
+    char name[48];
+    double value;
+} BENCH_METRIC;
+
+static const char *kernelNames[BENCH_KERNELS] = BENCH_KERNEL_NAMES;
+static const char *kernelUnits[BENCH_KERNELS] = BENCH_KERNEL_UNITS;
+
+static BENCH_RESULT results[BENCH_KERNELS];
+static uint64_t insns, cycles;          // since reset
+static uint64_t startInsns, startCycles;
+static uint32_t kernel, bytes;
+static uint8_t done;
+
+// Cycles per instruction by halfword address, 0 until first executed
+static uint8_t costs[BENCH_FLASH_SIZE / 2];
+#define BENCH_COST_COND 0x80            // conditional branch, 2 more when taken
+static uint64_t fallThrough;            // next address if the last branch wasn't taken
+
+static BENCH_METRIC metrics[BENCH_MAX_METRICS];
+static uint32_t metricCount;
+
+/*
+ * Cycles for a Thumb instruction on the Cortex-M0 with the single cycle
+ * multiplier, per the Cortex-M0 TRM. Flash wait states are not counted
+ */
+static uint8_t BENCH_Cost(uint16_t op) {
+    if ((op & 0xF800) >= 0xE800) return 4;                      // BL, MSR, MRS, DMB, DSB, ISB
+    if ((op & 0xF000) == 0xD000 && (op & 0x0E00) != 0x0E00) {
+        return 1 | BENCH_COST_COND;                             // B<cond>
+    }
+    if ((op & 0xF800) == 0xE000) return 3;                      // B
+    if ((op & 0xFC00) == 0x4400) {                              // high register ADD, CMP, MOV, BX, BLX
+        uint8_t kind = (op >> 8) & 0x3;
+        uint8_t rd = ((op >> 4) & 0x8) | (op & 0x7);
+        if (kind == 3) return 3;
+        if (kind != 1 && rd == 15) return 3;
+        return 1;
+    }
+    if ((op & 0xF800) == 0x4800) return 2;                      // LDR literal
+    if ((op & 0xF000) == 0x5000) return 2;                      // load/store register offset
+    if ((op & 0xE000) == 0x6000) return 2;                      // load/store word and byte immediate
+    if ((op & 0xE000) == 0x8000) return 2;                      // halfword and SP relative
+    if ((op & 0xF000) == 0xC000) return 1 + __builtin_popcount(op & 0xFF);      // LDM, STM
+    if ((op & 0xFE00) == 0xB400) return 1 + __builtin_popcount(op & 0x1FF);     // PUSH
+    if ((op & 0xFE00) == 0xBC00) {                                              // POP
+        if (op & 0x100) return 4 + __builtin_popcount(op & 0xFF);
+        return 1 + __builtin_popcount(op & 0xFF);
+    }
+    if (op == 0xBF30) return 2;                                 // WFI
+    return 1;
+}
+
+/*
+ * Runs before every instruction in flash
+ */
+static void BENCH_Code(uc_engine *uc, uint64_t address, uint32_t size, void *user) {
+    uint32_t i = (address - BENCH_FLASH_ADDR) / 2;
+
+    if (fallThrough != 0) {
+        if (address != fallThrough) cycles += 2; // taken, the pipeline refills
+        fallThrough = 0;
+    }
+
+    if (costs[i] == 0) {
+        uint16_t op;
+        uc_mem_read(uc, address, &op, sizeof(op));
+        costs[i] = BENCH_Cost(op);
+    }
+
+    cycles += costs[i] & ~BENCH_COST_COND;
+    if (costs[i] & BENCH_COST_COND) fallThrough = address + size;
+    insns++;
+}
+
+/*
+ * The harness marks the start and end of each measured call through the port
+ */
+static void BENCH_PortWrite(uc_engine *uc, uc_mem_type type, uint64_t address, int size, int64_t value, void *user) {
+    switch (address - BENCH_PORT_ADDR) {
+        case offsetof(BENCH_PORT, KERNEL): kernel = value; break;
+        case offsetof(BENCH_PORT, BYTES): bytes = value; break;
+        case offsetof(BENCH_PORT, CMD):
+            if (value == BENCH_CMD_BEGIN) {
+                startInsns = insns;
+                startCycles = cycles;
+            }
+            else if (value == BENCH_CMD_END && kernel < BENCH_KERNELS) {
+                results[kernel].calls++;
+                results[kernel].bytes += bytes;
+                results[kernel].insns += insns - startInsns;
+                results[kernel].cycles += cycles - startCycles;
+            }
+            else if (value == BENCH_CMD_DONE) {
+                done = 1;
+                uc_emu_stop(uc);
+            }
+            break;
+    }
+}
+
+/*
+ * Load the harness image into flash and run it from reset until it reports done.
+ * Returns 1 on failure, 0 otherwise
+ */
+static uint8_t BENCH_Run(char *image) {
+    static uint8_t flash[BENCH_FLASH_SIZE];
+    uc_engine *uc;
+    uc_hook code, port;
+    uc_err err;
+
+    FILE *f = fopen(image, "rb");
+    if (f == NULL) {
+        perror(image);
+        return 1; // FAILURE
+    }
+    size_t len = fread(flash, 1, sizeof(flash), f);
+    fclose(f);
+
+    err = uc_open(UC_ARCH_ARM, UC_MODE_THUMB | UC_MODE_MCLASS, &uc);
+    if (err == UC_ERR_OK) err = uc_ctl_set_cpu_model(uc, UC_CPU_ARM_CORTEX_M0);
+    if (err != UC_ERR_OK) {
+        fprintf(stderr, "bench: %s\n", uc_strerror(err));
+        return 1; // FAILURE
+    }
+
+    uc_mem_map(uc, BENCH_FLASH_ADDR, BENCH_FLASH_SIZE, UC_PROT_READ | UC_PROT_EXEC);
+    uc_mem_map(uc, BENCH_SRAM_ADDR, BENCH_SRAM_SIZE, UC_PROT_ALL);
+    uc_mem_map(uc, BENCH_APB_ADDR, BENCH_APB_SIZE, UC_PROT_READ | UC_PROT_WRITE);
+    uc_mem_map(uc, BENCH_GPIO_ADDR, BENCH_GPIO_SIZE, UC_PROT_READ | UC_PROT_WRITE);
+    uc_mem_map(uc, BENCH_SCS_ADDR, BENCH_SCS_SIZE, UC_PROT_READ | UC_PROT_WRITE);
+    uc_mem_map(uc, BENCH_PORT_ADDR, BENCH_PORT_SIZE, UC_PROT_READ | UC_PROT_WRITE);
+    uc_mem_write(uc, BENCH_FLASH_ADDR, flash, len);
+
+    uc_hook_add(uc, &code, UC_HOOK_CODE, BENCH_Code, NULL, BENCH_FLASH_ADDR, BENCH_FLASH_ADDR + BENCH_FLASH_SIZE - 1);
+    uc_hook_add(uc, &port, UC_HOOK_MEM_WRITE, BENCH_PortWrite, NULL, BENCH_PORT_ADDR, BENCH_PORT_ADDR + BENCH_PORT_SIZE - 1);
+
+    // initial stack pointer and reset handler from the vector table
+    uint32_t sp, reset;
+    memcpy(&sp, &flash[0], sizeof(sp));
+    memcpy(&reset, &flash[4], sizeof(reset));
+    uc_reg_write(uc, UC_ARM_REG_SP, &sp);
+
+    err = uc_emu_start(uc, reset | 1, 0, 0, BENCH_MAX_INSNS);
+    uc_close(uc);
+
+    if (err != UC_ERR_OK || !done) {
+        fprintf(stderr, "bench: harness stopped after %llu instructions: %s\n",
+                (unsigned long long) insns, err != UC_ERR_OK ? uc_strerror(err) : "never finished");
+        return 1; // FAILURE
+    }
+    return 0;
+}
+
+/*
+ * Record a metric for the report and the baseline check
+ */
+static void BENCH_AddMetric(const char *name, const char *what, double value) {
+    if (metricCount == BENCH_MAX_METRICS) return;
+    snprintf(metrics[metricCount].name, sizeof(metrics[0].name), "%s%s%s", name, *what ? "." : "", what);
+    metrics[metricCount].value = value;
+    metricCount++;
+}
+
+/*
+ * Sum the flash and RAM used by the allocated sections in a GNU ld map file.
+ * Returns 1 on failure, 0 otherwise
+ */
+static uint8_t BENCH_MapSizes(char *map, uint32_t *flashUsed, uint32_t *ramUsed) {
+    char line[BENCH_MAX_LINE], name[BENCH_MAX_LINE];
+    uint8_t inMap = 0;
+
+    FILE *f = fopen(map, "r");
+    if (f == NULL) {
+        perror(map);
+        return 1; // FAILURE
+    }
+
+    *flashUsed = 0;
+    *ramUsed = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "Linker script and memory map", 28) == 0) inMap = 1;
+        if (!inMap || line[0] != '.') continue;
+
+        // output sections start in the first column, long names wrap the rest onto the next line
+        unsigned int addr, size, load;
+        char *rest = line;
+        if (sscanf(line, "%s 0x%x 0x%x", name, &addr, &size) != 3) {
+            if (fgets(line, sizeof(line), f) == NULL) break;
+            if (sscanf(line, " 0x%x 0x%x", &addr, &size) != 2) continue;
+        }
+        else {
+            rest = line + strlen(name);
+        }
+
+        if ((addr & 0xFF000000) == BENCH_FLASH_ADDR) *flashUsed += size;
+        if ((addr & 0xFF000000) == BENCH_SRAM_ADDR) *ramUsed += size;
+
+        char *at = strstr(rest, "load address");
+        if (at != NULL && sscanf(at, "load address 0x%x", &load) == 1 && (load & 0xFF000000) == BENCH_FLASH_ADDR) {
+            *flashUsed += size; // initial values of .data
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Write the kernel results and sizes as JSON.
+ * Returns 1 on failure, 0 otherwise
+ */
+static uint8_t BENCH_Report(char *path, uint8_t haveSizes, uint32_t flashUsed, uint32_t ramUsed) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return 1; // FAILURE
+    }
+
+    BENCH_RESULT *base = &results[BENCH_OVERHEAD];
+    double baseInsns = base->calls ? (double) base->insns / base->calls : 0;
+    double baseCycles = base->calls ? (double) base->cycles / base->calls : 0;
+
+    fprintf(f, "{\n  \"cpu\": \"cortex-m0\",\n  \"overhead_cycles\": %.1f,\n  \"kernels\": {", baseCycles);
+    for (uint32_t k = BENCH_OVERHEAD + 1; k < BENCH_KERNELS; k++) {
+        BENCH_RESULT *r = &results[k];
+        if (r->calls == 0) continue;
+
+        double callInsns = (double) r->insns / r->calls - baseInsns;
+        double callCycles = (double) r->cycles / r->calls - baseCycles;
+        BENCH_AddMetric(kernelNames[k], "insns_per_call", callInsns);
+        BENCH_AddMetric(kernelNames[k], "cycles_per_call", callCycles);
+
+        fprintf(f, "%s\n    \"%s\": { \"unit\": \"%s\", \"calls\": %u, \"bytes\": %llu, "
+                "\"insns_per_call\": %.1f, \"cycles_per_call\": %.1f",
+                k == BENCH_OVERHEAD + 1 ? "" : ",", kernelNames[k], kernelUnits[k], (unsigned) r->calls,
+                (unsigned long long) r->bytes, callInsns, callCycles);
+        if (r->bytes != 0) {
+            double byteCycles = callCycles * r->calls / r->bytes;
+            BENCH_AddMetric(kernelNames[k], "cycles_per_byte", byteCycles);
+            fprintf(f, ", \"cycles_per_byte\": %.2f", byteCycles);
+        }
+        fprintf(f, " }");
+    }
+    fprintf(f, "\n  }");
+
+    if (haveSizes) {
+        BENCH_AddMetric("flash", "", flashUsed);
+        BENCH_AddMetric("ram", "", ramUsed);
+        fprintf(f, ",\n  \"flash\": %u,\n  \"ram\": %u", (unsigned) flashUsed, (unsigned) ramUsed);
+    }
+    fprintf(f, "\n}\n");
+
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Compare the metrics against the baseline file of "name value" lines.
+ * Returns the number that grew by more than tolerance percent or that the
+ * baseline has no value for, all of them if there is no baseline
+ */
+static uint32_t BENCH_Check(char *path, double tolerance) {
+    char line[BENCH_MAX_LINE], name[BENCH_MAX_LINE];
+    double value;
+    uint32_t regressions = 0;
+    uint8_t compared[BENCH_MAX_METRICS] = { 0 };
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "bench: no baseline at %s, make bench-baseline records one\n", path);
+        return metricCount != 0 ? metricCount : 1;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%s %lf", name, &value) != 2) continue;
+
+        for (uint32_t i = 0; i < metricCount; i++) {
+            if (strcmp(metrics[i].name, name) != 0) continue;
+
+            double change = value != 0 ? 100.0 * (metrics[i].value - value) / value : 0;
+            uint8_t regressed = change > tolerance;
+            printf("%-28s %12.1f %12.1f %+7.2f%%%s\n", name, value, metrics[i].value, change, regressed ? "  REGRESSED" : "");
+            regressions += regressed;
+            compared[i] = 1;
+        }
+    }
+    fclose(f);
+
+    for (uint32_t i = 0; i < metricCount; i++) {
+        if (compared[i]) continue;
+        printf("%-28s %12s %12.1f           NO BASELINE\n", metrics[i].name, "-", metrics[i].value);
+        regressions++;
+    }
+    return regressions;
+}
+
+/*
+ * Replace the baseline with the current metrics.
+ * Returns 1 on failure, 0 otherwise
+ */
+static uint8_t BENCH_Update(char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return 1; // FAILURE
+    }
+    for (uint32_t i = 0; i < metricCount; i++) fprintf(f, "%s %.1f\n", metrics[i].name, metrics[i].value);
+    fclose(f);
+    return 0;
+}
+
+static void BENCH_Usage(char *name) {
+    fprintf(stderr, "usage: %s [-m firmware.map] [-b baseline] [-u] [-t tolerance%%] [-o report.json] bench.bin\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    char *map = NULL, *baseline = NULL, *report = "bench.json";
+    double tolerance = BENCH_DEFAULT_TOLERANCE;
+    uint8_t update = 0;
+    uint32_t flashUsed = 0, ramUsed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:b:ut:o:")) != -1) {
+        switch (opt) {
+            case 'm': map = optarg; break;
+            case 'b': baseline = optarg; break;
+            case 'u': update = 1; break;
+            case 't': tolerance = atof(optarg); break;
+            case 'o': report = optarg; break;
+            default: BENCH_Usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) BENCH_Usage(argv[0]);
+
+    if (BENCH_Run(argv[optind])) return 1;
+    if (map != NULL && BENCH_MapSizes(map, &flashUsed, &ramUsed)) return 1;
+    if (BENCH_Report(report, map != NULL, flashUsed, ramUsed)) return 1;
+    printf("bench: %llu instructions, %llu cycles, report in %s\n",
+           (unsigned long long) insns, (unsigned long long) cycles, report);
+
+    if (baseline == NULL) return 0;
+    if (update) return BENCH_Update(baseline);
+
+    uint32_t regressions = BENCH_Check(baseline, tolerance);
+    if (regressions != 0) {
+        fprintf(stderr, "bench: %u metrics regressed by more than %.1f%% or have no baseline\n",
+                (unsigned) regressions, tolerance);
+        return 1;
+    }
+    return 0;
+}
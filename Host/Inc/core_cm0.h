@@ -0,0 +1,51 @@
+/*
+ * File: core_cm0.h
+ * Purpose: Host build stand-in for the CMSIS Cortex-M0 core header. Provides the
+ *          register qualifiers the device header needs and routes the NVIC and
+ *          interrupt masking intrinsics to the simulator instead of the core
+ */
+#ifndef __SIM_CORE_CM0_H
+#define __SIM_CORE_CM0_H
+
+#include <stdint.h>
+
+// register qualifiers
+#define __I   volatile const
+#define __O   volatile
+#define __IO  volatile
+#define __IM  volatile const
+#define __OM  volatile
+#define __IOM volatile
+
+// compiler abstraction
+#define __ASM            __asm
+#define __INLINE         inline
+#define __STATIC_INLINE  static inline
+#define __NO_RETURN      __attribute__((__noreturn__))
+#define __USED           __attribute__((used))
+#define __WEAK           __attribute__((weak))
+#define __PACKED         __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)     __attribute__((aligned(x)))
+
+// implemented in Host/Src/sim_hal.c
+void SIM_NvicEnable(IRQn_Type irq);
+void SIM_NvicDisable(IRQn_Type irq);
+void SIM_NvicSetPriority(IRQn_Type irq, uint32_t priority);
+void SIM_IrqDisable(void);
+void SIM_IrqEnable(void);
+void SIM_WaitForInterrupt(void);
+
+__STATIC_INLINE void NVIC_EnableIRQ(IRQn_Type IRQn) { SIM_NvicEnable(IRQn); }
+__STATIC_INLINE void NVIC_DisableIRQ(IRQn_Type IRQn) { SIM_NvicDisable(IRQn); }
+__STATIC_INLINE void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority) { SIM_NvicSetPriority(IRQn, priority); }
+
+__STATIC_INLINE void __enable_irq(void) { SIM_IrqEnable(); }
+__STATIC_INLINE void __disable_irq(void) { SIM_IrqDisable(); }
+__STATIC_INLINE void __WFI(void) { SIM_WaitForInterrupt(); }
+__STATIC_INLINE void __WFE(void) { SIM_WaitForInterrupt(); }
+__STATIC_INLINE void __NOP(void) { }
+__STATIC_INLINE void __DMB(void) { __sync_synchronize(); }
+__STATIC_INLINE void __DSB(void) { __sync_synchronize(); }
+__STATIC_INLINE void __ISB(void) { __sync_synchronize(); }
+
+#endif /* __SIM_CORE_CM0_H */
@@ -0,0 +1,61 @@
+/*
+ * File: stm32f0xx.h
+ * Purpose: Host build stand-in for the device header. Pulls in the real register
+ *          definitions, then points every peripheral the firmware touches at a
+ *          RAM copy of its registers owned by the simulator
+ */
+#ifndef __SIM_STM32F0XX_H
+#define __SIM_STM32F0XX_H
+
+#include_next "stm32f0xx.h"
+
+// implemented in Host/Src/sim_hal.c
+extern RCC_TypeDef SIM_RCC;
+extern FLASH_TypeDef SIM_FLASH;
+extern PWR_TypeDef SIM_PWR;
+extern EXTI_TypeDef SIM_EXTI;
+extern SYSCFG_TypeDef SIM_SYSCFG;
+extern TIM_TypeDef SIM_TIM2;
+extern I2C_TypeDef SIM_I2C1;
+extern USART_TypeDef SIM_USART1;
+extern USART_TypeDef SIM_USART3;
+extern SPI_TypeDef SIM_SPI2;
+extern RTC_TypeDef SIM_RTC;
+
+// GPIO writes to BSRR/BRR only reach ODR when the port is next accessed
+GPIO_TypeDef *SIM_GPIO(uint32_t port);
+
+// The calendar runs in TR and DR, brought up to date on each access
+RTC_TypeDef *SIM_RTCRegs(void);
+
+#undef RCC
+#undef FLASH
+#undef PWR
+#undef EXTI
+#undef SYSCFG
+#undef TIM2
+#undef I2C1
+#undef USART1
+#undef USART3
+#undef SPI2
+#undef RTC
+#undef GPIOA
+#undef GPIOB
+#undef GPIOC
+
+#define RCC     (&SIM_RCC)
+#define FLASH   (&SIM_FLASH)
+#define PWR     (&SIM_PWR)
+#define EXTI    (&SIM_EXTI)
+#define SYSCFG  (&SIM_SYSCFG)
+#define TIM2    (&SIM_TIM2)
+#define I2C1    (&SIM_I2C1)
+#define USART1  (&SIM_USART1)
+#define USART3  (&SIM_USART3)
+#define SPI2    (&SIM_SPI2)
+#define RTC     (SIM_RTCRegs())
+#define GPIOA   (SIM_GPIO(0))
+#define GPIOB   (SIM_GPIO(1))
+#define GPIOC   (SIM_GPIO(2))
+
+#endif /* __SIM_STM32F0XX_H */
@@ -0,0 +1,161 @@
+/*
+ * File: ringbuf_test.c
+ * Purpose: Stress test of the single-producer/single-consumer queue on the
+ *          host. A producer and a consumer thread pass a counting byte
+ *          sequence through a small queue as fast as they can, mixing the
+ *          single byte, bulk and span calls on both sides, and the consumer
+ *          checks every byte comes out once and in order. The free running
+ *          indexes start just short of wrapping around
+ *
+ *          make host-test
+ */
+#include "ringbuf.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_QUEUE_SIZE 16
+#define TEST_BYTES      4000000UL
+#define TEST_CHUNK      (TEST_QUEUE_SIZE + 3) // longer than the queue
+
+static uint8_t storage[TEST_QUEUE_SIZE];
+static RINGBUF queue;
+static volatile uint8_t failed;
+
+/*
+ * Next number from a small xorshift, so both threads vary their calls
+ * without sharing state
+ */
+static uint32_t TEST_Random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+ * Push TEST_BYTES bytes of the sequence, a byte, a bulk copy or a span at a
+ * time
+ */
+static void *TEST_Producer(void *arg) {
+    uint32_t state = 0x12345678;
+    unsigned long next = 0;
+    uint8_t chunk[TEST_CHUNK];
+
+    while (next < TEST_BYTES && !failed) {
+        uint32_t len = 1 + TEST_Random(&state) % TEST_CHUNK;
+        if (len > TEST_BYTES - next) len = TEST_BYTES - next;
+        if (RINGBUF_Free(&queue) == 0) sched_yield(); // on a single core too
+
+        switch (TEST_Random(&state) % 4) {
+            case 0:
+                if (!RINGBUF_Push(&queue, next & 0xFF)) next++;
+                break;
+            case 1:
+                for (uint32_t i = 0; i < len; i++) chunk[i] = (next + i) & 0xFF;
+                next += RINGBUF_PushBulk(&queue, chunk, len);
+                break;
+            case 2:
+                // all or nothing
+                for (uint32_t i = 0; i < len; i++) chunk[i] = (next + i) & 0xFF;
+                if (!RINGBUF_PushAll(&queue, chunk, len)) next += len;
+                break;
+            default: {
+                uint8_t *span;
+                uint32_t n = RINGBUF_WriteSpan(&queue, &span);
+                if (n > len) n = len;
+                for (uint32_t i = 0; i < n; i++) span[i] = (next + i) & 0xFF;
+                RINGBUF_Commit(&queue, n);
+                next += n;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Take the sequence out again, a byte, a bulk copy, a peek or a span at a
+ * time, and check it
+ */
+static void *TEST_Consumer(void *arg) {
+    uint32_t state = 0x9ABCDEF0;
+    unsigned long next = 0;
+    uint8_t chunk[TEST_CHUNK];
+
+    while (next < TEST_BYTES && !failed) {
+        uint32_t len = 1 + TEST_Random(&state) % TEST_CHUNK;
+        uint32_t got = 0;
+        uint8_t *data = chunk;
+        uint8_t c;
+
+        if (RINGBUF_Count(&queue) == 0) sched_yield();
+
+        switch (TEST_Random(&state) % 4) {
+            case 0:
+                if (!RINGBUF_Pop(&queue, &c)) {
+                    chunk[0] = c;
+                    got = 1;
+                }
+                break;
+            case 1:
+                got = RINGBUF_PopBulk(&queue, chunk, len);
+                break;
+            case 2:
+                // a peek sees what the pop after it takes
+                if (!RINGBUF_Peek(&queue, 0, &c) && !RINGBUF_Pop(&queue, &chunk[0])) {
+                    if (c != chunk[0]) {
+                        fprintf(stderr, "ringbuf: peeked %u, popped %u at %lu\n", c, chunk[0], next);
+                        failed = 1;
+                    }
+                    got = 1;
+                }
+                break;
+            default:
+                got = RINGBUF_ReadSpan(&queue, &data);
+                if (got > len) got = len;
+                break;
+        }
+
+        for (uint32_t i = 0; i < got && !failed; i++, next++) {
+            if (data[i] != (next & 0xFF)) {
+                fprintf(stderr, "ringbuf: got %u, expected %u at %lu\n", data[i], (unsigned) (next & 0xFF), next);
+                failed = 1;
+            }
+        }
+        if (data != chunk) RINGBUF_Consume(&queue, got);
+
+        if (RINGBUF_Count(&queue) > RINGBUF_Size(&queue)) {
+            fprintf(stderr, "ringbuf: %u queued in %u\n", (unsigned) RINGBUF_Count(&queue), (unsigned) RINGBUF_Size(&queue));
+            failed = 1;
+        }
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t producer, consumer;
+
+    if (RINGBUF_Init(&queue, storage, sizeof(storage)) || !RINGBUF_Init(&queue, storage, sizeof(storage) - 1)) {
+        fprintf(stderr, "ringbuf: size check\n");
+        return 1;
+    }
+    RINGBUF_Init(&queue, storage, sizeof(storage));
+
+    // the free running indexes wrap around 2^32, here within the first bytes
+    queue.head = queue.tail = 0xFFFFFFFF - TEST_QUEUE_SIZE / 2;
+
+    pthread_create(&producer, NULL, TEST_Producer, NULL);
+    pthread_create(&consumer, NULL, TEST_Consumer, NULL);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    if (!failed && (RINGBUF_Count(&queue) != 0 || queue.highWater > TEST_QUEUE_SIZE)) {
+        fprintf(stderr, "ringbuf: %u left, high water %u\n", (unsigned) RINGBUF_Count(&queue), (unsigned) queue.highWater);
+        failed = 1;
+    }
+    printf("ringbuf: %lu bytes through %u, high water %u, %u overflows%s\n", TEST_BYTES, TEST_QUEUE_SIZE,
+           (unsigned) queue.highWater, (unsigned) queue.overflows, failed ? " FAILED" : "");
+    return failed;
+}
@@ -0,0 +1,151 @@
+/*
+ * File: sim.h
+ * Purpose: Declares the host simulator. The firmware runs unchanged against RAM
+ *          register stand-ins, except for i2c.c, usart.c and spi.c which are
+ *          replaced by device models, and the HAL flash driver. Time is virtual: it only moves when the
+ *          firmware waits, sleeps or spends time on a bus, so replay runs as fast
+ *          as the host can execute the firmware.
+ */
+#ifndef __SIM_H
+#define __SIM_H
+
+#include "utilities.h"
+#include <stdio.h>
+
+#define SIM_NEVER UINT64_MAX
+#define SIM_US_PER_S 1000000ULL
+
+// Receiver time pulses land this far into each virtual second
+#define SIM_PPS_PHASE_US 300000
+
+// Firmware spinning for this many idle checks without calling the simulator is idle
+#define SIM_IDLE_TICKS 2
+#define SIM_TICK_US 1000
+
+// Give up if recording hasn't ended this long after the stop press was due
+#define SIM_HANG_US (60 * SIM_US_PER_S)
+
+// File the firmware writes the track to, its writes are kept for -c
+#define SIM_OPENLOG_TRACK "trail.gpx"
+
+// Supply hold-up after a brown-out trips the PVD, unless given with -u
+#define SIM_HOLDUP_US SIM_US_PER_S
+
+typedef struct {
+    char *session;      // receiver output to replay
+    char *outDir;       // where the OpenLog files, LCD frames and debug output go
+    char *battery;      // backup registers and receiver BBR kept between runs, NULL for none
+    uint64_t warm;      // time since the previous run for a reset without power loss, SIM_NEVER for power up
+    uint64_t startAt;   // virtual time of the button press that starts recording
+    uint64_t tail;      // how long after the replay runs out to press stop
+    char *flashImage;   // internal flash kept between runs, NULL for blank flash every run
+    uint32_t powerCut;  // lose power during this flash program or erase, 0 for never
+    char *reference;    // unsimplified trail of the same session to check the track against, NULL for none
+    uint64_t brownOut;  // when the supply starts to fail, tripping the PVD, SIM_NEVER for never
+    uint64_t holdup;    // and how long after that it collapses
+    uint8_t cuts;       // check the track would survive being cut off after any byte
+    uint64_t outage;    // when OpenLog loses power, dropping what it is sent, SIM_NEVER for never
+    uint64_t outageLen; // and how long until it boots again
+    uint64_t dumpAt;    // when the spool dump command is typed on the debug port, SIM_NEVER for never
+} SIM_CONFIG;
+
+typedef struct {
+    uint32_t offset;    // where in the track
+    uint8_t c;          // the byte written there
+} SIM_WRITE;
+
+typedef struct {
+    uint32_t epochs;        // receiver epochs replayed
+    uint32_t solutions;     // epochs the receiver navigated and output at its CFG-RATE
+    uint32_t ddcDropped;    // epoch bytes lost to a full DDC buffer
+    uint32_t ddcRead;       // bytes read out of the receiver
+    uint32_t ddcWritten;    // bytes written to the receiver
+    uint32_t uartRead;      // bytes DMA received from the receiver's UART
+    uint32_t uartWritten;   // bytes sent to the receiver's UART
+    uint32_t uartDropped;   // UART bytes lost to a full buffer or a rate mismatch
+    uint32_t logBytes;      // bytes stored by OpenLog
+    uint32_t replyOverruns; // bytes OpenLog sent that USART3 lost to an overrun
+    uint32_t trackPoints;   // <trkpt> records stored by OpenLog
+    uint32_t fenceEvents;   // geofence event records stored by OpenLog
+    uint32_t lcdFrames;     // frames dumped by the LCD
+    uint32_t debugBytes;    // bytes sent on the USART1 debug port
+    uint32_t irqs;          // interrupt handlers run
+    uint32_t assistPos;     // MGA-INI position assistance received
+    uint32_t assistTime;    // MGA-INI time assistance received
+    uint32_t assistAno;     // MGA-ANO offline orbit frames received
+    uint64_t firstFix;      // when the receiver first output a valid RMC, SIM_NEVER until then
+    uint32_t flashOps;      // halfwords programmed and pages erased
+    uint64_t gpsCharge;     // receiver charge drawn over the epochs, uA s
+    uint32_t gpsFullTime;   // epochs the receiver spent at full power
+    uint32_t gpsLowTime;    // and in power optimized tracking or off
+} SIM_STATS;
+
+extern SIM_CONFIG simConfig;
+extern SIM_STATS simStats;
+
+// firmware entry points, see -Dmain=FIRMWARE_Main in the host build
+int FIRMWARE_Main(void);
+void EXTI0_1_IRQHandler(void);
+void TIM2_IRQHandler(void);
+void USART3_4_IRQHandler(void);
+void USART2_IRQHandler(void);
+void DMA1_Channel4_5_6_7_IRQHandler(void);
+void PVD_VDDIO2_IRQHandler(void);
+
+// sim_hal.c
+void SIM_Reset(void);
+uint64_t SIM_Now(void);
+void SIM_Lock(void);
+void SIM_Unlock(void);
+uint8_t SIM_Busy(void);
+uint32_t SIM_Activity(void);
+void SIM_Poll(void);
+void SIM_Delay(uint64_t us);
+void SIM_AdvanceTo(uint64_t t);
+uint64_t SIM_NextEvent(void);
+uint8_t SIM_Idle(void);
+uint8_t SIM_Stopped(void);
+uint8_t SIM_Hung(void);
+uint8_t SIM_NvicEnabled(IRQn_Type irq);
+void SIM_SyncGpio(uint32_t port);
+void SIM_RtcRestore(uint64_t off);
+uint64_t SIM_CharTime(uint32_t baud);
+
+// sim_gps.c
+#define SIM_GPS_IRQ_IDLE 0x1    // USART2 idle line
+#define SIM_GPS_IRQ_DMA  0x2    // DMA1 channel 5 half or full transfer
+
+uint8_t SIM_GPS_Load(char *path);
+uint8_t SIM_GPS_Epoch(void);
+uint8_t SIM_GPS_Pulsed(void);
+uint64_t SIM_GPS_NextEvent(void);
+uint8_t SIM_GPS_Poll(void);
+void SIM_GPS_LoadBbr(FILE *f);
+void SIM_GPS_SaveBbr(FILE *f);
+
+// sim_openlog.c
+uint8_t SIM_OPENLOG_Open(char *dir);
+void SIM_OPENLOG_Close(void);
+void SIM_OPENLOG_PinsChanged(uint32_t port, uint32_t before, uint32_t after);
+uint64_t SIM_OPENLOG_NextEvent(void);
+uint8_t SIM_OPENLOG_Poll(void);
+uint8_t SIM_OPENLOG_Idle(void);
+uint32_t SIM_OPENLOG_Journal(SIM_WRITE **writes);
+
+// sim_main.c
+void SIM_PowerLoss(void);
+
+// sim_flash.c
+uint8_t SIM_FLASH_Open(char *image);
+void SIM_FLASH_Close(char *image);
+
+// sim_lcd.c
+uint8_t SIM_LCD_Open(char *dir);
+void SIM_LCD_Close(void);
+
+// sim_track.c
+uint8_t SIM_TRACK_Check(char *reference, char *trail);
+uint8_t SIM_TRACK_CheckTrip(char *reference);
+uint8_t SIM_TRACK_CheckCuts(void);
+
+#endif /* __SIM_H */
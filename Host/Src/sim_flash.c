@@ -0,0 +1,148 @@
+/*
+ * File: sim_flash.c
+ * Purpose: Models the internal flash and the HAL flash driver for the host
+ *          build. Flash is mapped at its real address so the firmware reads it
+ *          directly, and only the driver can change it: halfwords program from
+ *          0xFFFF, or to 0x0000, and pages erase to 0xFF. The contents can be
+ *          kept in an image file between runs, and power can be cut in the
+ *          middle of any program or erase to check what survives
+ */
+#include "sim.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SIM_FLASH_SIZE (FLASH_BANK1_END + 1 - FLASH_BASE)
+
+// Programming a halfword and erasing a page stall the CPU this long
+#define SIM_FLASH_PROGRAM_US 53
+#define SIM_FLASH_ERASE_US   40000
+
+static uint8_t *flash;          // mapped at FLASH_BASE
+static uint32_t flashOps;       // halfwords programmed and pages erased so far
+
+/*
+ * Map blank flash at FLASH_BASE and fill it from image if there is one.
+ * Returns 1 on failure, 0 otherwise
+ */
+uint8_t SIM_FLASH_Open(char *image) {
+    flash = mmap((void *) (uintptr_t) FLASH_BASE, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (flash == MAP_FAILED || flash != (uint8_t *) (uintptr_t) FLASH_BASE) return 1; // FAILURE
+
+    memset(flash, 0xFF, SIM_FLASH_SIZE);
+    if (image != NULL) {
+        FILE *f = fopen(image, "rb");
+        if (f != NULL) {
+            if (fread(flash, 1, SIM_FLASH_SIZE, f) != SIM_FLASH_SIZE) memset(flash, 0xFF, SIM_FLASH_SIZE);
+            fclose(f);
+        }
+    }
+
+    return mprotect(flash, SIM_FLASH_SIZE, PROT_READ) != 0;
+}
+
+/*
+ * Keep the flash contents in image
+ */
+void SIM_FLASH_Close(char *image) {
+    if (image == NULL || flash == NULL) return;
+
+    FILE *f = fopen(image, "wb");
+    if (f == NULL) {
+        perror(image);
+        return;
+    }
+    fwrite(flash, 1, SIM_FLASH_SIZE, f);
+    fclose(f);
+}
+
+/*
+ * Count a program or erase, and lose power if it is the one to cut.
+ * Returns 1 if this operation is interrupted, 0 otherwise
+ */
+static uint8_t SIM_FLASH_Op(void) {
+    simStats.flashOps = ++flashOps;
+    return flashOps == simConfig.powerCut;
+}
+
+/*
+ * Program a halfword at addr the way the flash interface does.
+ * Returns 1 on a programming error, 0 otherwise
+ */
+static uint8_t SIM_FLASH_Halfword(uint32_t addr, uint16_t data) {
+    if (addr < FLASH_BASE || addr + 2 > FLASH_BANK1_END + 1 || (addr & 1)) return 1; // FAILURE
+
+    uint16_t *cell = (uint16_t *) (uintptr_t) addr;
+    if (*cell != 0xFFFF && data != 0x0000) return 1; // FAILURE, PGERR
+
+    SIM_Lock();
+    SIM_Delay(SIM_FLASH_PROGRAM_US);
+    SIM_Unlock();
+
+    mprotect(flash, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE);
+    if (SIM_FLASH_Op()) {
+        // cut short, only some of the bits made it to 0
+        *cell &= data | (uint16_t) (flashOps * 0x9E37);
+        mprotect(flash, SIM_FLASH_SIZE, PROT_READ);
+        SIM_PowerLoss();
+    }
+    *cell &= data;
+    mprotect(flash, SIM_FLASH_SIZE, PROT_READ);
+    return 0;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+    SIM_FLASH.CR &= ~FLASH_CR_LOCK;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+    SIM_FLASH.CR |= FLASH_CR_LOCK;
+    return HAL_OK;
+}
+
+/*
+ * Program 16, 32 or 64 bits, a halfword at a time
+ */
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+    uint32_t halfwords = TypeProgram == FLASH_TYPEPROGRAM_HALFWORD ? 1 : TypeProgram == FLASH_TYPEPROGRAM_WORD ? 2 : 4;
+
+    if (SIM_FLASH.CR & FLASH_CR_LOCK) return HAL_ERROR;
+    for (uint32_t i = 0; i < halfwords; i++) {
+        if (SIM_FLASH_Halfword(Address + 2 * i, (Data >> (16 * i)) & 0xFFFF)) return HAL_ERROR;
+    }
+    return HAL_OK;
+}
+
+/*
+ * Erase pages. A cut leaves the start of the page erased and the rest as it was
+ */
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError) {
+    *PageError = 0xFFFFFFFF;
+    if (SIM_FLASH.CR & FLASH_CR_LOCK || pEraseInit->TypeErase != FLASH_TYPEERASE_PAGES) return HAL_ERROR;
+
+    for (uint32_t i = 0; i < pEraseInit->NbPages; i++) {
+        uint32_t addr = pEraseInit->PageAddress + i * FLASH_PAGE_SIZE;
+        if (addr < FLASH_BASE || addr + FLASH_PAGE_SIZE > FLASH_BANK1_END + 1) {
+            *PageError = addr;
+            return HAL_ERROR;
+        }
+        uint8_t *page = (uint8_t *) (uintptr_t) (addr & ~(FLASH_PAGE_SIZE - 1));
+
+        SIM_Lock();
+        SIM_Delay(SIM_FLASH_ERASE_US);
+        SIM_Unlock();
+
+        mprotect(flash, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE);
+        if (SIM_FLASH_Op()) {
+            memset(page, 0xFF, (flashOps * 0x9E37) % FLASH_PAGE_SIZE);
+            mprotect(flash, SIM_FLASH_SIZE, PROT_READ);
+            SIM_PowerLoss();
+        }
+        memset(page, 0xFF, FLASH_PAGE_SIZE);
+        mprotect(flash, SIM_FLASH_SIZE, PROT_READ);
+    }
+
+    return HAL_OK;
+}
@@ -0,0 +1,895 @@
+/*
+ * File: sim_gps.c
+ * Purpose: Host build replacement for i2c.c and the USART2 part of usart.c.
+ *          Models a SAM-M8Q on the DDC (I2C) port and on UART1, wired to USART2
+ *          and its receive DMA, that replays a recorded session of receiver
+ *          output one navigation epoch per time pulse, or fewer at a slower
+ *          CFG-RATE or in power save mode. Answers CFG-MSG rate changes and
+ *          polls, CFG-CFG saves to its battery backed RAM, CFG-PM2 and CFG-RXM
+ *          and NAV-STATUS polls, and counts the MGA assistance it is sent and
+ *          the charge it draws
+ */
+#include "sim.h"
+#include "gps.h"
+#include "telemetry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Receiver side DDC and UART output buffers
+#define SIM_DDC_BUF_SIZE 4096
+#define SIM_UART_BUF_SIZE 4096
+
+// Receiver UART rate out of reset
+#define SIM_UART_DEFAULT_BAUD 9600
+
+// Receiver ports that are modelled, index into SIM_RATE.rate
+#define SIM_PORT_DDC  0
+#define SIM_PORT_UART 1
+#define SIM_PORTS     2
+
+// 100 kHz bus, 8 data bits plus ACK
+#define SIM_I2C_BYTE_US 90
+
+// Longest sentence or UBX frame accepted on the receiver input
+#define SIM_GPS_MAX_LINE 128
+
+// Most messages whose output rate can be set
+#define SIM_GPS_MAX_RATES 32
+
+// Supply current in uA: rough SAM-M8Q figures, enough to compare the modes.
+// Full power while acquiring or tracking continuously, power optimized
+// tracking between cyclic tracking updates, and off between ON/OFF fixes
+#define SIM_GPS_UA_ACQUIRE  29000
+#define SIM_GPS_UA_TRACKING 23000
+#define SIM_GPS_UA_CYCLIC   7000
+#define SIM_GPS_UA_OFF      35
+
+// Seconds an ON/OFF receiver is awake for each fix, reacquiring with the
+// ephemeris still good from the last one and then navigating
+#define SIM_GPS_ONOFF_WAKE_S 2
+
+typedef struct {
+    uint32_t offset;    // start of the frame in the session
+    uint16_t len;       // bytes including the framing and checksum
+    uint8_t ubx;        // 1 for UBX, 0 for NMEA
+    char id[4];         // NMEA message id without the talker, ie: RMC
+} SIM_FRAME;
+
+typedef struct {
+    char id[4];
+    uint8_t rate[SIM_PORTS]; // output once every rate epochs, 0 disables
+} SIM_RATE;
+
+static uint8_t *session;
+static SIM_FRAME *frames;
+static uint32_t frameCount;
+static uint32_t *epochStart;    // first frame of each epoch, epochCount+1 entries
+static uint32_t epochCount;
+static uint32_t epochNext;      // next epoch to publish
+static int32_t epochCurrent;    // epoch of the latest navigation solution, -1 once replay is over
+static uint32_t measRate;       // CFG-RATE ms between solutions, the session has one a second
+static uint32_t solutionCount;  // solutions output, CFG-MSG rates count in them
+static uint8_t powerSave;       // CFG-RXM lpMode is power save
+static uint8_t pm2Cyclic;       // CFG-PM2 asks for cyclic tracking rather than ON/OFF
+static uint32_t pm2Update;      // and an update every this many seconds
+static uint8_t pulsed;          // the latest epoch pulsed TIMEPULSE
+
+static SIM_RATE rates[SIM_GPS_MAX_RATES];
+static uint32_t rateCount;
+
+// Configuration saved with CFG-CFG and restored at power up
+typedef struct {
+    uint8_t msgConf;    // rates are saved
+    uint8_t ioPort;     // uartBaud is saved
+    uint32_t uartBaud;
+    uint32_t rateCount;
+    SIM_RATE rates[SIM_GPS_MAX_RATES];
+} SIM_BBR;
+
+static SIM_BBR bbr;
+
+static uint8_t ddcStorage[SIM_DDC_BUF_SIZE];
+static RINGBUF ddcOut;
+static uint8_t ddcReg;
+
+static char rxLine[SIM_PORTS][SIM_GPS_MAX_LINE];  // sentence or UBX frame so far
+static uint32_t rxLen[SIM_PORTS];
+
+static uint8_t uartStorage[SIM_UART_BUF_SIZE];
+static RINGBUF uartOut;
+static uint32_t uartBaud;       // receiver UART1 rate
+static uint64_t uartNextAt;     // when the byte at the front of uartOut has been sent
+static uint64_t uartIdleAt;     // when the line counts as idle after the last byte
+static uint8_t uartIdlePending;
+
+static uint8_t *usart2Rx;       // USART2 side, the DMA circular buffer
+static uint32_t usart2RxSize;
+static uint32_t usart2RxHead;
+static uint32_t usart2Baud;     // rate asked for
+static uint32_t usart2Actual;   // rate BRR gives at the current PCLK
+static uint8_t usart2Irqs;      // SIM_GPS_IRQ_x waiting for their handler
+
+/*
+ * Add a frame to the session, starting a new epoch at each RMC or NAV-PVT.
+ * Whichever of the two shows up first marks the epochs
+ */
+static void SIM_GPS_AddFrame(uint32_t offset, uint32_t len, uint8_t ubx) {
+    static int8_t markerUbx = -1;
+    static uint8_t epochHasMarker = 0;
+    SIM_FRAME *frame;
+    uint8_t marker;
+
+    frames = realloc(frames, (frameCount + 1) * sizeof(SIM_FRAME));
+    frame = &frames[frameCount];
+    frame->offset = offset;
+    frame->len = len;
+    frame->ubx = ubx;
+    memset(frame->id, 0, sizeof(frame->id));
+
+    if (ubx) {
+        marker = session[offset+2] == 0x01 && session[offset+3] == 0x07; // NAV-PVT
+    }
+    else {
+        memcpy(frame->id, &session[offset+3], 3);
+        marker = strcmp(frame->id, "RMC") == 0;
+    }
+
+    if (marker && markerUbx < 0) markerUbx = ubx;
+    if (marker && markerUbx == ubx) {
+        if (epochHasMarker) {
+            epochStart = realloc(epochStart, (epochCount + 2) * sizeof(uint32_t));
+            epochStart[++epochCount] = frameCount;
+        }
+        epochHasMarker = 1;
+    }
+
+    frameCount++;
+}
+
+/*
+ * Load a raw capture of receiver output (NMEA and/or UBX) to replay.
+ * Anything that isn't a complete frame is skipped. Returns 1 on failure, 0 otherwise
+ */
+uint8_t SIM_GPS_Load(char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return 1; // FAILURE
+
+    simStats.firstFix = SIM_NEVER;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    session = malloc(size + 1);
+    if (fread(session, 1, size, f) != (size_t) size) {
+        fclose(f);
+        return 1; // FAILURE
+    }
+    fclose(f);
+
+    epochStart = malloc(2 * sizeof(uint32_t));
+    epochStart[0] = 0;
+    epochCount = 0;
+
+    long i = 0;
+    while (i < size) {
+        if (session[i] == '$') {
+            long j = i;
+            while (j < size && j - i < SIM_GPS_MAX_LINE && session[j] != '\n') j++;
+            if (j < size && session[j] == '\n' && j - i > 6) {
+                SIM_GPS_AddFrame(i, j - i + 1, 0);
+                i = j + 1;
+                continue;
+            }
+        }
+        else if (session[i] == 0xB5 && i + 6 <= size && session[i+1] == 0x62) {
+            long len = (session[i+4] | (session[i+5] << 8)) + 8;
+            if (i + len <= size) {
+                SIM_GPS_AddFrame(i, len, 1);
+                i += len;
+                continue;
+            }
+        }
+        i++;
+    }
+
+    if (frameCount > 0) epochCount++;
+    epochStart = realloc(epochStart, (epochCount + 1) * sizeof(uint32_t));
+    epochStart[epochCount] = frameCount;
+
+    epochNext = 0;
+    epochCurrent = -1;
+    measRate = 1000;
+    solutionCount = 0;
+    powerSave = 0;
+    pm2Cyclic = 1;
+    pm2Update = 1;
+    pulsed = 0;
+    rateCount = 0;
+    memset(rxLen, 0, sizeof(rxLen));
+    ddcReg = DATA_STREAM_REG;
+    RINGBUF_Init(&ddcOut, ddcStorage, SIM_DDC_BUF_SIZE);
+    RINGBUF_Init(&uartOut, uartStorage, SIM_UART_BUF_SIZE);
+    uartBaud = SIM_UART_DEFAULT_BAUD;
+    uartIdlePending = 0;
+    memset(&bbr, 0, sizeof(bbr));
+
+    return 0;
+}
+
+/*
+ * Output rate of an NMEA message on a port. Everything is on until turned off
+ */
+static uint8_t SIM_GPS_Rate(char *id, uint8_t port) {
+    for (uint32_t i = 0; i < rateCount; i++) {
+        if (strcmp(rates[i].id, id) == 0) return rates[i].rate[port];
+    }
+    return 1;
+}
+
+/*
+ * Change the output rate of an NMEA message on a port
+ */
+static void SIM_GPS_SetRate(char *id, uint8_t port, uint8_t rate) {
+    uint32_t i;
+    for (i = 0; i < rateCount; i++) {
+        if (strcmp(rates[i].id, id) == 0) break;
+    }
+    if (i == SIM_GPS_MAX_RATES) return;
+    if (i == rateCount) {
+        rateCount++;
+        snprintf(rates[i].id, sizeof(rates[i].id), "%s", id);
+        memset(rates[i].rate, 1, sizeof(rates[i].rate));
+    }
+
+    rates[i].rate[port] = rate;
+}
+
+/*
+ * True if USART2 is receiving at a rate close enough to the receiver's
+ */
+static uint8_t SIM_GPS_UartMatched(void) {
+    if (usart2Rx == NULL || usart2Actual == 0) return 0;
+
+    uint32_t diff = usart2Actual > uartBaud ? usart2Actual - uartBaud : uartBaud - usart2Actual;
+    return diff * 100 < uartBaud * 3;
+}
+
+/*
+ * Queue len bytes for the host on a port. When the buffer is full they are
+ * lost. UART output only goes anywhere once USART2 is set up
+ */
+static void SIM_GPS_Output(uint8_t *data, uint32_t len, uint8_t port) {
+    if (port == SIM_PORT_DDC) {
+        if (RINGBUF_PushAll(&ddcOut, data, len)) simStats.ddcDropped += len;
+        return;
+    }
+
+    if (usart2Rx == NULL) return;
+    if (RINGBUF_Count(&uartOut) == 0) {
+        uint64_t start = uartNextAt > SIM_Now() ? uartNextAt : SIM_Now();
+        uartNextAt = start + SIM_CharTime(uartBaud);
+    }
+    if (RINGBUF_PushAll(&uartOut, data, len)) simStats.uartDropped += len;
+}
+
+/*
+ * Queue a frame of the session for the host on a port
+ */
+static void SIM_GPS_OutputFrame(SIM_FRAME *frame, uint8_t port) {
+    SIM_GPS_Output(&session[frame->offset], frame->len, port);
+}
+
+/*
+ * True if frame is an RMC with status A, data valid
+ */
+static uint8_t SIM_GPS_ValidRMC(SIM_FRAME *frame) {
+    if (frame->ubx || strcmp(frame->id, "RMC") != 0) return 0;
+
+    char *status = memchr(&session[frame->offset], ',', frame->len);
+    if (status != NULL) status = memchr(status + 1, ',', frame->len - (status + 1 - (char *) &session[frame->offset]));
+    return status != NULL && status[1] == 'A';
+}
+
+/*
+ * True if the receiver navigates in epoch, and count the charge it draws in
+ * it. In power save mode it updates on a grid of pm2Update seconds, waking
+ * ahead of it to reacquire in ON/OFF
+ */
+static uint8_t SIM_GPS_Navigates(uint32_t epoch) {
+    if (!powerSave) {
+        simStats.gpsCharge += SIM_GPS_UA_TRACKING;
+        simStats.gpsFullTime++;
+        return epoch % (measRate / 1000) == 0;
+    }
+
+    uint32_t phase = epoch % pm2Update;
+    if (phase == 0) {
+        simStats.gpsCharge += pm2Cyclic ? SIM_GPS_UA_TRACKING : SIM_GPS_UA_ACQUIRE;
+        simStats.gpsFullTime++;
+        return 1;
+    }
+    if (!pm2Cyclic && pm2Update - phase < SIM_GPS_ONOFF_WAKE_S) {
+        simStats.gpsCharge += SIM_GPS_UA_ACQUIRE;
+        simStats.gpsFullTime++;
+        return 0;
+    }
+    simStats.gpsCharge += pm2Cyclic ? SIM_GPS_UA_CYCLIC : SIM_GPS_UA_OFF;
+    simStats.gpsLowTime++;
+    return 0;
+}
+
+/*
+ * True if the latest epoch pulsed TIMEPULSE. Running continuously the
+ * receiver pulses every second, in power save mode only with a fix
+ */
+uint8_t SIM_GPS_Pulsed(void) {
+    return pulsed;
+}
+
+/*
+ * Publish the next epoch if the navigation rate has a solution due at this
+ * time pulse. Called on each time pulse.
+ * Returns 1 if there was an epoch left to replay, 0 otherwise
+ */
+uint8_t SIM_GPS_Epoch(void) {
+    if (epochNext >= epochCount) {
+        epochCurrent = -1;
+        pulsed = 1;
+        return 0;
+    }
+
+    uint32_t epoch = epochNext++;
+    simStats.epochs++;
+    uint8_t navigates = SIM_GPS_Navigates(epoch);
+    pulsed = navigates || !powerSave;
+    if (!navigates) return 1;
+
+    epochCurrent = epoch;
+    simStats.solutions++;
+    uint32_t solution = solutionCount++;
+    for (uint32_t i = epochStart[epochCurrent]; i < epochStart[epochCurrent+1]; i++) {
+        if (simStats.firstFix == SIM_NEVER && SIM_GPS_ValidRMC(&frames[i])) simStats.firstFix = SIM_Now();
+        for (uint8_t port = 0; port < SIM_PORTS; port++) {
+            uint8_t rate = frames[i].ubx ? 1 : SIM_GPS_Rate(frames[i].id, port);
+            if (rate != 0 && solution % rate == 0) SIM_GPS_OutputFrame(&frames[i], port);
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Check the *hh checksum of a sentence. Returns 1 if it doesn't match, 0 otherwise
+ */
+static uint8_t SIM_GPS_BadChecksum(char *line) {
+    uint8_t cs = 0;
+    char *c = &line[1];
+
+    while (*c != '\0' && *c != '*') cs ^= *c++;
+    if (*c != '*') return 1; // FAILURE
+
+    return strtol(c + 1, NULL, 16) != cs;
+}
+
+/*
+ * Act on a complete sentence from the host on a port. Handles PUBX,40 rate
+ * changes, where empty fields leave a port alone, PUBX,41 UART rate changes
+ * and GNQ polls, which are answered from the current epoch on the same port
+ */
+static void SIM_GPS_Command(char *line, uint8_t port) {
+    char *field[10];
+    uint32_t fields = 0;
+
+    if (line[0] != '$' || SIM_GPS_BadChecksum(line)) return;
+
+    *strchr(line, '*') = '\0';
+    for (char *rest = &line[1], *c; (c = strsep(&rest, ",")) != NULL && fields < 10; ) {
+        field[fields++] = c;
+    }
+
+    if (fields >= 5 && strcmp(field[0], "PUBX") == 0 && strcmp(field[1], "40") == 0) {
+        if (field[3][0] != '\0') SIM_GPS_SetRate(field[2], SIM_PORT_DDC, atoi(field[3]));
+        if (field[4][0] != '\0') SIM_GPS_SetRate(field[2], SIM_PORT_UART, atoi(field[4]));
+    }
+    else if (fields >= 6 && strcmp(field[0], "PUBX") == 0 && strcmp(field[1], "41") == 0) {
+        if (atoi(field[2]) == 1 && atoi(field[5]) > 0) uartBaud = atoi(field[5]);
+    }
+    else if (fields >= 2 && strlen(field[0]) == 5 && strcmp(&field[0][2], "GNQ") == 0) {
+        if (epochCurrent < 0) return;
+        for (uint32_t i = epochStart[epochCurrent]; i < epochStart[epochCurrent+1]; i++) {
+            // every part of a multi-part message, every talker's GSV
+            if (!frames[i].ubx && strcmp(frames[i].id, field[1]) == 0) SIM_GPS_OutputFrame(&frames[i], port);
+        }
+    }
+}
+
+/*
+ * NMEA message id of a UBX-CFG-MSG msgID in the NMEA class, NULL if unknown
+ */
+static char *SIM_GPS_NmeaId(uint8_t msgid) {
+    static const struct { uint8_t msgid; char *id; } ids[] = {
+        { UBX_ID_NMEA_DTM, "DTM" }, { UBX_ID_NMEA_GBS, "GBS" }, { UBX_ID_NMEA_GGA, "GGA" },
+        { UBX_ID_NMEA_GLL, "GLL" }, { UBX_ID_NMEA_GNS, "GNS" }, { UBX_ID_NMEA_GRS, "GRS" },
+        { UBX_ID_NMEA_GSA, "GSA" }, { UBX_ID_NMEA_GST, "GST" }, { UBX_ID_NMEA_GSV, "GSV" },
+        { UBX_ID_NMEA_RMC, "RMC" }, { UBX_ID_NMEA_TXT, "TXT" }, { UBX_ID_NMEA_VLW, "VLW" },
+        { UBX_ID_NMEA_VTG, "VTG" }, { UBX_ID_NMEA_ZDA, "ZDA" }
+    };
+
+    for (uint32_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+        if (ids[i].msgid == msgid) return ids[i].id;
+    }
+    return NULL;
+}
+
+/*
+ * CFG-CFG: save the rates and UART rate to battery backed RAM or load them
+ * back. Returns 1 if the masks are malformed, 0 otherwise
+ */
+static uint8_t SIM_GPS_CfgCfg(uint8_t *payload, uint32_t len) {
+    if (len != 12 && len != 13) return 1; // FAILURE
+
+    uint8_t save = payload[4], load = payload[8];
+
+    if (save & UBX_CFG_CFG_MSGCONF) {
+        bbr.msgConf = 1;
+        bbr.rateCount = rateCount;
+        memcpy(bbr.rates, rates, sizeof(rates));
+    }
+    if (save & UBX_CFG_CFG_IOPORT) {
+        bbr.ioPort = 1;
+        bbr.uartBaud = uartBaud;
+    }
+    if ((load & UBX_CFG_CFG_MSGCONF) && bbr.msgConf) {
+        rateCount = bbr.rateCount;
+        memcpy(rates, bbr.rates, sizeof(rates));
+    }
+    if ((load & UBX_CFG_CFG_IOPORT) && bbr.ioPort) uartBaud = bbr.uartBaud;
+
+    return 0;
+}
+
+/*
+ * Answer a NAV-STATUS poll on a port. The time to first fix is counted from
+ * power up, when the replay starts
+ */
+static void SIM_GPS_NavStatus(uint8_t port) {
+    uint8_t payload[16] = { 0 };
+    uint8_t answer[sizeof(payload) + UBX_FRAME_OVERHEAD];
+    uint32_t ttff = simStats.firstFix == SIM_NEVER ? 0 : simStats.firstFix / 1000;
+    uint32_t msss = SIM_Now() / 1000;
+
+    if (simStats.firstFix != SIM_NEVER) {
+        payload[4] = 0x03; // 3D fix
+        payload[5] = UBX_NAV_STATUS_FIX_OK;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        payload[8 + i] = (ttff >> (8 * i)) & 0xFF;
+        payload[12 + i] = (msss >> (8 * i)) & 0xFF;
+    }
+    SIM_GPS_Output(answer, UBX_Frame(answer, UBX_CLASS_NAV, UBX_ID_NAV_STATUS, payload, sizeof(payload)), port);
+}
+
+/*
+ * Act on a complete UBX frame from the host on a port. CFG-MSG sets the rate
+ * of an NMEA message on this port or, with just the message, polls its rate
+ * on every port. CFG-RATE sets the navigation rate. CFG-CFG saves and loads
+ * the configuration. CFG-PM2 and CFG-RXM set up and enter power save mode.
+ * These are ACKed,
+ * anything else in the CFG class is NAKed. MGA assistance is counted without
+ * an answer, as the receiver does by default, and NAV-STATUS polls are
+ * answered. Frames with a bad checksum are ignored
+ */
+static void SIM_GPS_UbxCommand(uint8_t *frame, uint32_t len, uint8_t port) {
+    uint8_t ck_a = 0, ck_b = 0;
+    uint8_t answer[UBX_CFG_MSG_POLL_LEN];
+    uint8_t ok = 0;
+
+    for (uint32_t i = 2; i < len - 2; i++) {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+    if (ck_a != frame[len-2] || ck_b != frame[len-1]) return;
+
+    if (frame[2] == UBX_CLASS_MGA && frame[3] == UBX_ID_MGA_INI && len > UBX_FRAME_OVERHEAD) {
+        if (frame[6] == UBX_MGA_INI_POS_LLH) simStats.assistPos++;
+        if (frame[6] == UBX_MGA_INI_TIME_UTC) simStats.assistTime++;
+        return;
+    }
+    if (frame[2] == UBX_CLASS_MGA && frame[3] == UBX_ID_MGA_ANO && len == UBX_MGA_ANO_LEN) {
+        simStats.assistAno++;
+        return;
+    }
+    if (frame[2] == UBX_CLASS_NAV && frame[3] == UBX_ID_NAV_STATUS && len == UBX_FRAME_OVERHEAD) {
+        SIM_GPS_NavStatus(port);
+        return;
+    }
+    if (frame[2] != UBX_CLASS_CFG) return;
+
+    if (frame[3] == UBX_ID_CFG_MSG && frame[6] == UBX_CLASS_NMEA && SIM_GPS_NmeaId(frame[7]) != NULL) {
+        char *id = SIM_GPS_NmeaId(frame[7]);
+
+        if (len == UBX_CFG_MSG_LEN) {
+            SIM_GPS_SetRate(id, port, frame[8]);
+            ok = 1;
+        }
+        else if (len == 2 + UBX_FRAME_OVERHEAD) { // poll, the answer comes before the ACK
+            uint8_t payload[8] = { frame[6], frame[7] };
+            for (uint8_t p = 0; p < SIM_PORTS; p++) payload[2 + p] = SIM_GPS_Rate(id, p);
+            SIM_GPS_Output(answer, UBX_Frame(answer, UBX_CLASS_CFG, UBX_ID_CFG_MSG, payload, 8), port);
+            ok = 1;
+        }
+    }
+    else if (frame[3] == UBX_ID_CFG_RATE && len == UBX_CFG_RATE_LEN) {
+        uint32_t rate = frame[6] | (frame[7] << 8);
+        // whole seconds only, the session was recorded at one solution a second
+        if (rate >= 1000 && rate % 1000 == 0 && frame[8] == 1) {
+            measRate = rate;
+            ok = 1;
+        }
+    }
+    else if (frame[3] == UBX_ID_CFG_CFG) {
+        ok = !SIM_GPS_CfgCfg(&frame[6], len - UBX_FRAME_OVERHEAD);
+    }
+    else if (frame[3] == UBX_ID_CFG_PM2 && len == UBX_CFG_PM2_LEN && frame[6] == UBX_CFG_PM2_VERSION) {
+        uint8_t *payload = &frame[6];
+        uint32_t flags = 0, update = 0;
+        for (uint8_t i = 0; i < 4; i++) {
+            flags |= (uint32_t) payload[UBX_CFG_PM2_FLAGS + i] << (8 * i);
+            update |= (uint32_t) payload[UBX_CFG_PM2_UPDATE_PERIOD + i] << (8 * i);
+        }
+        // whole seconds only, and no waiting on external wake ups
+        if (update >= 1000 && update % 1000 == 0) {
+            pm2Cyclic = (flags & UBX_CFG_PM2_MODE_CYCLIC) != 0;
+            pm2Update = update / 1000;
+            ok = 1;
+        }
+    }
+    else if (frame[3] == UBX_ID_CFG_RXM && len == UBX_CFG_RXM_LEN) {
+        ok = frame[7] == UBX_CFG_RXM_CONTINUOUS || frame[7] == UBX_CFG_RXM_POWER_SAVE;
+        powerSave = ok ? frame[7] == UBX_CFG_RXM_POWER_SAVE : powerSave;
+    }
+
+    uint8_t ack[2] = { frame[2], frame[3] };
+    SIM_GPS_Output(answer, UBX_Frame(answer, UBX_CLASS_ACK, ok ? UBX_ID_ACK_ACK : UBX_ID_ACK_NAK, ack, 2), port);
+}
+
+/*
+ * Byte written to the receiver's message input on a port
+ */
+static void SIM_GPS_Receive(uint8_t c, uint8_t port) {
+    char *line = rxLine[port];
+
+    if (rxLen[port] > 0 && (uint8_t) line[0] == UBX_SYNC_1) { // binary, no line ends
+        line[rxLen[port]++] = c;
+        uint32_t len = rxLen[port] >= 6 ? ((uint8_t) line[4] | ((uint8_t) line[5] << 8)) + 8 : 0;
+
+        if (rxLen[port] == 2 && c != UBX_SYNC_2) rxLen[port] = 0;
+        else if (rxLen[port] == len) {
+            SIM_GPS_UbxCommand((uint8_t *) line, len, port);
+            rxLen[port] = 0;
+        }
+        else if (rxLen[port] == SIM_GPS_MAX_LINE) rxLen[port] = 0;
+        return;
+    }
+    if (c == UBX_SYNC_1) rxLen[port] = 0;
+
+    if (c == '$') rxLen[port] = 0;
+    if (c == '\r' || c == '\n') {
+        line[rxLen[port]] = '\0';
+        if (rxLen[port] > 0) SIM_GPS_Command(line, port);
+        rxLen[port] = 0;
+        return;
+    }
+    if (rxLen[port] < SIM_GPS_MAX_LINE - 1) line[rxLen[port]++] = c;
+}
+
+/*
+ * Store a byte from the receiver's UART the way DMA1 channel 5 would, flagging
+ * the half and full buffer interrupts
+ */
+static void SIM_GPS_UartDeliver(uint8_t c) {
+    if (!SIM_GPS_UartMatched()) { // framing errors, nothing useful arrives
+        simStats.uartDropped++;
+        return;
+    }
+
+    usart2Rx[usart2RxHead++] = c;
+    simStats.uartRead++;
+
+    if (usart2RxHead == usart2RxSize / 2) usart2Irqs |= SIM_GPS_IRQ_DMA;
+    if (usart2RxHead == usart2RxSize) {
+        usart2RxHead = 0;
+        usart2Irqs |= SIM_GPS_IRQ_DMA;
+    }
+}
+
+/*
+ * Power up with the configuration in a battery file, see SIM_GPS_SaveBbr
+ */
+void SIM_GPS_LoadBbr(FILE *f) {
+    if (fread(&bbr, sizeof(bbr), 1, f) != 1) {
+        memset(&bbr, 0, sizeof(bbr));
+        return;
+    }
+
+    if (bbr.msgConf) {
+        rateCount = bbr.rateCount;
+        memcpy(rates, bbr.rates, sizeof(rates));
+    }
+    if (bbr.ioPort) uartBaud = bbr.uartBaud;
+}
+
+/*
+ * Write the battery backed RAM to a battery file for the next run
+ */
+void SIM_GPS_SaveBbr(FILE *f) {
+    fwrite(&bbr, sizeof(bbr), 1, f);
+}
+
+/*
+ * Time the next byte from the receiver's UART lands or the line goes idle
+ */
+uint64_t SIM_GPS_NextEvent(void) {
+    if (RINGBUF_Count(&uartOut) != 0) return uartNextAt;
+    if (uartIdlePending) return uartIdleAt;
+    return SIM_NEVER;
+}
+
+/*
+ * Move the UART bytes that are due. Returns the SIM_GPS_IRQ_x waiting for
+ * their handlers
+ */
+uint8_t SIM_GPS_Poll(void) {
+    uint64_t now = SIM_Now();
+    uint8_t c;
+
+    while (RINGBUF_Count(&uartOut) != 0 && now >= uartNextAt) {
+        RINGBUF_Pop(&uartOut, &c);
+        SIM_GPS_UartDeliver(c);
+        uartIdleAt = uartNextAt + SIM_CharTime(uartBaud);
+        uartIdlePending = 1;
+        if (RINGBUF_Count(&uartOut) != 0) uartNextAt += SIM_CharTime(uartBaud);
+    }
+
+    if (uartIdlePending && RINGBUF_Count(&uartOut) == 0 && now >= uartIdleAt) {
+        uartIdlePending = 0;
+        usart2Irqs |= SIM_GPS_IRQ_IDLE;
+    }
+
+    return usart2Irqs;
+}
+
+/*
+ * Byte read from the current register. 0xFD/0xFE hold the number of bytes
+ * waiting and advance to the 0xFF data stream, which reads 0xFF when empty
+ */
+static uint8_t SIM_GPS_ReadByte(void) {
+    uint32_t count = RINGBUF_Count(&ddcOut);
+    uint8_t c;
+
+    switch (ddcReg) {
+        case AVAIL_BYTES_HIGH_REG:
+            ddcReg = AVAIL_BYTES_LOW_REG;
+            return count >> 8;
+        case AVAIL_BYTES_LOW_REG:
+            ddcReg = DATA_STREAM_REG;
+            return count & 0xFF;
+        case DATA_STREAM_REG:
+            if (RINGBUF_Pop(&ddcOut, &c)) return NO_DATA;
+            return c;
+        default:
+            ddcReg++;
+            return 0;
+    }
+}
+
+/*
+ * Address phase. Anything but the receiver NACKs
+ */
+static uint8_t SIM_GPS_Address(uint32_t addr) {
+    if (addr == GPS_I2C_ADDR) return 0;
+    telemetry.i2cNacks++;
+    return 1; // FAILURE
+}
+
+/*
+ * I2C1 kernel clock, as on the target
+ */
+uint32_t I2C1_GetClockFreq(void) {
+    if (RCC->CFGR3 & RCC_CFGR3_I2C1SW_Msk)
+        return HAL_RCC_GetSysClockFreq();
+    return HSI_VALUE;
+}
+
+/*
+ * Bus timing isn't modelled, every byte takes SIM_I2C_BYTE_US. TIMINGR is
+ * kept as the target would set it
+ */
+void I2C1_Config(void) {
+    uint32_t presc = (I2C1_GetClockFreq() / I2C_TIMING_TPRESC_HZ) - 1;
+    if (presc > 0xF) presc = 0xF;
+    I2C1->TIMINGR = (presc << I2C_TIMINGR_PRESC_Pos) | (0x4 << I2C_TIMINGR_SCLDEL_Pos) |
+                    (0x2 << I2C_TIMINGR_SDADEL_Pos) | (0xF << I2C_TIMINGR_SCLH_Pos) |
+                    (0x13 << I2C_TIMINGR_SCLL_Pos);
+}
+
+void I2C1_UpdateTiming(void) {
+    if (!(I2C1->CR1 & I2C_CR1_PE_Msk)) return; // not set up yet
+
+    I2C1->CR1 &= ~I2C_CR1_PE_Msk;
+    I2C1_Config();
+    I2C1->CR1 |= I2C_CR1_PE_Msk;
+}
+
+void I2C1_Recover(void) {
+    I2C1->CR1 &= ~I2C_CR1_PE_Msk;
+    I2C1->CR1 |= I2C_CR1_PE_Msk;
+}
+
+/*
+ * Transfers complete as soon as they are issued
+ */
+uint8_t I2C1_WaitFlag(uint32_t flag) {
+    return 0;
+}
+
+void I2C1_TransactionSetup(uint8_t addr, uint8_t bytes, uint8_t rdwr) {
+    I2C1->CR2 = (addr << (I2C_CR2_SADD_Pos + 1)) | (bytes << I2C_CR2_NBYTES_Pos) |
+                (rdwr > 0 ? I2C_CR2_RD_WRN_Msk : 0) | I2C_CR2_START_Msk;
+}
+
+void I2C1_SendStopCondition(void) {
+    I2C1->CR2 |= I2C_CR2_STOP_Msk;
+}
+
+void I2C1_SendChar(char c) {
+    I2C1->TXDR = c;
+}
+
+/*
+ * Write reg followed by str. A single byte write only sets the register,
+ * longer writes go to the receiver's message input
+ */
+uint8_t I2C1_WriteStr(uint32_t addr, uint8_t reg, char *str) {
+    uint32_t len = strlen(str) + 1;
+
+    SIM_Lock();
+    if (SIM_GPS_Address(addr)) {
+        SIM_Unlock();
+        SIM_Delay(SIM_I2C_BYTE_US);
+        return 1; // FAILURE
+    }
+
+    if (len == 1) {
+        ddcReg = reg;
+    }
+    else {
+        SIM_GPS_Receive(reg, SIM_PORT_DDC);
+        for (uint32_t i = 0; i < len - 1; i++) SIM_GPS_Receive(str[i], SIM_PORT_DDC);
+        simStats.ddcWritten += len;
+    }
+    SIM_Unlock();
+
+    SIM_Delay((1 + len) * SIM_I2C_BYTE_US);
+    return 0;
+}
+
+/*
+ * Write len bytes to the receiver's message input
+ */
+uint8_t I2C1_WriteNoReg(uint32_t addr, uint8_t *data, uint32_t len) {
+    SIM_Lock();
+    if (SIM_GPS_Address(addr)) {
+        SIM_Unlock();
+        SIM_Delay(SIM_I2C_BYTE_US);
+        return 1; // FAILURE
+    }
+
+    for (uint32_t i = 0; i < len; i++) SIM_GPS_Receive(data[i], SIM_PORT_DDC);
+    simStats.ddcWritten += len;
+    SIM_Unlock();
+
+    SIM_Delay((1 + len) * SIM_I2C_BYTE_US);
+    return 0;
+}
+
+uint8_t I2C1_WriteStrNoReg(uint32_t addr, char *str) {
+    return I2C1_WriteNoReg(addr, (uint8_t *) str, strlen(str));
+}
+
+/*
+ * Set the register then read bytes from it
+ */
+uint8_t I2C1_ReadStr(uint32_t addr, uint8_t reg, char str[], uint8_t bytes) {
+    if (I2C1_WriteStr(addr, reg, "\0")) return 1;
+
+    SIM_Lock();
+    if (SIM_GPS_Address(addr)) {
+        SIM_Unlock();
+        SIM_Delay(SIM_I2C_BYTE_US);
+        return 1; // FAILURE
+    }
+
+    for (uint32_t i = 0; i < bytes; i++) str[i] = SIM_GPS_ReadByte();
+    simStats.ddcRead += bytes;
+    SIM_Unlock();
+
+    SIM_Delay((1 + bytes) * SIM_I2C_BYTE_US);
+    return 0;
+}
+
+/*
+ * USART2 oversamples by 8, work out the rate BRR gives at the current PCLK
+ */
+void USART2_SetBaudRate(uint32_t rate) {
+    uint32_t usartdiv = (2 * HAL_RCC_GetPCLK1Freq() + rate/2) / rate;
+
+    usart2Baud = rate;
+    usart2Actual = (2 * HAL_RCC_GetPCLK1Freq() + usartdiv/2) / usartdiv;
+}
+
+/*
+ * Connect USART2 and its receive DMA to the receiver's UART
+ */
+void USART2_Setup(uint8_t tx_pin, uint8_t rx_pin, uint32_t rate, uint8_t *rx, uint32_t size) {
+    RCC->APB1ENR |= RCC_APB1ENR_USART2EN; // Enable USART2 clock
+    RCC->AHBENR |= RCC_AHBENR_GPIOAEN | RCC_AHBENR_DMAEN; // Enable GPIOA and DMA1 clocks
+
+    configPinA_AF1(tx_pin);
+    configPinA_AF1(rx_pin);
+
+    SIM_Lock();
+    usart2Rx = rx;
+    usart2RxSize = size;
+    usart2RxHead = 0;
+    usart2Irqs = 0;
+    USART2_SetBaudRate(rate);
+    SIM_Unlock();
+
+    NVIC_EnableIRQ(USART2_IRQn);
+    NVIC_EnableIRQ(DMA1_Channel4_5_6_7_IRQn);
+}
+
+void USART2_UpdateBaudRate(void) {
+    if (usart2Rx == NULL) return; // not set up yet
+
+    USART2_SetBaudRate(usart2Baud);
+}
+
+/*
+ * Send char to the receiver's UART, blocking for its time on the wire
+ */
+void USART2_SendChar(char c) {
+    SIM_Lock();
+    if (SIM_GPS_UartMatched()) SIM_GPS_Receive(c, SIM_PORT_UART);
+    simStats.uartWritten++;
+    SIM_Unlock();
+
+    SIM_Delay(SIM_CharTime(usart2Actual));
+}
+
+void USART2_SendStr(char* s) {
+    uint32_t i = 0;
+    while (s[i] != '\0') USART2_SendChar(s[i++]);
+}
+
+/*
+ * USART2_SendChar already waited for each byte
+ */
+void USART2_Flush(void) {
+}
+
+uint32_t USART2_RxHead(void) {
+    return usart2RxHead;
+}
+
+void USART2_IRQHandler(void) {
+    usart2Irqs &= ~SIM_GPS_IRQ_IDLE;
+    GPS_USART2ReceivedInterrupt();
+}
+
+void DMA1_Channel4_5_6_7_IRQHandler(void) {
+    usart2Irqs &= ~SIM_GPS_IRQ_DMA;
+    GPS_USART2ReceivedInterrupt();
+}
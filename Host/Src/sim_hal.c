@@ -0,0 +1,604 @@
+/*
+ * File: sim_hal.c
+ * Purpose: Defines the register stand-ins, the HAL and core functions the firmware
+ *          calls, the virtual clock, and interrupt delivery for the host build
+ */
+#include "sim.h"
+#include "fix.h"
+#include "rtc.h"
+#include <string.h>
+
+// Register stand-ins, see Host/Inc/stm32f0xx.h
+RCC_TypeDef SIM_RCC;
+FLASH_TypeDef SIM_FLASH;
+PWR_TypeDef SIM_PWR;
+EXTI_TypeDef SIM_EXTI;
+SYSCFG_TypeDef SIM_SYSCFG;
+TIM_TypeDef SIM_TIM2;
+I2C_TypeDef SIM_I2C1;
+USART_TypeDef SIM_USART1;
+USART_TypeDef SIM_USART3;
+SPI_TypeDef SIM_SPI2;
+RTC_TypeDef SIM_RTC;            // backup domain, kept across SIM_Reset
+static GPIO_TypeDef simGpio[3]; // ports A to C
+
+// Normally defined in system_stm32f0xx.c
+uint32_t SystemCoreClock = HSI_VALUE;
+const uint8_t AHBPrescTable[16] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 6, 7, 8, 9};
+const uint8_t APBPrescTable[8] = {0, 0, 0, 0, 1, 2, 3, 4};
+
+#define SIM_NO_IRQ 0xFF
+
+static volatile uint64_t simNow;        // virtual microseconds since power up
+static volatile uint32_t simLock;       // depth of simulator calls in progress
+static volatile uint32_t simActivity;   // simulator calls made by the firmware
+static volatile uint8_t simIrqMasked;   // PRIMASK
+static volatile uint32_t simNvic;       // enabled interrupt lines
+static volatile uint8_t simActive[32];  // handlers currently running
+static uint32_t simTim2Raised;          // TIM2 status flags the timer raised and nothing cleared
+static uint64_t simNextPps;             // when the receiver sends its next time pulse
+static uint64_t simPressAt[2];          // button presses that start and stop recording
+static volatile uint32_t simPresses;    // presses delivered so far
+static uint8_t simRtcInit;              // the calendar was in init mode at the last access
+static uint64_t simRtcBase;             // when the calendar last started running
+static uint32_t simRtcStart;            // and its seconds since 2000 then
+
+static const uint8_t simMonthDays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+/*
+ * Put every register back to its reset value. The backup domain (RTC) is
+ * only cleared by losing its battery
+ */
+void SIM_Reset(void) {
+    memset(&SIM_RCC, 0, sizeof(SIM_RCC));
+    memset(&SIM_FLASH, 0, sizeof(SIM_FLASH));
+    memset(&SIM_PWR, 0, sizeof(SIM_PWR));
+    memset(&SIM_EXTI, 0, sizeof(SIM_EXTI));
+    memset(&SIM_SYSCFG, 0, sizeof(SIM_SYSCFG));
+    memset(&SIM_TIM2, 0, sizeof(SIM_TIM2));
+    simTim2Raised = 0;
+    memset(&SIM_I2C1, 0, sizeof(SIM_I2C1));
+    memset(&SIM_USART1, 0, sizeof(SIM_USART1));
+    memset(&SIM_USART3, 0, sizeof(SIM_USART3));
+    memset(&SIM_SPI2, 0, sizeof(SIM_SPI2));
+    memset(simGpio, 0, sizeof(simGpio));
+
+    // boot from the HSI, transmitters idle
+    SIM_RCC.CR = RCC_CR_HSION | RCC_CR_HSIRDY;
+    SIM_RCC.CSR = simConfig.warm == SIM_NEVER ? RCC_CSR_PORRSTF : RCC_CSR_PINRSTF;
+    SIM_FLASH.CR = FLASH_CR_LOCK;
+    SIM_USART1.ISR = USART_ISR_TXE_Msk | USART_ISR_TC_Msk;
+    SIM_USART3.ISR = USART_ISR_TXE_Msk | USART_ISR_TC_Msk;
+    SIM_SPI2.SR = SPI_SR_TXE_Msk;
+    SystemCoreClock = HSI_VALUE;
+
+    simNow = 0;
+    simNvic = 0;
+    simIrqMasked = 0;
+    simNextPps = SIM_PPS_PHASE_US;
+    simPressAt[0] = simConfig.startAt;
+    simPressAt[1] = SIM_NEVER;
+    simPresses = 0;
+}
+
+/*
+ * Current virtual time in microseconds
+ */
+uint64_t SIM_Now(void) {
+    return simNow;
+}
+
+/*
+ * Move the virtual clock. TIM2 is the 1 MHz timebase so it follows directly
+ */
+static void SIM_SetNow(uint64_t t) {
+    simNow = t;
+    if (SIM_TIM2.CR1 & TIM_CR1_CEN) SIM_TIM2.CNT = (uint32_t) t;
+}
+
+/*
+ * Time on the wire for one 10 bit UART character at baud
+ */
+uint64_t SIM_CharTime(uint32_t baud) {
+    return (10 * SIM_US_PER_S + baud/2) / baud;
+}
+
+/*
+ * Bracket a simulator call made by the firmware. Interrupts that came due
+ * during the call are taken once the outermost call returns
+ */
+void SIM_Lock(void) {
+    simLock++;
+    simActivity++;
+}
+
+void SIM_Unlock(void) {
+    if (--simLock == 0) SIM_Poll();
+}
+
+/*
+ * True while interrupts can't be taken
+ */
+uint8_t SIM_Busy(void) {
+    return simLock != 0 || simIrqMasked;
+}
+
+/*
+ * Number of simulator calls so far. Unchanged across idle checks means the
+ * firmware is spinning on RAM
+ */
+uint32_t SIM_Activity(void) {
+    return simActivity;
+}
+
+/*
+ * True once the button press that stops recording has been delivered
+ */
+uint8_t SIM_Stopped(void) {
+    return simPresses >= 2;
+}
+
+/*
+ * True if recording still hasn't ended long after the stop press was due
+ */
+uint8_t SIM_Hung(void) {
+    return simPressAt[1] != SIM_NEVER && simNow > simPressAt[1] + SIM_HANG_US;
+}
+
+/*
+ * Apply writes to the port's BSRR and BRR to ODR and tell the models about
+ * any pins that moved
+ */
+void SIM_SyncGpio(uint32_t port) {
+    GPIO_TypeDef *gpio = &simGpio[port];
+    uint32_t set = gpio->BSRR & 0xFFFF;
+    uint32_t reset = (gpio->BSRR >> 16) | gpio->BRR;
+
+    if (set == 0 && reset == 0) return;
+
+    uint32_t before = gpio->ODR;
+    gpio->ODR = (before & ~reset) | set; // set wins over reset like BSRR
+    gpio->BSRR = 0;
+    gpio->BRR = 0;
+
+    if (gpio->ODR != before) SIM_OPENLOG_PinsChanged(port, before, gpio->ODR);
+}
+
+/*
+ * GPIOx stand-in. Each access settles the previous write to the port first
+ */
+GPIO_TypeDef *SIM_GPIO(uint32_t port) {
+    SIM_Lock();
+    SIM_SyncGpio(port);
+    SIM_Unlock();
+    return &simGpio[port];
+}
+
+static uint32_t SIM_FromBCD(uint32_t x) {
+    return (x >> 4) * 10 + (x & 0xF);
+}
+
+static uint32_t SIM_ToBCD(uint32_t x) {
+    return ((x / 10) << 4) | (x % 10);
+}
+
+/*
+ * Seconds since 2000 in the calendar registers
+ */
+static uint32_t SIM_RtcRead(void) {
+    uint32_t tr = SIM_RTC.TR, dr = SIM_RTC.DR;
+
+    return RTC_Seconds(FIX_PACK_DATE(SIM_FromBCD((dr >> RTC_DR_YU_Pos) & 0xFF), SIM_FromBCD((dr >> RTC_DR_MU_Pos) & 0x1F),
+                                     SIM_FromBCD((dr >> RTC_DR_DU_Pos) & 0x3F)) |
+                       FIX_PACK_TIME(SIM_FromBCD((tr >> RTC_TR_HU_Pos) & 0x3F), SIM_FromBCD((tr >> RTC_TR_MNU_Pos) & 0x7F),
+                                     SIM_FromBCD((tr >> RTC_TR_SU_Pos) & 0x7F)));
+}
+
+/*
+ * Set the calendar registers to seconds since 2000
+ */
+static void SIM_RtcWrite(uint32_t seconds) {
+    uint32_t days = seconds / 86400, year = 0, month = 1;
+    uint32_t weekday = (days + 5) % 7 + 1;
+
+    while (days >= (year % 4 == 0 ? 366U : 365U)) days -= year++ % 4 == 0 ? 366 : 365;
+    while (days >= simMonthDays[month-1] + (month == 2 && year % 4 == 0)) {
+        days -= simMonthDays[month-1] + (month == 2 && year % 4 == 0);
+        month++;
+    }
+
+    seconds %= 86400;
+    SIM_RTC.TR = (SIM_ToBCD(seconds / 3600) << RTC_TR_HU_Pos) | (SIM_ToBCD(seconds / 60 % 60) << RTC_TR_MNU_Pos) |
+                 (SIM_ToBCD(seconds % 60) << RTC_TR_SU_Pos);
+    SIM_RTC.DR = (SIM_ToBCD(year) << RTC_DR_YU_Pos) | (weekday << RTC_DR_WDU_Pos) |
+                 (SIM_ToBCD(month) << RTC_DR_MU_Pos) | (SIM_ToBCD(days + 1) << RTC_DR_DU_Pos);
+}
+
+/*
+ * RTC stand-in. Init mode is entered at once and the calendar starts from
+ * what was written when it is left, otherwise TR and DR follow virtual time
+ * while the RTC is clocked. The shadow registers are always in sync
+ */
+RTC_TypeDef *SIM_RTCRegs(void) {
+    uint8_t init = (SIM_RTC.ISR & RTC_ISR_INIT) != 0;
+
+    if (init) {
+        SIM_RTC.ISR |= RTC_ISR_INITF;
+    }
+    else if (simRtcInit) {
+        SIM_RTC.ISR = (SIM_RTC.ISR & ~RTC_ISR_INITF) | RTC_ISR_INITS;
+        simRtcStart = SIM_RtcRead();
+        simRtcBase = simNow;
+    }
+    else if ((SIM_RTC.ISR & RTC_ISR_INITS) && (SIM_RCC.BDCR & RCC_BDCR_RTCEN)) {
+        SIM_RtcWrite(simRtcStart + (simNow - simRtcBase) / SIM_US_PER_S);
+    }
+
+    simRtcInit = init;
+    SIM_RTC.ISR |= RTC_ISR_RSF;
+    return &SIM_RTC;
+}
+
+/*
+ * Start the calendar from the time saved in TR and DR, off microseconds
+ * later. The LSI stops without power, so off is 0 after a power-on reset
+ */
+void SIM_RtcRestore(uint64_t off) {
+    simRtcInit = 0;
+    simRtcStart = SIM_RtcRead() + off / SIM_US_PER_S;
+    simRtcBase = simNow;
+}
+
+/*
+ * TIM2 status flags are cleared by writing 0 and left as they are by writing
+ * 1, so what the firmware wrote can only have cleared ones the timer raised
+ */
+static void SIM_SyncTim2(void) {
+    SIM_TIM2.SR &= simTim2Raised;
+    simTim2Raised = SIM_TIM2.SR;
+}
+
+/*
+ * Raise a TIM2 status flag
+ */
+static void SIM_RaiseTim2(uint32_t flag) {
+    SIM_SyncTim2();
+    SIM_TIM2.SR |= flag;
+    simTim2Raised |= flag;
+}
+
+/*
+ * Time the TIM2 CH3 compare fires, if it is armed
+ */
+static uint64_t SIM_CompareTime(void) {
+    SIM_SyncTim2();
+    if (!(SIM_TIM2.DIER & TIM_DIER_CC3IE_Msk) || (SIM_TIM2.SR & TIM_SR_CC3IF_Msk)) return SIM_NEVER;
+
+    uint32_t ahead = SIM_TIM2.CCR3 - (uint32_t) simNow;
+    if (ahead > 0x7FFFFFFF) return simNow; // already passed
+    return simNow + ahead;
+}
+
+/*
+ * Time of the next thing any model or timer has scheduled
+ */
+uint64_t SIM_NextEvent(void) {
+    uint64_t next = simNextPps;
+    uint64_t t;
+
+    t = SIM_CompareTime();
+    if (t < next) next = t;
+    if (simPresses < 2 && simPressAt[simPresses] < next && SIM_NvicEnabled(EXTI0_1_IRQn)) next = simPressAt[simPresses];
+    t = SIM_OPENLOG_NextEvent();
+    if (t < next) next = t;
+    t = SIM_GPS_NextEvent();
+    if (t < next) next = t;
+    t = simNow < simConfig.brownOut ? simConfig.brownOut : simConfig.brownOut + simConfig.holdup;
+    if (simConfig.brownOut != SIM_NEVER && t < next) next = t;
+
+    return next;
+}
+
+/*
+ * True if the interrupt line is enabled in the NVIC
+ */
+uint8_t SIM_NvicEnabled(IRQn_Type irq) {
+    return (simNvic >> irq) & 1;
+}
+
+/*
+ * True if the handler for irq may be entered now
+ */
+static uint8_t SIM_CanTake(IRQn_Type irq) {
+    return SIM_NvicEnabled(irq) && !simActive[irq];
+}
+
+/*
+ * Run everything that has come due and return the interrupt to take, if any
+ */
+static uint8_t SIM_TakeEvent(void) {
+    SIM_SyncGpio(0);
+    SIM_SyncGpio(1);
+    SIM_SyncGpio(2);
+
+    if (SIM_OPENLOG_Poll() && SIM_CanTake(USART3_4_IRQn)) return USART3_4_IRQn;
+
+    uint8_t gpsIrqs = SIM_GPS_Poll();
+    if ((gpsIrqs & SIM_GPS_IRQ_DMA) && SIM_CanTake(DMA1_Channel4_5_6_7_IRQn)) return DMA1_Channel4_5_6_7_IRQn;
+    if ((gpsIrqs & SIM_GPS_IRQ_IDLE) && SIM_CanTake(USART2_IRQn)) return USART2_IRQn;
+
+    if (simNow >= simNextPps) {
+        // the receiver publishes the epoch and pulses TIMEPULSE
+        if (!SIM_GPS_Epoch() && simPressAt[1] == SIM_NEVER) {
+            simPressAt[1] = simNow + simConfig.tail; // replay over, stop recording
+        }
+        if ((SIM_TIM2.CCER & TIM_CCER_CC2E_Msk) && SIM_GPS_Pulsed()) {
+            SIM_TIM2.CCR2 = (uint32_t) simNextPps;
+            SIM_RaiseTim2(TIM_SR_CC2IF_Msk);
+        }
+        simNextPps += SIM_US_PER_S;
+    }
+    if (SIM_CompareTime() <= simNow) SIM_RaiseTim2(TIM_SR_CC3IF_Msk);
+    if ((SIM_TIM2.SR & SIM_TIM2.DIER & (TIM_SR_CC2IF_Msk | TIM_SR_CC3IF_Msk)) && SIM_CanTake(TIM2_IRQn)) {
+        return TIM2_IRQn;
+    }
+
+    if (simNow >= simConfig.brownOut) {
+        // the supply collapses once the hold-up is spent
+        if (simNow >= simConfig.brownOut + simConfig.holdup) SIM_PowerLoss();
+        if ((SIM_PWR.CR & PWR_CR_PVDE) && !(SIM_PWR.CSR & PWR_CSR_PVDO)) {
+            SIM_PWR.CSR |= PWR_CSR_PVDO;
+            if (SIM_EXTI.RTSR & EXTI_RTSR_TR16) SIM_EXTI.PR |= EXTI_PR_PR16;
+        }
+    }
+    if ((SIM_EXTI.PR & SIM_EXTI.IMR & EXTI_PR_PR16) && SIM_CanTake(PVD_VDDIO2_IRQn)) return PVD_VDDIO2_IRQn;
+
+    if (simPresses < 2 && simNow >= simPressAt[simPresses] && (SIM_EXTI.IMR & 1) && SIM_CanTake(EXTI0_1_IRQn)) {
+        SIM_EXTI.PR |= 1;
+        simPresses++;
+        return EXTI0_1_IRQn;
+    }
+
+    return SIM_NO_IRQ;
+}
+
+/*
+ * Enter the handler for irq. Flags the hardware clears on a register read are
+ * cleared once it returns
+ */
+static void SIM_CallHandler(uint8_t irq) {
+    simStats.irqs++;
+    simActive[irq] = 1;
+
+    switch (irq) {
+        case EXTI0_1_IRQn:
+            EXTI0_1_IRQHandler();
+            SIM_EXTI.PR &= ~1;
+            break;
+        case TIM2_IRQn:
+            TIM2_IRQHandler();
+            SIM_TIM2.SR &= ~TIM_SR_CC2IF_Msk; // reading CCR2 clears CC2IF
+            break;
+        case USART3_4_IRQn:
+            USART3_4_IRQHandler();
+            SIM_USART3.ISR &= ~USART_ISR_RXNE_Msk; // reading RDR clears RXNE
+            if (SIM_USART3.ICR & USART_ICR_ORECF_Msk) SIM_USART3.ISR &= ~USART_ISR_ORE_Msk;
+            SIM_USART3.ICR = 0;
+            break;
+        case USART2_IRQn:
+            USART2_IRQHandler();
+            break;
+        case DMA1_Channel4_5_6_7_IRQn:
+            DMA1_Channel4_5_6_7_IRQHandler();
+            break;
+        case PVD_VDDIO2_IRQn:
+            PVD_VDDIO2_IRQHandler();
+            SIM_EXTI.PR &= ~EXTI_PR_PR16;
+            break;
+    }
+
+    simActive[irq] = 0;
+}
+
+/*
+ * Take every interrupt that is due, unless masked or inside a simulator call
+ */
+void SIM_Poll(void) {
+    while (simLock == 0 && !simIrqMasked) {
+        simLock++;
+        uint8_t irq = SIM_TakeEvent();
+        simLock--;
+
+        if (irq == SIM_NO_IRQ) return;
+        SIM_CallHandler(irq);
+    }
+}
+
+/*
+ * Run the virtual clock forward to t, stopping at each scheduled event on the way
+ */
+void SIM_AdvanceTo(uint64_t t) {
+    while (simNow < t) {
+        simLock++;
+        uint64_t next = SIM_NextEvent();
+        SIM_SetNow(next > simNow && next < t ? next : t);
+        simActivity++;
+        simLock--;
+
+        SIM_Poll();
+    }
+}
+
+/*
+ * Spend us microseconds of virtual time
+ */
+void SIM_Delay(uint64_t us) {
+    SIM_AdvanceTo(simNow + us);
+}
+
+/*
+ * The firmware is spinning on something only an interrupt can change. Skip
+ * ahead until one is taken. Returns 1 if nothing can ever be taken, 0 otherwise
+ */
+uint8_t SIM_Idle(void) {
+    uint32_t irqs = simStats.irqs;
+
+    while (simStats.irqs == irqs) {
+        simLock++;
+        uint64_t next = SIM_NextEvent();
+        simLock--;
+
+        if (next == SIM_NEVER) return 1; // FAILURE
+        if (next > simNow) {
+            SIM_AdvanceTo(next);
+        }
+        else { // due but can't be taken
+            SIM_Poll();
+            if (simStats.irqs == irqs) return 1; // FAILURE
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Core intrinsics, see Host/Inc/core_cm0.h
+ */
+void SIM_NvicEnable(IRQn_Type irq) {
+    simNvic |= 1UL << irq;
+}
+
+void SIM_NvicDisable(IRQn_Type irq) {
+    simNvic &= ~(1UL << irq);
+}
+
+void SIM_NvicSetPriority(IRQn_Type irq, uint32_t priority) {
+    // handlers never preempt themselves, otherwise priorities aren't modelled
+}
+
+void SIM_IrqDisable(void) {
+    simIrqMasked = 1;
+}
+
+void SIM_IrqEnable(void) {
+    simIrqMasked = 0;
+    SIM_Poll();
+}
+
+/*
+ * Sleep until the next interrupt
+ */
+void SIM_WaitForInterrupt(void) {
+    uint32_t irqs = simStats.irqs;
+
+    SIM_Lock();
+    uint64_t next = SIM_NextEvent();
+    SIM_Unlock();
+
+    if (simStats.irqs == irqs && next != SIM_NEVER && next > simNow) SIM_AdvanceTo(next);
+}
+
+/*
+ * HAL time base
+ */
+HAL_StatusTypeDef HAL_Init(void) {
+    return HAL_OK;
+}
+
+uint32_t HAL_GetTick(void) {
+    SIM_Lock();
+    uint32_t tick = simNow / 1000;
+    SIM_Unlock();
+    return tick;
+}
+
+void HAL_Delay(uint32_t Delay) {
+    SIM_Delay((uint64_t) Delay * 1000);
+}
+
+/*
+ * Oscillators start instantly. Only the register state is kept
+ */
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct) {
+    if (RCC_OscInitStruct->OscillatorType & RCC_OSCILLATORTYPE_HSI) {
+        if (RCC_OscInitStruct->HSIState == RCC_HSI_ON) SIM_RCC.CR |= RCC_CR_HSION | RCC_CR_HSIRDY;
+        else SIM_RCC.CR &= ~(RCC_CR_HSION | RCC_CR_HSIRDY);
+    }
+    if (RCC_OscInitStruct->OscillatorType & RCC_OSCILLATORTYPE_LSI) {
+        if (RCC_OscInitStruct->LSIState == RCC_LSI_ON) SIM_RCC.CSR |= RCC_CSR_LSION | RCC_CSR_LSIRDY;
+        else SIM_RCC.CSR &= ~(RCC_CSR_LSION | RCC_CSR_LSIRDY);
+    }
+    if (RCC_OscInitStruct->OscillatorType & RCC_OSCILLATORTYPE_HSI48) {
+        if (RCC_OscInitStruct->HSI48State == RCC_HSI48_ON) SIM_RCC.CR2 |= RCC_CR2_HSI48ON | RCC_CR2_HSI48RDY;
+        else SIM_RCC.CR2 &= ~(RCC_CR2_HSI48ON | RCC_CR2_HSI48RDY);
+    }
+
+    if (RCC_OscInitStruct->PLL.PLLState == RCC_PLL_ON) {
+        SIM_RCC.CFGR &= ~(RCC_CFGR_PLLSRC_Msk | RCC_CFGR_PLLMUL_Msk);
+        SIM_RCC.CFGR |= RCC_OscInitStruct->PLL.PLLSource | RCC_OscInitStruct->PLL.PLLMUL;
+        SIM_RCC.CFGR2 = RCC_OscInitStruct->PLL.PREDIV;
+        SIM_RCC.CR |= RCC_CR_PLLON | RCC_CR_PLLRDY;
+    }
+    else if (RCC_OscInitStruct->PLL.PLLState == RCC_PLL_OFF) {
+        SIM_RCC.CR &= ~(RCC_CR_PLLON | RCC_CR_PLLRDY);
+    }
+
+    return HAL_OK;
+}
+
+/*
+ * Switch SYSCLK and the bus dividers. The switch takes effect immediately
+ */
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency) {
+    SIM_FLASH.ACR = (SIM_FLASH.ACR & ~FLASH_ACR_LATENCY) | FLatency;
+
+    if (RCC_ClkInitStruct->ClockType & RCC_CLOCKTYPE_SYSCLK) {
+        uint32_t sw = RCC_ClkInitStruct->SYSCLKSource;
+        SIM_RCC.CFGR &= ~(RCC_CFGR_SW_Msk | RCC_CFGR_SWS_Msk);
+        SIM_RCC.CFGR |= sw | (sw << RCC_CFGR_SWS_Pos);
+    }
+    if (RCC_ClkInitStruct->ClockType & RCC_CLOCKTYPE_HCLK) {
+        SIM_RCC.CFGR = (SIM_RCC.CFGR & ~RCC_CFGR_HPRE_Msk) | RCC_ClkInitStruct->AHBCLKDivider;
+    }
+    if (RCC_ClkInitStruct->ClockType & RCC_CLOCKTYPE_PCLK1) {
+        SIM_RCC.CFGR = (SIM_RCC.CFGR & ~RCC_CFGR_PPRE_Msk) | RCC_ClkInitStruct->APB1CLKDivider;
+    }
+
+    SystemCoreClock = HAL_RCC_GetSysClockFreq() >> AHBPrescTable[(SIM_RCC.CFGR & RCC_CFGR_HPRE_Msk) >> RCC_CFGR_HPRE_Pos];
+    return HAL_OK;
+}
+
+/*
+ * SYSCLK from the source in CFGR.SWS
+ */
+uint32_t HAL_RCC_GetSysClockFreq(void) {
+    uint32_t cfgr = SIM_RCC.CFGR;
+
+    switch (cfgr & RCC_CFGR_SWS_Msk) {
+        case RCC_SYSCLKSOURCE_STATUS_HSE:
+            return HSE_VALUE;
+        case RCC_SYSCLKSOURCE_STATUS_HSI48:
+            return HSI48_VALUE;
+        case RCC_SYSCLKSOURCE_STATUS_PLLCLK: {
+            uint32_t mul = ((cfgr & RCC_CFGR_PLLMUL_Msk) >> RCC_CFGR_PLLMUL_Pos) + 2;
+            uint32_t div = (SIM_RCC.CFGR2 & RCC_CFGR2_PREDIV_Msk) + 1;
+            switch (cfgr & RCC_CFGR_PLLSRC_Msk) {
+                case RCC_CFGR_PLLSRC_HSI_DIV2: return HSI_VALUE / 2 * mul;
+                case RCC_CFGR_PLLSRC_HSE_PREDIV: return HSE_VALUE / div * mul;
+                case RCC_CFGR_PLLSRC_HSI48_PREDIV: return HSI48_VALUE / div * mul;
+                default: return HSI_VALUE / div * mul;
+            }
+        }
+        case RCC_SYSCLKSOURCE_STATUS_HSI:
+        default:
+            return HSI_VALUE;
+    }
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void) {
+    return SystemCoreClock;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+    return SystemCoreClock >> APBPrescTable[(SIM_RCC.CFGR & RCC_CFGR_PPRE_Msk) >> RCC_CFGR_PPRE_Pos];
+}
@@ -0,0 +1,173 @@
+/*
+ * File: sim_lcd.c
+ * Purpose: Host build replacement for spi.c. Models the PCD8544 controller of
+ *          the Nokia 5110 LCD on SPI2 and dumps each finished frame to lcd.txt
+ *          in the output directory
+ */
+#include "sim.h"
+#include "lcd.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SIM_LCD_WIDTH 84
+#define SIM_LCD_BANKS 6     // rows of 8 pixels
+
+#define SIM_LCD_MAX_PATH 512
+
+extern LCD *thisScreen;
+
+static uint32_t spi2MaxHz = 0;
+
+static uint8_t ram[SIM_LCD_BANKS][SIM_LCD_WIDTH];
+static uint8_t x, y;
+static uint8_t extended;    // H bit, extended instruction set
+static uint8_t vertical;    // V bit, addressing advances y first
+static uint8_t display;     // D (0x4) and E (0x1) bits of display control
+static uint8_t dirty;       // written to since the last dump
+
+static FILE *frameOut;
+
+/*
+ * Create the frame output. Returns 1 on failure, 0 otherwise
+ */
+uint8_t SIM_LCD_Open(char *dir) {
+    char path[SIM_LCD_MAX_PATH];
+
+    snprintf(path, sizeof(path), "%s/lcd.txt", dir);
+    frameOut = fopen(path, "w");
+    return frameOut == NULL;
+}
+
+/*
+ * Draw display RAM as text, one character per pixel
+ */
+static void SIM_LCD_Dump(void) {
+    uint64_t now = SIM_Now();
+
+    dirty = 0;
+    if (frameOut == NULL) return;
+
+    simStats.lcdFrames++;
+    fprintf(frameOut, "frame %u at %llu.%06llu s\n", (unsigned) simStats.lcdFrames,
+            (unsigned long long) (now / SIM_US_PER_S), (unsigned long long) (now % SIM_US_PER_S));
+
+    for (uint32_t row = 0; row < SIM_LCD_BANKS * 8; row++) {
+        char line[SIM_LCD_WIDTH + 3];
+        line[0] = '|';
+        for (uint32_t col = 0; col < SIM_LCD_WIDTH; col++) {
+            uint8_t on = (ram[row / 8][col] >> (row % 8)) & 1;
+            switch (display) {
+                case 0x0: on = 0; break;    // blank
+                case 0x1: on = 1; break;    // all segments on
+                case 0x5: on = !on; break;  // inverse
+                default: break;             // normal
+            }
+            line[col + 1] = on ? '#' : ' ';
+        }
+        line[SIM_LCD_WIDTH + 1] = '|';
+        line[SIM_LCD_WIDTH + 2] = '\0';
+        fprintf(frameOut, "%s\n", line);
+    }
+}
+
+/*
+ * Dump the last frame and close the output
+ */
+void SIM_LCD_Close(void) {
+    if (dirty) SIM_LCD_Dump();
+    if (frameOut != NULL) fclose(frameOut);
+    frameOut = NULL;
+}
+
+/*
+ * Command byte (D/C low). Moving the cursor home after drawing ends a frame
+ */
+static void SIM_LCD_Command(uint8_t c) {
+    if ((c & 0xF8) == 0x20) { // function set
+        extended = c & 0x1;
+        vertical = (c >> 1) & 0x1;
+        return;
+    }
+    if (extended) return; // contrast, bias and temperature aren't modelled
+
+    if ((c & 0xF8) == 0x08) { // display control
+        display = c & 0x5;
+    }
+    else if ((c & 0xF8) == 0x40) {
+        if ((c & 0x7) < SIM_LCD_BANKS) y = c & 0x7;
+    }
+    else if (c & 0x80) {
+        if ((c & 0x7F) < SIM_LCD_WIDTH) x = c & 0x7F;
+    }
+    else {
+        return;
+    }
+
+    if (x == 0 && y == 0 && dirty) SIM_LCD_Dump();
+}
+
+/*
+ * Data byte (D/C high), sets a column of 8 pixels at the cursor
+ */
+static void SIM_LCD_Data(uint8_t c) {
+    ram[y][x] = c;
+    dirty = 1;
+
+    if (vertical) {
+        if (++y == SIM_LCD_BANKS) { y = 0; x = (x + 1) % SIM_LCD_WIDTH; }
+    }
+    else {
+        if (++x == SIM_LCD_WIDTH) { x = 0; y = (y + 1) % SIM_LCD_BANKS; }
+    }
+}
+
+/*
+ * Configure SPI2 as a transmit only master with the serial clock no faster than max_hz
+ */
+void SPI2_Setup(uint32_t max_hz) {
+    RCC->APB1ENR |= RCC_APB1ENR_SPI2EN; //Enable SPI2 clock
+
+    spi2MaxHz = max_hz;
+
+    SPI2_ConfigClock();
+    SPI2->CR1 |= SPI_CR1_BIDIOE_Msk | SPI_CR1_MSTR_Msk;
+    SPI2->CR2 |= (0x7 << SPI_CR2_DS_Pos) | SPI_CR2_SSOE_Msk;
+    SPI2->CR1 |= SPI_CR1_SPE_Msk;
+}
+
+/*
+ * Same prescaler choice as the target. BR = n divides PCLK by 2^(n+1)
+ */
+void SPI2_ConfigClock(void) {
+    uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+    uint32_t br = 0;
+
+    while (br < 7 && (pclk >> (br + 1)) > spi2MaxHz) br++;
+
+    SPI2->CR1 &= ~SPI_CR1_BR_Msk;
+    SPI2->CR1 |= br << SPI_CR1_BR_Pos;
+}
+
+void SPI2_UpdateClock(void) {
+    if (!(SPI2->CR1 & SPI_CR1_SPE_Msk)) return; // not set up yet
+
+    SPI2_ConfigClock();
+}
+
+/*
+ * Shift a byte out to the LCD if it is selected, taking 8 serial clocks
+ */
+void SPI2_SendByte(uint8_t c) {
+    uint32_t br = (SPI2->CR1 & SPI_CR1_BR_Msk) >> SPI_CR1_BR_Pos;
+    uint32_t sck = HAL_RCC_GetPCLK1Freq() >> (br + 1);
+
+    SIM_Lock();
+    uint32_t pins = SIM_GPIO(1)->ODR;
+    if (thisScreen != NULL && !(pins & (1 << thisScreen->chip_select))) {
+        if (pins & (1 << thisScreen->mode_select)) SIM_LCD_Data(c);
+        else SIM_LCD_Command(c);
+    }
+    SIM_Unlock();
+
+    SIM_Delay((8 * SIM_US_PER_S + sck - 1) / sck);
+}
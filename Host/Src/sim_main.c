@@ -0,0 +1,239 @@
+/*
+ * File: sim_main.c
+ * Purpose: Host simulator entry point. Loads the session to replay, watches for
+ *          the firmware spinning on interrupts, runs the firmware's main and
+ *          reports throughput once recording has ended
+ */
+#include "sim.h"
+#include "telemetry.h"
+#include "trip.h"
+#include "sat.h"
+#include "spool.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+SIM_CONFIG simConfig = { NULL, "sim_out", NULL, SIM_NEVER, 2 * SIM_US_PER_S, 6 * SIM_US_PER_S, NULL, 0, NULL,
+                         SIM_NEVER, SIM_HOLDUP_US, 0, SIM_NEVER, 0, SIM_NEVER };
+SIM_STATS simStats;
+
+static struct timespec realStart;
+
+/*
+ * Restore what the batteries kept from the previous run: the MCU backup
+ * domain, RTC calendar and backup registers, and the receiver's battery backed
+ * RAM. A missing file is a cold start
+ */
+static void SIM_LoadBattery(void) {
+    if (simConfig.battery == NULL) return;
+
+    FILE *f = fopen(simConfig.battery, "rb");
+    if (f == NULL) return;
+
+    if (fread((void *) &SIM_RTC, sizeof(SIM_RTC), 1, f) == 1) {
+        SIM_RtcRestore(simConfig.warm == SIM_NEVER ? 0 : simConfig.warm);
+        SIM_GPS_LoadBbr(f);
+    }
+    fclose(f);
+}
+
+static void SIM_SaveBattery(void) {
+    if (simConfig.battery == NULL) return;
+
+    FILE *f = fopen(simConfig.battery, "wb");
+    if (f == NULL) {
+        perror(simConfig.battery);
+        return;
+    }
+
+    fwrite((void *) SIM_RTCRegs(), sizeof(SIM_RTC), 1, f);
+    SIM_GPS_SaveBbr(f);
+    fclose(f);
+}
+
+/*
+ * Print what the run did and exit with code
+ */
+static void SIM_Finish(int code) {
+    struct itimerval off = { { 0, 0 }, { 0, 0 } };
+    struct timespec realEnd;
+
+    setitimer(ITIMER_VIRTUAL, &off, NULL);
+    SIM_OPENLOG_Close();
+    SIM_LCD_Close();
+    SIM_SaveBattery();
+    SIM_FLASH_Close(simConfig.flashImage);
+
+    clock_gettime(CLOCK_MONOTONIC, &realEnd);
+    double real = (realEnd.tv_sec - realStart.tv_sec) + (realEnd.tv_nsec - realStart.tv_nsec) / 1e9;
+    double virt = (double) SIM_Now() / SIM_US_PER_S;
+
+    printf("virtual time    %.3f s\n", virt);
+    printf("real time       %.3f s (%.0fx real time)\n", real, real > 0 ? virt / real : 0);
+    printf("epochs          %u, %u navigated (%u bytes dropped by the receiver)\n", (unsigned) simStats.epochs,
+           (unsigned) simStats.solutions, (unsigned) simStats.ddcDropped);
+    printf("ddc             %u bytes read, %u written\n", (unsigned) simStats.ddcRead, (unsigned) simStats.ddcWritten);
+    printf("uart            %u bytes read, %u written, %u dropped\n", (unsigned) simStats.uartRead,
+           (unsigned) simStats.uartWritten, (unsigned) simStats.uartDropped);
+    printf("openlog         %u bytes, %u track points (%.0f/s), %u fence events, %u batches, %u brown-outs\n",
+           (unsigned) simStats.logBytes, (unsigned) simStats.trackPoints, real > 0 ? simStats.trackPoints / real : 0,
+           (unsigned) simStats.fenceEvents, (unsigned) telemetry.batchWrites, (unsigned) telemetry.brownOuts);
+    printf("overruns        %u OpenLog bytes lost, %u counted, %u receiver bytes counted\n",
+           (unsigned) simStats.replyOverruns, (unsigned) telemetry.rxOverruns, (unsigned) telemetry.rxLost);
+    printf("spool           %u pending, %u dropped, %u resends\n", (unsigned) SPOOL_Pending(),
+           (unsigned) telemetry.spoolDropped, (unsigned) telemetry.batchResends);
+    printf("lcd             %u frames\n", (unsigned) simStats.lcdFrames);
+    printf("debug port      %u bytes\n", (unsigned) simStats.debugBytes);
+    printf("interrupts      %u\n", (unsigned) simStats.irqs);
+    printf("flash           %u programs and erases\n", (unsigned) simStats.flashOps);
+    printf("receiver        %.1f mAs, %.2f mAs per track point, %u s at full power, %u s low, psm=%u\n",
+           simStats.gpsCharge / 1000.0, simStats.trackPoints ? simStats.gpsCharge / 1000.0 / simStats.trackPoints : 0,
+           (unsigned) simStats.gpsFullTime, (unsigned) simStats.gpsLowTime, (unsigned) telemetry.psmChanges);
+    printf("assist          pos=%u time=%u ano=%u, first fix at %.3f s, ttff=%u ms\n", (unsigned) simStats.assistPos,
+           (unsigned) simStats.assistTime, (unsigned) simStats.assistAno,
+           simStats.firstFix == SIM_NEVER ? 0 : (double) simStats.firstFix / SIM_US_PER_S, (unsigned) telemetry.ttff);
+    printf("telemetry       nack=%u timeout=%u cksum=%u resync=%u dropped=%u stall=%u cfg=%u/%u%s nav=%u\n",
+           (unsigned) telemetry.i2cNacks, (unsigned) telemetry.i2cTimeouts, (unsigned) telemetry.checksumErrors,
+           (unsigned) telemetry.framerResyncs, (unsigned) telemetry.droppedEpochs, (unsigned) telemetry.txStalls,
+           (unsigned) telemetry.cfgRetries, (unsigned) telemetry.cfgFailures,
+           telemetry.cfgReused ? " (kept)" : "", (unsigned) telemetry.navRateChanges);
+    printf("fences          %u zones, %u rejected, %u events\n", (unsigned) telemetry.fenceZones,
+           (unsigned) telemetry.fenceRejects, (unsigned) telemetry.fenceEvents);
+    SAT_SUMMARY sats;
+    SAT_GetSummary(&sats);
+    printf("satellites      %u used, %u tracked, %u visible, hdop %u.%02u, cno %u/%u/%u/%u\n", (unsigned) sats.used,
+           (unsigned) sats.tracked, (unsigned) sats.visible, (unsigned) (sats.hdop / 100), (unsigned) (sats.hdop % 100),
+           (unsigned) sats.cno[0], (unsigned) sats.cno[1], (unsigned) sats.cno[2], (unsigned) sats.cno[3]);
+    printf("trip            %u.%02u m, moving %u s, stopped %u s, max %u cm/s, up %u mm, down %u mm\n",
+           (unsigned) trip.distance, (unsigned) trip.distanceCm, (unsigned) trip.movingTime,
+           (unsigned) trip.stoppedTime, (unsigned) trip.maxSpeed, (unsigned) trip.climb, (unsigned) trip.descent);
+    printf("frames          nmea=%u (%u bytes) ubx=%u (%u bytes) rtcm=%u (%u bytes) oversize=%u\n",
+           (unsigned) telemetry.nmeaFrames, (unsigned) telemetry.nmeaBytes, (unsigned) telemetry.ubxFrames,
+           (unsigned) telemetry.ubxBytes, (unsigned) telemetry.rtcmFrames, (unsigned) telemetry.rtcmBytes,
+           (unsigned) telemetry.oversizeFrames);
+
+    if (simConfig.reference != NULL) {
+        char trail[512];
+        snprintf(trail, sizeof(trail), "%s/trail.gpx", simConfig.outDir);
+        if (SIM_TRACK_Check(simConfig.reference, trail) && code == 0) code = 4;
+        if (SIM_TRACK_CheckTrip(simConfig.reference) && code == 0) code = 4;
+    }
+    if (simConfig.cuts && SIM_TRACK_CheckCuts() && code == 0) code = 4;
+
+    fflush(stdout);
+    exit(code);
+}
+
+/*
+ * Main power fails. Only the batteries and flash keep anything
+ */
+void SIM_PowerLoss(void) {
+    fprintf(stderr, "sim: power lost at %.3f s, flash operation %u, %u bytes queued unwritten\n",
+            (double) SIM_Now() / SIM_US_PER_S, (unsigned) simStats.flashOps, (unsigned) RINGBUF_Count(&usart3Tx));
+    SIM_Finish(3);
+}
+
+/*
+ * Runs every SIM_TICK_US of CPU time. If the firmware hasn't called into the
+ * simulator since the last few ticks it is spinning on something only an
+ * interrupt can change, so skip virtual time ahead to the next one
+ */
+static void SIM_Tick(int sig) {
+    static uint32_t lastActivity;
+    static uint32_t idleTicks;
+
+    if (SIM_Busy()) return;
+    if (SIM_Activity() != lastActivity) {
+        lastActivity = SIM_Activity();
+        idleTicks = 0;
+        return;
+    }
+    if (++idleTicks < SIM_IDLE_TICKS) return;
+    idleTicks = 0;
+
+    if (SIM_Stopped() && SIM_OPENLOG_Idle()) SIM_Finish(0); // recording ended
+
+    if (SIM_Idle() || SIM_Hung()) {
+        fprintf(stderr, "sim: firmware stuck at %.3f s\n", (double) SIM_Now() / SIM_US_PER_S);
+        SIM_Finish(1);
+    }
+
+    lastActivity = SIM_Activity();
+}
+
+static void SIM_Usage(char *name) {
+    fprintf(stderr, "usage: %s [-o outdir] [-b battery] [-w off_s] [-f flash] [-p cut_op] [-r ref.gpx] [-s start_s] [-t tail_s] [-u brownout_s[,holdup_s]] [-m outage_s,len_s] [-d dump_s] [-c] session\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:b:w:f:p:r:s:t:u:m:d:c")) != -1) {
+        char *rest;
+        switch (opt) {
+            case 'o': simConfig.outDir = optarg; break;
+            case 'b': simConfig.battery = optarg; break;
+            case 'w': simConfig.warm = strtod(optarg, NULL) * SIM_US_PER_S; break;
+            case 'f': simConfig.flashImage = optarg; break;
+            case 'p': simConfig.powerCut = strtoul(optarg, NULL, 0); break;
+            case 'r': simConfig.reference = optarg; break;
+            case 's': simConfig.startAt = strtod(optarg, NULL) * SIM_US_PER_S; break;
+            case 't': simConfig.tail = strtod(optarg, NULL) * SIM_US_PER_S; break;
+            case 'c': simConfig.cuts = 1; break;
+            case 'u':
+                simConfig.brownOut = strtod(optarg, &rest) * SIM_US_PER_S;
+                if (*rest == ',') simConfig.holdup = strtod(rest + 1, NULL) * SIM_US_PER_S;
+                break;
+            case 'm':
+                simConfig.outage = strtod(optarg, &rest) * SIM_US_PER_S;
+                if (*rest != ',') SIM_Usage(argv[0]);
+                simConfig.outageLen = strtod(rest + 1, NULL) * SIM_US_PER_S;
+                break;
+            case 'd': simConfig.dumpAt = strtod(optarg, NULL) * SIM_US_PER_S; break;
+            default: SIM_Usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) SIM_Usage(argv[0]);
+    simConfig.session = argv[optind];
+
+    if (mkdir(simConfig.outDir, 0777) && errno != EEXIST) {
+        perror(simConfig.outDir);
+        return 1;
+    }
+    if (SIM_GPS_Load(simConfig.session)) {
+        perror(simConfig.session);
+        return 1;
+    }
+    if (SIM_OPENLOG_Open(simConfig.outDir) || SIM_LCD_Open(simConfig.outDir)) {
+        perror(simConfig.outDir);
+        return 1;
+    }
+    if (SIM_FLASH_Open(simConfig.flashImage)) {
+        perror("flash");
+        return 1;
+    }
+
+    SIM_Reset();
+    SIM_LoadBattery();
+
+    // nested so a handler waiting on another interrupt can still be helped along
+    struct sigaction sa = { 0 };
+    sa.sa_handler = SIM_Tick;
+    sa.sa_flags = SA_RESTART | SA_NODEFER;
+    sigaction(SIGVTALRM, &sa, NULL);
+
+    struct itimerval tick = { { 0, SIM_TICK_US }, { 0, SIM_TICK_US } };
+    setitimer(ITIMER_VIRTUAL, &tick, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &realStart);
+
+    FIRMWARE_Main();
+
+    SIM_Finish(1); // the firmware never returns
+    return 1;
+}
@@ -0,0 +1,704 @@
+/*
+ * File: sim_openlog.c
+ * Purpose: Host build replacement for usart.c. USART3 drains its transmit queue
+ *          at the configured baud rate into a model of the OpenLog, which keeps
+ *          its files in the output directory. The USART1 debug port is written
+ *          to usart1.txt there, and types the spool dump command on it with
+ *          -d. With -c every byte written into the track is kept, in order,
+ *          for the truncation check. With -m OpenLog loses power for a while
+ *          and boots again, logging. Like OpenLog, the command prompt and
+ *          write mode read a line at a time, drop line feeds, take backspace
+ *          and delete out of the line and echo what they read until told
+ *          otherwise, and write mode only ends on an empty line
+ */
+#include "sim.h"
+#include "openlog.h"
+#include "spool.h"
+#include "telemetry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// OpenLog takes this long to boot after its reset pulse
+#define SIM_OPENLOG_BOOT_US 500000
+
+// and this long to act on a command
+#define SIM_OPENLOG_CMD_US 2000
+
+#define SIM_OPENLOG_MAX_CMD 64
+#define SIM_OPENLOG_MAX_PATH 512
+
+// OpenLog's line buffer. Write mode writes a line that fills it as it is and
+// goes on reading
+#define SIM_OPENLOG_LINE_LEN 30
+
+typedef enum {
+    SIM_OL_RESET,   // held in reset by the RTS line
+    SIM_OL_LOG,     // everything received is appended to the open file
+    SIM_OL_CMD,     // command prompt, entered with three CTRL+z
+    SIM_OL_WRITE    // lines received are written over the open file up to an empty one
+} SIM_OL_STATE;
+
+// Bytes waiting to go out on USART3
+static uint8_t usart3TxStorage[USART3_TX_BUF_SIZE];
+RINGBUF usart3Tx;
+
+static uint32_t usart3Baud = 0;
+static uint64_t txDoneAt;       // when the byte at the front of the queue is on the wire
+static uint8_t usart3Held = 0;  // bytes are queued without being sent
+static uint8_t usart3Stopped = 0; // nothing goes past usart3Stop, see USART3_SendUpTo
+static uint32_t usart3Stop;
+static uint32_t usart1Baud = 0;
+
+static SIM_OL_STATE olState = SIM_OL_LOG;
+static uint8_t olCtrlZ;
+static char olCmd[SIM_OPENLOG_MAX_CMD];
+static uint32_t olCmdLen;
+static uint8_t olLine[SIM_OPENLOG_LINE_LEN]; // line being written
+static uint32_t olLineLen;
+static uint8_t olEcho = 1;      // kept in EEPROM, so across boots
+static char *olDir;
+static FILE *olFile;
+static uint32_t olBoots;
+static uint8_t olTrack;         // the open file is the track
+
+static SIM_WRITE *olJournal;    // bytes written into the track, with -c
+static uint32_t olJournalLen;
+static uint32_t olJournalMax;
+
+static uint8_t *olOut;          // replies and echoes being sent back, in order
+static uint32_t olOutLen;
+static uint32_t olOutMax;
+static uint32_t olOutNext;      // next byte of them to send
+static uint64_t olOutAt;        // when it arrives
+
+static FILE *debugOut;
+
+static const char *TRKPT = "<trkpt";
+static uint32_t trkptMatch;
+static const char *FENCE = "<!-- fence ";
+static uint32_t fenceMatch;
+
+/*
+ * Follow a record marker through the stored bytes. Returns 1 when c completes
+ * it, 0 otherwise
+ */
+static uint8_t SIM_OPENLOG_Match(const char *marker, uint32_t *match, uint8_t c) {
+    if (c == marker[*match]) {
+        if (marker[++*match] == '\0') {
+            *match = 0;
+            return 1;
+        }
+    }
+    else {
+        *match = c == marker[0];
+    }
+    return 0;
+}
+
+/*
+ * Create the debug port output. Returns 1 on failure, 0 otherwise
+ */
+uint8_t SIM_OPENLOG_Open(char *dir) {
+    char path[SIM_OPENLOG_MAX_PATH];
+
+    olDir = dir;
+    snprintf(path, sizeof(path), "%s/usart1.txt", olDir);
+    debugOut = fopen(path, "w");
+    return debugOut == NULL;
+}
+
+/*
+ * Close everything OpenLog has open
+ */
+void SIM_OPENLOG_Close(void) {
+    if (olFile != NULL) fclose(olFile);
+    if (debugOut != NULL) fclose(debugOut);
+    free(olOut);
+    olFile = NULL;
+    debugOut = NULL;
+    olOut = NULL;
+    olOutLen = olOutNext = olOutMax = 0;
+}
+
+/*
+ * Every byte written into the track so far, oldest first. Returns how many
+ */
+uint32_t SIM_OPENLOG_Journal(SIM_WRITE **writes) {
+    *writes = olJournal;
+    return olJournalLen;
+}
+
+/*
+ * Keep a byte written into the track at offset
+ */
+static void SIM_OPENLOG_Keep(long offset, uint8_t c) {
+    if (olJournalLen == olJournalMax) {
+        olJournalMax = olJournalMax ? 2 * olJournalMax : 4096;
+        olJournal = realloc(olJournal, olJournalMax * sizeof(SIM_WRITE));
+    }
+    olJournal[olJournalLen].offset = offset;
+    olJournal[olJournalLen].c = c;
+    olJournalLen++;
+}
+
+/*
+ * Send len bytes of reply to the host after delay, or after what is already
+ * being sent
+ */
+static void SIM_OPENLOG_ReplyBytes(const uint8_t *reply, uint32_t len, uint64_t delay) {
+    if (olOutLen + len > olOutMax) {
+        olOutMax = 2 * (olOutLen + len);
+        olOut = realloc(olOut, olOutMax);
+    }
+    if (olOutNext == olOutLen) {
+        olOutNext = olOutLen = 0;
+        olOutAt = SIM_Now() + delay;
+    }
+    memcpy(&olOut[olOutLen], reply, len);
+    olOutLen += len;
+}
+
+/*
+ * Stop sending, OpenLog lost power
+ */
+static void SIM_OPENLOG_Silence(void) {
+    olOutNext = olOutLen = 0;
+}
+
+static void SIM_OPENLOG_Reply(const char *reply, uint64_t delay) {
+    SIM_OPENLOG_ReplyBytes((const uint8_t *) reply, strlen(reply), delay);
+}
+
+/*
+ * Answer read with up to len bytes of file name from byte start followed by
+ * the prompt, all in a single reply
+ */
+static void SIM_OPENLOG_Read(char *name, long start, long len) {
+    char path[SIM_OPENLOG_MAX_PATH];
+
+    snprintf(path, sizeof(path), "%s/%s", olDir, name);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL || start < 0 || len < 0 || fseek(f, start, SEEK_SET) != 0) {
+        if (f != NULL) fclose(f);
+        SIM_OPENLOG_Reply("\r\n!>", SIM_OPENLOG_CMD_US);
+        return;
+    }
+
+    uint8_t *data = malloc(len + 3);
+    uint32_t got = fread(data, 1, len, f);
+    fclose(f);
+    memcpy(&data[got], "\r\n>", 3);
+    SIM_OPENLOG_ReplyBytes(data, got + 3, SIM_OPENLOG_CMD_US);
+    free(data);
+}
+
+/*
+ * Open name in the output directory with fopen mode, replacing the open file
+ */
+static void SIM_OPENLOG_OpenFile(char *name, const char *mode) {
+    char path[SIM_OPENLOG_MAX_PATH];
+
+    if (olFile != NULL) fclose(olFile);
+    snprintf(path, sizeof(path), "%s/%s", olDir, name);
+    olFile = fopen(path, mode);
+    olTrack = strcmp(name, SIM_OPENLOG_TRACK) == 0;
+}
+
+/*
+ * The GRN pin resets OpenLog while low. It boots again when released
+ */
+void SIM_OPENLOG_PinsChanged(uint32_t port, uint32_t before, uint32_t after) {
+    if (port != 1 || thisOpenLog == NULL) return;
+    uint32_t rts = 1 << thisOpenLog->uart_rts;
+
+    if ((before & rts) && !(after & rts)) {
+        olState = SIM_OL_RESET;
+        SIM_OPENLOG_Silence();
+    }
+    else if (!(before & rts) && (after & rts) && olState == SIM_OL_RESET) {
+        if (olFile != NULL) fclose(olFile);
+        olFile = NULL;
+        olBoots++;
+        olCtrlZ = 0;
+        olState = SIM_OL_LOG;
+        SIM_OPENLOG_Reply("12<", SIM_OPENLOG_BOOT_US);
+    }
+}
+
+/*
+ * Store a logged byte. Until a file is appended to, OpenLog logs to a new
+ * sequentially numbered file each boot
+ */
+static void SIM_OPENLOG_Store(uint8_t c) {
+    if (olFile == NULL) {
+        char name[MAX_FILE_NAME_LENGTH+1];
+        snprintf(name, sizeof(name), "LOG%05u.TXT", (unsigned) olBoots);
+        SIM_OPENLOG_OpenFile(name, "ab");
+    }
+    if (olFile != NULL && olTrack && simConfig.cuts) SIM_OPENLOG_Keep(ftell(olFile), c);
+    if (olFile != NULL) fputc(c, olFile);
+
+    simStats.logBytes++;
+    if (SIM_OPENLOG_Match(TRKPT, &trkptMatch, c)) simStats.trackPoints++;
+    if (SIM_OPENLOG_Match(FENCE, &fenceMatch, c)) simStats.fenceEvents++;
+}
+
+/*
+ * Run a command line. Replies are the ones the firmware waits for, see openlog.c
+ */
+static void SIM_OPENLOG_Command(char *cmd) {
+    char path[SIM_OPENLOG_MAX_PATH];
+    char *arg = strchr(cmd, ' ');
+    if (arg != NULL) *arg++ = '\0';
+
+    if (strcmp(cmd, "append") == 0 && arg != NULL) {
+        SIM_OPENLOG_OpenFile(arg, "ab");
+        olState = SIM_OL_LOG;
+        SIM_OPENLOG_Reply("\r\n<", SIM_OPENLOG_CMD_US);
+    }
+    else if (strcmp(cmd, "new") == 0 && arg != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", olDir, arg);
+        FILE *f = fopen(path, "ab");
+        if (f != NULL) fclose(f);
+        SIM_OPENLOG_Reply("\r\n<", SIM_OPENLOG_CMD_US);
+    }
+    else if (strcmp(cmd, "rm") == 0 && arg != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", olDir, arg);
+        remove(path);
+        SIM_OPENLOG_Reply("\r\n!>", SIM_OPENLOG_CMD_US);
+    }
+    else if (strcmp(cmd, "read") == 0 && arg != NULL) {
+        char name[SIM_OPENLOG_MAX_CMD];
+        long start = 0, len = 0;
+        if (sscanf(arg, "%63s %ld %ld", name, &start, &len) == 3) SIM_OPENLOG_Read(name, start, len);
+        else SIM_OPENLOG_Reply("\r\n!>", SIM_OPENLOG_CMD_US);
+    }
+    else if (strcmp(cmd, "write") == 0 && arg != NULL) {
+        char name[SIM_OPENLOG_MAX_CMD];
+        long offset = 0;
+        if (sscanf(arg, "%63s %ld", name, &offset) == 2) SIM_OPENLOG_OpenFile(name, "r+b");
+        if (olFile != NULL && offset >= 0 && fseek(olFile, offset, SEEK_SET) == 0) {
+            olState = SIM_OL_WRITE;
+            olLineLen = 0;
+        }
+        else SIM_OPENLOG_Reply("\r\n!>", SIM_OPENLOG_CMD_US);
+    }
+    else if (strcmp(cmd, "size") == 0 && arg != NULL) {
+        static char reply[24];
+        struct stat st;
+        if (olFile != NULL) fflush(olFile); // as OpenLog sees it, not as last flushed
+        snprintf(path, sizeof(path), "%s/%s", olDir, arg);
+        snprintf(reply, sizeof(reply), "%ld\r\n>", stat(path, &st) == 0 ? (long) st.st_size : -1L);
+        SIM_OPENLOG_Reply(reply, SIM_OPENLOG_CMD_US);
+    }
+    else if (strcmp(cmd, "sync") == 0) {
+        if (olFile != NULL) fflush(olFile);
+        SIM_OPENLOG_Reply("\r\n<", SIM_OPENLOG_CMD_US);
+    }
+    else if (strcmp(cmd, "echo") == 0 && arg != NULL && (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0)) {
+        olEcho = strcmp(arg, "on") == 0;
+        SIM_OPENLOG_Reply("\r\n>", SIM_OPENLOG_CMD_US);
+    }
+    else if (cmd[0] == '\0') {
+        SIM_OPENLOG_Reply("\r\n>", SIM_OPENLOG_CMD_US);
+    }
+    else if (strcmp(cmd, "init") == 0 || strcmp(cmd, "reset") == 0) {
+        if (olFile != NULL) fclose(olFile);
+        olFile = NULL;
+        SIM_OPENLOG_Reply("\r\n<", SIM_OPENLOG_CMD_US);
+    }
+    else {
+        SIM_OPENLOG_Reply("\r\n!>", SIM_OPENLOG_CMD_US);
+    }
+}
+
+/*
+ * OpenLog loses power at the start of the -m outage, the open file closed
+ * with whatever was written to it, and boots again at the end
+ */
+static void SIM_OPENLOG_Outage(void) {
+    if (simConfig.outage == SIM_NEVER || SIM_Now() < simConfig.outage) return;
+
+    if (SIM_Now() < simConfig.outage + simConfig.outageLen) {
+        if (olState == SIM_OL_RESET) return;
+        if (olFile != NULL) fclose(olFile);
+        olFile = NULL;
+        olState = SIM_OL_RESET;
+        SIM_OPENLOG_Silence();
+        return;
+    }
+
+    simConfig.outage = SIM_NEVER;
+    olBoots++;
+    olCtrlZ = 0;
+    olState = SIM_OL_LOG;
+    SIM_OPENLOG_Reply("12<", SIM_OPENLOG_BOOT_US);
+}
+
+/*
+ * Write the line read in write mode, then read the next
+ */
+static void SIM_OPENLOG_WriteLine(void) {
+    for (uint32_t i = 0; i < olLineLen; i++) SIM_OPENLOG_Store(olLine[i]);
+    olLineLen = 0;
+}
+
+/*
+ * Byte received by OpenLog from USART3
+ */
+static void SIM_OPENLOG_Receive(uint8_t c) {
+    if (olState == SIM_OL_RESET) return;
+
+    if (c == 26) { // CTRL+z
+        if (++olCtrlZ == 3) {
+            olCtrlZ = 0;
+            olCmdLen = 0;
+            olState = SIM_OL_CMD;
+            SIM_OPENLOG_Reply("~>", SIM_OPENLOG_CMD_US);
+        }
+        return;
+    }
+    olCtrlZ = 0;
+
+    if (olState == SIM_OL_LOG) {
+        SIM_OPENLOG_Store(c);
+        return;
+    }
+
+    // the rest is read a line at a time
+    uint32_t *len = olState == SIM_OL_WRITE ? &olLineLen : &olCmdLen;
+    if (c == 0x08 || c == 0x7F) {
+        if (*len > 0) {
+            (*len)--;
+            SIM_OPENLOG_Reply("\b \b", 0);
+        }
+        return;
+    }
+    if (olEcho) SIM_OPENLOG_ReplyBytes(&c, 1, 0);
+    if (c == '\n') return;
+
+    if (olState == SIM_OL_WRITE) {
+        if (c == '\r' && olLineLen == 0) {
+            olState = SIM_OL_CMD;
+            SIM_OPENLOG_Reply("\r\n>", 0);
+        }
+        else if (c == '\r') {
+            SIM_OPENLOG_WriteLine();
+            SIM_OPENLOG_Reply("\r\n", 0);
+        }
+        else {
+            olLine[olLineLen++] = c;
+            if (olLineLen == SIM_OPENLOG_LINE_LEN - 1) SIM_OPENLOG_WriteLine();
+        }
+    }
+    else if (c == '\r') {
+        olCmd[olCmdLen] = '\0';
+        olCmdLen = 0;
+        SIM_OPENLOG_Command(olCmd);
+    }
+    else if (olCmdLen < SIM_OPENLOG_MAX_CMD - 1) {
+        olCmd[olCmdLen++] = c;
+    }
+}
+
+/*
+ * Hand every byte that has finished shifting out to OpenLog
+ */
+static void SIM_USART3_Drain(void) {
+    uint8_t c;
+
+    if (!(USART3->CR1 & USART_CR1_TXEIE_Msk)) return; // held, or nothing to send
+
+    uint8_t stop = 0;
+    while (RINGBUF_Count(&usart3Tx) != 0 && SIM_Now() >= txDoneAt) {
+        stop = usart3Stopped && (int32_t) (usart3Stop - usart3Tx.tail) <= 0;
+        if (stop) break;
+
+        RINGBUF_Pop(&usart3Tx, &c);
+        SIM_OPENLOG_Receive(c);
+        txDoneAt += SIM_CharTime(usart3Baud);
+    }
+
+    if (RINGBUF_Count(&usart3Tx) == 0 || stop) USART3->CR1 &= ~USART_CR1_TXEIE_Msk;
+}
+
+/*
+ * Start shifting out the queue unless it already is
+ */
+static void SIM_USART3_Start(void) {
+    if (USART3->CR1 & USART_CR1_TXEIE_Msk) return;
+
+    txDoneAt = SIM_Now() + SIM_CharTime(usart3Baud);
+    USART3->CR1 |= USART_CR1_TXEIE_Msk;
+}
+
+/*
+ * Let the byte at the front of the queue finish
+ */
+static void SIM_USART3_Wait(void) {
+    SIM_AdvanceTo(txDoneAt);
+    SIM_Lock();
+    SIM_USART3_Drain();
+    SIM_Unlock();
+}
+
+/*
+ * Time of the next byte to finish in either direction
+ */
+uint64_t SIM_OPENLOG_NextEvent(void) {
+    uint64_t next = SIM_NEVER;
+
+    if (RINGBUF_Count(&usart3Tx) != 0 && (USART3->CR1 & USART_CR1_TXEIE_Msk)) next = txDoneAt;
+    if (olOutNext != olOutLen && olOutAt < next) next = olOutAt;
+    if (simConfig.outage != SIM_NEVER) {
+        uint64_t t = SIM_Now() < simConfig.outage ? simConfig.outage : simConfig.outage + simConfig.outageLen;
+        if (t < next) next = t;
+    }
+
+    return next;
+}
+
+/*
+ * Move bytes that are due in both directions.
+ * Returns 1 if a received byte is waiting for the interrupt handler, 0 otherwise
+ */
+uint8_t SIM_OPENLOG_Poll(void) {
+    SIM_OPENLOG_Outage();
+    SIM_USART3_Drain();
+
+    while (olOutNext != olOutLen && SIM_Now() >= olOutAt) {
+        // dropped unless the receiver is on, and overrun if the last byte
+        // wasn't read before this one came
+        uint8_t on = (USART3->CR1 & (USART_CR1_UE_Msk | USART_CR1_RE_Msk)) == (USART_CR1_UE_Msk | USART_CR1_RE_Msk);
+        if (on && !(USART3->ISR & USART_ISR_RXNE_Msk)) {
+            USART3->RDR = olOut[olOutNext];
+            USART3->ISR |= USART_ISR_RXNE_Msk;
+        }
+        else if (on) {
+            if (USART3->CR3 & USART_CR3_OVRDIS_Msk) USART3->RDR = olOut[olOutNext];
+            else USART3->ISR |= USART_ISR_ORE_Msk;
+            simStats.replyOverruns++;
+        }
+        olOutNext++;
+        olOutAt += SIM_CharTime(usart3Baud);
+    }
+
+    return (USART3->ISR & (USART_ISR_RXNE_Msk | USART_ISR_ORE_Msk)) && (USART3->CR1 & USART_CR1_RXNEIE_Msk);
+}
+
+/*
+ * True once nothing is in flight on USART3
+ */
+uint8_t SIM_OPENLOG_Idle(void) {
+    return RINGBUF_Count(&usart3Tx) == 0 && olOutNext == olOutLen;
+}
+
+/*
+ * Start USART3 off at rate with an empty transmit queue
+ */
+void USART3_Setup(uint32_t rate) {
+    RINGBUF_Init(&usart3Tx, usart3TxStorage, sizeof(usart3TxStorage));
+    USART3_SetBaudRate(rate);
+}
+
+/*
+ * Set baud rate of USART3 to rate using PCLK, which clocks USART3
+ */
+void USART3_SetBaudRate(uint32_t rate) {
+    uint32_t fclk = HAL_RCC_GetPCLK1Freq();
+    usart3Baud = rate;
+    USART3->BRR = (fclk + rate/2) / rate;
+}
+
+/*
+ * Recompute BRR after a clock change
+ */
+void USART3_UpdateBaudRate(void) {
+    if (!(USART3->CR1 & USART_CR1_UE_Msk) || usart3Baud == 0) return; // not set up yet
+    if (USART3->BRR == (HAL_RCC_GetPCLK1Freq() + usart3Baud/2) / usart3Baud) return;
+
+    USART3_Flush();
+    USART3->CR1 &= ~USART_CR1_UE_Msk;
+    USART3_SetBaudRate(usart3Baud);
+    USART3->CR1 |= USART_CR1_UE_Msk;
+}
+
+/*
+ * Queue char to send on USART3. Only blocks if the transmit queue is full.
+ * Only from the main loop
+ */
+void USART3_SendChar(char c) {
+    if (RINGBUF_Free(&usart3Tx) == 0 && !usart3Stopped) {
+        telemetry.txStalls++;
+        SIM_Lock();
+        SIM_USART3_Start(); // a full queue goes out even if held
+        SIM_Unlock();
+        while (RINGBUF_Free(&usart3Tx) == 0) SIM_USART3_Wait();
+    }
+
+    SIM_Lock();
+    RINGBUF_Push(&usart3Tx, c); // dropped if stopped and full
+    if (!usart3Held && !usart3Stopped) SIM_USART3_Start();
+    SIM_Unlock();
+}
+
+/*
+ * Keep what is queued from now on until USART3_Release
+ */
+void USART3_Hold(void) {
+    usart3Held = 1;
+}
+
+/*
+ * Start sending what was held back
+ */
+void USART3_Release(void) {
+    SIM_Lock();
+    usart3Held = 0;
+    if (RINGBUF_Count(&usart3Tx) != 0 && !usart3Stopped) SIM_USART3_Start();
+    SIM_Unlock();
+}
+
+/*
+ * Send what was queued before free running index head and stop the queue
+ * there, waiting until it has gone. Returns the number of bytes sent
+ */
+uint32_t USART3_SendUpTo(uint32_t head) {
+    int32_t left = head - usart3Tx.tail;
+
+    SIM_Lock();
+    usart3Stop = head;
+    usart3Stopped = 1;
+    if (left > 0) SIM_USART3_Start();
+    else USART3->CR1 &= ~USART_CR1_TXEIE_Msk;
+    SIM_Unlock();
+
+    USART3_Flush();
+    return left > 0 ? left : 0;
+}
+
+/*
+ * Send char past the stopped queue, blocking for its time on the wire
+ */
+void USART3_SendNow(char c) {
+    uint64_t done = (SIM_Now() > txDoneAt ? SIM_Now() : txDoneAt) + SIM_CharTime(usart3Baud);
+
+    SIM_AdvanceTo(done);
+    SIM_Lock();
+    SIM_OPENLOG_Receive(c);
+    SIM_Unlock();
+}
+
+/*
+ * Drop everything queued and start the queue again
+ */
+void USART3_Discard(void) {
+    RINGBUF_Consume(&usart3Tx, RINGBUF_Count(&usart3Tx));
+    usart3Stopped = 0;
+    usart3Held = 0;
+}
+
+/*
+ * Send a null-terminated string on USART3
+ */
+void USART3_SendStr(char* s) {
+    uint32_t i = 0;
+    while (s[i] != '\0') USART3_SendChar(s[i++]);
+}
+
+/*
+ * Wait until everything being sent has been shifted out of USART3. Bytes that
+ * are held stay queued
+ */
+void USART3_Flush(void) {
+    if (!(USART3->CR1 & USART_CR1_UE_Msk)) return; // not set up yet
+
+    while (USART3->CR1 & USART_CR1_TXEIE_Msk) SIM_USART3_Wait();
+}
+
+/*
+ * Pass on the bytes that have been sent
+ */
+void USART3_TransmitInterrupt(void) {
+    SIM_Lock();
+    SIM_USART3_Drain();
+    SIM_Unlock();
+}
+
+/*
+ * Set up USART1 as the debug port on PA(tx_pin) and PA(rx_pin)
+ */
+void USART1_Setup(uint8_t tx_pin, uint8_t rx_pin, uint32_t rate) {
+    RCC->APB2ENR |= RCC_APB2ENR_USART1EN; // Enable USART1 clock
+    RCC->AHBENR |= RCC_AHBENR_GPIOAEN;    // Enable GPIOA clock
+
+    configPinA_AF1(tx_pin);
+    configPinA_AF1(rx_pin);
+
+    usart1Baud = rate;
+    USART1->BRR = (HAL_RCC_GetPCLK1Freq() + rate/2) / rate;
+    USART1->CR1 |= USART_CR1_TE_Msk | USART_CR1_RE_Msk | USART_CR1_UE_Msk;
+}
+
+/*
+ * Recompute BRR after a clock change
+ */
+void USART1_UpdateBaudRate(void) {
+    if (!(USART1->CR1 & USART_CR1_UE_Msk) || usart1Baud == 0) return; // not set up yet
+
+    USART1->BRR = (HAL_RCC_GetPCLK1Freq() + usart1Baud/2) / usart1Baud;
+}
+
+/*
+ * Send char on the USART1 debug port, blocking for its time on the wire
+ */
+void USART1_SendChar(char c) {
+    if (!(USART1->CR1 & USART_CR1_UE_Msk)) return; // debug port not in use
+
+    SIM_Lock();
+    if (debugOut != NULL) fputc(c, debugOut);
+    simStats.debugBytes++;
+    SIM_Unlock();
+
+    SIM_Delay(SIM_CharTime(usart1Baud));
+}
+
+/*
+ * Send a null-terminated string on the USART1 debug port
+ */
+void USART1_SendStr(char* s) {
+    uint32_t i = 0;
+    while (s[i] != '\0') USART1_SendChar(s[i++]);
+}
+
+/*
+ * The spool dump command once the -d time has come. Until then each poll
+ * takes a character time, so the firmware waiting on the port isn't idle
+ */
+uint8_t USART1_Receive(uint8_t *c) {
+    if (!(USART1->CR1 & USART_CR1_RE_Msk) || simConfig.dumpAt == SIM_NEVER) return 1; // FAILURE
+
+    if (SIM_Now() < simConfig.dumpAt) {
+        SIM_Delay(SIM_CharTime(usart1Baud));
+        return 1; // FAILURE
+    }
+
+    simConfig.dumpAt = SIM_NEVER;
+    *c = SPOOL_DUMP_CMD;
+    return 0;
+}
+
+/*
+ * USART3 and 4 interrupt handler
+ */
+void USART3_4_IRQHandler(void) {
+    if (USART3->ISR & USART_ISR_ORE_Msk) {
+        USART3->ICR = USART_ICR_ORECF_Msk;
+        telemetry.rxOverruns++;
+    }
+
+    USART3_TransmitInterrupt();
+    OPENLOG_USART3ReceivedInterrupt();
+}
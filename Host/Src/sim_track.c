@@ -0,0 +1,360 @@
+/*
+ * File: sim_track.c
+ * Purpose: Checks the track simplifier and the trip distance against a
+ *          recorded track. The reference is the trail of a run of the same
+ *          session built with SIMPLIFY_TOLERANCE_M=0, so it holds every fix the
+ *          firmware sampled. Each reference point is measured in double
+ *          precision against the segment of the simplified trail logged around
+ *          its time, and each leg between them against the WGS84 geodesic.
+ *          The track file is also cut off after every byte written into it and
+ *          checked to still be valid GPX once closed as the firmware would
+ */
+#define _GNU_SOURCE // memmem
+#include "sim.h"
+#include "gpx.h"
+#include "simplify.h"
+#include "trip.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_TRACK_EARTH_M 6371008.8
+#define SIM_TRACK_MAX_POINTS 100000
+
+// WGS84 ellipsoid
+#define SIM_TRACK_WGS84_A 6378137.0
+#define SIM_TRACK_WGS84_F (1 / 298.257223563)
+
+// Most the trip distance may be off the geodesic, as a fraction. The firmware
+// works on the mean sphere, which is up to 0.3% short east to west at 47N
+#define SIM_TRACK_TRIP_BOUND 0.005
+
+// Legs past TRIP_FLAT_SPAN, so the great circle fallback is checked too
+static const double simTrackLongLegs[][4] = {
+    { 47.2852, 8.5652, 48.4, 9.9 },
+    { 47.2852, 8.5652, 40.6413, -73.7781 },
+    { 0.5, 179.5, -0.5, -179.5 },
+    { 69.6, 18.9, 78.2, 15.6 },
+    { -33.9, 18.4, -34.6, 20.1 },
+};
+
+typedef struct {
+    double lat;         // degrees
+    double lon;
+    time_t time;
+} SIM_TRACK_POINT;
+
+/*
+ * Read the <trkpt> records of a GPX file, with its lines ended by line feeds
+ * or, as OpenLog writes them, spaces. Returns the number read, the caller
+ * frees *points
+ */
+static uint32_t SIM_TRACK_Load(char *path, SIM_TRACK_POINT **points) {
+    FILE *f = fopen(path, "rb");
+    *points = NULL;
+    if (f == NULL) return 0;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+    char *file = malloc(size + 1);
+    file[fread(file, 1, size, f)] = '\0';
+    fclose(f);
+
+    SIM_TRACK_POINT *p = malloc(SIM_TRACK_MAX_POINTS * sizeof(SIM_TRACK_POINT));
+    uint32_t n = 0;
+    char *trkpt = file;
+
+    while (n < SIM_TRACK_MAX_POINTS && (trkpt = strstr(trkpt, "<trkpt")) != NULL) {
+        char *time = strstr(trkpt, "<time>");
+        struct tm tm = { 0 };
+        trkpt++;
+        if (time == NULL) break;
+        if (sscanf(trkpt - 1, "<trkpt lat=\"%lf\" lon=\"%lf\"", &p[n].lat, &p[n].lon) != 2) continue;
+        if (sscanf(time, "<time>%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) continue;
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        p[n++].time = timegm(&tm);
+    }
+    free(file);
+
+    *points = p;
+    return n;
+}
+
+/*
+ * Distance in meters from r to the segment a to b
+ */
+static double SIM_TRACK_Distance(SIM_TRACK_POINT *a, SIM_TRACK_POINT *b, SIM_TRACK_POINT *r) {
+    double k = SIM_TRACK_EARTH_M * M_PI / 180;
+    double c = cos(a->lat * M_PI / 180);
+    double bx = (b->lon - a->lon) * c * k, by = (b->lat - a->lat) * k;
+    double rx = (r->lon - a->lon) * c * k, ry = (r->lat - a->lat) * k;
+    double len2 = bx * bx + by * by;
+    double t = len2 > 0 ? (rx * bx + ry * by) / len2 : 0;
+
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    return hypot(rx - t * bx, ry - t * by);
+}
+
+/*
+ * Compare the simplified trail to the reference and report the largest
+ * distance of a reference point from it. Returns 1 if that is over the
+ * simplifier's bound or the trails don't cover the same time, 0 otherwise
+ */
+uint8_t SIM_TRACK_Check(char *reference, char *trail) {
+    SIM_TRACK_POINT *ref, *simp;
+    uint32_t refCount = SIM_TRACK_Load(reference, &ref);
+    uint32_t simpCount = SIM_TRACK_Load(trail, &simp);
+    double bound = SIMPLIFY_TOLERANCE_M + SIMPLIFY_STILL_M;
+    double worst = 0;
+    time_t worstAt = 0;
+    uint32_t outside = 0;
+
+    for (uint32_t i = 0, s = 0; i < refCount; i++) {
+        // the simplified segment logged around this point's time
+        while (s + 1 < simpCount && simp[s + 1].time <= ref[i].time) s++;
+        if (simpCount == 0 || ref[i].time < simp[0].time || ref[i].time > simp[simpCount - 1].time) {
+            outside++;
+            continue;
+        }
+
+        SIM_TRACK_POINT *b = s + 1 < simpCount ? &simp[s + 1] : &simp[s];
+        double d = SIM_TRACK_Distance(&simp[s], b, &ref[i]);
+        if (d > worst) {
+            worst = d;
+            worstAt = ref[i].time;
+        }
+    }
+
+    uint8_t failed = worst > bound || outside != 0 || refCount == 0;
+    printf("track           %u of %u points kept, max error %.2f m at %02u:%02u:%02u (bound %.0f m)%s\n",
+           (unsigned) simpCount, (unsigned) refCount, worst, (unsigned) (worstAt / 3600 % 24),
+           (unsigned) (worstAt / 60 % 60), (unsigned) (worstAt % 60), bound, failed ? " FAILED" : "");
+    if (outside != 0) printf("track           %u reference points outside the simplified trail\n", (unsigned) outside);
+
+    free(ref);
+    free(simp);
+    return failed;
+}
+
+/*
+ * Geodesic distance in meters between two points on the WGS84 ellipsoid, by
+ * Vincenty's inverse method
+ */
+static double SIM_TRACK_Geodesic(double lat1, double lon1, double lat2, double lon2) {
+    double a = SIM_TRACK_WGS84_A, f = SIM_TRACK_WGS84_F, b = a * (1 - f);
+    double L = (lon2 - lon1) * M_PI / 180;
+    double U1 = atan((1 - f) * tan(lat1 * M_PI / 180));
+    double U2 = atan((1 - f) * tan(lat2 * M_PI / 180));
+    double sinU1 = sin(U1), cosU1 = cos(U1), sinU2 = sin(U2), cosU2 = cos(U2);
+    double lambda = L, sinSigma = 0, cosSigma = 1, sigma = 0, cos2Alpha = 1, cos2SigmaM = 0;
+
+    for (int i = 0; i < 200; i++) {
+        double sinLambda = sin(lambda), cosLambda = cos(lambda);
+        sinSigma = hypot(cosU2 * sinLambda, cosU1 * sinU2 - sinU1 * cosU2 * cosLambda);
+        if (sinSigma == 0) return 0;
+        cosSigma = sinU1 * sinU2 + cosU1 * cosU2 * cosLambda;
+        sigma = atan2(sinSigma, cosSigma);
+        double sinAlpha = cosU1 * cosU2 * sinLambda / sinSigma;
+        cos2Alpha = 1 - sinAlpha * sinAlpha;
+        cos2SigmaM = cos2Alpha != 0 ? cosSigma - 2 * sinU1 * sinU2 / cos2Alpha : 0;
+        double C = f / 16 * cos2Alpha * (4 + f * (4 - 3 * cos2Alpha));
+        double previous = lambda;
+        lambda = L + (1 - C) * f * sinAlpha *
+                 (sigma + C * sinSigma * (cos2SigmaM + C * cosSigma * (-1 + 2 * cos2SigmaM * cos2SigmaM)));
+        if (fabs(lambda - previous) < 1e-12) break;
+    }
+
+    double u2 = cos2Alpha * (a * a - b * b) / (b * b);
+    double A = 1 + u2 / 16384 * (4096 + u2 * (-768 + u2 * (320 - 175 * u2)));
+    double B = u2 / 1024 * (256 + u2 * (-128 + u2 * (74 - 47 * u2)));
+    double deltaSigma = B * sinSigma * (cos2SigmaM + B / 4 * (cosSigma * (-1 + 2 * cos2SigmaM * cos2SigmaM) -
+                        B / 6 * cos2SigmaM * (-3 + 4 * sinSigma * sinSigma) * (-3 + 4 * cos2SigmaM * cos2SigmaM)));
+    return b * A * (sigma - deltaSigma);
+}
+
+/*
+ * Trip leg length in meters as the firmware works it out
+ */
+static double SIM_TRACK_Leg(double lat1, double lon1, double lat2, double lon2) {
+    return TRIP_Leg(lround(lat1 * 1e7), lround(lon1 * 1e7), lround(lat2 * 1e7), lround(lon2 * 1e7)) / 100.0;
+}
+
+/*
+ * Compare the trip distance over the reference's moving legs, and over some
+ * long legs, to the geodesic. Returns 1 if any is off by more than
+ * SIM_TRACK_TRIP_BOUND, 0 otherwise
+ */
+uint8_t SIM_TRACK_CheckTrip(char *reference) {
+    SIM_TRACK_POINT *ref;
+    uint32_t refCount = SIM_TRACK_Load(reference, &ref);
+    double geodesic = 0, flat = 0;
+    uint32_t legs = 0;
+
+    // legs the firmware counts as moving, judged by the geodesic speed
+    for (uint32_t i = 1; i < refCount; i++) {
+        double g = SIM_TRACK_Geodesic(ref[i - 1].lat, ref[i - 1].lon, ref[i].lat, ref[i].lon);
+        time_t elapsed = ref[i].time - ref[i - 1].time;
+        if (elapsed <= 0 || g * 100 < TRIP_STILL_CM_S * elapsed) continue;
+
+        geodesic += g;
+        flat += SIM_TRACK_Leg(ref[i - 1].lat, ref[i - 1].lon, ref[i].lat, ref[i].lon);
+        legs++;
+    }
+
+    double error = geodesic > 0 ? fabs(flat - geodesic) / geodesic : 0;
+    uint8_t failed = error > SIM_TRACK_TRIP_BOUND || legs == 0;
+    printf("trip check      %u legs, %.2f m against %.2f m geodesic, error %.3f%%%s\n", (unsigned) legs, flat,
+           geodesic, error * 100, failed ? " FAILED" : "");
+
+    for (uint32_t i = 0; i < sizeof(simTrackLongLegs) / sizeof(simTrackLongLegs[0]); i++) {
+        const double *leg = simTrackLongLegs[i];
+        double g = SIM_TRACK_Geodesic(leg[0], leg[1], leg[2], leg[3]);
+        double d = SIM_TRACK_Leg(leg[0], leg[1], leg[2], leg[3]);
+        uint8_t off = fabs(d - g) / g > SIM_TRACK_TRIP_BOUND;
+        printf("trip check      %.4f,%.4f to %.4f,%.4f: %.0f m against %.0f m geodesic, error %.3f%%%s\n",
+               leg[0], leg[1], leg[2], leg[3], d, g, fabs(d - g) / g * 100, off ? " FAILED" : "");
+        failed |= off;
+    }
+
+    free(ref);
+    return failed;
+}
+
+/*
+ * Whether the line from line to end starts and ends with the given text
+ */
+static uint8_t SIM_TRACK_LineIs(const uint8_t *line, const uint8_t *end, const char *first, const char *last) {
+    uint32_t len = end - line, a = strlen(first), b = strlen(last);
+    return len >= a + b && memcmp(line, first, a) == 0 && memcmp(end - b, last, b) == 0;
+}
+
+/*
+ * End of the line from line on, where GPX_Scan ends it: at the line feed or
+ * the space after its closing >. NULL if it doesn't end before end
+ */
+static const uint8_t *SIM_TRACK_LineEnd(const uint8_t *line, const uint8_t *end) {
+    for (const uint8_t *p = line; p < end; p++) {
+        if (*p == '\n' || (*p == ' ' && p > line && p[-1] == '>')) return p;
+    }
+    return NULL;
+}
+
+/*
+ * Check a track file line by line: the header, then whole track points and
+ * comments, the trailer and nothing but whitespace after it. Returns the
+ * number of track points, -1 if it isn't valid, -2 if it has no header yet
+ */
+static int32_t SIM_TRACK_Valid(const uint8_t *file, uint32_t len) {
+    const uint8_t *end = file + len;
+    const uint8_t *p = memmem(file, len, "<trkseg>", 8);
+    if (p == NULL || p + 8 == end || SIM_TRACK_LineEnd(p + 7, end) != p + 8) return -2;
+    if (len < 5 || memcmp(file, "<?xml", 5) != 0) return -1;
+    p += 9;
+
+    int32_t points = 0;
+    while (p < end) {
+        const uint8_t *nl = SIM_TRACK_LineEnd(p, end);
+        if (nl == NULL) return -1; // cut off before the trailer
+
+        if (SIM_TRACK_LineIs(p, nl, "\t</trkseg></trk>", "") && nl - p == 16) {
+            const uint8_t *last = SIM_TRACK_LineEnd(nl + 1, end);
+            if (last == NULL || last - (nl + 1) != 6 || memcmp(nl + 1, "</gpx>", 6) != 0) return -1;
+            for (p = last + 1; p < end; p++) {
+                if (*p != ' ' && *p != '\n') return -1;
+            }
+            return points;
+        }
+        if (SIM_TRACK_LineIs(p, nl, "\t\t<trkpt lat=\"", "</time></trkpt>")) {
+            points++;
+        }
+        else if (!SIM_TRACK_LineIs(p, nl, "\t<!-- ", " -->") || memmem(p + 6, nl - p - 10, "--", 2) != NULL) {
+            return -1;
+        }
+        p = nl + 1;
+    }
+    return -1;
+}
+
+/*
+ * Cut the track off after every byte written into it, close it the way
+ * BATCH_Recover does at the next boot and check it is valid GPX holding every
+ * whole track point written before the cut. Returns 1 if any cut isn't, 0
+ * otherwise
+ */
+uint8_t SIM_TRACK_CheckCuts(void) {
+    SIM_WRITE *writes;
+    uint32_t count = SIM_OPENLOG_Journal(&writes);
+    uint32_t max = 0, size = 0;
+    uint32_t closed = 0, recovered = 0, empty = 0, invalid = 0, firstInvalid = 0;
+    int32_t points = 0;
+    const char *marker = "</trkpt> ";
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (writes[i].offset + 1 > max) max = writes[i].offset + 1;
+    }
+    uint32_t room = max + sizeof(GPX_TRAILER);
+    uint8_t *file = calloc(room, 1);
+    uint8_t *closing = malloc(room);
+    uint8_t *counted = calloc(room + 1, 1);   // offsets a track point was seen to end at
+
+    for (uint32_t i = 0; i <= count; i++) {
+        if (i > 0) {
+            SIM_WRITE *w = &writes[i - 1];
+            file[w->offset] = w->c;
+            if (w->offset + 1 > size) size = w->offset + 1;
+
+            // whole track points written so far, by where they end, so one
+            // written again over itself after a lost batch counts once
+            uint32_t n = strlen(marker);
+            for (uint32_t at = w->offset + 1; at < w->offset + 1 + n && at <= size; at++) {
+                if (at >= n && !counted[at] && memcmp(&file[at - n], marker, n) == 0) {
+                    counted[at] = 1;
+                    points++;
+                }
+            }
+        }
+
+        // close it over the tail, the trailer and spaces over what's past it
+        uint32_t start = size > GPX_SCAN_TAIL ? size - GPX_SCAN_TAIL : 0;
+        GPX_SCAN scan;
+        GPX_ScanInit(&scan, start);
+        GPX_Scan(&scan, &file[start], size - start);
+
+        memcpy(closing, file, size);
+        uint32_t closedSize = size;
+        if (GPX_ScanClosed(&scan)) {
+            closed++;
+        }
+        else if (scan.end != 0) {
+            uint32_t trailer = strlen(GPX_TRAILER);
+            memcpy(&closing[scan.end], GPX_TRAILER, trailer);
+            if (scan.end + trailer > closedSize) closedSize = scan.end + trailer;
+            for (uint32_t j = scan.end + trailer; j < size; j++) closing[j] = ' ';
+            recovered++;
+        }
+
+        int32_t valid = SIM_TRACK_Valid(closing, closedSize);
+        if (valid == -2 && points == 0 && scan.end == 0) {
+            empty++;
+        }
+        else if (valid != points) {
+            if (invalid++ == 0) firstInvalid = i;
+        }
+    }
+
+    uint8_t failed = invalid != 0 || count == 0;
+    printf("cuts            %u bytes written, %u cuts closed, %u closed at boot, %u before the header, %u invalid%s\n",
+           (unsigned) count, (unsigned) closed, (unsigned) recovered, (unsigned) empty, (unsigned) invalid,
+           failed ? " FAILED" : "");
+    if (invalid != 0) printf("cuts            first invalid after %u bytes\n", (unsigned) firstInvalid);
+
+    free(file);
+    free(closing);
+    free(counted);
+    return failed;
+}
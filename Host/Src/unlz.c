@@ -0,0 +1,151 @@
+/*
+ * File: unlz.c
+ * Purpose: Decoder for the raw log. Writes the NMEA sentences the blocks in
+ *          a raw file hold to standard output. Blocks are found by their
+ *          marker, so one cut off by a power loss or by OpenLog losing a
+ *          batch is skipped. The ones that match against it are too, up to
+ *          the next that starts afresh
+ *
+ *          make host && build/host/unlz raw.lz > raw.nmea
+ */
+#include "lz.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t bits;      // bits left
+    uint32_t at;        // next bit
+} UNLZ_BITS;
+
+/*
+ * Next count bits, most significant first
+ */
+static uint32_t UNLZ_Get(UNLZ_BITS *in, uint32_t count) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; i++, in->at++) {
+        value = (value << 1) | ((in->data[in->at / 8] >> (7 - in->at % 8)) & 1);
+    }
+    in->bits -= count;
+    return value;
+}
+
+// Output so far, matched against by the blocks that follow
+static uint8_t ring[LZ_WINDOW];
+static uint32_t pos;
+static uint32_t start;  // where the last fresh block started
+
+/*
+ * Decode the tokens of a block, packed bytes of them, to out.
+ * Returns the number of bytes written, or -1 if a match reaches back past
+ * the last fresh block
+ */
+static long UNLZ_Block(const uint8_t *tokens, uint32_t packed, FILE *out) {
+    UNLZ_BITS in = { tokens, 8 * packed, 0 };
+    uint32_t from = pos;
+
+    // what is left after the last token is padding, too short for another
+    while (in.bits >= 1 + 8) {
+        if (UNLZ_Get(&in, 1) == LZ_LITERAL) {
+            uint8_t c = UNLZ_Get(&in, 8);
+            ring[pos++ % LZ_WINDOW] = c;
+            fputc(c, out);
+            continue;
+        }
+        if (in.bits < LZ_WINDOW_BITS + LZ_LENGTH_BITS) break;
+
+        uint32_t dist = UNLZ_Get(&in, LZ_WINDOW_BITS) + 1;
+        uint32_t len = UNLZ_Get(&in, LZ_LENGTH_BITS) + LZ_MIN_MATCH;
+        if (dist > pos - start) return -1;
+
+        for (uint32_t i = 0; i < len; i++, pos++) {
+            uint8_t c = ring[(pos - dist) % LZ_WINDOW];
+            ring[pos % LZ_WINDOW] = c;
+            fputc(c, out);
+        }
+    }
+    return pos - from;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s raw.lz > raw.nmea\n", argv[0]);
+        return 2;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+
+    uint8_t *data = malloc(size + 1);
+    uint8_t *block = malloc(size + 1);
+    if (data == NULL || block == NULL || fread(data, 1, size, f) != (size_t) size) {
+        fprintf(stderr, "%s: can't read it\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    uint32_t blocks = 0, skipped = 0;
+    unsigned long decoded = 0;
+    uint8_t first = 1;
+    uint8_t chained = 0;    // the last block decoded, one that follows it may too
+    uint16_t last = 0;
+
+    long i = 0;
+    while (i < size) {
+        if (!(data[i] == LZ_ESC && i + 1 < size && data[i+1] == LZ_MARK)) {
+            i++;
+            continue;
+        }
+
+        // unescape up to the next marker
+        uint32_t len = 0;
+        for (i += 2; i < size && !(data[i] == LZ_ESC && i + 1 < size && data[i+1] == LZ_MARK); i++) {
+            if (data[i] == LZ_ESC && i + 1 < size) block[len++] = data[++i] ^ LZ_ESC_XOR;
+            else block[len++] = data[i];
+        }
+
+        if (len < LZ_HEADER_LEN) {
+            skipped++;
+            continue;
+        }
+        uint16_t seq = block[0] | (block[1] << 8);
+        uint32_t packed = block[2] | (block[3] << 8);
+        uint8_t fresh = (packed & LZ_FRESH) != 0;
+        packed &= ~LZ_FRESH;
+
+        // cut off, older than one already decoded, or following one that
+        // wasn't
+        if (packed > len - LZ_HEADER_LEN || (!first && (int16_t) (seq - last) <= 0)
+            || (!fresh && !(chained && seq == (uint16_t) (last + 1)))) {
+            if (!first && (int16_t) (seq - last) > 0) chained = 0;
+            skipped++;
+            continue;
+        }
+        if (fresh) start = pos;
+
+        long out = UNLZ_Block(&block[LZ_HEADER_LEN], packed, stdout);
+        if (out < 0) {
+            fprintf(stderr, "%s: block %u is corrupt\n", argv[1], (unsigned) seq);
+            skipped++;
+            chained = 0;
+            continue;
+        }
+        decoded += out;
+        blocks++;
+        first = 0;
+        chained = 1;
+        last = seq;
+    }
+
+    fprintf(stderr, "%s: %u blocks, %u skipped, %ld bytes to %lu\n", argv[1], (unsigned) blocks,
+            (unsigned) skipped, size, decoded);
+    free(data);
+    free(block);
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * File: assist.c
+ * Purpose: Receiver hot start assistance. The last valid fix is kept in the
+ *          backup registers, and in flash when recording ends, and the RTC is
+ *          kept in step with the receiver, so
+ *          at the next boot the receiver can be told roughly where and when
+ *          it is instead of searching the whole sky
+ */
+#include "assist.h"
+#include "backup.h"
+#include "demux.h"
+#include "gps.h"
+#include "openlog.h"
+#include "rtc.h"
+#include "store.h"
+#include "telemetry.h"
+#include <string.h>
+
+static uint32_t assistToday;     // packed date offline data is loaded for
+static uint8_t assistPastToday;  // the offline file has moved on to later days
+static DEMUX *assistDemux;       // splits the offline file while it is read
+
+/*
+ * Store value in n bytes at p, little endian as UBX payloads are
+ */
+static void ASSIST_Put(uint8_t *p, uint32_t value, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) p[i] = (value >> (8 * i)) & 0xFF;
+}
+
+/*
+ * Keep a valid fix with a date and time for the next boot, and set the RTC
+ * from it if the RTC isn't trusted or is more than a second out
+ */
+void ASSIST_Remember(FIX *fix) {
+    uint32_t want = FIX_HAS_POS | FIX_HAS_TIME | FIX_HAS_DATE;
+    if (fix->status != FIX_VALID || (fix->flags & want) != want) return;
+
+    int32_t alt = (fix->flags & FIX_HAS_ALT) ? fix->alt / 1000 : 0;
+    if (alt > INT16_MAX) alt = INT16_MAX;
+    if (alt < INT16_MIN) alt = INT16_MIN;
+    uint32_t acc = (fix->flags & FIX_HAS_HDOP) ? (uint32_t) fix->hdop * ASSIST_UERE_M / 100 : ASSIST_UERE_M * 20;
+    if (acc > UINT16_MAX) acc = UINT16_MAX;
+
+    BACKUP_Write(BACKUP_FIX_LAT, fix->lat);
+    BACKUP_Write(BACKUP_FIX_LON, fix->lon);
+    BACKUP_Write(BACKUP_FIX_ALT_ACC, ((uint32_t) (uint16_t) alt << 16) | acc);
+    BACKUP_Write(BACKUP_FIX_TIME, fix->datetime);
+
+    uint32_t now;
+    if (RTC_Get(&now)) {
+        RTC_Set(fix->datetime);
+        return;
+    }
+    uint32_t rtc = RTC_Seconds(now), gps = RTC_Seconds(fix->datetime);
+    if (rtc > gps + 1 || gps > rtc + 1) RTC_Set(fix->datetime);
+}
+
+/*
+ * Copy the fix in the backup registers to the store, which keeps it without
+ * VBAT. Only writes flash for values that changed
+ */
+void ASSIST_Save(void) {
+    if (BACKUP_Read(BACKUP_FIX_TIME) == 0) return;
+
+    for (uint8_t i = 0; i <= BACKUP_FIX_TIME - BACKUP_FIX_LAT; i++) {
+        STORE_Set(STORE_FIX_LAT + i, BACKUP_Read(BACKUP_FIX_LAT + i));
+    }
+}
+
+/*
+ * Send the RTC time and the last fix to the receiver as MGA-INI-TIME_UTC and
+ * MGA-INI-POS_LLH. The time goes only if the RTC kept running, its accuracy
+ * is how far the LSI can have drifted since the RTC was last checked against
+ * a fix. A fix from flash comes with an RTC that lost power, so it goes
+ * without the time. Returns the ASSIST_SENT_x bits for what was sent
+ */
+uint8_t ASSIST_HotStart(void) {
+    uint8_t payload[ASSIST_INI_TIME_UTC_LEN];
+    uint8_t frame[ASSIST_INI_TIME_UTC_LEN + UBX_FRAME_OVERHEAD];
+    uint32_t fixTime = BACKUP_Read(BACKUP_FIX_TIME);
+    uint8_t sent = 0;
+    uint32_t now;
+
+    // the backup registers were lost with power, use the fix saved in flash
+    if (fixTime == 0 && !STORE_Get(STORE_FIX_TIME, &fixTime)) {
+        for (uint8_t i = 0; i <= BACKUP_FIX_TIME - BACKUP_FIX_LAT; i++) {
+            uint32_t value = 0;
+            STORE_Get(STORE_FIX_LAT + i, &value);
+            BACKUP_Write(BACKUP_FIX_LAT + i, value);
+        }
+    }
+    if (fixTime == 0) return 0; // nothing to go on
+
+    if (!RTC_Get(&now) && RTC_Seconds(now) >= RTC_Seconds(fixTime)) {
+        uint32_t tAcc = 2 + (RTC_Seconds(now) - RTC_Seconds(fixTime)) / RTC_DRIFT_DIV;
+
+        memset(payload, 0, ASSIST_INI_TIME_UTC_LEN);
+        payload[0] = UBX_MGA_INI_TIME_UTC;
+        payload[3] = (uint8_t) -128; // leap seconds unknown
+        ASSIST_Put(&payload[4], 2000 + FIX_YEAR(now), 2);
+        payload[6] = FIX_MONTH(now);
+        payload[7] = FIX_DAY(now);
+        payload[8] = FIX_HOUR(now);
+        payload[9] = FIX_MINUTE(now);
+        payload[10] = FIX_SECOND(now);
+        ASSIST_Put(&payload[16], tAcc > UINT16_MAX ? UINT16_MAX : tAcc, 2);
+
+        uint32_t len = UBX_Frame(frame, UBX_CLASS_MGA, UBX_ID_MGA_INI, payload, ASSIST_INI_TIME_UTC_LEN);
+        if (GPS_WriteBytes(frame, len) == 0) sent |= ASSIST_SENT_TIME;
+    }
+
+    uint32_t altAcc = BACKUP_Read(BACKUP_FIX_ALT_ACC);
+    int32_t alt = (int16_t) (altAcc >> 16);
+    uint32_t acc = (altAcc & 0xFFFF) + ASSIST_TRAVEL_M;
+
+    memset(payload, 0, ASSIST_INI_POS_LLH_LEN);
+    payload[0] = UBX_MGA_INI_POS_LLH;
+    ASSIST_Put(&payload[4], BACKUP_Read(BACKUP_FIX_LAT), 4);
+    ASSIST_Put(&payload[8], BACKUP_Read(BACKUP_FIX_LON), 4);
+    ASSIST_Put(&payload[12], (uint32_t) (alt * 100), 4);
+    ASSIST_Put(&payload[16], acc * 100, 4);
+
+    uint32_t len = UBX_Frame(frame, UBX_CLASS_MGA, UBX_ID_MGA_INI, payload, ASSIST_INI_POS_LLH_LEN);
+    if (GPS_WriteBytes(frame, len) == 0) sent |= ASSIST_SENT_POS;
+
+    telemetry.assistSent = sent;
+    return sent;
+}
+
+/*
+ * Forward the MGA-ANO frames for today to the receiver. The file is in date
+ * order, so a later day means there is nothing more to find
+ */
+static void ASSIST_HandleUBX(uint8_t *frame, uint32_t len) {
+    if (len != UBX_MGA_ANO_LEN || frame[2] != UBX_CLASS_MGA || frame[3] != UBX_ID_MGA_ANO) return;
+
+    uint8_t *date = &frame[UBX_MGA_ANO_DATE];
+    uint32_t day = FIX_PACK_DATE(date[0], date[1], date[2]);
+    if (day > assistToday) assistPastToday = 1;
+    if (day != assistToday) return;
+
+    if (GPS_WriteBytes(frame, len) == 0) telemetry.assistAno++;
+}
+
+/*
+ * Demultiplex the next bytes of the offline file. Stops the read once the
+ * file is past today
+ */
+static uint8_t ASSIST_ReadOffline(uint8_t *data, uint32_t len) {
+    DEMUX_Feed(assistDemux, data, len);
+    return assistPastToday;
+}
+
+/*
+ * Load today's AssistNow Offline data from file name on the SD card into the
+ * receiver, after ASSIST_HotStart so the receiver has the time to use it.
+ * Needs the RTC to know what today is. Returns the number of frames sent
+ */
+uint32_t ASSIST_LoadOffline(char *name) {
+    // only needed at boot, so on the stack
+    DEMUX demux = { .handlers = { [UBX] = ASSIST_HandleUBX } };
+    uint32_t now;
+
+    if (RTC_Get(&now)) return 0;
+    assistToday = now & FIX_DATE_MASK;
+    assistPastToday = 0;
+
+    assistDemux = &demux;
+    OPENLOG_ReadAll(name, ASSIST_READ_CHUNK, ASSIST_ReadOffline);
+    assistDemux = NULL;
+
+    return telemetry.assistAno;
+}
@@ -0,0 +1,41 @@
+/*
+ * File: assist.h
+ * Purpose: Declares the receiver hot start assistance: the last valid fix and
+ *          the RTC time are sent as UBX-MGA-INI at boot, and AssistNow Offline
+ *          orbits for the day are loaded from the SD card if there are any
+ */
+#ifndef __ASSIST_H
+#define __ASSIST_H
+
+#include "utilities.h"
+#include "fix.h"
+#include "ubx.h"
+
+// AssistNow Offline data as downloaded from u-blox, in the SD card's root
+#define ASSIST_OFFLINE_FILE "mgaoffln.ubx"
+
+// How far the logger may have been carried while it was off, added to the
+// accuracy of the last fix
+#define ASSIST_TRAVEL_M 10000
+
+// Receiver position error per unit of HDOP
+#define ASSIST_UERE_M 5
+
+// The offline file holds nothing but MGA-ANO frames, so it is read in chunks
+// of whole frames
+#define ASSIST_READ_CHUNK (24 * UBX_MGA_ANO_LEN)
+
+// What ASSIST_HotStart sent, see telemetry
+#define ASSIST_SENT_POS  0x01
+#define ASSIST_SENT_TIME 0x02
+
+// UBX-MGA-INI payloads
+#define ASSIST_INI_POS_LLH_LEN  20
+#define ASSIST_INI_TIME_UTC_LEN 24
+
+void ASSIST_Remember(FIX *fix);
+void ASSIST_Save(void);
+uint8_t ASSIST_HotStart(void);
+uint32_t ASSIST_LoadOffline(char *name);
+
+#endif /* __ASSIST_H */
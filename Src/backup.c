@@ -0,0 +1,30 @@
+/*
+ * File: backup.c
+ * Purpose: Access to the RTC backup registers. They sit in the backup domain,
+ *          which the RTC clock doesn't need to be running for
+ */
+#include "backup.h"
+
+/*
+ * Enable the PWR clock and lift the backup domain write protection
+ */
+void BACKUP_Setup(void) {
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR |= PWR_CR_DBP;
+}
+
+/*
+ * Value of backup register reg, 0 to RTC_BKP_NUMBER-1
+ */
+uint32_t BACKUP_Read(uint8_t reg) {
+    if (reg >= RTC_BKP_NUMBER) return 0;
+    return (&RTC->BKP0R)[reg];
+}
+
+/*
+ * Set backup register reg, 0 to RTC_BKP_NUMBER-1
+ */
+void BACKUP_Write(uint8_t reg, uint32_t value) {
+    if (reg >= RTC_BKP_NUMBER) return;
+    (&RTC->BKP0R)[reg] = value;
+}
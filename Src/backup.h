@@ -0,0 +1,22 @@
+/*
+ * File: backup.h
+ * Purpose: Declares access to the RTC backup registers, 20 bytes that survive
+ *          resets, standby and, with a battery on VBAT, loss of main power
+ */
+#ifndef __BACKUP_H
+#define __BACKUP_H
+
+#include "utilities.h"
+
+// What each register holds
+#define BACKUP_GPS_CFG_HASH 0   // hash of the configuration saved to the receiver's BBR, 0 if none
+#define BACKUP_FIX_LAT      1   // last valid fix, in the units of FIX
+#define BACKUP_FIX_LON      2
+#define BACKUP_FIX_ALT_ACC  3   // altitude in m in the high half, horizontal accuracy in m in the low half
+#define BACKUP_FIX_TIME     4   // packed date and time of the fix, 0 if none
+
+void BACKUP_Setup(void);
+uint32_t BACKUP_Read(uint8_t reg);
+void BACKUP_Write(uint8_t reg, uint32_t value);
+
+#endif /* __BACKUP_H */
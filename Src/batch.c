@@ -0,0 +1,466 @@
+/*
+ * File: batch.c
+ * Purpose: RAM batching of the track. USART3 holds the records back in its
+ *          transmit queue and BATCH_Flush releases them, so OpenLog gets a
+ *          few bursts instead of a write per fix and the main loop never waits
+ *          for one. Each batch is written over the trailer the last one ended
+ *          with and ends with the trailer again, so the file is valid GPX
+ *          after every batch. The PVD interrupt, which preempts everything but
+ *          the USART3 and TIM2 interrupts, sends what the main loop last
+ *          committed of the batch, closes the track after it and waits for it
+ *          to leave before the supply collapses. It never queues anything
+ *          itself, and if the supply comes back the batch goes again like a
+ *          lost one. A batch never holds more than can be sent in
+ *          BATCH_HOLDUP_US. A track cut off anyway is closed at the
+ *          next boot by BATCH_Recover from the tail of the file. Each batch
+ *          asks for the size of the file after it, and one OpenLog doesn't
+ *          answer for is written again from the last it did, so the spool
+ *          knows which of its records are safely on the card. The raw log's
+ *          block goes out with a batch, appended after the track
+ */
+#include "batch.h"
+#include "gpx.h"
+#include "openlog.h"
+#include "rawlog.h"
+#include "telemetry.h"
+#include <string.h>
+
+static char batchFile[MAX_FILE_NAME_LENGTH+1]; // empty while no track is open
+static char batchHeader[BATCH_HEADER_LEN]; // goes first in a batch that starts the file
+static uint32_t batchOffset;            // where the next record goes in the file
+static uint32_t batchRecords;           // records held back
+static volatile uint8_t batchHeld;      // a batch is being held back or begun
+static uint32_t batchStart;             // HAL_GetTick of the first one
+static uint32_t batchLimit;             // most bytes a batch may hold
+static uint32_t batchReserve;           // of those, taken by the commands and trailer around the records
+
+// What the PVD interrupt sends of a held batch, see BATCH_Commit
+static volatile uint32_t batchCommitted;    // usart3Tx.head after the last whole step
+static volatile uint8_t batchCommittedOpen; // the track is to be closed after it
+static volatile uint32_t batchCommittedEnd; // batchOffset then
+static volatile uint32_t batchCommittedHigh;// and batchHigh
+static volatile uint32_t batchCommittedTag; // and batchTag
+static volatile uint8_t batchBrownOut;      // the PVD interrupt sent it, nothing goes until BATCH_Poll
+static volatile uint32_t batchBrownOutEnd;  // how far into the file it may have written
+
+// Batches OpenLog hasn't confirmed yet, oldest first
+static BATCH_SENT batchSent[BATCH_IN_FLIGHT];
+static uint32_t batchSentCount;
+static uint32_t batchAcked;             // end of the records of the last one it did
+static uint32_t batchHigh;              // furthest into the file anything was written
+static uint32_t batchTag;               // BATCH_Tag of the batch being filled
+static uint32_t batchAckedTag;          // and of the last one confirmed
+static uint8_t batchNewAck;             // for BATCH_Acked
+static uint8_t batchLost;               // for BATCH_Lost
+static uint32_t batchLostTag;           // and the tag of the last record kept
+static uint8_t batchResync;             // OpenLog may not be at its prompt
+static uint8_t batchHeldResync;         // the held batch starts by getting it back there
+static uint32_t batchRetryAt;           // HAL_GetTick a lost batch may be sent again from
+static uint32_t batchBackoff;           // and how long the next loss in a row waits
+
+// Tail of the track being closed by BATCH_Recover
+static GPX_SCAN batchScan;
+static uint32_t batchScanSize;
+
+/*
+ * Size batches for OpenLog's baud rate and arm the PVD
+ */
+void BATCH_Setup(uint32_t baud) {
+    batchFile[0] = '\0';
+    batchHeld = 0;
+    batchBrownOut = 0;
+    batchBrownOutEnd = 0;
+    batchCommitted = usart3Tx.head;
+    batchCommittedOpen = 0;
+
+    // what can be sent in the hold-up time and fits in the queue
+    batchLimit = baud / 10 * (BATCH_HOLDUP_US / 1000) / 1000;
+    if (batchLimit > USART3_TX_BUF_SIZE - 1) batchLimit = USART3_TX_BUF_SIZE - 1;
+
+    // the PVD output reaches the NVIC through EXTI line 16, rising as VDD falls
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR = (PWR->CR & ~PWR_CR_PLS) | BATCH_PVD_LEVEL | PWR_CR_PVDE;
+    EXTI->RTSR |= EXTI_RTSR_TR16;
+    EXTI->IMR |= EXTI_IMR_MR16;
+
+    // below USART3 so its interrupt keeps draining the queue during a flush
+    NVIC_EnableIRQ(PVD_VDDIO2_IRQn);
+    NVIC_SetPriority(PVD_VDDIO2_IRQn, 1);
+}
+
+/*
+ * Write batches into track name from offset on, over a file size bytes long
+ */
+static void BATCH_Track(char *name, uint32_t offset, uint32_t size) {
+    strncpy(batchFile, name, MAX_FILE_NAME_LENGTH);
+    batchFile[MAX_FILE_NAME_LENGTH] = '\0';
+    batchOffset = offset;
+    batchRecords = 0;
+    batchHeld = 0;
+
+    batchSentCount = 0;
+    batchAcked = offset;
+    batchHigh = size;
+    batchTag = 0;
+    batchAckedTag = 0;
+    batchNewAck = 0;
+    batchLost = 0;
+    batchBackoff = 0;
+
+    // ctrl-Z and "write <name> <offset>\r" at the front, the trailer, the
+    // empty line and "size <name>\r" at the end
+    batchReserve = 3 + strlen("write  4294967295\r") + strlen(GPX_TRAILER) + 2 + strlen("size \r")
+                 + 2 * strlen(batchFile);
+}
+
+/*
+ * Snapshot for the PVD interrupt of the batch as it is queued now, so it sends
+ * that much and closes the track after it if open is set. Only where the
+ * queue holds whole commands and records
+ */
+static void BATCH_Commit(uint8_t open) {
+    __disable_irq(); // the PVD interrupt takes all of it or none
+    if (!batchBrownOut) {
+        batchCommitted = usart3Tx.head;
+        batchCommittedOpen = open;
+        batchCommittedEnd = batchOffset;
+        batchCommittedHigh = batchHigh;
+        batchCommittedTag = batchTag;
+    }
+    __enable_irq();
+}
+
+/*
+ * Start holding a batch back: the write command, after getting OpenLog back
+ * to its prompt if it may not be there, and the header if the batch starts
+ * the file
+ */
+static void BATCH_Begin(void) {
+    BATCH_Commit(0); // what was queued before it goes as it is
+    batchHeld = 1;
+    USART3_Hold();
+    if (batchResync) OPENLOG_Resync();
+    batchHeldResync = batchResync;
+    batchResync = 0;
+
+    OPENLOG_WriteFile(batchFile, batchOffset);
+    if (batchOffset == 0) {
+        OPENLOG_WriteStr(batchHeader);
+        batchOffset += strlen(batchHeader);
+    }
+    batchStart = HAL_GetTick();
+    BATCH_Commit(1);
+}
+
+/*
+ * Start a new track file for the batches to be written into, valid and empty
+ * to begin with. header is kept to write it again if OpenLog loses it
+ */
+void BATCH_Open(char *name, char *header) {
+    BATCH_Track(name, 0, 0);
+    strncpy(batchHeader, header, BATCH_HEADER_LEN - 1);
+    batchHeader[BATCH_HEADER_LEN - 1] = '\0';
+
+    // written over from the start, so it has to exist
+    OPENLOG_NewFile(batchFile);
+
+    BATCH_Begin();
+    BATCH_Flush();
+}
+
+/*
+ * The batch up to batchOffset was sent, it waits for OpenLog to confirm it
+ */
+static void BATCH_Sent(void) {
+    // with too many waiting, the newest stands for this one too
+    BATCH_SENT *sent = &batchSent[batchSentCount < BATCH_IN_FLIGHT ? batchSentCount++ : BATCH_IN_FLIGHT - 1];
+    sent->end = batchOffset;
+    sent->tag = batchTag;
+    sent->sent = HAL_GetTick();
+}
+
+/*
+ * Close the track again and start writing the records held back so far,
+ * asking for the file's size after them
+ */
+void BATCH_Flush(void) {
+    if (!batchHeld) return;
+
+    OPENLOG_WriteStr(GPX_TRAILER);
+
+    // spaces over what a write that was lost and sent again left past the
+    // trailer, as far as the queue has room for now
+    uint32_t end = batchOffset + strlen(GPX_TRAILER);
+    for (; end < batchHigh && RINGBUF_Free(&usart3Tx) > batchReserve; end++) USART3_SendChar(' ');
+    if (end > batchHigh) batchHigh = end;
+
+    OPENLOG_EndWrite(); // the next write starts over the trailer
+
+    // the raw log in what the batch may still take, leaving the size command
+    uint32_t used = RINGBUF_Count(&usart3Tx) + strlen("size \r") + strlen(batchFile);
+    if (RAWLOG_ENABLED && used < batchLimit) RAWLOG_Write(batchLimit - used);
+    OPENLOG_AskSize(batchFile);
+
+    BATCH_Sent();
+    batchRecords = 0;
+    batchHeld = 0; // whole, the PVD interrupt may send all of it
+
+    USART3_Release();
+    telemetry.batchWrites++;
+}
+
+/*
+ * Add a record to the batch, writing the batch first if it is full or would
+ * grow past the limit with the raw log's block
+ */
+void BATCH_Add(char *record) {
+    uint32_t len = strlen(record);
+    uint32_t raw = RAWLOG_ENABLED ? RAWLOG_Pending() : 0;
+
+    if (batchRecords >= BATCH_MAX_RECORDS || RINGBUF_Count(&usart3Tx) + len + raw + batchReserve > batchLimit) BATCH_Flush();
+
+    if (!batchHeld) BATCH_Begin();
+    OPENLOG_WriteStr(record);
+    batchOffset += len;
+    batchRecords++;
+    BATCH_Commit(1);
+}
+
+/*
+ * Whether a record of len bytes can go into the batch without waiting: a
+ * track is open, OpenLog isn't being given time after a lost batch, and the
+ * queue has room
+ */
+uint8_t BATCH_Room(uint32_t len) {
+    if (batchFile[0] == '\0' || batchSentCount >= BATCH_IN_FLIGHT) return 0;
+    if (!batchHeld && (int32_t) (HAL_GetTick() - batchRetryAt) < 0) return 0;
+
+    uint32_t header = batchOffset == 0 ? strlen(batchHeader) : 0;
+    return RINGBUF_Free(&usart3Tx) > len + header + batchReserve;
+}
+
+/*
+ * Give the batch being filled tag, which BATCH_Acked hands back once OpenLog
+ * has confirmed it. Tags only go up. Right after the record it is for was
+ * added, the PVD interrupt may send that far
+ */
+void BATCH_Tag(uint32_t tag) {
+    batchTag = tag;
+    if (batchHeld) BATCH_Commit(1);
+}
+
+/*
+ * Tag of the newest batch OpenLog confirmed in tag.
+ * Returns 1 if one was confirmed since the last call, 0 otherwise
+ */
+uint8_t BATCH_Acked(uint32_t *tag) {
+    if (!batchNewAck) return 0;
+
+    batchNewAck = 0;
+    *tag = batchAckedTag;
+    return 1;
+}
+
+/*
+ * Whether records were lost since the last call, with the tag of the last one
+ * kept in tag. Everything after it has to be added again
+ */
+uint8_t BATCH_Lost(uint32_t *tag) {
+    uint8_t lost = batchLost;
+    batchLost = 0;
+    *tag = batchLostTag;
+    return lost;
+}
+
+/*
+ * Everything after offset in the file goes again, the spool adds what it
+ * tagged after tag back after BATCH_Lost
+ */
+static void BATCH_Lose(uint32_t offset, uint32_t tag) {
+    batchOffset = offset;
+    batchTag = tag;
+    batchLost = 1;
+    batchLostTag = tag;
+    if (RAWLOG_ENABLED) RAWLOG_Rewind();
+}
+
+/*
+ * OpenLog didn't confirm a batch in time, or came up again and may have lost
+ * some. The batches go again from the end of the last one it did, once it
+ * has been given time, starting with ctrl-Z in case it is logging
+ */
+static void BATCH_Rewind(void) {
+    // a held batch that gets OpenLog back to its prompt first goes after
+    // whatever it lost, and nothing else is, if none were waiting
+    uint8_t safe = batchHeld && batchHeldResync && batchSentCount == 0;
+    BATCH_Flush(); // anything held was to go after what was lost
+    if (safe) return;
+
+    batchResync = 1;
+    if (batchSentCount != 0) {
+        batchSentCount = 0;
+        BATCH_Lose(batchAcked, batchAckedTag);
+
+        batchRetryAt = HAL_GetTick() + batchBackoff;
+        batchBackoff = batchBackoff == 0 ? BATCH_RETRY_MS : 2 * batchBackoff;
+        if (batchBackoff > BATCH_RETRY_MAX_MS) batchBackoff = BATCH_RETRY_MAX_MS;
+        telemetry.batchResends++;
+    }
+}
+
+/*
+ * The supply came back after the PVD interrupt sent the batch. What the main
+ * loop queued after the snapshot is dropped and goes again, what was sent of
+ * the batch waits for OpenLog to confirm it like a batch of its own
+ */
+static void BATCH_Resume(void) {
+    __disable_irq(); // another PVD interrupt sends nothing of the old queue
+    USART3_Discard();
+    batchBrownOut = 0;
+    __enable_irq();
+
+    // batches the main loop released into the stopped queue never went
+    while (batchSentCount != 0 && batchSent[batchSentCount - 1].end > batchCommittedEnd) batchSentCount--;
+
+    batchHeld = 0;
+    batchRecords = 0;
+    if (batchBrownOutEnd > batchHigh) batchHigh = batchBrownOutEnd;
+    BATCH_Lose(batchCommittedEnd, batchCommittedTag);
+
+    // the sizes asked before are not coming after a command that may have
+    // been cut off
+    OPENLOG_Resync();
+    if (batchBrownOutEnd != 0) BATCH_Sent();
+    if (batchSentCount != 0) OPENLOG_AskSize(batchFile);
+    batchBrownOutEnd = 0;
+    telemetry.batchResends++;
+}
+
+/*
+ * Take in the sizes OpenLog answered, every batch that ends within one is
+ * confirmed. Then write the batch once it is full or its oldest record has
+ * waited BATCH_MAX_AGE_MS, or one for the raw log's block once that is
+ * RAWLOG_FLUSH_AT full
+ */
+void BATCH_Poll(void) {
+    uint32_t size;
+
+    if (batchBrownOut) BATCH_Resume();
+
+    if (OPENLOG_SizeReply(&size)) {
+        while (batchSentCount != 0 && size >= batchSent[0].end + strlen(GPX_TRAILER)) {
+            batchAcked = batchSent[0].end;
+            batchAckedTag = batchSent[0].tag;
+            batchNewAck = 1;
+            batchBackoff = 0;
+            memmove(&batchSent[0], &batchSent[1], --batchSentCount * sizeof(BATCH_SENT));
+        }
+    }
+
+    uint8_t late = batchSentCount != 0 && HAL_GetTick() - batchSent[0].sent >= BATCH_ACK_MS;
+    if (OPENLOG_Rebooted() || late) BATCH_Rewind();
+
+    if (batchHeld && (batchRecords >= BATCH_MAX_RECORDS || HAL_GetTick() - batchStart >= BATCH_MAX_AGE_MS)) {
+        BATCH_Flush();
+    }
+    else if (RAWLOG_ENABLED && RAWLOG_Pending() >= RAWLOG_FLUSH_AT && BATCH_Room(0)) {
+        if (!batchHeld) BATCH_Begin();
+        BATCH_Flush();
+    }
+}
+
+/*
+ * Write out the batch, or just the trailer if there is none, and wait up to
+ * BATCH_ACK_MS for OpenLog to confirm everything
+ */
+void BATCH_Close(void) {
+    if (batchFile[0] == '\0') return;
+
+    if (!batchHeld) BATCH_Begin();
+    BATCH_Flush();
+
+    uint32_t start = HAL_GetTick();
+    while (batchSentCount != 0 && HAL_GetTick() - start < BATCH_ACK_MS) {
+        BATCH_Poll();
+        if (batchSentCount != 0) __WFI(); // until OpenLog answers or SysTick
+    }
+}
+
+/*
+ * Follow the tail of the track, up to the size OpenLog gave
+ */
+static uint8_t BATCH_Scan(uint8_t *data, uint32_t len) {
+    uint32_t left = batchScanSize - batchScan.offset;
+    GPX_Scan(&batchScan, data, len < left ? len : left);
+    return 0;
+}
+
+/*
+ * Take up a track the power failed in the middle of a batch of, or one that
+ * may not have everything the spool had for it yet if more is set, so the
+ * batches go on after its last whole record. Only the last GPX_SCAN_TAIL
+ * bytes are read. BATCH_Close closes it again, spaces over what is left of a
+ * cut off record. Returns 1 if it was taken up, 0 otherwise
+ */
+uint8_t BATCH_Recover(char *name, uint8_t more) {
+    int32_t size = OPENLOG_FileSize(name);
+    if (size <= 0) return 0; // no track
+
+    batchScanSize = size;
+    uint32_t start = batchScanSize > GPX_SCAN_TAIL ? batchScanSize - GPX_SCAN_TAIL : 0;
+    GPX_ScanInit(&batchScan, start);
+    OPENLOG_ReadFrom(name, start, GPX_SCAN_TAIL, BATCH_Scan);
+
+    // read short, or no whole record to go on after
+    if (batchScan.offset != batchScanSize || batchScan.end == 0) return 0;
+
+    uint8_t closed = GPX_ScanClosed(&batchScan);
+    if (closed && !more) return 0;
+    if (!closed) telemetry.gpxRecovered++;
+
+    BATCH_Track(name, batchScan.end, batchScanSize);
+    batchHeader[0] = '\0';
+    return 1;
+}
+
+/*
+ * PVD interrupt handler: the supply has dropped below the threshold. Send
+ * what the main loop committed of the batch and close the track after it,
+ * straight out of USART3, the main loop may be in the middle of queueing
+ * more. Without a batch everything queued is whole and goes as it is.
+ * Returns once USART3 has sent the last of it
+ */
+void PVD_VDDIO2_IRQHandler(void) {
+    if (!(EXTI->PR & EXTI_PR_PR16)) return;
+    EXTI->PR = EXTI_PR_PR16; // write 1 to clear, only this line
+
+    if (!(PWR->CSR & PWR_CSR_PVDO)) return; // back above it
+
+    telemetry.brownOuts++;
+    if (!batchHeld) {
+        USART3_Release();
+        USART3_Flush();
+        return;
+    }
+
+    batchBrownOut = 1;
+    uint32_t sent = USART3_SendUpTo(batchCommitted);
+    if (batchCommittedOpen) {
+        // unless a burst under way took part of a record along, which leaves
+        // the track to be closed at the next boot
+        int32_t past = usart3Tx.tail - batchCommitted;
+        uint32_t end = batchCommittedEnd + (past > 0 ? past : 0);
+        if (past <= 0) {
+            OPENLOG_WriteStrNow(GPX_TRAILER);
+
+            // spaces over what a longer write left, in what the hold-up time has left
+            for (end += strlen(GPX_TRAILER); end < batchCommittedHigh && sent < batchLimit; end++, sent++) {
+                USART3_SendNow(' ');
+            }
+        }
+        OPENLOG_EndWriteNow();
+        batchBrownOutEnd = end;
+        batchCommittedOpen = 0; // once is enough
+    }
+    USART3_Flush();
+}
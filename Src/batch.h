@@ -0,0 +1,62 @@
+/*
+ * File: batch.h
+ * Purpose: Declares the batching layer between the track and OpenLog. Records
+ *          collect in the USART3 transmit queue and go out in one burst once
+ *          there are enough of them or the oldest has waited long enough. The
+ *          PVD interrupt sends what the main loop committed of the batch and
+ *          closes the track when the supply starts to fail. Every batch
+ *          leaves the track closed, and one cut off anyway is closed at the
+ *          next boot. OpenLog confirms each batch with the size of the file,
+ *          and tags put on the batches tell the spool which of its records
+ *          that covers
+ */
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include "utilities.h"
+
+// A batch is written once it holds this many records, or its oldest record
+// is this old, whichever comes first
+#define BATCH_MAX_RECORDS 8
+#define BATCH_MAX_AGE_MS  30000
+
+// Time the supply holds up after the PVD trips, from the board's bulk
+// capacitance. A batch is kept small enough to be written out in it
+#define BATCH_HOLDUP_US 1000000
+
+// PVD threshold, level 7 is the highest, about 2.9 V
+#define BATCH_PVD_LEVEL PWR_CR_PLS_LEV7
+
+// Batches that may wait for OpenLog to confirm them. One written with that
+// many waiting is confirmed along with the newest
+#define BATCH_IN_FLIGHT 4
+
+// A batch OpenLog hasn't confirmed this long after it was released is lost.
+// The next goes out after BATCH_RETRY_MS, twice as long after each loss in a
+// row up to BATCH_RETRY_MAX_MS
+#define BATCH_ACK_MS       5000
+#define BATCH_RETRY_MS     1000
+#define BATCH_RETRY_MAX_MS 60000
+
+// Longest track header kept to write again
+#define BATCH_HEADER_LEN 192
+
+typedef struct {
+    uint32_t end;       // offset after its records
+    uint32_t tag;       // see BATCH_Tag
+    uint32_t sent;      // HAL_GetTick when it was released
+} BATCH_SENT;
+
+void BATCH_Setup(uint32_t baud);
+void BATCH_Open(char *name, char *header);
+void BATCH_Add(char *record);
+uint8_t BATCH_Room(uint32_t len);
+void BATCH_Tag(uint32_t tag);
+uint8_t BATCH_Acked(uint32_t *tag);
+uint8_t BATCH_Lost(uint32_t *tag);
+void BATCH_Poll(void);
+void BATCH_Flush(void);
+void BATCH_Close(void);
+uint8_t BATCH_Recover(char *name, uint8_t more);
+
+#endif /* __BATCH_H */
@@ -0,0 +1,148 @@
+/*
+ * File: clock.c
+ * Purpose: Defines the selectable system clock profiles and keeps the I2C1,
+ *          SPI2 and USART3 timing in step with the live clock
+ */
+#include "clock.h"
+#include "main.h"
+#include "timebase.h"
+
+static CLOCK_PROFILE currentProfile;
+static uint8_t profileSet = 0;
+
+/*
+ * Run SYSCLK from the 8 MHz HSI. This is always safe to switch to, so it is
+ * used as the stepping stone before the PLL or HSI48 are reconfigured
+ */
+static void CLOCK_SelectHSI(void) {
+    RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+    RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+
+    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
+    RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+    RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK) {
+        Error_Handler();
+    }
+
+    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+                                |RCC_CLOCKTYPE_PCLK1;
+    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+    RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+    RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
+
+    // HAL lowers the wait states after the switch when going down in frequency
+    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK) {
+        Error_Handler();
+    }
+}
+
+/*
+ * Turn off the 48 MHz sources once nothing runs from them
+ */
+static void CLOCK_StopFastOscillators(void) {
+    RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+
+    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI48;
+    RCC_OscInitStruct.HSI48State = RCC_HSI48_OFF;
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_OFF;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK) {
+        Error_Handler();
+    }
+}
+
+/*
+ * Run SYSCLK at 48 MHz from either HSI48 or the PLL. The HSI is left running
+ * because it still clocks I2C1
+ */
+static void CLOCK_Select48MHz(CLOCK_PROFILE profile) {
+    RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+    RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+
+    if (profile == CLOCK_HSI48_48MHZ) {
+        RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI48;
+        RCC_OscInitStruct.HSI48State = RCC_HSI48_ON;
+        RCC_OscInitStruct.PLL.PLLState = RCC_PLL_OFF;
+        RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI48;
+    }
+    else { // 8 MHz HSI / 1 * 6
+        RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI|RCC_OSCILLATORTYPE_HSI48;
+        RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+        RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
+        RCC_OscInitStruct.HSI48State = RCC_HSI48_OFF;
+        RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+        RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+        RCC_OscInitStruct.PLL.PREDIV = RCC_PREDIV_DIV1;
+        RCC_OscInitStruct.PLL.PLLMUL = RCC_PLL_MUL6;
+        RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+    }
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK) {
+        Error_Handler();
+    }
+
+    // flash needs the prefetch buffer and 1 wait state above 24 MHz
+    __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+
+    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+                                |RCC_CLOCKTYPE_PCLK1;
+    RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+    RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
+
+    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_1) != HAL_OK) {
+        Error_Handler();
+    }
+}
+
+/*
+ * Switch the system clock to profile and retime every clock dependent peripheral.
+ * Anything still queued for USART3 is sent at the old rate first
+ */
+void CLOCK_SetProfile(CLOCK_PROFILE profile) {
+    if (profileSet && profile == currentProfile) return;
+
+    USART3_Flush();
+
+    // the PLL and HSI48 can't be changed while SYSCLK runs from them
+    if (__HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_HSI) {
+        CLOCK_SelectHSI();
+    }
+
+    switch (profile) {
+        case CLOCK_HSI48_48MHZ:
+        case CLOCK_PLL_48MHZ:
+            CLOCK_Select48MHz(profile);
+            break;
+        case CLOCK_HSI_8MHZ:
+        default:
+            CLOCK_SelectHSI();
+            CLOCK_StopFastOscillators();
+            profile = CLOCK_HSI_8MHZ;
+            break;
+    }
+
+    currentProfile = profile;
+    profileSet = 1;
+
+    CLOCK_UpdatePeripherals();
+}
+
+/*
+ * Return the profile the system clock is currently running
+ */
+CLOCK_PROFILE CLOCK_GetProfile(void) {
+    return currentProfile;
+}
+
+/*
+ * Recompute the timing of every peripheral that depends on the clock.
+ * Peripherals that have not been set up yet are skipped
+ */
+void CLOCK_UpdatePeripherals(void) {
+    I2C1_UpdateTiming();
+    USART3_UpdateBaudRate();
+    USART1_UpdateBaudRate();
+    USART2_UpdateBaudRate();
+    SPI2_UpdateClock();
+    TIMEBASE_UpdateClock();
+}
@@ -0,0 +1,32 @@
+/*
+ * File: clock.h
+ * Purpose: Declares the selectable system clock profiles. Peripherals whose
+ *          timing depends on the clock are reconfigured whenever the profile changes.
+ */
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+#include "utilities.h"
+
+typedef enum {
+    CLOCK_HSI_8MHZ,     // 8 MHz HSI, no PLL, 0 flash wait states - low power
+    CLOCK_HSI48_48MHZ,  // 48 MHz straight from the HSI48 oscillator, 1 flash wait state
+    CLOCK_PLL_48MHZ     // 48 MHz from HSI x6 through the PLL, 1 flash wait state
+} CLOCK_PROFILE;
+
+// Profile used from boot and while doing parse/format work
+#ifndef CLOCK_PROFILE_ACTIVE
+#define CLOCK_PROFILE_ACTIVE CLOCK_HSI48_48MHZ
+#endif
+
+// Profile used while waiting for the next sample
+#ifndef CLOCK_PROFILE_IDLE
+#define CLOCK_PROFILE_IDLE CLOCK_HSI_8MHZ
+#endif
+
+
+void CLOCK_SetProfile(CLOCK_PROFILE profile);
+CLOCK_PROFILE CLOCK_GetProfile(void);
+void CLOCK_UpdatePeripherals(void);
+
+#endif /* __CLOCK_H */
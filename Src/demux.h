@@ -0,0 +1,52 @@
+/*
+ * File: demux.h
+ * Purpose: Declares the demultiplexer that splits the receiver's byte stream
+ *          into NMEA, UBX and RTCM3 frames and routes each to its handler
+ */
+#ifndef __DEMUX_H
+#define __DEMUX_H
+
+#include "utilities.h"
+
+typedef enum {
+    NONE,
+    NMEA,
+    UBX,
+    RTCM
+} PROTOCOL;
+
+#define DEMUX_PROTOCOLS (RTCM+1)
+
+// RTCM3 frame: | 0xD3 | 6 reserved bits, 10 bit length | message | CRC24Q |
+#define RTCM_PREAMBLE    0xD3
+#define RTCM_MAX_LEN_MSG 1023
+
+// The DDC data stream reads this when empty
+#define DEMUX_IDLE 0xFF
+
+// Largest frame handed to a handler. Longer RTCM ones are still checked and
+// counted but can't be routed, a UBX header giving a longer length is taken
+// for a false sync
+#ifndef DEMUX_MAX_FRAME
+#define DEMUX_MAX_FRAME 512
+#endif
+
+// Called with a complete frame that passed its checksum, NMEA frames are
+// null terminated after the checksum
+typedef void (*DEMUX_HANDLER)(uint8_t *frame, uint32_t len);
+
+typedef struct {
+    uint8_t state;
+    uint8_t skipping;       // inside a run of bytes that aren't part of any frame
+    uint8_t ck_a;           // NMEA XOR or UBX Fletcher checksum so far
+    uint8_t ck_b;
+    uint32_t crc;           // RTCM CRC24Q so far
+    uint32_t len;           // bytes of the current frame
+    uint32_t need;          // bytes left in the current state
+    DEMUX_HANDLER handlers[DEMUX_PROTOCOLS];
+    uint8_t frame[DEMUX_MAX_FRAME+1];
+} DEMUX;
+
+void DEMUX_Feed(DEMUX *demux, uint8_t *data, uint32_t len);
+
+#endif /* __DEMUX_H */
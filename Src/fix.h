@@ -0,0 +1,66 @@
+/*
+ * File: fix.h
+ * Purpose: Declares the binary fix record. Receiver output is decoded into it
+ *          once and the logger, display and anything else read the numbers
+ *          directly instead of re-parsing strings
+ */
+#ifndef __FIX_H
+#define __FIX_H
+
+#include <stdint.h>
+
+typedef enum {
+    FIX_NO_DATA,        // nothing received, or a sentence without a status
+    FIX_COMM_ERROR,     // the receiver couldn't be read
+    FIX_INVALID,        // receiver reports the data as not valid
+    FIX_VALID
+} FIX_STATUS;
+
+// Which members hold a decoded value
+#define FIX_HAS_POS    0x01
+#define FIX_HAS_ALT    0x02
+#define FIX_HAS_TIME   0x04
+#define FIX_HAS_DATE   0x08
+#define FIX_HAS_SPEED  0x10
+#define FIX_HAS_COURSE 0x20
+#define FIX_HAS_HDOP   0x40
+#define FIX_HAS_MV     0x80
+
+// UTC date and time in 32 bits, YYYYYYMM MMDDDDDh hhhhmmmm mmssssss with
+// the year counted from 2000 (up to 2063). Packed values compare in time order
+#define FIX_PACK_DATE(y, m, d)  (((uint32_t) (y) << 26) | ((uint32_t) (m) << 22) | ((uint32_t) (d) << 17))
+#define FIX_PACK_TIME(h, m, s)  (((uint32_t) (h) << 12) | ((uint32_t) (m) << 6) | (uint32_t) (s))
+#define FIX_DATE_MASK 0xFFFE0000UL
+#define FIX_TIME_MASK 0x0001FFFFUL
+
+#define FIX_YEAR(dt)   (((dt) >> 26) & 0x3F)
+#define FIX_MONTH(dt)  (((dt) >> 22) & 0xF)
+#define FIX_DAY(dt)    (((dt) >> 17) & 0x1F)
+#define FIX_HOUR(dt)   (((dt) >> 12) & 0x1F)
+#define FIX_MINUTE(dt) (((dt) >> 6) & 0x3F)
+#define FIX_SECOND(dt) ((dt) & 0x3F)
+
+// Members are ordered by size so the record needs no padding or packing,
+// which would force byte-wise access on the Cortex-M0
+typedef struct {
+    int32_t lat;        // 1e-7 degrees, north positive
+    int32_t lon;        // 1e-7 degrees, east positive
+    int32_t alt;        // millimeters above mean sea level
+    uint32_t datetime;  // see FIX_PACK_DATE and FIX_PACK_TIME
+    uint16_t speed;     // speed over ground in cm/s
+    uint16_t course;    // course over ground in 0.01 degrees
+    int16_t magvar;     // magnetic variation in 0.01 degrees, east positive
+    uint16_t hdop;      // horizontal dilution of precision in 0.01
+    uint8_t centis;     // hundredths of the UTC second
+    uint8_t quality;    // GGA quality indicator
+    uint8_t numsv;      // satellites used
+    uint8_t inview;     // satellites in view
+    char posmode;       // NMEA mode indicator, '\0' if not sent
+    char navstatus;     // NMEA navigational status, '\0' if not sent
+    uint8_t status;     // FIX_STATUS
+    uint8_t flags;      // FIX_HAS_x
+} FIX;
+
+_Static_assert(sizeof(FIX) == 32, "FIX record should stay 32 bytes");
+
+#endif /* __FIX_H */
@@ -0,0 +1,74 @@
+/*
+ * File: geo.c
+ * Purpose: Fixed-point geometry shared by the track modules: cos(latitude)
+ *          from a table, local north/east offsets in centimeters and an
+ *          integer square root, all without the soft-float library
+ */
+#include "geo.h"
+
+// cos(d) for whole degrees 0 to 90 in Q15. Linear interpolation between them
+// is within 4e-5 of the true value
+static const uint16_t geoCos[91] = {
+    32768, 32763, 32748, 32723, 32688, 32643, 32588, 32524, 32449, 32365,
+    32270, 32166, 32052, 31928, 31795, 31651, 31499, 31336, 31164, 30983,
+    30792, 30592, 30382, 30163, 29935, 29698, 29452, 29197, 28932, 28660,
+    28378, 28088, 27789, 27482, 27166, 26842, 26510, 26170, 25822, 25466,
+    25102, 24730, 24351, 23965, 23571, 23170, 22763, 22348, 21926, 21498,
+    21063, 20622, 20174, 19720, 19261, 18795, 18324, 17847, 17364, 16877,
+    16384, 15886, 15384, 14876, 14365, 13848, 13328, 12803, 12275, 11743,
+    11207, 10668, 10126, 9580, 9032, 8481, 7927, 7371, 6813, 6252,
+    5690, 5126, 4560, 3993, 3425, 2856, 2286, 1715, 1144, 572,
+    0
+};
+
+/*
+ * Cosine of a latitude in 1e-7 degrees, Q15
+ */
+int32_t GEO_CosLat(int32_t lat) {
+    uint32_t a = lat < 0 ? -(uint32_t) lat : (uint32_t) lat;
+    uint32_t deg = a / 10000000;
+    if (deg >= 90) return 0;
+
+    // interpolate on 1e-4 degree steps so the product stays in 32 bits
+    uint32_t frac = (a - deg * 10000000) / 1000;
+    uint32_t drop = geoCos[deg] - geoCos[deg + 1];
+    return geoCos[deg] - (int32_t) ((drop * frac + 5000) / 10000);
+}
+
+/*
+ * Offset of lat, lon from the reference lat0, lon0 in centimeters north and
+ * east. cos0 is GEO_CosLat(lat0), passed in so a caller projecting many
+ * points around one reference works it out once
+ */
+void GEO_Offset(int32_t lat0, int32_t lon0, int32_t cos0, int32_t lat, int32_t lon, int32_t *north, int32_t *east) {
+    int64_t dlat = (int64_t) lat - lat0;
+    int64_t dlon = (int64_t) lon - lon0;
+
+    // the short way round across the antimeridian
+    if (dlon > GEO_HALF_TURN_E7) dlon -= 2 * (int64_t) GEO_HALF_TURN_E7;
+    else if (dlon < -GEO_HALF_TURN_E7) dlon += 2 * (int64_t) GEO_HALF_TURN_E7;
+
+    *north = (int32_t) ((dlat * GEO_CM_PER_E7_Q16) >> 16);
+    *east = (int32_t) ((((dlon * GEO_CM_PER_E7_Q16) >> 16) * cos0) >> 15);
+}
+
+/*
+ * Integer square root, rounded down
+ */
+uint32_t GEO_Sqrt(uint64_t x) {
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+
+    while (bit > x) bit >>= 2;
+    while (bit != 0) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t) root;
+}
@@ -0,0 +1,27 @@
+/*
+ * File: geo.h
+ * Purpose: Declares the fixed-point geometry shared by the track modules.
+ *          Nearby fixes are projected onto a flat local grid in centimeters
+ *          around a reference point, which is plenty over the few kilometers
+ *          any one calculation spans
+ */
+#ifndef __GEO_H
+#define __GEO_H
+
+#include <stdint.h>
+
+// Centimeters per 1e-7 degree along a meridian on the mean Earth sphere
+// (6371008.8 m), in Q16
+#define GEO_CM_PER_E7_Q16 72873
+
+// Cosines are Q15, 32768 is 1.0
+#define GEO_COS_ONE 32768
+
+// 180 degrees in 1e-7 degrees, for longitude differences across the antimeridian
+#define GEO_HALF_TURN_E7 1800000000L
+
+int32_t GEO_CosLat(int32_t lat);
+void GEO_Offset(int32_t lat0, int32_t lon0, int32_t cos0, int32_t lat, int32_t lon, int32_t *north, int32_t *east);
+uint32_t GEO_Sqrt(uint64_t x);
+
+#endif /* __GEO_H */
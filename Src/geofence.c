@@ -0,0 +1,449 @@
+/*
+ * File: geofence.c
+ * Purpose: Polygon geofences on a uniform grid. Each grid cell lists the
+ *          zones whose bounding box overlaps it, so a fix is tested against
+ *          the few zones of its own cell however many are loaded. Containment
+ *          is a crossing count on the 1e-7 degree coordinates and the margin
+ *          check for enter and leave works in centimeters, all in integers
+ */
+#include "geofence.h"
+#include "geo.h"
+#include "gpx.h"
+#include "openlog.h"
+#include "telemetry.h"
+#include <stdio.h>
+#include <string.h>
+
+#define GEOFENCE_MARGIN_CM ((int64_t) GEOFENCE_MARGIN_M * 100)
+#define GEOFENCE_CELLS     (GEOFENCE_GRID * GEOFENCE_GRID)
+
+_Static_assert(GEOFENCE_MAX_ZONES <= 256, "grid cells list zones in 8 bits");
+_Static_assert(GEOFENCE_MAX_REFS <= 65535, "grid cells index zone entries in 16 bits");
+
+typedef struct {
+    int32_t lat;        // south west corner, 1e-7 degrees
+    int32_t lon;
+    uint16_t height;    // extent north and east in 1e-6 degrees
+    uint16_t width;
+    uint16_t first;     // index of its first vertex
+    uint16_t count;     // number of vertices
+    uint16_t id;
+} GEOFENCE_ZONE;
+
+typedef struct {
+    uint16_t north;     // 1e-6 degrees from the zone's corner
+    uint16_t east;
+} GEOFENCE_VERTEX;
+
+static GEOFENCE_ZONE zones[GEOFENCE_MAX_ZONES];
+static uint32_t zoneCount;
+static GEOFENCE_VERTEX vertices[GEOFENCE_MAX_VERTICES];
+static uint32_t vertexCount;
+
+// Zones the logger is in, a bit each
+static uint32_t inside[(GEOFENCE_MAX_ZONES + 31) / 32];
+
+// The grid's south west corner and cell size in 1e-7 degrees. Cell c lists
+// the zones cellZones[cellStart[c]] up to cellZones[cellStart[c+1]]
+static int32_t gridLat, gridLon;
+static uint32_t cellHeight, cellWidth;
+static uint16_t cellStart[GEOFENCE_CELLS + 1];
+static uint8_t cellZones[GEOFENCE_MAX_REFS];
+
+// A line of the zone file as it is read
+typedef struct {
+    int32_t lat[GEOFENCE_MAX_ZONE_VERTICES];
+    int32_t lon[GEOFENCE_MAX_ZONE_VERTICES];
+    uint32_t count;     // vertices so far
+    uint32_t fields;    // numbers so far, the id then alternating lat and lon
+    uint32_t id;
+    uint32_t mantissa;  // digits of the number being read
+    uint8_t digits;
+    uint8_t fraction;   // digits after the point, 0xFF before it
+    uint8_t negative;
+    uint8_t bad;        // the line isn't a zone
+    uint8_t comment;    // skipping to the end of the line
+} GEOFENCE_PARSER;
+
+static GEOFENCE_PARSER *parser;
+
+static const uint32_t geofencePow10[8] = { 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1 };
+
+/*
+ * Keep the zone on the parser's line, if it is one and there is room for it
+ */
+static void GEOFENCE_AddZone(GEOFENCE_PARSER *p) {
+    if (p->fields == 0 && !p->bad) return; // blank or only a comment
+    if (p->bad || p->count < 3 || p->fields != 1 + 2 * p->count || p->id > 0xFFFF) {
+        telemetry.fenceRejects++;
+        return;
+    }
+    if (zoneCount == GEOFENCE_MAX_ZONES || vertexCount + p->count > GEOFENCE_MAX_VERTICES) {
+        telemetry.fenceRejects++;
+        return;
+    }
+
+    int32_t minLat = p->lat[0], maxLat = p->lat[0], minLon = p->lon[0], maxLon = p->lon[0];
+    for (uint32_t i = 1; i < p->count; i++) {
+        if (p->lat[i] < minLat) minLat = p->lat[i];
+        if (p->lat[i] > maxLat) maxLat = p->lat[i];
+        if (p->lon[i] < minLon) minLon = p->lon[i];
+        if (p->lon[i] > maxLon) maxLon = p->lon[i];
+    }
+    if ((int64_t) maxLat - minLat > GEOFENCE_MAX_SPAN || (int64_t) maxLon - minLon > GEOFENCE_MAX_SPAN) {
+        telemetry.fenceRejects++;
+        return;
+    }
+
+    GEOFENCE_ZONE *zone = &zones[zoneCount++];
+    zone->lat = minLat;
+    zone->lon = minLon;
+    zone->height = (maxLat - minLat + GEOFENCE_VERTEX_SCALE - 1) / GEOFENCE_VERTEX_SCALE;
+    zone->width = (maxLon - minLon + GEOFENCE_VERTEX_SCALE - 1) / GEOFENCE_VERTEX_SCALE;
+    zone->first = vertexCount;
+    zone->count = p->count;
+    zone->id = p->id;
+
+    for (uint32_t i = 0; i < p->count; i++) {
+        vertices[vertexCount].north = (p->lat[i] - minLat + GEOFENCE_VERTEX_SCALE / 2) / GEOFENCE_VERTEX_SCALE;
+        vertices[vertexCount].east = (p->lon[i] - minLon + GEOFENCE_VERTEX_SCALE / 2) / GEOFENCE_VERTEX_SCALE;
+        vertexCount++;
+    }
+}
+
+/*
+ * A number on the line has ended. The first is the id, the rest degrees
+ */
+static void GEOFENCE_EndNumber(GEOFENCE_PARSER *p) {
+    if (p->digits == 0) {
+        if (p->negative || p->fraction != 0xFF) p->bad = 1; // a lone sign or point
+        return;
+    }
+
+    if (p->fields == 0) {
+        if (p->negative || p->fraction != 0xFF) p->bad = 1;
+        p->id = p->mantissa;
+    }
+    else {
+        uint8_t fraction = p->fraction == 0xFF ? 0 : p->fraction;
+        int32_t degrees = p->mantissa * geofencePow10[fraction];
+        if (p->negative) degrees = -degrees;
+
+        uint32_t vertex = (p->fields - 1) / 2;
+        if (vertex >= GEOFENCE_MAX_ZONE_VERTICES) p->bad = 1;
+        else if (p->fields % 2) {
+            if (degrees > 900000000 || degrees < -900000000) p->bad = 1;
+            p->lat[vertex] = degrees;
+        }
+        else {
+            p->lon[vertex] = degrees;
+            p->count = vertex + 1;
+        }
+    }
+    p->fields++;
+
+    p->mantissa = 0;
+    p->digits = 0;
+    p->fraction = 0xFF;
+    p->negative = 0;
+}
+
+/*
+ * Start the next line
+ */
+static void GEOFENCE_NewLine(GEOFENCE_PARSER *p) {
+    p->count = 0;
+    p->fields = 0;
+    p->mantissa = 0;
+    p->digits = 0;
+    p->fraction = 0xFF;
+    p->negative = 0;
+    p->bad = 0;
+    p->comment = 0;
+}
+
+/*
+ * Parse the next bytes of the zone file
+ */
+static uint8_t GEOFENCE_Read(uint8_t *data, uint32_t len) {
+    GEOFENCE_PARSER *p = parser;
+
+    for (uint32_t i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (c == '\n' || c == '\r') {
+            if (!p->comment) GEOFENCE_EndNumber(p);
+            GEOFENCE_AddZone(p);
+            GEOFENCE_NewLine(p);
+        }
+        else if (p->comment) {
+            continue;
+        }
+        else if (c == '#') {
+            GEOFENCE_EndNumber(p);
+            p->comment = 1;
+        }
+        else if (c == ' ' || c == '\t' || c == ',') {
+            GEOFENCE_EndNumber(p);
+        }
+        else if (c >= '0' && c <= '9') {
+            if (p->fraction == 7) continue; // finer than 1e-7 degrees
+            if (p->fraction != 0xFF) p->fraction++;
+            p->mantissa = p->mantissa * 10 + (c - '0');
+            p->digits++;
+            if (p->fraction == 0xFF && p->mantissa > (p->fields == 0 ? 0xFFFF : 180)) p->bad = 1;
+        }
+        else if (c == '.' && p->fraction == 0xFF && p->fields > 0) {
+            p->fraction = 0;
+        }
+        else if (c == '-' && p->digits == 0 && !p->negative && p->fraction == 0xFF) {
+            p->negative = 1;
+        }
+        else {
+            p->bad = 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Grid row or column of an offset from the grid corner, -1 if outside
+ */
+static int32_t GEOFENCE_Index(int64_t offset, uint32_t cell) {
+    if (offset < 0) return -1;
+    int64_t index = offset / cell;
+    return index < GEOFENCE_GRID ? (int32_t) index : -1;
+}
+
+/*
+ * Cell a position falls in, -1 if it is outside the grid
+ */
+static int32_t GEOFENCE_Cell(int32_t lat, int32_t lon) {
+    int32_t row = GEOFENCE_Index((int64_t) lat - gridLat, cellHeight);
+    int32_t col = GEOFENCE_Index((int64_t) lon - gridLon, cellWidth);
+    return row < 0 || col < 0 ? -1 : row * GEOFENCE_GRID + col;
+}
+
+/*
+ * Lay the grid over the zones and list each one in the cells it overlaps.
+ * Zones that don't fit in GEOFENCE_MAX_REFS are dropped from the end
+ */
+static void GEOFENCE_BuildGrid(void) {
+    int64_t maxLat = zones[0].lat, maxLon = zones[0].lon;
+
+    gridLat = zones[0].lat;
+    gridLon = zones[0].lon;
+    for (uint32_t z = 0; z < zoneCount; z++) {
+        if (zones[z].lat < gridLat) gridLat = zones[z].lat;
+        if (zones[z].lon < gridLon) gridLon = zones[z].lon;
+        if ((int64_t) zones[z].lat + zones[z].height * GEOFENCE_VERTEX_SCALE > maxLat) {
+            maxLat = (int64_t) zones[z].lat + zones[z].height * GEOFENCE_VERTEX_SCALE;
+        }
+        if ((int64_t) zones[z].lon + zones[z].width * GEOFENCE_VERTEX_SCALE > maxLon) {
+            maxLon = (int64_t) zones[z].lon + zones[z].width * GEOFENCE_VERTEX_SCALE;
+        }
+    }
+    cellHeight = (maxLat - gridLat) / GEOFENCE_GRID + 1;
+    cellWidth = (maxLon - gridLon) / GEOFENCE_GRID + 1;
+
+    // count each cell's zones, keeping the zones that fit
+    uint32_t refs = 0;
+    memset(cellStart, 0, sizeof(cellStart));
+    for (uint32_t z = 0; z < zoneCount; z++) {
+        GEOFENCE_ZONE *zone = &zones[z];
+        int32_t row0 = GEOFENCE_Index((int64_t) zone->lat - gridLat, cellHeight);
+        int32_t col0 = GEOFENCE_Index((int64_t) zone->lon - gridLon, cellWidth);
+        int32_t row1 = GEOFENCE_Index((int64_t) zone->lat + zone->height * GEOFENCE_VERTEX_SCALE - gridLat, cellHeight);
+        int32_t col1 = GEOFENCE_Index((int64_t) zone->lon + zone->width * GEOFENCE_VERTEX_SCALE - gridLon, cellWidth);
+
+        uint32_t cells = (row1 - row0 + 1) * (col1 - col0 + 1);
+        if (refs + cells > GEOFENCE_MAX_REFS) {
+            telemetry.fenceRejects += zoneCount - z;
+            zoneCount = z;
+            break;
+        }
+        refs += cells;
+        for (int32_t row = row0; row <= row1; row++) {
+            for (int32_t col = col0; col <= col1; col++) cellStart[row * GEOFENCE_GRID + col]++;
+        }
+    }
+
+    // running totals make cellStart[c] the end of cell c's list, filling each
+    // list from its end moves it back to the start
+    for (uint32_t c = 0, total = 0; c <= GEOFENCE_CELLS; c++) {
+        total += cellStart[c];
+        cellStart[c] = total;
+    }
+    for (uint32_t z = 0; z < zoneCount; z++) {
+        GEOFENCE_ZONE *zone = &zones[z];
+        int32_t row0 = GEOFENCE_Index((int64_t) zone->lat - gridLat, cellHeight);
+        int32_t col0 = GEOFENCE_Index((int64_t) zone->lon - gridLon, cellWidth);
+        int32_t row1 = GEOFENCE_Index((int64_t) zone->lat + zone->height * GEOFENCE_VERTEX_SCALE - gridLat, cellHeight);
+        int32_t col1 = GEOFENCE_Index((int64_t) zone->lon + zone->width * GEOFENCE_VERTEX_SCALE - gridLon, cellWidth);
+
+        for (int32_t row = row0; row <= row1; row++) {
+            for (int32_t col = col0; col <= col1; col++) {
+                cellZones[--cellStart[row * GEOFENCE_GRID + col]] = z;
+            }
+        }
+    }
+}
+
+/*
+ * Load the zones from file name on the SD card and index them. Called at
+ * boot, before recording starts. Returns the number of zones loaded
+ */
+uint32_t GEOFENCE_Load(char *name) {
+    // only needed while loading, so on the stack
+    GEOFENCE_PARSER lines;
+
+    zoneCount = 0;
+    vertexCount = 0;
+    memset(inside, 0, sizeof(inside));
+
+    GEOFENCE_NewLine(&lines);
+    parser = &lines;
+    // the line end of OpenLog's prompt after the last chunk ends the file's
+    // last line, the rest of the prompt is never a whole line
+    OPENLOG_ReadAll(name, GEOFENCE_READ_CHUNK, GEOFENCE_Read);
+    parser = NULL;
+
+    if (zoneCount > 0) GEOFENCE_BuildGrid();
+    telemetry.fenceZones = zoneCount;
+    return zoneCount;
+}
+
+/*
+ * True if the position is inside the zone. Counts the edges a line due east
+ * of the position crosses, in the zone's corner-relative 1e-7 degrees
+ */
+static uint8_t GEOFENCE_Contains(GEOFENCE_ZONE *zone, int32_t lat, int32_t lon) {
+    int64_t y = (int64_t) lat - zone->lat;
+    int64_t x = (int64_t) lon - zone->lon;
+    if (y < 0 || x < 0 || y > zone->height * GEOFENCE_VERTEX_SCALE || x > zone->width * GEOFENCE_VERTEX_SCALE) return 0;
+
+    GEOFENCE_VERTEX *v = &vertices[zone->first];
+    uint8_t in = 0;
+    for (uint32_t i = 0, j = zone->count - 1; i < zone->count; j = i++) {
+        int32_t yi = v[i].north * GEOFENCE_VERTEX_SCALE, xi = v[i].east * GEOFENCE_VERTEX_SCALE;
+        int32_t yj = v[j].north * GEOFENCE_VERTEX_SCALE, xj = v[j].east * GEOFENCE_VERTEX_SCALE;
+        if ((yi > y) == (yj > y)) continue;
+
+        // east of the edge where it crosses y, without dividing
+        int64_t lhs = (x - xi) * (yj - yi);
+        int64_t rhs = (int64_t) (xj - xi) * (y - yi);
+        if (yj > yi ? lhs < rhs : lhs > rhs) in = !in;
+    }
+    return in;
+}
+
+/*
+ * True if the point (pn, pe) is within the margin of the segment a to b, all
+ * in centimeters
+ */
+static uint8_t GEOFENCE_Near(int64_t pn, int64_t pe, int64_t an, int64_t ae, int64_t bn, int64_t be) {
+    int64_t dn = bn - an, de = be - ae;
+    int64_t qn = pn - an, qe = pe - ae;
+    int64_t dot = dn * qn + de * qe;
+    int64_t len2 = dn * dn + de * de;
+
+    if (dot <= 0) return qn * qn + qe * qe <= GEOFENCE_MARGIN_CM * GEOFENCE_MARGIN_CM;
+    if (dot >= len2) {
+        int64_t rn = pn - bn, re = pe - be;
+        return rn * rn + re * re <= GEOFENCE_MARGIN_CM * GEOFENCE_MARGIN_CM;
+    }
+
+    int64_t cross = dn * qe - de * qn;
+    if (cross < 0) cross = -cross;
+    return cross <= GEOFENCE_MARGIN_CM * GEO_Sqrt(len2);
+}
+
+/*
+ * True if the position is more than the margin from every edge of the zone,
+ * so being in or out of it is no longer in doubt
+ */
+static uint8_t GEOFENCE_Clear(GEOFENCE_ZONE *zone, int32_t lat, int32_t lon, int32_t cos) {
+    int32_t pn, pe;
+    GEO_Offset(zone->lat, zone->lon, cos, lat, lon, &pn, &pe);
+
+    // scale corner-relative 1e-6 degrees to centimeters as GEO_Offset does
+    int64_t scale = (int64_t) GEOFENCE_VERTEX_SCALE * GEO_CM_PER_E7_Q16;
+    int64_t heightCm = (zone->height * scale) >> 16;
+    int64_t widthCm = (((zone->width * scale) >> 16) * cos) >> 15;
+    if (pn < -GEOFENCE_MARGIN_CM || pe < -GEOFENCE_MARGIN_CM ||
+        pn > heightCm + GEOFENCE_MARGIN_CM || pe > widthCm + GEOFENCE_MARGIN_CM) return 1;
+
+    GEOFENCE_VERTEX *v = &vertices[zone->first];
+    int64_t jn = (v[zone->count - 1].north * scale) >> 16;
+    int64_t je = (((v[zone->count - 1].east * scale) >> 16) * cos) >> 15;
+    for (uint32_t i = 0; i < zone->count; i++) {
+        int64_t in = (v[i].north * scale) >> 16;
+        int64_t ie = (((v[i].east * scale) >> 16) * cos) >> 15;
+        if (GEOFENCE_Near(pn, pe, jn, je, in, ie)) return 0;
+        jn = in;
+        je = ie;
+    }
+    return 1;
+}
+
+/*
+ * Check a valid fix against the zones. Fills events with the zones entered
+ * and left, up to max, and returns how many there are
+ */
+uint32_t GEOFENCE_Check(FIX *fix, GEOFENCE_EVENT *events, uint32_t max) {
+    uint32_t count = 0;
+
+    if (zoneCount == 0 || !(fix->flags & FIX_HAS_POS)) return 0;
+    int32_t cos = GEO_CosLat(fix->lat);
+
+    // zones around the fix that it may have entered
+    int32_t cell = GEOFENCE_Cell(fix->lat, fix->lon);
+    if (cell >= 0) {
+        for (uint32_t k = cellStart[cell]; k < cellStart[cell + 1] && count < max; k++) {
+            uint32_t z = cellZones[k];
+            if (inside[z / 32] & (1UL << (z % 32))) continue;
+
+            if (GEOFENCE_Contains(&zones[z], fix->lat, fix->lon) && GEOFENCE_Clear(&zones[z], fix->lat, fix->lon, cos)) {
+                inside[z / 32] |= 1UL << (z % 32);
+                events[count].id = zones[z].id;
+                events[count].entered = 1;
+                count++;
+            }
+        }
+    }
+
+    // zones it was in that it may have left, wherever it is now
+    for (uint32_t w = 0; w < sizeof(inside) / sizeof(inside[0]); w++) {
+        for (uint32_t bits = inside[w]; bits != 0 && count < max; bits &= bits - 1) {
+            uint32_t z = w * 32 + __builtin_ctz(bits);
+
+            if (!GEOFENCE_Contains(&zones[z], fix->lat, fix->lon) && GEOFENCE_Clear(&zones[z], fix->lat, fix->lon, cos)) {
+                inside[w] &= ~(1UL << (z % 32));
+                events[count].id = zones[z].id;
+                events[count].entered = 0;
+                count++;
+            }
+        }
+    }
+
+    telemetry.fenceEvents += count;
+    return count;
+}
+
+/*
+ * Write an event as an XML comment line for the track, with where and when
+ * it happened. Returns the number of characters written
+ */
+int GEOFENCE_FormatEvent(GEOFENCE_EVENT *event, FIX *fix, char *buf, uint32_t len) {
+    char lat[GPX_COORD_LEN], lon[GPX_COORD_LEN];
+
+    GPX_FormatCoord(fix->lat, lat);
+    GPX_FormatCoord(fix->lon, lon);
+    int written = snprintf(buf, len, "\t<!-- fence %s %u at %s,%s %02u:%02u:%02u -->\n",
+                           event->entered ? "enter" : "leave", (unsigned) event->id, lat, lon,
+                           (unsigned) FIX_HOUR(fix->datetime), (unsigned) FIX_MINUTE(fix->datetime),
+                           (unsigned) FIX_SECOND(fix->datetime));
+
+    if (written < 0) return 0;
+    return (uint32_t) written < len ? written : (int)(len - 1);
+}
@@ -0,0 +1,59 @@
+/*
+ * File: geofence.h
+ * Purpose: Declares the geofences. Polygon zones are loaded from the SD card
+ *          at boot into a uniform grid over their area, so checking a fix
+ *          only tests the zones overlapping its grid cell and the ones it is
+ *          already in. Entering and leaving are reported as events
+ */
+#ifndef __GEOFENCE_H
+#define __GEOFENCE_H
+
+#include "utilities.h"
+#include "fix.h"
+
+// Zones, one per line: an id from 0 to 65535 then at least three vertices as
+// decimal degrees lat lon lat lon ..., separated by spaces or commas. # starts
+// a comment
+#define GEOFENCE_FILE "fences.txt"
+
+// What the zones may take up in RAM
+#define GEOFENCE_MAX_ZONES    64
+#define GEOFENCE_MAX_VERTICES 384
+
+// Vertices are kept as 1e-6 degree offsets from their zone's south west
+// corner in 16 bits, so a zone spans at most 0.065 degrees, about 7 km
+#define GEOFENCE_VERTEX_SCALE 10
+#define GEOFENCE_MAX_SPAN     (65535L * GEOFENCE_VERTEX_SCALE)
+
+// Most vertices on one line of the file
+#define GEOFENCE_MAX_ZONE_VERTICES 32
+
+// The grid has GEOFENCE_GRID cells a side over all zones, and up to
+// GEOFENCE_MAX_REFS zone entries over all cells. Zones that don't fit in
+// those aren't loaded
+#define GEOFENCE_GRID     16
+#define GEOFENCE_MAX_REFS 384
+
+// A fix has to be this far inside a zone to enter it and this far outside to
+// leave it, so receiver jitter at the edge doesn't flap in and out
+#define GEOFENCE_MARGIN_M 10
+
+// Most events GEOFENCE_Check reports at once, later ones wait for the next fix
+#define GEOFENCE_MAX_EVENTS 4
+
+// The file is text, read in chunks of this size
+#define GEOFENCE_READ_CHUNK 512
+
+// Longest event record, see GEOFENCE_FormatEvent
+#define GEOFENCE_EVENT_LEN 80
+
+typedef struct {
+    uint16_t id;        // zone id from the file
+    uint8_t entered;    // 1 on entering the zone, 0 on leaving it
+} GEOFENCE_EVENT;
+
+uint32_t GEOFENCE_Load(char *name);
+uint32_t GEOFENCE_Check(FIX *fix, GEOFENCE_EVENT *events, uint32_t max);
+int GEOFENCE_FormatEvent(GEOFENCE_EVENT *event, FIX *fix, char *buf, uint32_t len);
+
+#endif /* __GEOFENCE_H */
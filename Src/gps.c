@@ -1,93 +1,623 @@
 /*
  * File: gps.c
  * Purpose: Defines functions that allow interaction with the SAM-M8Q GPS
- *          via I2C1
+ *          via I2C1 (DDC) or USART2
  */
 #include "gps.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "timebase.h"
+#include "backup.h"
+#include "sat.h"
+#include "rawlog.h"
 #include <string.h>
 #include "lcd.h"
 #include <stdio.h>
 
-volatile PROTOCOL currentProtocol;
+static FIX gpsFix; // the epoch's sentences merged by GPS_HandleNMEA
 
-uint32_t UBX_ByteNumber, NMEA_ByteNumber, RTCM_ByteNumber;
+// Receiver output on USART2, written by DMA
+static uint8_t gpsRx[GPS_RX_BUF_SIZE];
+static uint32_t gpsRxTail; // next byte not demultiplexed yet
+static uint32_t gpsRxTaken; // bytes demultiplexed since setup
+static volatile uint32_t gpsRxHead; // where DMA had written to at the last interrupt
+static volatile uint32_t gpsRxReceived; // bytes DMA had written since setup then
+static volatile uint32_t gpsRxAt; // TIMEBASE_Now bytes last arrived
+static uint32_t gpsStallAt;       // TIMEBASE_Now a flash erase started
+static uint32_t gpsStallRoom;     // and bytes the buffer had room for then
+static uint32_t gpsStallHead;
 
 /*
- * Setup the I2C1 subsytem and the GPIO pins
+ * Merge a decoded sentence into the fix of its epoch field by field: the
+ * members it set, with their FIX_HAS_x flags, and its status if it has one.
+ * A sentence with another time of day starts the fix over for its own epoch
  */
-void GPS_Setup(GPS *gps) {
-    RCC->AHBENR |= RCC_AHBENR_GPIOBEN;	// Enable GPIOB clock
-    RCC->APB1ENR |= RCC_APB1ENR_I2C1EN; // Enable I2C2 clock
+static void GPS_MergeFix(FIX *fix) {
+    if ((fix->flags & gpsFix.flags & FIX_HAS_TIME) &&
+        (((fix->datetime ^ gpsFix.datetime) & FIX_TIME_MASK) != 0 || fix->centis != gpsFix.centis)) {
+        memset(&gpsFix, 0, sizeof(gpsFix));
+        gpsFix.status = FIX_NO_DATA;
+    }
 
-    thisGPS = gps;
-    currentProtocol = NONE;
-    UBX_ByteNumber = 0;
-    NMEA_ByteNumber = 0;
-    RTCM_ByteNumber = 0;
+    if (fix->flags & FIX_HAS_POS) {
+        gpsFix.lat = fix->lat;
+        gpsFix.lon = fix->lon;
+    }
+    if (fix->flags & FIX_HAS_ALT) gpsFix.alt = fix->alt;
+    if (fix->flags & FIX_HAS_TIME) {
+        gpsFix.datetime = (gpsFix.datetime & FIX_DATE_MASK) | (fix->datetime & FIX_TIME_MASK);
+        gpsFix.centis = fix->centis;
+    }
+    if (fix->flags & FIX_HAS_DATE) gpsFix.datetime = (gpsFix.datetime & FIX_TIME_MASK) | (fix->datetime & FIX_DATE_MASK);
+    if (fix->flags & FIX_HAS_SPEED) gpsFix.speed = fix->speed;
+    if (fix->flags & FIX_HAS_COURSE) gpsFix.course = fix->course;
+    if (fix->flags & FIX_HAS_HDOP) gpsFix.hdop = fix->hdop;
+    if (fix->flags & FIX_HAS_MV) gpsFix.magvar = fix->magvar;
+    gpsFix.flags |= fix->flags;
+
+    // members without a flag are sent when they are not 0
+    if (fix->quality != 0) gpsFix.quality = fix->quality;
+    if (fix->numsv != 0) gpsFix.numsv = fix->numsv;
+    if (fix->inview != 0) gpsFix.inview = fix->inview;
+    if (fix->posmode != '\0') gpsFix.posmode = fix->posmode;
+    if (fix->navstatus != '\0') gpsFix.navstatus = fix->navstatus;
+    if (fix->status != FIX_NO_DATA) gpsFix.status = fix->status;
+}
 
-    configPinB_AF1(thisGPS->i2c_scl);
-    configPinB_AF1(thisGPS->i2c_sda);
-    
-    I2C1_Config();
+/*
+ * Merge the fixes decoded from NMEA frames. GSV and GSA go to the satellite
+ * table instead. Every frame goes into the raw log
+ */
+static void GPS_HandleNMEA(uint8_t *frame, uint32_t len) {
+    if (RAWLOG_ENABLED) RAWLOG_Frame(frame, len);
+
+    char *format = (char *) &frame[NMEA_MAX_LEN_START+NMEA_MAX_LEN_TALKERID];
+    if (format[0] == 'G' && format[1] == 'S') {
+        if (format[2] == 'V') {
+            SAT_HandleGSV((char *) frame);
+            return;
+        }
+        if (format[2] == 'A') {
+            SAT_HandleGSA((char *) frame);
+            return;
+        }
+    }
+
+    FIX fix = NMEA_ParseFrame((char *) frame);
+    GPS_MergeFix(&fix);
+}
+
+// Answers to the CFG messages sent, in the order they came
+static volatile uint8_t gpsCfgAcked[GPS_CFG_MAX_ITEMS];
+static volatile uint32_t gpsCfgAnswers;
+
+// CFG-MSG poll answers: msgClass, msgID and the rate on the port in use
+static volatile uint8_t gpsCfgPolled[GPS_CFG_MAX_ITEMS][3];
+static volatile uint32_t gpsCfgPolls;
+
+// Time to first fix from NAV-STATUS answers, 0 without a fix
+static volatile uint32_t gpsTTFF;
+static volatile uint32_t gpsNavStatus;
+
+/*
+ * Record ACK-ACK and ACK-NAK answers to CFG messages, CFG-MSG poll answers
+ * and NAV-STATUS. Other UBX frames are only counted
+ */
+static void GPS_HandleUBX(uint8_t *frame, uint32_t len) {
+    if (len == UBX_ACK_LEN && frame[2] == UBX_CLASS_ACK && frame[6] == UBX_CLASS_CFG) {
+        if (gpsCfgAnswers < GPS_CFG_MAX_ITEMS) {
+            gpsCfgAcked[gpsCfgAnswers++] = frame[3] == UBX_ID_ACK_ACK;
+        }
+    }
+    else if (len == UBX_CFG_MSG_POLL_LEN && frame[2] == UBX_CLASS_CFG && frame[3] == UBX_ID_CFG_MSG) {
+        if (gpsCfgPolls < GPS_CFG_MAX_ITEMS) {
+            gpsCfgPolled[gpsCfgPolls][0] = frame[6];
+            gpsCfgPolled[gpsCfgPolls][1] = frame[7];
+            gpsCfgPolled[gpsCfgPolls][2] = frame[8 + thisGPS->port];
+            gpsCfgPolls++;
+        }
+    }
+    else if (len == UBX_NAV_STATUS_LEN && frame[2] == UBX_CLASS_NAV && frame[3] == UBX_ID_NAV_STATUS) {
+        uint8_t *ttff = &frame[UBX_NAV_STATUS_TTFF];
+        gpsTTFF = (frame[UBX_NAV_STATUS_FLAGS] & UBX_NAV_STATUS_FIX_OK) ?
+                  ttff[0] | (ttff[1] << 8) | (ttff[2] << 16) | ((uint32_t) ttff[3] << 24) : 0;
+        gpsNavStatus++;
+    }
+}
 
-    // Enable I2C1 peripheral using PE bit in CR1
-	I2C1->CR1 |= 1 << I2C_CR1_PE_Pos;
+// RTCM frames are only counted until something handles them
+static DEMUX gpsDemux = { .handlers = { [NMEA] = GPS_HandleNMEA, [UBX] = GPS_HandleUBX } };
 
-    // Interrupt?
+/*
+ * Write data to the receiver's DDC message input
+ */
+static uint8_t GPS_DDC_Write(uint8_t *data, uint32_t len) {
+    return I2C1_WriteNoReg(GPS_I2C_ADDR, data, len);
 }
 
 /*
- * Get data from the GPS
+ * Read everything waiting on DDC in GPS_READ_CHUNK pieces and demultiplex it.
+ * Returns 1 on failure, 0 otherwise
  */
-NMEA_MSG GPS_GetData_NMEA() {
+static uint8_t GPS_DDC_Read(void) {
     // can either get number of bytes available, or poll the data stream register and 0xff means no data
     // if leave off reg addr, will automatically inc until 0xff; default is 0xff so can omit reg addr
-    NMEA_MSG msg;
 
     // Get available bytes
     uint32_t available_bytes = 0;
     char available_high[2], available_low[2];
     if (I2C1_ReadStr(GPS_I2C_ADDR, AVAIL_BYTES_HIGH_REG, available_high, 1)) { // something went wrong
-        snprintf(msg.status, NMEA_RMC_LEN_STATUS+1, "%s", commError);
-        return msg;
+        return 1; // FAILURE
     }
     if (I2C1_ReadStr(GPS_I2C_ADDR, AVAIL_BYTES_LOW_REG, available_low, 1)) { // something went wrong
-        snprintf(msg.status, NMEA_RMC_LEN_STATUS+1, "%s", commError);
-        return msg;
+        return 1; // FAILURE
     }
     available_bytes = ((uint32_t)available_high[0] << 8) | (uint32_t)available_low[0];
 
-    if (available_bytes == 0) { // no data available
-        snprintf(msg.status, NMEA_RMC_LEN_STATUS+1, "%s", noData);
-        return msg;
+    char data_stream[GPS_READ_CHUNK];
+    while (available_bytes > 0) {
+        uint32_t chunk = available_bytes < GPS_READ_CHUNK ? available_bytes : GPS_READ_CHUNK;
+        if (I2C1_ReadStr(GPS_I2C_ADDR, DATA_STREAM_REG, data_stream, chunk)) {
+            return 1; // FAILURE
+        }
+        DEMUX_Feed(&gpsDemux, (uint8_t *) data_stream, chunk);
+        available_bytes -= chunk;
+    }
+
+    return 0;
+}
+
+/*
+ * Demultiplex what USART2 interrupts have seen arrive since the last call. If
+ * DMA has come round over bytes not taken yet, they are counted lost and the
+ * read starts over at the head. Returns 0
+ */
+static uint8_t GPS_USART_Read(void) {
+    __disable_irq(); // head and count from the same interrupt
+    uint32_t head = gpsRxHead;
+    uint32_t received = gpsRxReceived;
+    __enable_irq();
+
+    if (received - gpsRxTaken > GPS_RX_BUF_SIZE) {
+        telemetry.rxLost += received - gpsRxTaken;
+    } else {
+        if (head < gpsRxTail || (head == gpsRxTail && received != gpsRxTaken)) { // wrapped around the end
+            DEMUX_Feed(&gpsDemux, &gpsRx[gpsRxTail], GPS_RX_BUF_SIZE - gpsRxTail);
+            gpsRxTail = 0;
+        }
+        DEMUX_Feed(&gpsDemux, &gpsRx[gpsRxTail], head - gpsRxTail);
+    }
+    gpsRxTail = head;
+    gpsRxTaken = received;
+
+    return 0;
+}
+
+/*
+ * Send data on USART2
+ */
+static uint8_t GPS_USART_Write(uint8_t *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) USART2_SendChar(data[i]);
+    return 0;
+}
+
+static const GPS_TRANSPORT ddcTransport = { GPS_DDC_Write, GPS_DDC_Read };
+static const GPS_TRANSPORT usartTransport = { GPS_USART_Write, GPS_USART_Read };
+
+static const GPS_TRANSPORT *gpsTransport = &ddcTransport;
+
+/*
+ * Setup the transport for the receiver port in gps. DDC uses I2C1, the
+ * receiver's UART1 is wired to USART2 and switched from its reset rate to
+ * gps->baud. Returns 1 if the port isn't supported, 0 otherwise
+ */
+uint8_t GPS_Setup(GPS *gps) {
+    thisGPS = gps;
+
+    switch (gps->port) {
+        case GPS_DDC:
+            RCC->AHBENR |= RCC_AHBENR_GPIOBEN;	// Enable GPIOB clock
+            RCC->APB1ENR |= RCC_APB1ENR_I2C1EN; // Enable I2C1 clock
+
+            configPinB_AF1(thisGPS->i2c_scl);
+            configPinB_AF1(thisGPS->i2c_sda);
+
+            I2C1_Config();
+
+            // Enable I2C1 peripheral using PE bit in CR1
+            I2C1->CR1 |= 1 << I2C_CR1_PE_Pos;
+
+            gpsTransport = &ddcTransport;
+            return 0;
+
+        case GPS_USART1:
+            gpsRxTail = 0;
+            gpsRxTaken = 0;
+            gpsRxHead = 0;
+            gpsRxReceived = 0;
+            USART2_Setup(thisGPS->usart_tx, thisGPS->usart_rx, GPS_UART_DEFAULT_BAUD, gpsRx, GPS_RX_BUF_SIZE);
+            gpsTransport = &usartTransport;
+
+            // a receiver already at gps->baud just sees noise
+            if (thisGPS->baud != GPS_UART_DEFAULT_BAUD) {
+                NMEA_SetPort(GPS_USART1, thisGPS->baud);
+                USART2_Flush();
+                USART2_SetBaudRate(thisGPS->baud);
+            }
+            return 0;
+
+        default:
+            return 1; // FAILURE
+    }
+}
+
+/*
+ * Send a message to the receiver. Returns 1 on failure, 0 otherwise
+ */
+uint8_t GPS_Write(char *str) {
+    return gpsTransport->write((uint8_t *) str, strlen(str));
+}
+
+/*
+ * Send len bytes to the receiver, at most GPS_WRITE_MAX.
+ * Returns 1 on failure, 0 otherwise
+ */
+uint8_t GPS_WriteBytes(uint8_t *data, uint32_t len) {
+    return gpsTransport->write(data, len);
+}
+
+/*
+ * Wait until *count reaches want or GPS_CFG_TIMEOUT_US passes, reading the
+ * receiver meanwhile
+ */
+static void GPS_WaitAnswers(volatile uint32_t *count, uint32_t want) {
+    uint32_t start = TIMEBASE_Now();
+    while (*count < want && TIMEBASE_Elapsed(start) < GPS_CFG_TIMEOUT_US) {
+        gpsTransport->read();
+    }
+}
+
+/*
+ * Configure the receiver with ready-made CFG-MSG frames. Pending frames go out
+ * back-to-back, neighbours in a single write, then the ACK/NAKs are matched to
+ * them in order since the receiver answers its input in order. NAKed frames
+ * are sent again. Every CFG-MSG answer looks the same, so if any went missing
+ * the rest can't be matched and the whole round is sent again.
+ * Returns a bit per item that was never acknowledged, 0 if all of them were
+ */
+uint32_t GPS_Configure(const UBX_CFG_MSG_FRAME *items, uint32_t count) {
+    uint8_t sent[GPS_CFG_MAX_ITEMS];
+
+    if (count > GPS_CFG_MAX_ITEMS) count = GPS_CFG_MAX_ITEMS;
+    uint32_t pending = count == 32 ? 0xFFFFFFFF : (1UL << count) - 1;
+
+    for (uint32_t round = 0; round < GPS_CFG_TRIES && pending != 0; round++) {
+        uint32_t sentCount = 0;
+        gpsCfgAnswers = 0;
+
+        for (uint32_t i = 0; i < count; ) {
+            uint32_t run = 0;
+            while (i + run < count && (pending & (1UL << (i + run))) &&
+                   (run + 1) * UBX_CFG_MSG_LEN <= GPS_WRITE_MAX) {
+                sent[sentCount++] = i + run;
+                run++;
+            }
+
+            if (run == 0) {
+                i++;
+                continue;
+            }
+            if (round > 0) telemetry.cfgRetries += run;
+
+            // a failed write just leaves its items unanswered
+            gpsTransport->write((uint8_t *) items[i], run * UBX_CFG_MSG_LEN);
+            i += run;
+        }
+
+        GPS_WaitAnswers(&gpsCfgAnswers, sentCount);
+        if (gpsCfgAnswers != sentCount) continue;
+        for (uint32_t k = 0; k < sentCount; k++) {
+            if (gpsCfgAcked[k]) pending &= ~(1UL << sent[k]);
+        }
     }
-    
-    char data_stream[available_bytes+1];
-    if (I2C1_ReadStr(GPS_I2C_ADDR, DATA_STREAM_REG, data_stream, available_bytes)) {
-        snprintf(msg.status, NMEA_RMC_LEN_STATUS+1, "%s", commError);
-        return msg;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (pending & (1UL << i)) telemetry.cfgFailures++;
     }
+    return pending;
+}
 
-    data_stream[available_bytes] = '\0';
-    // LCD_ClearDisplay(); LCD_PrintStringCentered("parse");
-    return GPS_ParseData_NMEA(data_stream);
+/*
+ * FNV-1a hash of the configuration frames and the port settings they go with.
+ * Never 0, which marks no saved configuration
+ */
+uint32_t GPS_ConfigHash(const UBX_CFG_MSG_FRAME *items, uint32_t count) {
+    uint32_t hash = 2166136261UL;
+    uint8_t *data = (uint8_t *) items;
+
+    for (uint32_t i = 0; i < count * UBX_CFG_MSG_LEN; i++) hash = (hash ^ data[i]) * 16777619UL;
+    hash = (hash ^ thisGPS->port) * 16777619UL;
+    for (uint32_t i = 0; i < 4; i++) hash = (hash ^ ((thisGPS->baud >> (8 * i)) & 0xFF)) * 16777619UL;
+
+    return hash != 0 ? hash : 1;
 }
 
 /*
- * Parse received data sent with NMEA or UBX protocol
+ * Poll the receiver for the rates of the items flagged in keys, back-to-back,
+ * and compare them with the rates the items set on the port in use.
+ * Returns 1 if they all match, 0 otherwise
+ */
+uint8_t GPS_ConfigMatches(const UBX_CFG_MSG_FRAME *items, uint32_t count, uint32_t keys) {
+    uint8_t poll[2 + UBX_FRAME_OVERHEAD];
+    uint32_t polled = 0;
+
+    if (count > GPS_CFG_MAX_ITEMS) count = GPS_CFG_MAX_ITEMS;
+    gpsCfgPolls = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!(keys & (1UL << i))) continue;
+        uint32_t len = UBX_Frame(poll, UBX_CLASS_CFG, UBX_ID_CFG_MSG, &items[i][6], 2);
+        gpsTransport->write(poll, len);
+        polled++;
+    }
+
+    GPS_WaitAnswers(&gpsCfgPolls, polled);
+    if (gpsCfgPolls != polled) return 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!(keys & (1UL << i))) continue;
+
+        uint8_t found = 0;
+        for (uint32_t k = 0; k < gpsCfgPolls && !found; k++) {
+            found = gpsCfgPolled[k][0] == items[i][6] && gpsCfgPolled[k][1] == items[i][7] &&
+                    gpsCfgPolled[k][2] == items[i][8];
+        }
+        if (!found) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Save the receiver's port settings and message rates to its battery backed
+ * RAM with CFG-CFG. Returns 1 on failure, 0 otherwise
+ */
+uint8_t GPS_SaveConfig(void) {
+    // clearMask, saveMask, loadMask, deviceMask
+    const uint8_t payload[13] = { 0, 0, 0, 0, UBX_CFG_CFG_IOPORT | UBX_CFG_CFG_MSGCONF, 0, 0, 0,
+                                  0, 0, 0, 0, UBX_CFG_CFG_DEV_BBR };
+    uint8_t frame[sizeof(payload) + UBX_FRAME_OVERHEAD];
+
+    uint32_t len = UBX_Frame(frame, UBX_CLASS_CFG, UBX_ID_CFG_CFG, payload, sizeof(payload));
+    gpsCfgAnswers = 0;
+    gpsTransport->write(frame, len);
+
+    GPS_WaitAnswers(&gpsCfgAnswers, 1);
+    if (gpsCfgAnswers == 0 || !gpsCfgAcked[0]) return 1; // FAILURE
+    return 0;
+}
+
+/*
+ * Set how often the receiver navigates with CFG-RATE, one solution every
+ * measRate ms, each output. It isn't saved, so a reset goes back to the
+ * receiver's default of one a second. Returns 1 on failure, 0 otherwise
+ */
+uint8_t GPS_SetNavRate(uint16_t measRate) {
+    // measRate, navRate, timeRef
+    const uint8_t payload[6] = { measRate & 0xFF, measRate >> 8, 1, 0, UBX_CFG_RATE_TIME_GPS, 0 };
+    uint8_t frame[sizeof(payload) + UBX_FRAME_OVERHEAD];
+
+    uint32_t len = UBX_Frame(frame, UBX_CLASS_CFG, UBX_ID_CFG_RATE, payload, sizeof(payload));
+    gpsCfgAnswers = 0;
+    gpsTransport->write(frame, len);
+
+    GPS_WaitAnswers(&gpsCfgAnswers, 1);
+    if (gpsCfgAnswers == 0 || !gpsCfgAcked[0]) return 1; // FAILURE
+    return 0;
+}
+
+/*
+ * Switch the receiver between continuous operation and the power save mode
+ * set up with CFG-PM2, with CFG-RXM. Returns 1 on failure, 0 otherwise
+ */
+static uint8_t GPS_SetLowPowerMode(uint8_t lpMode) {
+    // reserved, lpMode
+    const uint8_t payload[2] = { 8, lpMode };
+    uint8_t frame[sizeof(payload) + UBX_FRAME_OVERHEAD];
+
+    uint32_t len = UBX_Frame(frame, UBX_CLASS_CFG, UBX_ID_CFG_RXM, payload, sizeof(payload));
+    gpsCfgAnswers = 0;
+    gpsTransport->write(frame, len);
+
+    GPS_WaitAnswers(&gpsCfgAnswers, 1);
+    if (gpsCfgAnswers == 0 || !gpsCfgAcked[0]) return 1; // FAILURE
+    return 0;
+}
+
+/*
+ * Put the receiver in power save mode with CFG-PM2 and CFG-RXM: a position
+ * every updatePeriod ms, cyclic tracking or ON/OFF as flags say, and a new
+ * search every searchPeriod ms while it can't get one. Neither is saved, so a
+ * reset goes back to continuous operation. Returns 1 on failure, 0 otherwise
+ */
+uint8_t GPS_SetPowerSave(uint32_t flags, uint32_t updatePeriod, uint32_t searchPeriod) {
+    uint8_t payload[UBX_CFG_PM2_LEN - UBX_FRAME_OVERHEAD] = { UBX_CFG_PM2_VERSION };
+    uint8_t frame[UBX_CFG_PM2_LEN];
+
+    for (uint8_t i = 0; i < 4; i++) {
+        payload[UBX_CFG_PM2_FLAGS + i] = (flags >> (8 * i)) & 0xFF;
+        payload[UBX_CFG_PM2_UPDATE_PERIOD + i] = (updatePeriod >> (8 * i)) & 0xFF;
+        payload[UBX_CFG_PM2_SEARCH_PERIOD + i] = (searchPeriod >> (8 * i)) & 0xFF;
+    }
+
+    // onTime stays 0: off or at low power again as soon as the fix is out
+    uint32_t len = UBX_Frame(frame, UBX_CLASS_CFG, UBX_ID_CFG_PM2, payload, sizeof(payload));
+    gpsCfgAnswers = 0;
+    gpsTransport->write(frame, len);
+
+    GPS_WaitAnswers(&gpsCfgAnswers, 1);
+    if (gpsCfgAnswers == 0 || !gpsCfgAcked[0]) return 1; // FAILURE
+
+    return GPS_SetLowPowerMode(UBX_CFG_RXM_POWER_SAVE);
+}
+
+/*
+ * Take the receiver out of power save mode. Returns 1 on failure, 0 otherwise
+ */
+uint8_t GPS_SetContinuous(void) {
+    return GPS_SetLowPowerMode(UBX_CFG_RXM_CONTINUOUS);
+}
+
+/*
+ * Bring the receiver to the configuration in items. A receiver that kept the
+ * configuration saved last time in its battery backed RAM, going by the hash
+ * in the backup registers and a poll of the items flagged in keys, is left
+ * alone. Otherwise it is configured and the result saved.
+ * Returns a bit per item that was never acknowledged, 0 if all of them were
+ */
+uint32_t GPS_EnsureConfig(const UBX_CFG_MSG_FRAME *items, uint32_t count, uint32_t keys) {
+    uint32_t hash = GPS_ConfigHash(items, count);
+
+    if (BACKUP_Read(BACKUP_GPS_CFG_HASH) == hash && GPS_ConfigMatches(items, count, keys)) {
+        telemetry.cfgReused = 1;
+        return 0;
+    }
+
+    // nothing is known to be saved until the receiver says so
+    BACKUP_Write(BACKUP_GPS_CFG_HASH, 0);
+
+    uint32_t failed = GPS_Configure(items, count);
+    if (failed == 0 && GPS_SaveConfig() == 0) BACKUP_Write(BACKUP_GPS_CFG_HASH, hash);
+
+    return failed;
+}
+
+/*
+ * Poll NAV-STATUS for the receiver's time to first fix since it started.
+ * Returns it in ms, 0 if there is no fix or no answer
+ */
+uint32_t GPS_PollTTFF(void) {
+    uint8_t frame[UBX_FRAME_OVERHEAD];
+
+    uint32_t len = UBX_Frame(frame, UBX_CLASS_NAV, UBX_ID_NAV_STATUS, NULL, 0);
+    gpsNavStatus = 0;
+    gpsTTFF = 0;
+    gpsTransport->write(frame, len);
+
+    GPS_WaitAnswers(&gpsNavStatus, 1);
+    return gpsTTFF;
+}
+
+/*
+ * Note how far DMA has written to gpsRx, for GPS_USART_Read to take in from
+ * the main loop. Runs from the USART2 idle line and DMA half/full interrupts,
+ * at least twice per lap of the buffer
+ */
+void GPS_USART2ReceivedInterrupt(void) {
+    uint32_t head = USART2_RxHead();
+    uint32_t n = (head + GPS_RX_BUF_SIZE - gpsRxHead) % GPS_RX_BUF_SIZE;
+
+    if (n != 0) {
+        gpsRxReceived += n;
+        gpsRxAt = TIMEBASE_Now();
+    }
+    gpsRxHead = head;
+}
+
+/*
+ * Take in what the receiver has sent over USART2 since the last call. Called
+ * while the main loop waits, so the buffer doesn't come round meanwhile
+ */
+void GPS_Serve(void) {
+    if (gpsTransport == &usartTransport) GPS_USART_Read();
+}
+
+/*
+ * Whether a flash erase can stall the CPU now without USART2 DMA writing over
+ * what hasn't been demultiplexed: everything received was taken, the last
+ * burst is over and the next isn't due within the stall. Always over DDC,
+ * which the receiver only sends on when read
+ */
+uint8_t GPS_Quiet(void) {
+    if (gpsTransport != &usartTransport) return 1;
+
+    GPS_USART_Read();
+    uint32_t since = TIMEBASE_Elapsed(gpsRxAt) % 1000000;
+    return USART2_RxHead() == gpsRxTail && since >= GPS_QUIET_US && since + GPS_STALL_US < GPS_BURST_DUE_US;
+}
+
+/*
+ * Note where the USART2 buffer stands as a flash erase starts
+ */
+void GPS_StallBegin(void) {
+    gpsStallAt = TIMEBASE_Now();
+    gpsStallHead = USART2_RxHead();
+    gpsStallRoom = GPS_RX_BUF_SIZE - (gpsStallHead + GPS_RX_BUF_SIZE - gpsRxTail) % GPS_RX_BUF_SIZE;
+}
+
+/*
+ * Count what the erase since GPS_StallBegin may have cost, if the receiver
+ * sent anything during it: as many bytes as the UART carries in that time,
+ * past the room the buffer had
+ */
+void GPS_StallEnd(void) {
+    if (gpsTransport != &usartTransport) return;
+
+    uint64_t most = (uint64_t) TIMEBASE_Elapsed(gpsStallAt) * (thisGPS->baud / 10) / 1000000;
+    if (USART2_RxHead() != gpsStallHead && most > gpsStallRoom) telemetry.rxLost += most - gpsStallRoom;
+}
+
+/*
+ * Take the fix merged so far and leave FIX_NO_DATA in its place
+ */
+static FIX GPS_TakeFix(void) {
+    FIX fix = gpsFix;
+    memset(&gpsFix, 0, sizeof(gpsFix));
+    gpsFix.status = FIX_NO_DATA;
+
+    return fix;
+}
+
+/*
+ * Get data from the GPS. The fix merges the sentences of the last epoch
+ * demultiplexed since the previous call, it is valid once an RMC or GLL says so
+ */
+FIX GPS_GetData_NMEA() {
+    PROF_BEGIN(PROF_GPS_READ);
+    uint8_t failed = gpsTransport->read();
+    PROF_END(PROF_GPS_READ);
+
+    FIX fix = GPS_TakeFix();
+    if (failed) fix.status = FIX_COMM_ERROR;
+    return fix;
+}
+
+/*
+ * Poll GSA and GSV for the satellite table and take in the answers. Called
+ * after the fix has been logged, so the answers are read here and never
+ * queued ahead of the next sample's RMC. Returns 1 on failure, 0 otherwise
+ */
+uint8_t GPS_PollSatellites(void) {
+    NMEA_PollGNQ(NMEA_GSA);
+    NMEA_PollGNQ(NMEA_GSV);
+
+    // USART2 is taken in as the answers come so its buffer doesn't come
+    // round, DDC holds them
+    uint32_t start = TIMEBASE_Now();
+    while (TIMEBASE_Elapsed(start) < GPS_POLL_ANSWER_MS * 1000) GPS_Serve();
+    return gpsTransport->read();
+}
+
+/*
+ * Parse received data, which may interleave NMEA, UBX and RTCM frames
  * NMEA Frame: | $ | <address> | {,<value} | <checksum> | <CR><LF> |
  *      ie: $GPGLL,4717.11634,N,00833.91297,E,124923.00,A,A*6E
  *          $xxDTM,datum,subDatum,lat,NS,lon,EW,alt,refDatum*cs<CR><LF>
+ * UBX Frame: | 0xB5 0x62 | class | ID | length | payload | CK_A CK_B |
+ * RTCM3 Frame: | 0xD3 | length | message | CRC24Q |
  */
-NMEA_MSG GPS_ParseData_NMEA(char* data) {
-    NMEA_MSG msg;
-
-    if (data[0] != '$') {
-        snprintf(msg.status, NMEA_RMC_LEN_STATUS+1, "%s", commError);
-        return msg;
-    }
-    
-    return NMEA_ParseData(data);
+FIX GPS_ParseData_NMEA(char* data) {
+    DEMUX_Feed(&gpsDemux, (uint8_t *) data, strlen(data));
+    return GPS_TakeFix();
 }
 
 /*
@@ -95,7 +625,7 @@ NMEA_MSG GPS_ParseData_NMEA(char* data) {
  */
 void GPS_PollData(PROTOCOL prot, char* msgid) {
     switch (prot) {
-        case NMEA: NMEA_PollGNQ(msgid, GPS_I2C_ADDR); break;
+        case NMEA: NMEA_PollGNQ(msgid); break;
         case NONE:
         default:
             return;
@@ -106,5 +636,5 @@ void GPS_PollData(PROTOCOL prot, char* msgid) {
  * Set rate of NMEA messages
  */
 void GPS_SetRateNMEA(char* msgid, GPS_INTERFACE port, unsigned int rate) {
-    NMEA_SetRate(msgid, port, rate, GPS_I2C_ADDR);
+    NMEA_SetRate(msgid, port, rate);
 }
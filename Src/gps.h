@@ -1,7 +1,7 @@
 /*
  * File: gps.h
  * Purpose: Declares functions that allow interaction with the SAM-M8Q GPS
- *          via I2C1
+ *          via I2C1 (DDC) or USART2
  * Datasheet: https://www.u-blox.com/sites/default/files/products/documents/u-blox8-M8_ReceiverDescrProtSpec_%28UBX-13003221%29.pdf
  */
 #ifndef __GPS_H
@@ -10,6 +10,7 @@
 #include "utilities.h"
 #include "nmea.h"
 #include "ubx.h"
+#include "demux.h"
 
 #define GPS_I2C_ADDR 0x42
 
@@ -21,25 +22,78 @@
 #define AVAIL_BYTES_LOW_REG  0xFE
 #define DATA_STREAM_REG      0xFF
 
-typedef enum {
-    NONE,
-    NMEA,
-    UBX,
-    RTCM
-} PROTOCOL;
+// Largest single read of the data stream
+#define GPS_READ_CHUNK 64
+
+// Largest single write, I2C1 counts the bytes of a transfer in 8 bits
+#define GPS_WRITE_MAX 255
+
+// GPS_Configure takes up to GPS_CFG_MAX_ITEMS frames, one bit each in its
+// result, and sends the unacknowledged ones up to GPS_CFG_TRIES times. The
+// receiver answers a CFG message within a second
+#define GPS_CFG_MAX_ITEMS  32
+#define GPS_CFG_TRIES      3
+#define GPS_CFG_TIMEOUT_US 1000000
+
+// Time the receiver takes to answer an NMEA poll, all parts of a GSV included
+#define GPS_POLL_ANSWER_MS 100
+
+// Receiver UART rate out of reset, see GPS_Setup
+#define GPS_UART_DEFAULT_BAUD 9600
+
+// USART2 DMA receive buffer. Half of it should outlast the demultiplexing of a burst
+#define GPS_RX_BUF_SIZE 512
+
+// A flash erase stalls the CPU this long, and nothing takes what DMA writes
+// into the buffer meanwhile. Erases wait for the line to have been idle
+// GPS_QUIET_US after a burst, and for the next burst, which comes a whole
+// number of seconds after the last, to be no sooner than GPS_BURST_DUE_US
+// after its end
+#define GPS_STALL_US     40000
+#define GPS_QUIET_US     5000
+#define GPS_BURST_DUE_US 900000
 
 typedef struct {
     uint8_t i2c_scl;
     uint8_t i2c_sda;
+    uint8_t usart_tx;       // USART2 pins on GPIOA
+    uint8_t usart_rx;
+    GPS_INTERFACE port;     // receiver port wired to the board, GPS_DDC or GPS_USART1
+    uint32_t baud;          // rate to run GPS_USART1 at
 } GPS;
 
+// How messages get to and from the receiver
+typedef struct {
+    uint8_t (*write)(uint8_t *data, uint32_t len); // send len bytes, at most GPS_WRITE_MAX.
+                                                   // Returns 1 on failure, 0 otherwise
+    uint8_t (*read)(void);          // demultiplex what has arrived.
+                                    // Returns 1 on failure, 0 otherwise
+} GPS_TRANSPORT;
+
 GPS *thisGPS;
 
 
-void GPS_Setup(GPS *gps);
+uint8_t GPS_Setup(GPS *gps);
+uint8_t GPS_Write(char *str);
+uint8_t GPS_WriteBytes(uint8_t *data, uint32_t len);
+uint32_t GPS_Configure(const UBX_CFG_MSG_FRAME *items, uint32_t count);
+uint32_t GPS_ConfigHash(const UBX_CFG_MSG_FRAME *items, uint32_t count);
+uint8_t GPS_ConfigMatches(const UBX_CFG_MSG_FRAME *items, uint32_t count, uint32_t keys);
+uint8_t GPS_SaveConfig(void);
+uint32_t GPS_EnsureConfig(const UBX_CFG_MSG_FRAME *items, uint32_t count, uint32_t keys);
+uint8_t GPS_SetNavRate(uint16_t measRate);
+uint8_t GPS_SetPowerSave(uint32_t flags, uint32_t updatePeriod, uint32_t searchPeriod);
+uint8_t GPS_SetContinuous(void);
+uint32_t GPS_PollTTFF(void);
+void GPS_USART2ReceivedInterrupt(void);
+void GPS_Serve(void);
+uint8_t GPS_Quiet(void);
+void GPS_StallBegin(void);
+void GPS_StallEnd(void);
 
-NMEA_MSG GPS_GetData_NMEA(void);
-NMEA_MSG GPS_ParseData_NMEA(char* data);
+FIX GPS_GetData_NMEA(void);
+uint8_t GPS_PollSatellites(void);
+FIX GPS_ParseData_NMEA(char* data);
 void GPS_PollData(PROTOCOL prot, char* msgid);
 void GPS_SetRateNMEA(char* msgid, GPS_INTERFACE port, unsigned int rate);
 
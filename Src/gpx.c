@@ -0,0 +1,136 @@
+/*
+ * File: gpx.c
+ * Purpose: Converts fixes into GPX track points. The scan reads a track file
+ *          line by line to find the last whole record, so a file that was cut
+ *          off in the middle of a batch can be closed right after it. OpenLog
+ *          writes the line feeds as spaces, so a line ends at a space after
+ *          the > that closes it, which no line has in the middle
+ */
+#include "gpx.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Write a coordinate in 1e-7 degrees as decimal degrees with 7 places.
+ * out must hold GPX_COORD_LEN characters
+ */
+void GPX_FormatCoord(int32_t coord, char *out) {
+    uint32_t mag = coord < 0 ? -(uint32_t) coord : (uint32_t) coord;
+
+    snprintf(out, GPX_COORD_LEN, "%s%lu.%07lu", coord < 0 ? "-" : "",
+             (unsigned long) (mag / 10000000), (unsigned long) (mag % 10000000));
+}
+
+/*
+ * Write the <trkpt> line for a fix. Returns the number of characters written
+ */
+int GPX_FormatTrackPoint(FIX *fix, char *buf, uint32_t len) {
+    char lat[GPX_COORD_LEN], lon[GPX_COORD_LEN];
+    char ele[GPX_COORD_LEN] = "0";
+
+    GPX_FormatCoord(fix->lat, lat);
+    GPX_FormatCoord(fix->lon, lon);
+    if (fix->flags & FIX_HAS_ALT) {
+        uint32_t mag = fix->alt < 0 ? -(uint32_t) fix->alt : (uint32_t) fix->alt;
+        snprintf(ele, sizeof(ele), "%s%lu.%03lu", fix->alt < 0 ? "-" : "",
+                 (unsigned long) (mag / 1000), (unsigned long) (mag % 1000));
+    }
+
+    return snprintf(buf, len, "\t\t<trkpt lat=\"%s\" lon=\"%s\"><ele>%s</ele><time>20%02u-%02u-%02uT%02u:%02u:%02uZ</time></trkpt>\n",
+                    lat, lon, ele, (unsigned) FIX_YEAR(fix->datetime), (unsigned) FIX_MONTH(fix->datetime), \
+                    (unsigned) FIX_DAY(fix->datetime), (unsigned) FIX_HOUR(fix->datetime), \
+                    (unsigned) FIX_MINUTE(fix->datetime), (unsigned) FIX_SECOND(fix->datetime));
+}
+
+/*
+ * Start a scan of a track file from byte start. Past the start of the file
+ * the header is taken as read, and the line the scan lands in is skipped
+ */
+void GPX_ScanInit(GPX_SCAN *scan, uint32_t start) {
+    memset(scan, 0, sizeof(*scan));
+    scan->offset = start;
+    scan->blank = 1;
+    scan->skip = start > 0;
+    scan->opened = start > 0;
+}
+
+/*
+ * Whether the line just read starts or ends with s, at most GPX_SCAN_EDGE long
+ */
+static uint8_t GPX_LineStarts(GPX_SCAN *scan, const char *s) {
+    uint32_t n = strlen(s);
+    return scan->lineLen >= n && memcmp(scan->head, s, n) == 0;
+}
+
+static uint8_t GPX_LineEnds(GPX_SCAN *scan, const char *s) {
+    uint32_t n = strlen(s);
+    return scan->lineLen >= n && memcmp(&scan->tail[GPX_SCAN_EDGE - n], s, n) == 0;
+}
+
+/*
+ * Sort out the line that just ended. A cut leaves part of a record run into
+ * what was left of the trailer it was written over, which is neither. Until
+ * the first record, lines that are neither are the header
+ */
+static void GPX_ScanLine(GPX_SCAN *scan) {
+    if (scan->skip) {
+        scan->skip = 0;
+        return;
+    }
+    if (scan->broken || scan->blank) return; // past the cut, or padding
+
+    if (scan->trailer) {
+        scan->trailer = 0;
+        if (scan->lineLen == 6 && GPX_LineStarts(scan, "</gpx>")) scan->closed = 1;
+        else scan->broken = 1;
+    }
+    else if (scan->closed) {
+        scan->broken = 1; // nothing but padding follows the trailer
+    }
+    else if (scan->lineLen == 16 && GPX_LineStarts(scan, "\t</trkse") && GPX_LineEnds(scan, "g></trk>")) {
+        scan->trailer = 1;
+    }
+    else if (GPX_LineStarts(scan, "\t<trk>") && GPX_LineEnds(scan, "<trkseg>")) {
+        scan->opened = 1;
+        scan->end = scan->offset;
+    }
+    else if (scan->opened && ((GPX_LineStarts(scan, "\t\t<trkpt") && GPX_LineEnds(scan, "</trkpt>")) ||
+                              (GPX_LineStarts(scan, "\t<!-- ") && GPX_LineEnds(scan, " -->")))) {
+        scan->end = scan->offset;
+    }
+    else if (scan->end != 0) {
+        scan->broken = 1;
+    }
+}
+
+/*
+ * Follow the next len bytes of the file
+ */
+void GPX_Scan(GPX_SCAN *scan, const uint8_t *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        char c = data[i];
+        scan->offset++;
+
+        if (c == '\n' || (c == ' ' && scan->lineLen != 0 && scan->tail[GPX_SCAN_EDGE - 1] == '>')) {
+            GPX_ScanLine(scan);
+            scan->lineLen = 0;
+            scan->blank = 1;
+            continue;
+        }
+
+        if (scan->lineLen < GPX_SCAN_EDGE) scan->head[scan->lineLen] = c;
+        scan->lineLen++;
+        memmove(scan->tail, &scan->tail[1], GPX_SCAN_EDGE - 1);
+        scan->tail[GPX_SCAN_EDGE - 1] = c;
+        if (c != ' ') scan->blank = 0;
+    }
+}
+
+/*
+ * Whether the file scanned ends with the trailer, or the padding after one.
+ * If not, end is where GPX_TRAILER goes to close it, 0 if nothing was found
+ * to close
+ */
+uint8_t GPX_ScanClosed(GPX_SCAN *scan) {
+    return scan->closed && !scan->broken && scan->blank;
+}
@@ -0,0 +1,51 @@
+/*
+ * File: gpx.h
+ * Purpose: Declares the conversion of fixes into GPX track points, and the
+ *          scan that finds where a track file that was cut off can be closed
+ */
+#ifndef __GPX_H
+#define __GPX_H
+
+#include "fix.h"
+#include <stdint.h>
+
+// -ddd.ddddddd and the null
+#define GPX_COORD_LEN 13
+
+// One <trkpt> line, see GPX_FormatTrackPoint
+#define GPX_TRKPT_LEN 128
+
+// Closes the track. Written after every batch and written over by the next,
+// so the file is valid GPX at each of them. Like every line feed written
+// into the track, its line feeds reach the file as spaces
+#define GPX_TRAILER "\t</trkseg></trk>\n</gpx>\n"
+
+// Characters kept from each end of a line to tell records from what is left
+// when a write was cut off
+#define GPX_SCAN_EDGE 8
+
+// Bytes from the end of a track file that hold the batch it was cut off in
+// and the record before it
+#define GPX_SCAN_TAIL 2048
+
+typedef struct {
+    uint32_t offset;    // of the next byte
+    uint32_t lineLen;   // length of the line being read
+    char head[GPX_SCAN_EDGE];   // its first and last characters
+    char tail[GPX_SCAN_EDGE];
+    uint8_t blank;      // it is all spaces so far
+    uint8_t skip;       // it started before the scan did
+    uint8_t opened;     // records may follow, the scan is past the <trkseg> line
+    uint8_t trailer;    // the last line was the first one of GPX_TRAILER
+    uint8_t closed;     // the last line that isn't blank ends GPX_TRAILER
+    uint8_t broken;     // a line that is none of the above, the cut is there
+    uint32_t end;       // offset after the last whole record
+} GPX_SCAN;
+
+void GPX_FormatCoord(int32_t coord, char *out);
+int GPX_FormatTrackPoint(FIX *fix, char *buf, uint32_t len);
+void GPX_ScanInit(GPX_SCAN *scan, uint32_t start);
+void GPX_Scan(GPX_SCAN *scan, const uint8_t *data, uint32_t len);
+uint8_t GPX_ScanClosed(GPX_SCAN *scan);
+
+#endif /* __GPX_H */
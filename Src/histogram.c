@@ -0,0 +1,69 @@
+/*
+ * File: histogram.c
+ * Purpose: Defines a small running statistics accumulator with log2 buckets
+ */
+#include "histogram.h"
+#include <stdio.h>
+
+/*
+ * Clear all samples
+ */
+void HIST_Reset(HISTOGRAM *hist) {
+    hist->count = 0;
+    hist->min = 0xFFFFFFFF;
+    hist->max = 0;
+    hist->sum = 0;
+    for (int i = 0; i < HIST_BINS; i++) hist->bins[i] = 0;
+}
+
+/*
+ * Find which bin value falls in. The M0 has no CLZ instruction, so shift down
+ */
+uint8_t HIST_Bin(uint32_t value) {
+    uint8_t bin = 0;
+    while (value != 0 && bin < HIST_BINS-1) {
+        value >>= 1;
+        bin++;
+    }
+    return bin;
+}
+
+/*
+ * Record a sample
+ */
+void HIST_Add(HISTOGRAM *hist, uint32_t value) {
+    if (hist->count == 0 || value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+    hist->sum += value;
+    hist->count++;
+
+    uint8_t bin = HIST_Bin(value);
+    if (hist->bins[bin] != 0xFFFF) hist->bins[bin]++; // saturate instead of wrapping
+}
+
+/*
+ * Average of all samples, 0 if there are none
+ */
+uint32_t HIST_Mean(HISTOGRAM *hist) {
+    if (hist->count == 0) return 0;
+    return (uint32_t)(hist->sum / hist->count);
+}
+
+/*
+ * Write a one line summary into buf: count, min, max, mean, then each non-empty
+ * bin as <upper bound>:<count>. Returns the number of characters written
+ */
+int HIST_Format(HISTOGRAM *hist, char *buf, uint32_t len) {
+    int written = snprintf(buf, len, "n=%lu min=%lu max=%lu mean=%lu",
+                           (unsigned long) hist->count, (unsigned long) (hist->count ? hist->min : 0),
+                           (unsigned long) hist->max, (unsigned long) HIST_Mean(hist));
+
+    for (int i = 0; i < HIST_BINS && written >= 0 && (uint32_t) written < len; i++) {
+        if (hist->bins[i] == 0) continue;
+        written += snprintf(&buf[written], len - written, " <%lu:%u",
+                            (unsigned long) (1UL << i), hist->bins[i]);
+    }
+
+    if (written < 0) return 0;
+    return (uint32_t) written < len ? written : (int)(len - 1);
+}
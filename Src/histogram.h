@@ -0,0 +1,28 @@
+/*
+ * File: histogram.h
+ * Purpose: Declares a small running statistics accumulator with log2 buckets,
+ *          used for latency and timing measurements
+ */
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <stdint.h>
+
+// bins[0] counts zeros, bins[i] counts values in [2^(i-1), 2^i), the last bin catches the rest
+#define HIST_BINS 24
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint16_t bins[HIST_BINS];
+} HISTOGRAM;
+
+void HIST_Reset(HISTOGRAM *hist);
+void HIST_Add(HISTOGRAM *hist, uint32_t value);
+uint32_t HIST_Mean(HISTOGRAM *hist);
+uint8_t HIST_Bin(uint32_t value);
+int HIST_Format(HISTOGRAM *hist, char *buf, uint32_t len);
+
+#endif /* __HISTOGRAM_H */
@@ -3,25 +3,88 @@
  * Purpose: Define the utility functions pertaining to the I2C1 peripheral
  */
 #include "utilities.h"
+#include "timebase.h"
+#include "telemetry.h"
 #include <string.h>
 
+/*
+ * Get the frequency of the I2C1 kernel clock. It runs from the HSI unless
+ * I2C1SW selects SYSCLK
+ */
+uint32_t I2C1_GetClockFreq(void) {
+	if (RCC->CFGR3 & RCC_CFGR3_I2C1SW_Msk)
+		return HAL_RCC_GetSysClockFreq();
+	return HSI_VALUE;
+}
+
 /*
  * Configures the I2C1 peripheral to 100kHz
  * TODO: up this to 400kHz
  */
 void I2C1_Config() {
 	// Configure bus timing using I2Cx_TIMINGR for 100 kHz
-	// PRESC = 1, SCLL = 0x13, SCLH = 0xF, SDADEL = 0x2, SCLDEL = 0x4
+	// PRESC gives a 250 ns tPRESC from the live clock (1 at 8 MHz, 0xB at 48 MHz)
+	// SCLL = 0x13, SCLH = 0xF, SDADEL = 0x2, SCLDEL = 0x4 in units of tPRESC
+	uint32_t presc = (I2C1_GetClockFreq() / I2C_TIMING_TPRESC_HZ) - 1;
+	if (presc > 0xF) presc = 0xF;
 	// Clear the register
 	I2C1->TIMINGR = 0x00000000;
 	// Set everything
-	I2C1->TIMINGR |= (0x1 << I2C_TIMINGR_PRESC_Pos);
+	I2C1->TIMINGR |= (presc << I2C_TIMINGR_PRESC_Pos);
 	I2C1->TIMINGR |= (0x4 << I2C_TIMINGR_SCLDEL_Pos);
 	I2C1->TIMINGR |= (0x2 << I2C_TIMINGR_SDADEL_Pos);
 	I2C1->TIMINGR |= (0xF << I2C_TIMINGR_SCLH_Pos);
 	I2C1->TIMINGR |= (0x13 << I2C_TIMINGR_SCLL_Pos);
 }
 
+/*
+ * Recompute the bus timing after a clock change. TIMINGR can only be written
+ * while the peripheral is disabled, so wait for the bus to go idle first
+ */
+void I2C1_UpdateTiming() {
+	if (!(I2C1->CR1 & I2C_CR1_PE_Msk)) return; // not set up yet
+
+	while (I2C1->ISR & I2C_ISR_BUSY_Msk);
+
+	I2C1->CR1 &= ~I2C_CR1_PE_Msk;
+	I2C1_Config();
+	I2C1->CR1 |= I2C_CR1_PE_Msk;
+}
+
+/*
+ * Software reset of I2C1 after a stalled transfer. PE must stay low for at
+ * least 3 APB clock cycles
+ */
+void I2C1_Recover() {
+	I2C1->CR1 &= ~I2C_CR1_PE_Msk;
+	while (I2C1->CR1 & I2C_CR1_PE_Msk);
+	I2C1->CR1 |= I2C_CR1_PE_Msk;
+}
+
+/*
+ * Wait for flag in ISR. A NACK (the hardware sends the STOP itself) or a stalled
+ * bus ends the wait early and is counted in the telemetry.
+ * Returns 1 on NACK or timeout, 0 once the flag is set
+ */
+uint8_t I2C1_WaitFlag(uint32_t flag) {
+	uint32_t start = TIMEBASE_Now();
+
+	while (!(I2C1->ISR & flag)) {
+		if (I2C1->ISR & I2C_ISR_NACKF_Msk) {
+			I2C1->ICR = I2C_ICR_NACKCF_Msk;
+			telemetry.i2cNacks++;
+			return 1; // FAILURE
+		}
+		if (TIMEBASE_Elapsed(start) > I2C_TIMEOUT_US) {
+			I2C1_Recover();
+			telemetry.i2cTimeouts++;
+			return 1; // FAILURE
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Set up a transaction by setting the info need in the CR2 Reg
  * addr is slave address, bytes is the number of bytes, rdwr is read or write transaction
@@ -66,10 +129,8 @@ uint8_t I2C1_WriteStr(uint32_t addr, uint8_t reg, char *str) {
     I2C1_TransactionSetup(addr, len, WRITE);
 
     for (uint32_t i = 0; i < len; i++) {
-        // Check for TXIS or NACK flag set
-        while (!(I2C1->ISR & I2C_ISR_TXIS_Msk) && !(I2C1->ISR & I2C_ISR_NACKF_Msk));
-        
-        if (I2C1->ISR & I2C_ISR_NACKF_Msk) {
+        // Wait for TXIS, NACK or timeout
+        if (I2C1_WaitFlag(I2C_ISR_TXIS_Msk)) {
             return 1; // FAILURE
         }
 		
@@ -85,27 +146,30 @@ uint8_t I2C1_WriteStr(uint32_t addr, uint8_t reg, char *str) {
 }
 
 /*
- * Send a string of null-terminated data over I2C1 to no register. No stop condition is sent to allow restart condition
+ * Send len bytes of data, at most 255, over I2C1 to no register. No stop condition is sent to allow restart condition
  */
-uint8_t I2C1_WriteStrNoReg(uint32_t addr, char *str) {
-    uint32_t len = strlen(str);
-
+uint8_t I2C1_WriteNoReg(uint32_t addr, uint8_t *data, uint32_t len) {
     I2C1_TransactionSetup(addr, len, WRITE);
 
     for (uint32_t i = 0; i < len; i++) {
-        // Check for TXIS or NACK flag set
-        while (!(I2C1->ISR & I2C_ISR_TXIS_Msk) && !(I2C1->ISR & I2C_ISR_NACKF_Msk));
-        
-        if (I2C1->ISR & I2C_ISR_NACKF_Msk) {
+        // Wait for TXIS, NACK or timeout
+        if (I2C1_WaitFlag(I2C_ISR_TXIS_Msk)) {
             return 1; // FAILURE
         }
 
-        I2C1_SendChar(str[i]);
+        I2C1_SendChar(data[i]);
     }
 
     return 0;
 }
 
+/*
+ * Send a string of null-terminated data over I2C1 to no register. No stop condition is sent to allow restart condition
+ */
+uint8_t I2C1_WriteStrNoReg(uint32_t addr, char *str) {
+    return I2C1_WriteNoReg(addr, (uint8_t *) str, strlen(str));
+}
+
 /*
  * Read a string of data over I2C1 into the provided str buffer. No stop condition is sent to allow restart condition
  */
@@ -122,10 +186,8 @@ uint8_t I2C1_ReadStr(uint32_t addr, uint8_t reg, char str[], uint8_t bytes) {
     //LCD_PrintStringCentered("reading data");
 
     for (uint32_t i = 0; i < bytes; i++) {
-        // Check for RXNE or NACK flag set
-        while (!(I2C1->ISR & I2C_ISR_RXNE_Msk) && !(I2C1->ISR & I2C_ISR_NACKF_Msk));
-		
-        if (I2C1->ISR & I2C_ISR_NACKF_Msk) {
+        // Wait for RXNE, NACK or timeout
+        if (I2C1_WaitFlag(I2C_ISR_RXNE_Msk)) {
             return 1; // FAILURE
         }
 		
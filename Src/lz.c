@@ -0,0 +1,185 @@
+/*
+ * File: lz.c
+ * Purpose: Streaming LZSS compression into a block of static RAM. Where each
+ *          token starts, a hash of the input gives LZ_HASH_WAYS candidates to
+ *          compare up to LZ_MAX_MATCH bytes against, and a match only costs
+ *          as many compares per byte it covers, so the cost per byte stays
+ *          bounded whatever the input. The block is
+ *          escaped as it is written, ready to go to OpenLog as it is. Blocks
+ *          match against the ones before them back to the last LZ_Reset
+ */
+#include "lz.h"
+
+#define LZ_MASK (LZ_WINDOW - 1)
+
+static uint8_t lzRing[LZ_WINDOW];           // input, the newest LZ_WINDOW bytes
+static uint16_t lzHash[1 << LZ_HASH_BITS][LZ_HASH_WAYS]; // low halfwords of positions, newest first
+static uint32_t lzPos;                      // position of the next input byte
+static uint32_t lzStart;                    // oldest position that may be matched against
+static uint8_t lzFresh;                     // the block starts after LZ_Reset
+static uint32_t lzBits;                     // the lzBitCount bits not packed into a byte yet
+static uint32_t lzBitCount;
+
+static uint8_t lzBlock[LZ_BLOCK_LEN];
+static uint32_t lzBlockLen;                 // bytes in lzBlock, escaped
+static uint32_t lzPacked;                   // and before escaping
+static uint8_t lzFull;                      // the input being compressed doesn't fit
+
+/*
+ * Hash of the LZ_HASH_LEN input bytes from pos on
+ */
+static inline uint32_t LZ_Hash(uint32_t pos) {
+    uint32_t hash = 0;
+    for (uint32_t i = 0; i < LZ_HASH_LEN; i++) hash = (hash << 3) ^ (hash >> 9) ^ lzRing[(pos + i) & LZ_MASK];
+    return (hash ^ (hash >> LZ_HASH_BITS)) & ((1 << LZ_HASH_BITS) - 1);
+}
+
+/*
+ * Add a byte to the block, escaped, as long as the byte padding the last
+ * token still fits after it
+ */
+static void LZ_Out(uint8_t c) {
+    if (lzBlockLen + 2 * 2 > LZ_BLOCK_LEN) {
+        lzFull = 1;
+        return;
+    }
+    lzBlockLen += LZ_Escape(c, &lzBlock[lzBlockLen]);
+    lzPacked++;
+}
+
+/*
+ * Pack the low count bits of value after the ones so far
+ */
+static void LZ_Put(uint32_t value, uint32_t count) {
+    lzBits = (lzBits << count) | value;
+    lzBitCount += count;
+    while (lzBitCount >= 8) {
+        lzBitCount -= 8;
+        LZ_Out(lzBits >> lzBitCount);
+    }
+    lzBits &= (1 << lzBitCount) - 1;
+}
+
+/*
+ * Start the next block after the one LZ_Finish handed over
+ */
+void LZ_Next(void) {
+    lzBits = 0;
+    lzBitCount = 0;
+    lzBlockLen = 0;
+    lzPacked = 0;
+    lzFresh = 0;
+}
+
+/*
+ * Start a new block with nothing before it to match against, for a decoder
+ * that may not have the ones before
+ */
+void LZ_Reset(void) {
+    LZ_Next();
+    lzStart = lzPos;
+    lzFresh = 1;
+}
+
+/*
+ * Compress len bytes into the block, greedily taking the longest match of
+ * the candidates if it is long enough. Input that doesn't fit all in is taken back
+ * out, and what it wrote over in the ring isn't matched against any more.
+ * Returns 1 if it doesn't fit, 0 otherwise
+ */
+uint8_t LZ_Compress(const uint8_t *data, uint32_t len) {
+    if (len > LZ_WINDOW) return 1; // FAILURE
+
+    uint32_t pos = lzPos, bits = lzBits, bitCount = lzBitCount, blockLen = lzBlockLen, packed = lzPacked;
+    lzFull = 0;
+    uint32_t end = lzPos + len;
+    for (uint32_t i = 0; i < len; i++) lzRing[(lzPos + i) & LZ_MASK] = data[i];
+
+    while (lzPos != end && !lzFull) {
+        uint32_t left = end - lzPos;
+        uint32_t max = left < LZ_MAX_MATCH ? left : LZ_MAX_MATCH;
+        uint32_t dist = 0;
+        uint32_t best = 0;
+
+        if (left >= LZ_HASH_LEN) {
+            uint16_t *ways = lzHash[LZ_Hash(lzPos)];
+            for (uint32_t way = 0; way < LZ_HASH_WAYS; way++) {
+                uint32_t back = (uint16_t) (lzPos - ways[way]);
+                uint32_t run = 0;
+
+                // since the last LZ_Reset, and not written over by this input
+                if (back != 0 && back <= lzPos - lzStart && back + left <= LZ_WINDOW) {
+                    uint32_t from = lzPos - back;
+                    while (run < max && lzRing[(from + run) & LZ_MASK] == lzRing[(lzPos + run) & LZ_MASK]) run++;
+                }
+                if (run > best) {
+                    best = run;
+                    dist = back;
+                }
+            }
+
+            for (uint32_t way = LZ_HASH_WAYS - 1; way > 0; way--) ways[way] = ways[way-1];
+            ways[0] = lzPos;
+        }
+
+        if (best < LZ_MIN_MATCH) {
+            LZ_Put((LZ_LITERAL << 8) | lzRing[lzPos & LZ_MASK], 9);
+            lzPos++;
+            continue;
+        }
+
+        LZ_Put((LZ_MATCH << (LZ_WINDOW_BITS + LZ_LENGTH_BITS)) | ((dist - 1) << LZ_LENGTH_BITS) | (best - LZ_MIN_MATCH),
+               1 + LZ_WINDOW_BITS + LZ_LENGTH_BITS);
+        lzPos += best;
+    }
+
+    if (lzFull) {
+        if ((int32_t) (end - LZ_WINDOW - lzStart) > 0) lzStart = end - LZ_WINDOW;
+        lzPos = pos;
+        lzBits = bits;
+        lzBitCount = bitCount;
+        lzBlockLen = blockLen;
+        lzPacked = packed;
+        return 1; // FAILURE
+    }
+    return 0;
+}
+
+/*
+ * Bytes LZ_Finish would hand over now, 0 if the block is empty
+ */
+uint32_t LZ_Pending(void) {
+    return lzBlockLen + (lzBitCount != 0 ? 2 : 0);
+}
+
+/*
+ * Pad the last token out to a byte with zeros, too few bits for another, and
+ * hand over the block: its length escaped in len and before escaping in
+ * packed, with LZ_FRESH if it starts after LZ_Reset. It stays until LZ_Next
+ * or LZ_Reset
+ */
+uint8_t *LZ_Finish(uint32_t *len, uint32_t *packed) {
+    if (lzBitCount != 0) { // LZ_Out left room for it
+        lzBlockLen += LZ_Escape(lzBits << (8 - lzBitCount), &lzBlock[lzBlockLen]);
+        lzPacked++;
+        lzBitCount = 0;
+    }
+
+    *len = lzBlockLen;
+    *packed = lzPacked | (lzFresh ? LZ_FRESH : 0);
+    return lzBlock;
+}
+
+/*
+ * Escape c into out for OpenLog's append mode.
+ * Returns the number of bytes written, 1 or 2
+ */
+uint32_t LZ_Escape(uint8_t c, uint8_t *out) {
+    if (c != 26 && c != LZ_ESC) {
+        out[0] = c;
+        return 1;
+    }
+    out[0] = LZ_ESC;
+    out[1] = c ^ LZ_ESC_XOR;
+    return 2;
+}
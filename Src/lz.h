@@ -0,0 +1,61 @@
+/*
+ * File: lz.h
+ * Purpose: Declares the streaming LZSS compressor behind the raw log and the
+ *          format it writes, which the host tools decode. Input goes through
+ *          a 1 KB ring, each token is a flag bit and a literal byte or a
+ *          distance and length into the ring, packed most significant bit
+ *          first. A block matches against the ones before it, back to the
+ *          last one that starts afresh
+ */
+#ifndef __LZ_H
+#define __LZ_H
+
+#include <stdint.h>
+
+// Ring of input bytes matches are looked for in
+#define LZ_WINDOW_BITS 10
+#define LZ_WINDOW      (1 << LZ_WINDOW_BITS)
+
+// Match lengths, a shorter one costs more than its literals. Repeated
+// sentences share long runs
+#define LZ_LENGTH_BITS 6
+#define LZ_MIN_MATCH   3
+#define LZ_MAX_MATCH   (LZ_MIN_MATCH + (1 << LZ_LENGTH_BITS) - 1)
+
+// The newest LZ_HASH_WAYS positions each hash of LZ_HASH_LEN input bytes was
+// seen at are the candidates for a match. Only where tokens start goes in,
+// so the runs repeated every epoch stay in long enough to be matched
+#define LZ_HASH_BITS 7
+#define LZ_HASH_WAYS 2
+#define LZ_HASH_LEN  5
+
+// Token flag bits
+#define LZ_LITERAL 1
+#define LZ_MATCH   0
+
+// Compressed bytes of a block, after escaping
+#define LZ_BLOCK_LEN 384
+
+// Blocks are appended to the raw file, which OpenLog stops on three ctrl-Z
+// in a row, so ctrl-Z and LZ_ESC itself go out as LZ_ESC and the byte xor
+// LZ_ESC_XOR. LZ_ESC and LZ_MARK, which no escaped byte can be, start a block
+#define LZ_ESC     0x1B
+#define LZ_ESC_XOR 0x20
+#define LZ_MARK    'B'
+
+// Block: | LZ_ESC | LZ_MARK | sequence | length | tokens |, sequence and
+// length 16 bits low byte first, and the length counts the token bytes
+// before escaping. The sequence goes up by one with every block written, a
+// block that doesn't follow the one before has LZ_FRESH in its length and
+// matches nothing before it
+#define LZ_HEADER_LEN 4
+#define LZ_FRESH      0x8000
+
+void LZ_Reset(void);
+void LZ_Next(void);
+uint8_t LZ_Compress(const uint8_t *data, uint32_t len);
+uint32_t LZ_Pending(void);
+uint8_t *LZ_Finish(uint32_t *len, uint32_t *packed);
+uint32_t LZ_Escape(uint8_t c, uint8_t *out);
+
+#endif /* __LZ_H */
@@ -21,7 +21,26 @@
 #include "lcd.h"
 #include "openlog.h"
 #include "gps.h"
+#include "gpx.h"
 #include "fatfs.h"
+#include "clock.h"
+#include "timebase.h"
+#include "pps.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "backup.h"
+#include "rtc.h"
+#include "assist.h"
+#include "store.h"
+#include "simplify.h"
+#include "rate.h"
+#include "geofence.h"
+#include "trip.h"
+#include "sat.h"
+#include "psm.h"
+#include "batch.h"
+#include "spool.h"
+#include "rawlog.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -38,15 +57,79 @@
 #define SCL_B 8
 #define SDA_B 9
 
+// UART Pins for GPS (USART2), used when its UART1 is wired up instead
+#define GPS_TX_A 2
+#define GPS_RX_A 3
+#define GPS_BAUD 460800
+
+// Receiver port to use, GPS_DDC or GPS_USART1. Set with GPS_PORT in the Makefile
+#ifndef GPS_PORT
+#define GPS_PORT GPS_DDC
+#endif
+
+// Receiver message rates sent at boot. CFG-MSG applies to the port it arrives
+// on, so the same frames serve DDC and UART
+static const UBX_CFG_MSG_FRAME gpsConfig[] = {
+    // Disable unwanted messages
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_DTM, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_GBS, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_GLL, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_GNS, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_GRS, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_GSA, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_GST, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_GSV, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_TXT, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_VLW, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_VTG, 0),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_ZDA, 0),
+
+    // enable RMC and GGA once per epoch, GGA for the altitude, HDOP and
+    // satellites used
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_RMC, 1),
+    UBX_CFG_MSG(UBX_CLASS_NMEA, UBX_ID_NMEA_GGA, 1)
+};
+
+// gpsConfig items polled at boot to tell whether the receiver still has it:
+// the busiest one out of reset besides GGA, and the ones that are logged
+#define GPS_CONFIG_KEYS ((1UL << 7) | (1UL << 12) | (1UL << 13)) // GSV, RMC, GGA
+
 // UART Pins for SD Card (USART3)
 #define TX_B 10
 #define RX_B 11
 #define RTS_B 14
 
+// Track file on the card
+#define TRACK_FILE "trail.gpx"
+
+// Raw log on the card, with RAWLOG_ENABLED
+#define RAW_FILE "raw.lz"
+
+// Debug UART Pins (USART1)
+#define DEBUG_TX_A 9
+#define DEBUG_RX_A 10
+#define DEBUG_BAUD 115200
+
 
 void SystemClock_Config(void);
+void LogHistogram(char *name, HISTOGRAM *hist);
+void LogTrackPoint(FIX *fix);
+void StartTrack(void);
+void StopTrack(void);
 
 volatile int recorddata = 0;
+static volatile uint8_t buttonPressed;  // set by the button's interrupt, taken by the main loop
+
+/*
+ * Change the clock profile, if it isn't already, with nothing coming from the
+ * receiver or going to OpenLog. A byte either sends while the clock is
+ * switched under its baud rate is lost, so until both are quiet the profile
+ * stays as it is
+ */
+static void SwitchProfile(CLOCK_PROFILE profile) {
+    if (CLOCK_GetProfile() == profile || !GPS_Quiet() || !OPENLOG_Quiet()) return;
+    CLOCK_SetProfile(profile);
+}
 
 /**
   * @brief  The application entry point.
@@ -69,49 +152,89 @@ int main(void) {
     // set upt user button and interrupt
     configUserButton();
     configUserButtonInterrupt();
+
+    // free running timebase and receiver time pulse capture
+    TIMEBASE_Setup();
+    PPS_Setup();
+    PROF_Reset();
+    TELEM_Reset();
+    BACKUP_Setup();
+    RTC_Setup();
+    STORE_Setup();
+    SPOOL_Setup();
+
+    // debug port for diagnostics, and to ask for the spool
+    USART1_Setup(DEBUG_TX_A, DEBUG_RX_A, DEBUG_BAUD);
     
 
     // Set up LCD screen
     LCD screen = { SCK_B, MOSI_B, SCE_B, DC_B, RST_B };
     LCD_Setup(&screen);
 
-    GPS gps = { SCL_B, SDA_B };
-    GPS_Setup(&gps);
+    GPS gps = { SCL_B, SDA_B, GPS_TX_A, GPS_RX_A, GPS_PORT, GPS_BAUD };
+    if (GPS_Setup(&gps)) Error_Handler();
 
     // Setup OpenLog
     OPENLOG sdcard = { TX_B, RX_B, RTS_B, 9600 };
     OPENLOG_Setup(&sdcard);
+    BATCH_Setup(sdcard.uart_baud);
 
-    // Disable unwanted messages
-    GPS_SetRateNMEA("DTM", GPS_DDC, 0);
-    GPS_SetRateNMEA("GBS", GPS_DDC, 0);
-    GPS_SetRateNMEA("GGA", GPS_DDC, 0);
-    GPS_SetRateNMEA("GLL", GPS_DDC, 0);
-    GPS_SetRateNMEA("GNS", GPS_DDC, 0);
-    GPS_SetRateNMEA("GRS", GPS_DDC, 0);
-    GPS_SetRateNMEA("GSA", GPS_DDC, 0);
-    GPS_SetRateNMEA("GST", GPS_DDC, 0);
-    GPS_SetRateNMEA("GSV", GPS_DDC, 0);
-    GPS_SetRateNMEA("TXT", GPS_DDC, 0);
-    GPS_SetRateNMEA("VLW", GPS_DDC, 0);
-    GPS_SetRateNMEA("VTG", GPS_DDC, 0);
-    GPS_SetRateNMEA("ZDA", GPS_DDC, 0);
-
-    // enable the RMC message once per epoch
-    GPS_SetRateNMEA("RMC", GPS_DDC, 1);
+    // Set up message rates unless the receiver kept them from last time,
+    // frames never acknowledged show up in telemetry
+    GPS_EnsureConfig(gpsConfig, sizeof(gpsConfig) / sizeof(gpsConfig[0]), GPS_CONFIG_KEYS);
+
+    // sampling starts every pulse, the controller slows it from there, and
+    // the receiver runs continuously until it does
+    RATE_Setup();
+    PSM_Setup();
+
+    // tell the receiver where and when it last was, then what the satellites
+    // are doing today if there is offline data on the card
+    ASSIST_HotStart();
+
+    ASSIST_LoadOffline(ASSIST_OFFLINE_FILE);
+    GEOFENCE_Load(GEOFENCE_FILE);
+
+    // close the last track if the power failed before it was, with whatever
+    // the spool still has for it
+    if (BATCH_Recover(TRACK_FILE, SPOOL_Pending() != 0)) {
+        SPOOL_Finish();
+        BATCH_Close();
+    }
 
     LCD_ClearDisplay();
     LCD_PrintStringCentered("Ready! Press button to record.");
 
+    uint32_t fixCount = 0;
+
     while (1) {
-        while (recorddata == 0);
-        HAL_Delay(5000);
+        // a press starts or ends the track here, between epochs
+        if (buttonPressed) {
+            buttonPressed = 0;
+            if (recorddata == 0) StartTrack();
+            else StopTrack();
+        }
+
+        // idle at the low power clock while not recording or when samples
+        // are more than a pulse apart, staying at the active one at 1 Hz
+        while (recorddata == 0 && !buttonPressed) {
+            SwitchProfile(CLOCK_PROFILE_IDLE);
+            GPS_Serve();
+            SPOOL_Serve();
+        }
+        if (buttonPressed) continue;
+        if (RATE_Period() > 1) SwitchProfile(CLOCK_PROFILE_IDLE);
+        PPS_STAMP stamp;
+        PROF_BEGIN(PROF_IDLE);
+        PSM_WaitForEpoch(RATE_Period(), &stamp);
+        PROF_END(PROF_IDLE);
+        SwitchProfile(CLOCK_PROFILE_ACTIVE);
         toggleLED(GREEN_LED);
         
         GPS_PollData(NMEA, NMEA_RMC);
 
-        NMEA_MSG rmc = GPS_GetData_NMEA();
-        if (strcmp(rmc.status, commError) == 0) {
+        FIX fix = GPS_GetData_NMEA();
+        if (fix.status == FIX_COMM_ERROR) {
             clearLED(ORANGE_LED);
             clearLED(BLUE_LED);
             setLED(RED_LED);
@@ -119,81 +242,214 @@ int main(void) {
         }
 
         // wait for data to be available
-        while (strcmp(rmc.status, noData) == 0 || strcmp(rmc.status, invalidStatus) == 0) {
+        while ((fix.status == FIX_NO_DATA || fix.status == FIX_INVALID) && !buttonPressed) {
             clearLED(RED_LED);
             clearLED(BLUE_LED);
             setLED(ORANGE_LED);
+            PROF_BEGIN(PROF_IDLE);
             HAL_Delay(100);
-            rmc = GPS_GetData_NMEA();
+            PROF_END(PROF_IDLE);
+            fix = GPS_GetData_NMEA();
         }
+        if (buttonPressed) continue;
+
+        PPS_MarkParsed(&stamp);
+        PSM_MarkParsed(&stamp);
+
+        // sample sooner in turns and at speed, later on straights and at rest
+        RATE_Update(&fix);
+
+        // running distance, time, speed and altitude totals
+        TRIP_Update(&fix);
 
         clearLED(RED_LED);
         clearLED(ORANGE_LED);
         setLED(BLUE_LED);
 
-        // save to SD card
-        char latmin[3];
-        char latdeg[9];
-        char lonmin[4];
-        char londeg[9];
-        char buff[2048];
-
-        snprintf(latmin, 3, "%c%c", rmc.lat[0], rmc.lat[1]);
-        snprintf(latdeg, 9, "%c%c%c%c%c%c%c%c", rmc.lat[2], rmc.lat[3], rmc.lat[4], rmc.lat[5], rmc.lat[6], rmc.lat[7], rmc.lat[8], rmc.lat[9]);
-
-        snprintf(lonmin, 4, "%c%c%c", rmc.lon[0], rmc.lon[1], rmc.lon[2]);
-        snprintf(londeg, 9, "%c%c%c%c%c%c%c%c", rmc.lon[3], rmc.lon[4], rmc.lon[5], rmc.lon[6], rmc.lon[7], rmc.lon[8], rmc.lon[9], rmc.lon[10]);
+        // save to SD card, only the fixes needed to keep the track's shape
+        FIX logged;
+        if (SIMPLIFY_Push(&fix, &logged)) {
+            LogTrackPoint(&logged);
+        }
 
-        float latdec = atof(latdeg) / 60.0;
-        float londec = atof(londeg) / 60.0;
+        // note zones entered and left alongside the track
+        GEOFENCE_EVENT events[GEOFENCE_MAX_EVENTS];
+        uint32_t eventCount = GEOFENCE_Check(&fix, events, GEOFENCE_MAX_EVENTS);
+        for (uint32_t i = 0; i < eventCount; i++) {
+            char event[GEOFENCE_EVENT_LEN];
+            GEOFENCE_FormatEvent(&events[i], &fix, event, sizeof(event));
+            BATCH_Add(event);
+        }
+        PPS_MarkLogged(&stamp);
+        fixCount++;
+
+        // records are written in batches, a slow track still gets out in time,
+        // and spooled fixes follow as far as OpenLog keeps up
+        BATCH_Poll();
+        PROF_BEGIN(PROF_FORMAT);
+        SPOOL_Drain();
+        PROF_END(PROF_FORMAT);
+
+        // the receiver saves power to match the next period, once the fix is
+        // logged as its answers take a while
+        PSM_Update(RATE_Period());
+
+        // every few fixes, once the fix is logged, ask for the satellites
+        if (fixCount % SAT_POLL_PERIOD == 1) GPS_PollSatellites();
+
+        // keep the fix for the next boot's hot start, and ask the receiver
+        // how long this boot took to get one. The session record goes out
+        // with it at once, a track may not last until the next
+        ASSIST_Remember(&fix);
+        if (fixCount == 1) {
+            telemetry.ttff = GPS_PollTTFF();
+            TELEM_LogSession();
+        }
 
-        char latstr[12], lonstr[12];
-        snprintf(latstr, 2048, "%d.%07u", rmc.ns[0] == 'N' ? atoi(latmin) : -1*atoi(latmin), (int) ((latdec - (int) latdec) * 10000000));
-        snprintf(lonstr, 2048, "%d.%07u", rmc.ew[0] == 'E' ? atoi(lonmin) : -1*atoi(lonmin), (int) ((londec - (int) londec) * 10000000));
+        // periodic link-health summary alongside the track, and now and then
+        // the session's counters
+        if (fixCount % TELEM_PERIOD == 0) {
+            TELEM_Log();
+        }
+        if (fixCount % TELEM_SESSION_PERIOD == 0) {
+            TELEM_LogSession();
+        }
 
-        snprintf(buff, 2048, "\t\t<trkpt lat=\"%s\" lon=\"%s\"><ele>%s</ele><time>20%c%c-%c%c-%c%cT%c%c:%c%c:%c%cZ</time></trkpt>\n",
-                latstr, lonstr, "0", rmc.date[0], rmc.date[1], rmc.date[2], rmc.date[3], rmc.date[4], rmc.date[5], \
-                rmc.time[0], rmc.time[1], rmc.time[2], rmc.time[3], rmc.time[4], rmc.time[5]);
-        USART3_SendStr(buff);
+#ifdef PROFILE_ENABLED
+        // periodically swap the fix for the diagnostics page
+        if (fixCount % PROF_DUMP_PERIOD == 0) {
+            PROF_Dump();
+            PROF_ShowLCD();
+            continue;
+        }
+#endif
+
+        // every few fixes show the trip so far or the satellites instead of
+        // the position
+        if (fixCount % TRIP_PAGE_PERIOD == 0) {
+            PROF_BEGIN(PROF_LCD_DRAW);
+            TRIP_ShowLCD();
+            PROF_END(PROF_LCD_DRAW);
+            continue;
+        }
+        if (fixCount % SAT_PAGE_PERIOD == SAT_PAGE_PERIOD / 2) {
+            PROF_BEGIN(PROF_LCD_DRAW);
+            SAT_ShowLCD();
+            PROF_END(PROF_LCD_DRAW);
+            continue;
+        }
 
         // Print to screen
+        PROF_BEGIN(PROF_LCD_DRAW);
+        char timestr[9], latstr[GPX_COORD_LEN], lonstr[GPX_COORD_LEN];
+        snprintf(timestr, sizeof(timestr), "%02u:%02u:%02u", (unsigned) FIX_HOUR(fix.datetime), \
+                 (unsigned) FIX_MINUTE(fix.datetime), (unsigned) FIX_SECOND(fix.datetime));
+        GPX_FormatCoord(fix.lat, latstr);
+        GPX_FormatCoord(fix.lon, lonstr);
+
         LCD_ClearDisplay();
-        LCD_PrintString("TIME: "); LCD_PrintString(rmc.time);
+        LCD_PrintString("TIME: "); LCD_PrintString(timestr);
         LCD_PrintString(" LAT: "); LCD_PrintString(latstr);
         LCD_PrintString(" LON: "); LCD_PrintString(lonstr);
+        PROF_END(PROF_LCD_DRAW);
     }
 }
 
 /*
- * EXTI0 and EXTI1 interrupt request handler for User Button
+ * Write a fix into the track, by way of the spool
  */
-void EXTI0_1_IRQHandler(void) {
-    if (recorddata == 0) { // first time through, delete file and write start of track
-        char *file = "trail.gpx";
-        char *setupText = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-                          "<gpx version=\"1.0\">\n"
-                          "\t<name>track 1 gpx</name>\n"
-                          "\t<trk><name>track 1</name><number>1</number><trkseg>\n";
-        OPENLOG_RemoveFile(file); // TODO wait for OpenLog reply
-        OPENLOG_AppendFile(file, setupText);
+void LogTrackPoint(FIX *fix) {
+    PROF_BEGIN(PROF_LOG_WRITE);
+    SPOOL_Add(fix);
+    PROF_END(PROF_LOG_WRITE);
+}
 
-        recorddata = 1;
+/*
+ * Write a histogram summary into the track as an XML comment
+ */
+void LogHistogram(char *name, HISTOGRAM *hist) {
+    char report[192];
+    int len = snprintf(report, sizeof(report), "\t<!-- %s: ", name);
+    len += HIST_Format(hist, &report[len], sizeof(report) - len - 6);
+    snprintf(&report[len], sizeof(report) - len, " -->\n");
+    BATCH_Add(report);
+}
 
-        LCD_ClearDisplay();
-        LCD_PrintStringCentered("Waiting for sats!");
-    }
-    else { // stop recordering data and end track
-        char *endtags = "\t</trkseg></trk>\n"
-                        "</gpx>\n";
-        USART3_SendStr(endtags);
-        recorddata = 0;
+/*
+ * Start a track: delete the file and write the start of it
+ */
+void StartTrack(void) {
+    char setupText[192];
+    uint32_t session = 0;
+
+    // number the tracks across power cycles
+    STORE_Get(STORE_SESSION, &session);
+    STORE_Set(STORE_SESSION, ++session);
+    snprintf(setupText, sizeof(setupText),
+             "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             "<gpx version=\"1.0\">\n"
+             "\t<name>track %lu gpx</name>\n"
+             "\t<trk><name>track %lu</name><number>%lu</number><trkseg>\n",
+             (unsigned long) session, (unsigned long) session, (unsigned long) session);
+    // whatever the spool has left is for the track this one replaces
+    SPOOL_Abandon();
+    if (RAWLOG_ENABLED) RAWLOG_Open(RAW_FILE);
+    OPENLOG_RemoveFile(TRACK_FILE); // returns once OpenLog has answered
+    BATCH_Open(TRACK_FILE, setupText);
+
+    recorddata = 1;
+    SIMPLIFY_Reset();
+    TRIP_Reset();
+    PROF_Reset();
 
-        LCD_ClearDisplay();
-        LCD_PrintStringCentered("Recording ended!");
-        while(1);
+    LCD_ClearDisplay();
+    LCD_PrintStringCentered("Waiting for sats!");
+}
+
+/*
+ * Stop recording data and end the track
+ */
+void StopTrack(void) {
+    // the simplifier still holds the newest fix
+    FIX last;
+    if (SIMPLIFY_Flush(&last)) {
+        LogTrackPoint(&last);
     }
+    SPOOL_Finish();
+
+    // sum up the trip, then the fix latency seen over the track
+    TRIP_Log();
+    LogHistogram("pps-to-parse us", &ppsToParse);
+    LogHistogram("pps-to-log us", &ppsToLog);
+    LogHistogram("wake-to-fix us", &psmWakeToFix);
+    TELEM_Log();
+    TELEM_LogSession();
+    PROF_Dump();
+
+    // the trailer ends every batch, so this closes the track, and the
+    // raw log's last block goes with it
+    BATCH_Close();
+    if (RAWLOG_ENABLED) RAWLOG_Close();
+    recorddata = 0;
+
+    // keep the last fix in flash too, the backup registers need VBAT
+    ASSIST_Save();
+
+    LCD_ClearDisplay();
+    LCD_PrintStringCentered("Recording ended!");
 
-    EXTI->PR |= 1;
+    // OpenLog still has to confirm the end of the track for the spool, which
+    // the main loop serves while it waits for the next press
+}
+
+/*
+ * EXTI0 and EXTI1 interrupt request handler for User Button. The track is
+ * started and ended from the main loop, the spool, batches and OpenLog
+ * commands all belong to it
+ */
+void EXTI0_1_IRQHandler(void) {
+    buttonPressed = 1;
+    EXTI->PR = 1; // write 1 to clear
 }
 	
 	
@@ -205,31 +461,9 @@ void EXTI0_1_IRQHandler(void) {
   */
 void SystemClock_Config(void)
 {
-  RCC_OscInitTypeDef RCC_OscInitStruct = {0};
-  RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
-
-  /** Initializes the CPU, AHB and APB busses clocks 
-  */
-  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
-  RCC_OscInitStruct.HSIState = RCC_HSI_ON;
-  RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
-  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
-  if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
-  {
-    Error_Handler();
-  }
-  /** Initializes the CPU, AHB and APB busses clocks 
+  /** Boot into the active profile, see clock.h for the available profiles
   */
-  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
-                              |RCC_CLOCKTYPE_PCLK1;
-  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
-  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
-  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
-
-  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
-  {
-    Error_Handler();
-  }
+  CLOCK_SetProfile(CLOCK_PROFILE_ACTIVE);
 }
 
 /* USER CODE BEGIN 4 */
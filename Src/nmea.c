@@ -4,6 +4,9 @@
  * https://en.wikipedia.org/wiki/NMEA_0183#Message_structure
  */
 #include "nmea.h"
+#include "gps.h"
+#include "profile.h"
+#include "telemetry.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -12,147 +15,323 @@ char start = '$';
 char csstart = '*';
 char end[3] = { 0x0D, 0x0A, '\0' }; // <CR><LF>
 
-char invalidStatus[NMEA_RMC_LEN_STATUS+1] = "V";
-char noData[NMEA_RMC_LEN_STATUS+1] = "Z";
-char commError[NMEA_RMC_LEN_STATUS+1] = "Q";
-
 /*
  * Create and send the poll message defined in the struct
  */
-void NMEA_PollMsg(NMEA_POLL_MSG* msgstruct, uint8_t i2caddr) {
+void NMEA_PollMsg(NMEA_POLL_MSG* msgstruct) {
     char msg[NMEA_MAX_LEN+1];
     snprintf(msg, NMEA_MAX_LEN+1, \
         "%c%s,%s%c%02X%s", start, msgstruct->addr, msgstruct->data, csstart, msgstruct->checksum, end);
-    I2C1_WriteStrNoReg(i2caddr, msg);
+    GPS_Write(msg);
 }
 
 /*
  * Send a poll message for GN data: $xxGNQ,msgId*cs<CR><LF>
  */
-void NMEA_PollGNQ(char* msgid, uint8_t i2caddr) {
+void NMEA_PollGNQ(char* msgid) {
     char addr[NMEA_MAX_LEN_ADDR+1];
     snprintf(addr, NMEA_MAX_LEN_ADDR+1, "%s%s", TALKER_ID_MICROPROC, NMEA_GNQ);
     int cs = NMEA_Checksum(addr, msgid);
     NMEA_POLL_MSG msgstruct = { addr, msgid, cs };
-    NMEA_PollMsg(&msgstruct, i2caddr);
+    NMEA_PollMsg(&msgstruct);
 }
 
 /*
  * Send a poll message for GP data: $xxGPQ,msgId*cs<CR><LF>
  */
-void NMEA_PollGPQ(char* msgid, uint8_t i2caddr) {
+void NMEA_PollGPQ(char* msgid) {
     char addr[NMEA_MAX_LEN_ADDR+1];
     snprintf(addr, NMEA_MAX_LEN_ADDR+1, "%s%s", TALKER_ID_MICROPROC, NMEA_GPQ);
     int cs = NMEA_Checksum(addr, msgid);
     NMEA_POLL_MSG msgstruct = { addr, msgid, cs };
-    NMEA_PollMsg(&msgstruct, i2caddr);
+    NMEA_PollMsg(&msgstruct);
 }
 
 /*
- * Parse the received data
+ * Field schemas, one NMEA_FIELD per data field in the order the receiver sends
+ * them. Trailing fields that aren't decoded are left off
  */
-NMEA_MSG NMEA_ParseData(char* data) {
-    char id[NMEA_MAX_LEN_TALKERID+1];
-    char format[NMEA_MAX_LEN_SENTENCE+1];
+static const uint8_t mapDTM[] = { NMEA_F_SKIP };
+static const uint8_t mapGBQ[] = { NMEA_F_SKIP };
+static const uint8_t mapGBS[] = { NMEA_F_TIME };
+static const uint8_t mapGGA[] = { NMEA_F_TIME, NMEA_F_LAT, NMEA_F_NS, NMEA_F_LON, NMEA_F_EW, NMEA_F_QUALITY,
+                                  NMEA_F_NUMSV, NMEA_F_HDOP, NMEA_F_ALT };
+static const uint8_t mapGLL[] = { NMEA_F_LAT, NMEA_F_NS, NMEA_F_LON, NMEA_F_EW, NMEA_F_TIME, NMEA_F_STATUS,
+                                  NMEA_F_POSMODE };
+static const uint8_t mapGLQ[] = { NMEA_F_SKIP };
+static const uint8_t mapGNQ[] = { NMEA_F_SKIP };
+static const uint8_t mapGNS[] = { NMEA_F_TIME, NMEA_F_LAT, NMEA_F_NS, NMEA_F_LON, NMEA_F_EW, NMEA_F_POSMODE,
+                                  NMEA_F_NUMSV, NMEA_F_HDOP, NMEA_F_ALT, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP,
+                                  NMEA_F_NAVSTATUS };
+static const uint8_t mapGPQ[] = { NMEA_F_SKIP };
+static const uint8_t mapGRS[] = { NMEA_F_TIME };
+static const uint8_t mapGSA[] = { NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP,
+                                  NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP,
+                                  NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_HDOP };
+static const uint8_t mapGST[] = { NMEA_F_TIME };
+static const uint8_t mapGSV[] = { NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_INVIEW };
+static const uint8_t mapRMC[] = { NMEA_F_TIME, NMEA_F_STATUS, NMEA_F_LAT, NMEA_F_NS, NMEA_F_LON, NMEA_F_EW,
+                                  NMEA_F_SPD, NMEA_F_COG, NMEA_F_DATE, NMEA_F_MV, NMEA_F_MVEW, NMEA_F_POSMODE,
+                                  NMEA_F_NAVSTATUS };
+static const uint8_t mapTXT[] = { NMEA_F_SKIP };
+static const uint8_t mapVLW[] = { NMEA_F_SKIP };
+static const uint8_t mapVTG[] = { NMEA_F_COG, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_SPD, NMEA_F_SKIP,
+                                  NMEA_F_SKIP, NMEA_F_SKIP, NMEA_F_POSMODE };
+static const uint8_t mapZDA[] = { NMEA_F_TIME, NMEA_F_DAY, NMEA_F_MONTH, NMEA_F_YEAR };
 
-    for (int i = 1, j = 0; i < 3; i++, j++) {
-        id[j] = data[i];
-    }
-    for (int i = 3, j = 0; i < 6; i++, j++) {
-        format[j] = data[i];
+// A frame count covers the address, checksum and end as well as the data fields
+#define NMEA_SCHEMA_CHECK(name, c0, c1, c2, count) \
+    _Static_assert(sizeof(map##name) <= (count) - 3, #name " schema has more fields than the sentence");
+NMEA_SENTENCES(NMEA_SCHEMA_CHECK)
+
+// Schemas by NMEA_HASH of the formatter. Sentences left out of NMEA_DECODE keep
+// their slot so they are still recognised
+#define NMEA_SCHEMA_ENTRY(name, c0, c1, c2, count) \
+    [NMEA_HASH(c0, c1, c2)] = { #name, (NMEA_DECODE & NMEA_BIT(name)) ? map##name : NULL, \
+                                (NMEA_DECODE & NMEA_BIT(name)) ? sizeof(map##name) : 0 },
+static const NMEA_SCHEMA schemas[NMEA_HASH_SIZE] = { NMEA_SENTENCES(NMEA_SCHEMA_ENTRY) };
+
+#define NMEA_HASH_CASE(name, c0, c1, c2, count) case NMEA_HASH(c0, c1, c2):
+
+// Degree digits in front of the minutes of a coordinate
+#define NMEA_LAT_DEG_DIGITS 2
+#define NMEA_LON_DEG_DIGITS 3
+
+// Date parts of FIX.datetime, for ZDA which sends them as separate fields
+#define NMEA_YEAR_MASK  0xFC000000UL
+#define NMEA_MONTH_MASK 0x03C00000UL
+#define NMEA_DAY_MASK   0x003E0000UL
+
+/*
+ * Parse the received data
+ */
+FIX NMEA_ParseData(char* data) {
+    if (NMEA_VerifyChecksum(data)) {
+        FIX fix = { 0 };
+        fix.status = FIX_NO_DATA;
+        telemetry.checksumErrors++;
+        return fix;
     }
-    id[NMEA_MAX_LEN_TALKERID] = '\0';
-    format[NMEA_MAX_LEN_SENTENCE] = '\0';
 
-    if (strcmp(format, NMEA_RMC) == 0) {
-        return NMEA_ParseRMCData(data);
+    return NMEA_ParseFrame(data);
+}
+
+/*
+ * Parse a sentence, starting at the '$', whose checksum has already been checked
+ */
+FIX NMEA_ParseFrame(char* data) {
+    FIX fix;
+    PROF_BEGIN(PROF_NMEA_PARSE);
+
+    memset(&fix, 0, sizeof(fix));
+    fix.status = FIX_NO_DATA;
+
+    const NMEA_SCHEMA *schema = NMEA_Lookup(&data[NMEA_MAX_LEN_START+NMEA_MAX_LEN_TALKERID]);
+    if (schema != NULL && schema->map != NULL) NMEA_Decode(schema, data, &fix);
+
+    PROF_END(PROF_NMEA_PARSE);
+    return fix;
+}
+
+/*
+ * Find the schema for the 3 character sentence formatter.
+ * Returns NULL if it isn't one listed in NMEA_SENTENCES
+ */
+const NMEA_SCHEMA* NMEA_Lookup(char* format) {
+    uint32_t h = NMEA_HASH(format[0], format[1], format[2]);
+
+    // a duplicate case here means a formatter collides under NMEA_HASH
+    switch (h) {
+        NMEA_SENTENCES(NMEA_HASH_CASE)
+            break;
+        default:
+            return NULL;
     }
-    else if (strcmp(format, NMEA_GLL) == 0) {
-        return NMEA_ParseGLLData(data);
+
+    const NMEA_SCHEMA *schema = &schemas[h];
+    if (schema->name[0] != format[0] || schema->name[1] != format[1] || schema->name[2] != format[2]) return NULL;
+    return schema;
+}
+
+/*
+ * Read a decimal field of len characters as an integer scaled by 10^places,
+ * extra decimals are dropped. Returns 1 if the field is empty, 0 otherwise
+ */
+uint8_t NMEA_Fixed(char* field, uint32_t len, uint8_t places, int32_t* out) {
+    int32_t value = 0;
+    uint8_t negative = 0;
+    uint8_t decimals = 0;
+    uint8_t point = 0;
+
+    if (len == 0) return 1; // FAILURE
+
+    if (*field == '-') {
+        negative = 1;
+        field++;
+        len--;
     }
-    else {
-        NMEA_MSG msg;
-        snprintf(msg.status, NMEA_RMC_LEN_STATUS+1, "%s", noData);
-        return msg;
+
+    for (; len > 0; field++, len--) {
+        if (*field == '.') {
+            point = 1;
+        }
+        else if (!point || decimals < places) {
+            value = value * 10 + (*field - '0');
+            if (point) decimals++;
+        }
     }
+    for (; decimals < places; decimals++) value *= 10;
+
+    *out = negative ? -value : value;
+    return 0;
 }
 
 /*
- * Parse received RMC data
+ * Two digit number at field
  */
-NMEA_MSG NMEA_ParseRMCData(char* data) {
-    int len = strlen(data);
-    int fieldno = 0;
-    int charnum = 0;
-    NMEA_MSG rmc;
-    char checksum[NMEA_MAX_LEN_CHECKSUM+1];
+static uint32_t NMEA_Digits2(char* field) {
+    return (field[0] - '0') * 10 + (field[1] - '0');
+}
 
-    for (int i = 1; i < len-NMEA_MAX_LEN_END; i++) {
-        if (data[i] == ',' || data[i] == '*') {
-            fieldno++; charnum = 0; continue;
-        }
+/*
+ * Convert a ddmm.mmmmm or dddmm.mmmmm coordinate into 1e-7 degrees.
+ * Returns 1 if the field is too short, 0 otherwise
+ */
+static uint8_t NMEA_Coord(char* field, uint32_t len, uint8_t degDigits, int32_t* out) {
+    int32_t deg, min;
 
-        switch(fieldno) {
-            case  0: rmc.addr[charnum] = data[i]; rmc.addr[charnum+1] = '\0'; break;
-            case  1: rmc.time[charnum] =  data[i]; rmc.time[charnum+1] = '\0'; break;
-            case  2: rmc.status[charnum] =  data[i]; rmc.status[charnum+1] = '\0'; break;
-            case  3: rmc.lat[charnum] =  data[i]; rmc.lat[charnum+1] = '\0'; break;
-            case  4: rmc.ns[charnum] =  data[i]; rmc.ns[charnum+1] = '\0'; break;
-            case  5: rmc.lon[charnum] =  data[i]; rmc.lon[charnum+1] = '\0'; break;
-            case  6: rmc.ew[charnum] =  data[i]; rmc.ew[charnum+1] = '\0'; break;
-            case  7: rmc.spd[charnum] =  data[i]; rmc.spd[charnum+1] = '\0'; break;
-            case  8: rmc.cog[charnum] =  data[i]; rmc.cog[charnum+1] = '\0'; break;
-            case  9: rmc.date[charnum] =  data[i]; rmc.date[charnum+1] = '\0'; break;
-            case 10: rmc.mv[charnum] =  data[i]; rmc.mv[charnum+1] = '\0'; break;
-            case 11: rmc.mvew[charnum] =  data[i]; rmc.mvew[charnum+1] = '\0'; break;
-            case 12: rmc.posmode[charnum] =  data[i]; rmc.posmode[charnum+1] = '\0'; break;
-            case 13: rmc.navstatus[charnum] =  data[i]; rmc.navstatus[charnum+1] = '\0'; break;
-            case 14: checksum[charnum] =  data[i]; checksum[charnum+1] = '\0'; break;
-        };
-
-        charnum++;
+    if (len <= degDigits) return 1; // FAILURE
+    if (NMEA_Fixed(field, degDigits, 0, &deg) || NMEA_Fixed(field + degDigits, len - degDigits, 5, &min)) {
+        return 1; // FAILURE
     }
 
-    int cs = (int) strtol(&checksum[1], NULL, 16);
-    rmc.checksum = cs;
-
-    return rmc;
+    // 1e-5 minutes are 5/3 of 1e-7 degrees, rounded
+    *out = deg * 10000000 + (min * 5 + 1) / 3;
+    return 0;
 }
 
 /*
- * Parse received GLL data
+ * Convert a field into the member of fix that holds its kind.
+ * Empty fields leave the member and its FIX_HAS_x flag untouched
  */
-NMEA_MSG NMEA_ParseGLLData(char *data) {
-    int len = strlen(data);
-    int fieldno = 0;
-    int charnum = 0;
-    NMEA_MSG gll;
-    char checksum[NMEA_MAX_LEN_CHECKSUM+1];
+static void NMEA_Store(FIX* fix, uint8_t kind, char* field, uint32_t len) {
+    int32_t v;
 
-    for (int i = 1; i < len-NMEA_MAX_LEN_END; i++) {
-        if (data[i] == ',' || data[i] == '*') {
-            fieldno++; charnum = 0; continue;
-        }
+    if (len == 0) return;
 
-        switch(fieldno) {
-            case 0: gll.addr[charnum] = data[i]; gll.addr[charnum+1] = '\0'; break;
-            case 1: gll.lat[charnum] =  data[i]; gll.lat[charnum+1] = '\0'; break;
-            case 2: gll.ns[charnum] =  data[i]; gll.ns[charnum+1] = '\0'; break;
-            case 3: gll.lon[charnum] =  data[i]; gll.lon[charnum+1] = '\0'; break;
-            case 4: gll.ew[charnum] =  data[i]; gll.ew[charnum+1] = '\0'; break;
-            case 5: gll.time[charnum] =  data[i]; gll.time[charnum+1] = '\0'; break;
-            case 6: gll.status[charnum] =  data[i]; gll.status[charnum+1] = '\0'; break;
-            case 7: gll.posmode[charnum] =  data[i]; gll.posmode[charnum+1] = '\0'; break;
-            case 8: checksum[charnum] =  data[i]; checksum[charnum+1] = '\0'; break;
-        };
-
-        charnum++;
+    switch (kind) {
+        case NMEA_F_TIME: // hhmmss.ss
+            if (len < 6) return;
+            fix->datetime = (fix->datetime & FIX_DATE_MASK) | \
+                FIX_PACK_TIME(NMEA_Digits2(field), NMEA_Digits2(field + 2), NMEA_Digits2(field + 4));
+            fix->centis = NMEA_Fixed(field + 6, len - 6, 2, &v) ? 0 : v;
+            fix->flags |= FIX_HAS_TIME;
+            break;
+        case NMEA_F_DATE: // ddmmyy
+            if (len < 6) return;
+            fix->datetime = (fix->datetime & FIX_TIME_MASK) | \
+                FIX_PACK_DATE(NMEA_Digits2(field + 4), NMEA_Digits2(field + 2), NMEA_Digits2(field));
+            fix->flags |= FIX_HAS_DATE;
+            break;
+        case NMEA_F_DAY:
+            NMEA_Fixed(field, len, 0, &v);
+            fix->datetime = (fix->datetime & ~NMEA_DAY_MASK) | FIX_PACK_DATE(0, 0, v);
+            fix->flags |= FIX_HAS_DATE;
+            break;
+        case NMEA_F_MONTH:
+            NMEA_Fixed(field, len, 0, &v);
+            fix->datetime = (fix->datetime & ~NMEA_MONTH_MASK) | FIX_PACK_DATE(0, v, 0);
+            break;
+        case NMEA_F_YEAR:
+            NMEA_Fixed(field, len, 0, &v);
+            fix->datetime = (fix->datetime & ~NMEA_YEAR_MASK) | FIX_PACK_DATE(v % 100, 0, 0);
+            break;
+        case NMEA_F_STATUS:
+            fix->status = field[0] == 'A' ? FIX_VALID : FIX_INVALID;
+            break;
+        case NMEA_F_LAT:
+            if (NMEA_Coord(field, len, NMEA_LAT_DEG_DIGITS, &fix->lat)) return;
+            fix->flags |= FIX_HAS_POS;
+            break;
+        case NMEA_F_LON:
+            if (NMEA_Coord(field, len, NMEA_LON_DEG_DIGITS, &fix->lon)) return;
+            fix->flags |= FIX_HAS_POS;
+            break;
+        case NMEA_F_NS: // follows its coordinate
+            if (field[0] == 'S') fix->lat = -fix->lat;
+            break;
+        case NMEA_F_EW:
+            if (field[0] == 'W') fix->lon = -fix->lon;
+            break;
+        case NMEA_F_SPD: // knots, 1 knot is 1286/2500 m/s
+            NMEA_Fixed(field, len, 3, &v);
+            v = v * 1286 / 25000;
+            fix->speed = v > UINT16_MAX ? UINT16_MAX : v;
+            fix->flags |= FIX_HAS_SPEED;
+            break;
+        case NMEA_F_COG:
+            NMEA_Fixed(field, len, 2, &v);
+            fix->course = v;
+            fix->flags |= FIX_HAS_COURSE;
+            break;
+        case NMEA_F_MV:
+            NMEA_Fixed(field, len, 2, &v);
+            fix->magvar = v;
+            fix->flags |= FIX_HAS_MV;
+            break;
+        case NMEA_F_MVEW:
+            if (field[0] == 'W') fix->magvar = -fix->magvar;
+            break;
+        case NMEA_F_POSMODE:
+            fix->posmode = field[0];
+            break;
+        case NMEA_F_NAVSTATUS:
+            fix->navstatus = field[0];
+            break;
+        case NMEA_F_QUALITY:
+            NMEA_Fixed(field, len, 0, &v);
+            fix->quality = v;
+            break;
+        case NMEA_F_NUMSV:
+            NMEA_Fixed(field, len, 0, &v);
+            fix->numsv = v;
+            break;
+        case NMEA_F_INVIEW:
+            NMEA_Fixed(field, len, 0, &v);
+            fix->inview = v;
+            break;
+        case NMEA_F_HDOP:
+            NMEA_Fixed(field, len, 2, &v);
+            fix->hdop = v > UINT16_MAX ? UINT16_MAX : v;
+            fix->flags |= FIX_HAS_HDOP;
+            break;
+        case NMEA_F_ALT: // meters
+            NMEA_Fixed(field, len, 3, &v);
+            fix->alt = v;
+            fix->flags |= FIX_HAS_ALT;
+            break;
+        default:
+            break;
     }
+}
 
-    int cs = (int) strtol(&checksum[1], NULL, 16);
-    gll.checksum = cs;
+/*
+ * Split the sentence at data, which starts at the '$', into its fields and
+ * convert each one the schema decodes into fix
+ */
+void NMEA_Decode(const NMEA_SCHEMA* schema, char* data, FIX* fix) {
+    char *c = &data[NMEA_MAX_LEN_START+NMEA_MAX_LEN_ADDR];
+    uint32_t field = 0;
 
-    return gll;
+    while (*c == ',') {
+        char *start = ++c;
+        while (*c != ',' && *c != '*' && *c != '\0') c++;
+
+        if (field < schema->fields && schema->map[field] != NMEA_F_SKIP) {
+            NMEA_Store(fix, schema->map[field], start, c - start);
+        }
+        field++;
+    }
 }
 
 /*
@@ -172,32 +351,67 @@ int NMEA_Checksum(char* addr, char* data) {
     return checksum;
 }
 
+/*
+ * Check the checksum of the first sentence in data, which starts at the '$'.
+ * Returns 1 if it is missing or does not match, 0 otherwise
+ */
+uint8_t NMEA_VerifyChecksum(char* data) {
+    int checksum = 0;
+    int i = 1;
+
+    while (data[i] != '*') {
+        if (data[i] == '\0' || i > NMEA_MAX_LEN) return 1; // FAILURE
+        checksum ^= data[i++];
+    }
+
+    char sent[NMEA_MAX_LEN_CHECKSUM] = { data[i+1], data[i+2], '\0' };
+    if (sent[0] == '\0' || sent[1] == '\0') return 1; // FAILURE
+
+    return strtol(sent, NULL, 16) != checksum;
+}
+
 /*
  * Set rate of NMEA messages using the PUBX command RATE
  */
-void NMEA_SetRate(char* msgid, GPS_INTERFACE port, unsigned int rate, uint8_t i2caddr) {
+void NMEA_SetRate(char* msgid, GPS_INTERFACE port, unsigned int rate) {
     char msg[NMEA_MAX_LEN+1];
     char *addr = "PUBX";
-    char rates[NMEA_MAX_LEN_DATA+1];
-    char payload[NMEA_MAX_LEN_DATA+1] = "40,";
-
-    strncat(payload, msgid, 4);
+    char rates[20]; // six rates, one of them set
+    char payload[NMEA_MAX_LEN_DATA+1];
 
     switch (port) {
-        case GPS_DDC:    snprintf(rates, NMEA_MAX_LEN_DATA, ",%u,,,,,", rate); break;
-        case GPS_USART1: snprintf(rates, NMEA_MAX_LEN_DATA, ",,%u,,,,", rate); break;
-        case GPS_USART2: snprintf(rates, NMEA_MAX_LEN_DATA, ",,,%u,,,", rate); break;
-        case GPS_USB:    snprintf(rates, NMEA_MAX_LEN_DATA, ",,,,%u,,", rate); break;
-        case GPS_SPI:    snprintf(rates, NMEA_MAX_LEN_DATA, ",,,,,%u,", rate); break;
-        default:         snprintf(rates, NMEA_MAX_LEN_DATA, ",,,,,,"); break;
+        case GPS_DDC:    snprintf(rates, sizeof(rates), ",%u,,,,,", rate); break;
+        case GPS_USART1: snprintf(rates, sizeof(rates), ",,%u,,,,", rate); break;
+        case GPS_USART2: snprintf(rates, sizeof(rates), ",,,%u,,,", rate); break;
+        case GPS_USB:    snprintf(rates, sizeof(rates), ",,,,%u,,", rate); break;
+        case GPS_SPI:    snprintf(rates, sizeof(rates), ",,,,,%u,", rate); break;
+        default:         snprintf(rates, sizeof(rates), ",,,,,,"); break;
     }
 
-    strncat(payload, rates, NMEA_MAX_LEN_DATA);
-    strncat(payload, "0", 2); // reserved character, always 0
+    // the last field is reserved, always 0
+    snprintf(payload, sizeof(payload), "40,%.4s%s0", msgid, rates);
+
+    uint8_t checksum = NMEA_Checksum(addr, payload);
+
+    snprintf(msg, sizeof(msg), "%c%s,%s%c%02x%s", start, addr, payload, csstart, checksum, end);
+
+    GPS_Write(msg);
+}
+
+/*
+ * Set the protocols and baud rate of a receiver port using the PUBX command
+ * CONFIG. NMEA, UBX and RTCM are accepted, NMEA and UBX are output
+ */
+void NMEA_SetPort(GPS_INTERFACE port, uint32_t baud) {
+    char msg[NMEA_MAX_LEN+1];
+    char *addr = "PUBX";
+    char payload[NMEA_MAX_LEN_DATA+1];
+
+    snprintf(payload, NMEA_MAX_LEN_DATA+1, "41,%u,0007,0003,%lu,0", (unsigned) port, (unsigned long) baud);
+
+    uint8_t checksum = NMEA_Checksum(addr, payload);
 
-    int checksum = NMEA_Checksum(addr, payload);
-    
-    snprintf(msg, NMEA_MAX_LEN, "%c%s,%s%c%02x%s", start, addr, payload, csstart, checksum, end);
+    snprintf(msg, sizeof(msg), "%c%s,%s%c%02X%s", start, addr, payload, csstart, checksum, end);
 
-    I2C1_WriteStrNoReg(i2caddr, msg);
+    GPS_Write(msg);
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #define __NMEA_H
 
 #include "utilities.h"
+#include "fix.h"
 
 // Talker IDs - https://www.nmea.org/Assets/20190303%20nmea%200183%20talker%20identifier%20mnemonics.pdf
 #define TALKER_ID_GPS       "GP"
@@ -58,6 +59,52 @@
 #define NMEA_FRAME_COUNT_VTG 12 // Output; Course over ground and ground speed
 #define NMEA_FRAME_COUNT_ZDA 9  // Output; Time and date
 
+// Every sentence formatter above as X(name, formatter characters, frame count)
+#define NMEA_SENTENCES(X) \
+    X(DTM, 'D', 'T', 'M', NMEA_FRAME_COUNT_DTM) \
+    X(GBQ, 'G', 'B', 'Q', NMEA_FRAME_COUNT_GBQ) \
+    X(GBS, 'G', 'B', 'S', NMEA_FRAME_COUNT_GBS) \
+    X(GGA, 'G', 'G', 'A', NMEA_FRAME_COUNT_GGA) \
+    X(GLL, 'G', 'L', 'L', NMEA_FRAME_COUNT_GLL) \
+    X(GLQ, 'G', 'L', 'Q', NMEA_FRAME_COUNT_GLQ) \
+    X(GNQ, 'G', 'N', 'Q', NMEA_FRAME_COUNT_GNQ) \
+    X(GNS, 'G', 'N', 'S', NMEA_FRAME_COUNT_GNS) \
+    X(GPQ, 'G', 'P', 'Q', NMEA_FRAME_COUNT_GPQ) \
+    X(GRS, 'G', 'R', 'S', NMEA_FRAME_COUNT_GRS) \
+    X(GSA, 'G', 'S', 'A', NMEA_FRAME_COUNT_GSA) \
+    X(GST, 'G', 'S', 'T', NMEA_FRAME_COUNT_GST) \
+    X(GSV, 'G', 'S', 'V', NMEA_FRAME_COUNT_GSV) \
+    X(RMC, 'R', 'M', 'C', NMEA_FRAME_COUNT_RMC) \
+    X(TXT, 'T', 'X', 'T', NMEA_FRAME_COUNT_TXT) \
+    X(VLW, 'V', 'L', 'W', NMEA_FRAME_COUNT_VLW) \
+    X(VTG, 'V', 'T', 'G', NMEA_FRAME_COUNT_VTG) \
+    X(ZDA, 'Z', 'D', 'A', NMEA_FRAME_COUNT_ZDA)
+
+#define NMEA_ID_ENTRY(name, c0, c1, c2, count) NMEA_ID_##name,
+typedef enum {
+    NMEA_SENTENCES(NMEA_ID_ENTRY)
+    NMEA_SENTENCE_COUNT
+} NMEA_SENTENCE;
+#undef NMEA_ID_ENTRY
+
+#define NMEA_BIT(name) (1UL << NMEA_ID_##name)
+
+// Received sentences NMEA_ParseData decodes. The others are recognised but come
+// back as FIX_NO_DATA and their schemas are left out of the build
+#ifndef NMEA_DECODE
+#define NMEA_DECODE (NMEA_BIT(RMC) | NMEA_BIT(GLL) | NMEA_BIT(GGA) | NMEA_BIT(GNS) | NMEA_BIT(GSA) | \
+                     NMEA_BIT(GSV) | NMEA_BIT(GST) | NMEA_BIT(VTG) | NMEA_BIT(ZDA))
+#endif
+
+// Perfect hash of the formatter characters into NMEA_HASH_SIZE slots, the
+// multiplier was found by search over the formatters above. NMEA_Lookup stops
+// compiling if a new formatter collides
+#define NMEA_HASH_BITS 5
+#define NMEA_HASH_SIZE (1 << NMEA_HASH_BITS)
+#define NMEA_HASH(c0, c1, c2) \
+    ((uint32_t) ((((uint32_t) (uint8_t) (c0) << 16) | ((uint32_t) (uint8_t) (c1) << 8) | (uint8_t) (c2)) * 0x170C4B01U) \
+     >> (32 - NMEA_HASH_BITS))
+
 // Max length of each part of the message, total max length of 82 characters
 #define NMEA_MAX_LEN          82
 #define NMEA_MAX_LEN_START    1
@@ -68,19 +115,38 @@
 #define NMEA_MAX_LEN_CHECKSUM 3 // includes the '*'
 #define NMEA_MAX_LEN_END      2
 
-#define NMEA_RMC_LEN_TIME      9
-#define NMEA_RMC_LEN_STATUS    1
-#define NMEA_RMC_LEN_LAT       10
-#define NMEA_RMC_LEN_NS        1
-#define NMEA_RMC_LEN_LON       11
-#define NMEA_RMC_LEN_EW        1
-#define NMEA_RMC_LEN_SPD       NMEA_MAX_LEN_DATA
-#define NMEA_RMC_LEN_COG       NMEA_MAX_LEN_DATA
-#define NMEA_RMC_LEN_DATE      6
-#define NMEA_RMC_LEN_MV        NMEA_MAX_LEN_DATA
-#define NMEA_RMC_LEN_MVEW      1
-#define NMEA_RMC_LEN_POSMODE   1
-#define NMEA_RMC_LEN_NAVSTATUS 1
+// What a data field holds. Each decoded kind is converted into its FIX member
+typedef enum {
+    NMEA_F_SKIP,        // not decoded
+    NMEA_F_TIME,
+    NMEA_F_STATUS,
+    NMEA_F_LAT,
+    NMEA_F_NS,
+    NMEA_F_LON,
+    NMEA_F_EW,
+    NMEA_F_SPD,
+    NMEA_F_COG,
+    NMEA_F_DATE,
+    NMEA_F_DAY,         // ZDA date parts
+    NMEA_F_MONTH,
+    NMEA_F_YEAR,
+    NMEA_F_MV,
+    NMEA_F_MVEW,
+    NMEA_F_POSMODE,
+    NMEA_F_NAVSTATUS,
+    NMEA_F_QUALITY,
+    NMEA_F_NUMSV,
+    NMEA_F_INVIEW,
+    NMEA_F_HDOP,
+    NMEA_F_ALT,
+    NMEA_FIELD_KINDS
+} NMEA_FIELD;
+
+typedef struct {
+    char name[NMEA_MAX_LEN_SENTENCE+1]; // sentence formatter
+    const uint8_t *map;                 // NMEA_FIELD of each data field, NULL if not decoded
+    uint8_t fields;                     // length of map
+} NMEA_SCHEMA;
 
 
 typedef struct {
@@ -89,39 +155,20 @@ typedef struct {
     int checksum;   // '*' followed by two characters - XOR of all characaters in addr and data
 } NMEA_POLL_MSG;
 
-typedef struct {
-    char addr[NMEA_MAX_LEN_ADDR+1];           // talker ID and sentence formatter
-    char time[NMEA_RMC_LEN_TIME+1];           // UTC time - HHMMSS.SS
-    char status[NMEA_RMC_LEN_STATUS+1];       // data validitiy status
-    char lat[NMEA_RMC_LEN_LAT+1];             // latitude - ddmm.mmmmm
-    char ns[NMEA_RMC_LEN_NS+1];               // North/South indicator
-    char lon[NMEA_RMC_LEN_LON+1];             // longitude - dddmm.mmmmm
-    char ew[NMEA_RMC_LEN_EW+1];               // East/West indicator
-    char spd[NMEA_RMC_LEN_SPD+1];             // speed over ground
-    char cog[NMEA_RMC_LEN_COG+1];             // course over ground
-    char date[NMEA_RMC_LEN_DATE+1];           // date in DDMMYY format
-    char mv[NMEA_RMC_LEN_MV+1];               // magnetic variation value
-    char mvew[NMEA_RMC_LEN_MV+1];             // magnetic variation E/W indicator
-    char posmode[NMEA_RMC_LEN_POSMODE+1];     // mode indicator
-    char navstatus[NMEA_RMC_LEN_NAVSTATUS+1]; // navigational status
-    int checksum;                             // '*' followed by two characters - XOR of all characaters in addr and data
-} NMEA_MSG;
-
-extern char invalidStatus[NMEA_RMC_LEN_STATUS+1];
-extern char noData[NMEA_RMC_LEN_STATUS+1];
-extern char commError[NMEA_RMC_LEN_STATUS+1];
-
-
-void NMEA_PollMsg(NMEA_POLL_MSG* msgstruct, uint8_t i2caddr);
-void NMEA_PollGNQ(char* msgid, uint8_t i2caddr);
-void NMEA_PollGPQ(char* msgid, uint8_t i2caddr);
-
-NMEA_MSG NMEA_ParseData(char* data);
-NMEA_MSG NMEA_ParseRMCData(char* data);
-NMEA_MSG NMEA_ParseGLLData(char *data);
+void NMEA_PollMsg(NMEA_POLL_MSG* msgstruct);
+void NMEA_PollGNQ(char* msgid);
+void NMEA_PollGPQ(char* msgid);
+
+FIX NMEA_ParseData(char* data);
+FIX NMEA_ParseFrame(char* data);
+const NMEA_SCHEMA* NMEA_Lookup(char* format);
+void NMEA_Decode(const NMEA_SCHEMA* schema, char* data, FIX* fix);
+uint8_t NMEA_Fixed(char* field, uint32_t len, uint8_t places, int32_t* out);
 
 int NMEA_Checksum(char* addr, char* msg);
+uint8_t NMEA_VerifyChecksum(char* data);
 
-void NMEA_SetRate(char* msgid, GPS_INTERFACE port, unsigned int rate, uint8_t i2caddr);
+void NMEA_SetRate(char* msgid, GPS_INTERFACE port, unsigned int rate);
+void NMEA_SetPort(GPS_INTERFACE port, uint32_t baud);
 
 #endif /* __NMEA_H */
@@ -6,7 +6,9 @@
  */
 #include "openlog.h"
 #include "lcd.h"
+#include "timebase.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 volatile enum MODE mode;
 
@@ -22,6 +24,18 @@ const char *INIT_CMD_MD_OK = "\r\n<";
 uint8_t rm_rply_md_frame;
 const char *RM_RPLY_MD_ERR = "\r\n!>";
 
+RINGBUF *read_rply_sink; // where file contents go while reading
+
+// Replies at the command prompt that nothing waits for, see OPENLOG_Reply
+static uint32_t replyValue;                 // number being received
+static uint8_t replyDigits;                 // digits of it so far
+static uint8_t replyLineStart = 1;          // nothing but the number since a line or prompt ended
+static volatile uint32_t replySize;         // last size answered
+static volatile uint32_t replySizes;        // size replies so far
+static volatile uint32_t replyAsked;        // size commands sent so far
+static uint32_t replySizesSeen;             // of those, taken by OPENLOG_SizeReply
+static volatile uint8_t replyRebooted;      // OpenLog came up again on its own
+
 /*
  * Setup the USART3 subsytem and the GPIO pins
  */
@@ -37,7 +51,7 @@ void OPENLOG_Setup(OPENLOG *openLog) {
     configGPIOB_output(thisOpenLog->uart_rts);  // Should this be a general output instead?
     GPIOB->BSRR = (1 << thisOpenLog->uart_rts);
 
-    USART3_SetBaudRate(thisOpenLog->uart_baud);
+    USART3_Setup(thisOpenLog->uart_baud);
 
     // enable transmitter and reciever hardware
     USART3->CR1 |= USART_CR1_RE_Msk | USART_CR1_TE_Msk;
@@ -52,6 +66,7 @@ void OPENLOG_Setup(OPENLOG *openLog) {
 
     HAL_Delay(100);
     OPENLOG_ResetSequence();
+    OPENLOG_EchoOff();
 }
 
 /*
@@ -68,6 +83,38 @@ void OPENLOG_Setup(OPENLOG *openLog) {
     while (mode != RDY);
  }
 
+/*
+ * Follow what OpenLog sends at the command prompt between commands that wait
+ * for their reply. A number on a line of its own and a prompt answers a size
+ * command if one is waiting for it, and 12< at the start of a line means
+ * OpenLog reset and is logging again. Anything else, like a line a write
+ * ended or an echo of what was sent, is passed over
+ */
+static void OPENLOG_Reply(uint8_t c) {
+    if (c >= '0' && c <= '9') {
+        if (replyLineStart) {
+            replyValue = replyValue * 10 + (c - '0');
+            replyDigits++;
+        }
+        return;
+    }
+
+    if (c == '>' && replyDigits != 0 && replySizes != replyAsked) {
+        replySize = replyValue;
+        replySizes++;
+    }
+    else if (c == '<' && replyDigits == 2 && replyValue == 12) {
+        replyRebooted = 1;
+    }
+
+    // the number goes on to the prompt after its line
+    if (c != '\r' && c != '\n') {
+        replyValue = 0;
+        replyDigits = 0;
+    }
+    replyLineStart = c == '\r' || c == '\n' || c == '>' || c == '<';
+}
+
 /*
  * USART3 or 4 interrupt request handler
  */
@@ -75,6 +122,13 @@ void OPENLOG_USART3ReceivedInterrupt() {
     if (!(USART3->ISR & USART_ISR_RXNE_Msk)) return;
     uint8_t recvValue = USART3->RDR;
 
+    // everything OpenLog sends while reading a file is passed on, the end is
+    // up to the reader to tell
+    if (mode == READ_RPLY) {
+        RINGBUF_Push(read_rply_sink, recvValue);
+        return;
+    }
+
     // if in reset sequence, a received 12< means OpenLog is ready to receive data
     // if it's not that, something has gone wrong so spin
     if (mode == RST_SEQ && recvValue != RST_SEQ_OK[rst_seq_frame]) {LCD_ClearDisplay();LCD_PrintStringCentered("RST SEQ ERROR");while(1);}
@@ -109,6 +163,9 @@ void OPENLOG_USART3ReceivedInterrupt() {
     else if (mode == RM_RPLY && rm_rply_md_frame == 3) {
         mode = RDY;
     }
+    else if (mode == CMD_RDY) {
+        OPENLOG_Reply(recvValue);
+    }
 }
 
 /*
@@ -135,6 +192,9 @@ void OPENLOG_NewFile(char* name) {
     char cmd[32];
     sprintf(cmd, "new %s\r", name);
     USART3_SendStr(cmd);
+
+    while (mode != RDY);
+    mode = CMD_RDY; // still at the command prompt
 }
 
 /*
@@ -155,6 +215,274 @@ void OPENLOG_RemoveFile(char* name) {
     while (mode != RDY);
 }
 
+/*
+ * Read len bytes of a file from byte start, raw. The bytes, followed by
+ * OpenLog's prompt, are pushed to sink from the USART3 interrupt until
+ * OPENLOG_EndRead is called
+ */
+void OPENLOG_ReadFile(char* name, uint32_t start, uint32_t len, RINGBUF *sink) {
+    if (mode != CMD_RDY) {
+        OPENLOG_EnterCommandMode();
+        while (mode != CMD_RDY);
+    }
+
+    read_rply_sink = sink;
+    mode = READ_RPLY;
+    char cmd[48];
+    sprintf(cmd, "read %s %lu %lu %d\r", name, (unsigned long) start, (unsigned long) len, RAW);
+    USART3_SendStr(cmd);
+}
+
+/*
+ * Stop passing on what OpenLog sends once a read has finished, it is back at
+ * the command prompt
+ */
+void OPENLOG_EndRead(void) {
+    mode = CMD_RDY;
+}
+
+/*
+ * Read a file from byte start to the end in chunks of chunk bytes, handing
+ * them to reader as they arrive. Only the first chunk bytes of each reply are
+ * file contents, the prompt after them is dropped. Returns the number of bytes
+ * handed over
+ */
+uint32_t OPENLOG_ReadFrom(char *name, uint32_t start, uint32_t chunk, OPENLOG_READER reader) {
+    // only needed while reading, so on the stack
+    uint8_t store[OPENLOG_READ_BUF_SIZE];
+    uint8_t data[32];
+    RINGBUF sink;
+    uint32_t total = 0;
+    uint8_t stop = 0;
+
+    RINGBUF_Init(&sink, store, sizeof(store));
+
+    uint32_t began = TIMEBASE_Now();
+    for (uint32_t offset = start; !stop && TIMEBASE_Elapsed(began) < OPENLOG_READ_TIMEOUT_US; offset += chunk) {
+        uint32_t got = 0;
+
+        OPENLOG_ReadFile(name, offset, chunk, &sink);
+        uint32_t quiet = TIMEBASE_Now();
+        while (TIMEBASE_Elapsed(quiet) < OPENLOG_READ_IDLE_US) {
+            uint32_t n = RINGBUF_PopBulk(&sink, data, sizeof(data));
+            if (n == 0) {
+                __WFI(); // the next byte or SysTick will wake us
+                continue;
+            }
+            quiet = TIMEBASE_Now();
+
+            uint32_t keep = got < chunk ? chunk - got : 0;
+            if (keep > n) keep = n;
+            got += n;
+            if (keep > 0 && !stop) {
+                total += keep;
+                stop = reader(data, keep);
+            }
+        }
+        OPENLOG_EndRead();
+
+        if (got < chunk) break; // end of the file, or no file
+    }
+
+    return total;
+}
+
+/*
+ * Read a whole file, see OPENLOG_ReadFrom
+ */
+uint32_t OPENLOG_ReadAll(char *name, uint32_t chunk, OPENLOG_READER reader) {
+    return OPENLOG_ReadFrom(name, 0, chunk, reader);
+}
+
+/*
+ * Start writing over a file from byte offset, with OPENLOG_WriteStr. OpenLog
+ * takes what follows a line at a time up to an empty one, which
+ * OPENLOG_EndWrite sends to get it back to the command prompt. The file has
+ * to exist
+ */
+void OPENLOG_WriteFile(char* name, uint32_t offset) {
+    if (mode != CMD_RDY) {
+        OPENLOG_EnterCommandMode();
+        while (mode != CMD_RDY);
+    }
+
+    char cmd[48];
+    sprintf(cmd, "write %s %lu\r", name, (unsigned long) offset);
+    USART3_SendStr(cmd);
+}
+
+/*
+ * Send text to be written after OPENLOG_WriteFile. Write mode drops line
+ * feeds and takes a carriage return for the end of a line, so each line feed
+ * goes as a space and every byte sent is a byte in the file. Text sent has no
+ * carriage returns, backspaces or deletes
+ */
+void OPENLOG_WriteStr(char *s) {
+    for (uint32_t i = 0; s[i] != '\0'; i++) USART3_SendChar(s[i] == '\n' ? ' ' : s[i]);
+}
+
+/*
+ * End a write: the carriage return ends the last line and writes it, and the
+ * empty line after it gets OpenLog back to the command prompt
+ */
+void OPENLOG_EndWrite(void) {
+    USART3_SendStr("\r\r");
+}
+
+/*
+ * OPENLOG_WriteStr and OPENLOG_EndWrite straight out of USART3, once
+ * USART3_SendUpTo has stopped its queue
+ */
+void OPENLOG_WriteStrNow(char *s) {
+    for (uint32_t i = 0; s[i] != '\0'; i++) USART3_SendNow(s[i] == '\n' ? ' ' : s[i]);
+}
+
+void OPENLOG_EndWriteNow(void) {
+    USART3_SendNow('\r');
+    USART3_SendNow('\r');
+}
+
+/*
+ * Stop OpenLog echoing what it is sent, at the prompt and while writing, so
+ * only its replies come back. It keeps the setting in its EEPROM, so this
+ * only has to get through once, and the wait for the prompt lets an echo of
+ * the command go by
+ */
+void OPENLOG_EchoOff(void) {
+    uint8_t store[OPENLOG_SIZE_REPLY_LEN];
+    uint8_t c = 0;
+    RINGBUF sink;
+
+    RINGBUF_Init(&sink, store, sizeof(store));
+    if (mode != CMD_RDY) {
+        OPENLOG_EnterCommandMode();
+        while (mode != CMD_RDY);
+    }
+
+    read_rply_sink = &sink;
+    mode = READ_RPLY;
+    USART3_SendStr("echo off\r");
+
+    uint32_t start = TIMEBASE_Now();
+    while (c != '>' && TIMEBASE_Elapsed(start) < OPENLOG_READ_IDLE_US) {
+        if (RINGBUF_Pop(&sink, &c)) __WFI();
+    }
+    OPENLOG_EndRead();
+}
+
+/*
+ * Start appending to a file, created if need be, without waiting for OpenLog
+ * to answer. Unlike a write, everything sent goes into the file as it is up
+ * to the three ctrl-Z OPENLOG_EndAppend sends, so a single ctrl-Z may be in
+ * it but no more in a row
+ */
+void OPENLOG_AppendTo(char *name) {
+    char cmd[32];
+    sprintf(cmd, "append %s\r", name);
+    USART3_SendStr(cmd);
+}
+
+/*
+ * End an append, OpenLog is back at the command prompt
+ */
+void OPENLOG_EndAppend(void) {
+    char ctrlZ[4] = { 26, 26, 26, '\0' };
+    USART3_SendStr(ctrlZ);
+}
+
+/*
+ * Size of a file in bytes, -1 if there is no such file or OpenLog didn't
+ * answer in time
+ */
+int32_t OPENLOG_FileSize(char* name) {
+    uint8_t store[OPENLOG_SIZE_REPLY_LEN];
+    char reply[OPENLOG_SIZE_REPLY_LEN];
+    uint32_t len = 0;
+    uint8_t c = 0;
+    RINGBUF sink;
+
+    RINGBUF_Init(&sink, store, sizeof(store));
+    if (mode != CMD_RDY) {
+        OPENLOG_EnterCommandMode();
+        while (mode != CMD_RDY);
+    }
+
+    // the reply is passed on like a read, up to the prompt
+    read_rply_sink = &sink;
+    mode = READ_RPLY;
+    char cmd[32];
+    sprintf(cmd, "size %s\r", name);
+    USART3_SendStr(cmd);
+
+    uint32_t start = TIMEBASE_Now();
+    while (c != '>' && TIMEBASE_Elapsed(start) < OPENLOG_READ_IDLE_US) {
+        if (RINGBUF_Pop(&sink, &c)) {
+            __WFI();
+            continue;
+        }
+        if (len < sizeof(reply) - 1) reply[len++] = c;
+    }
+    OPENLOG_EndRead();
+
+    reply[len] = '\0';
+    char *end;
+    long size = strtol(reply, &end, 10);
+    return end == reply ? -1 : size;
+}
+
+/*
+ * Ask for the size of a file without waiting for it, OPENLOG_SizeReply has
+ * the answer
+ */
+void OPENLOG_AskSize(char* name) {
+    char cmd[32];
+    replyAsked++;
+    sprintf(cmd, "size %s\r", name);
+    USART3_SendStr(cmd);
+}
+
+/*
+ * Latest answer to OPENLOG_AskSize in size.
+ * Returns 1 if there was a new one since the last call, 0 otherwise
+ */
+uint8_t OPENLOG_SizeReply(uint32_t *size) {
+    if (replySizes == replySizesSeen) return 0;
+
+    replySizesSeen = replySizes;
+    *size = replySize;
+    return 1;
+}
+
+/*
+ * Whether OpenLog has come up again on its own since the last call. It is
+ * logging then, and only takes commands after OPENLOG_Resync
+ */
+uint8_t OPENLOG_Rebooted(void) {
+    uint8_t rebooted = replyRebooted;
+    replyRebooted = 0;
+    return rebooted;
+}
+
+/*
+ * Get back to the command prompt without waiting for OpenLog to answer, for
+ * when it may not be there. Commands sent after it get through once it is
+ */
+void OPENLOG_Resync(void) {
+    char ctrlZ[4] = { 26, 26, 26, '\0' };
+    USART3_SendStr(ctrlZ);
+    mode = CMD_RDY;
+    replyAsked = replySizes; // the sizes asked before are not coming
+}
+
+/*
+ * Whether OpenLog has nothing left to answer: nothing is going out to it, no
+ * command is waiting for its reply and every size asked was answered. It
+ * only speaks when spoken to, apart from coming up again on its own
+ */
+uint8_t OPENLOG_Quiet(void) {
+    return !(USART3->CR1 & USART_CR1_TXEIE_Msk) && (mode == RDY || mode == CMD_RDY) && replySizes == replyAsked;
+}
+
 /*
  * Append text to the end of a file. If the file does not exist, it is created. msg needs to be null terminated
  */
@@ -8,12 +8,27 @@
 #define __OPENLOG_H
 
 #include "utilities.h"
+#include "ringbuf.h"
 
 
 #define MAX_FILE_NAME_LENGTH 12
 
+// OPENLOG_ReadAll has a chunk once OpenLog is quiet this long, and stops
+// after the total time whatever is left
+#define OPENLOG_READ_IDLE_US    500000
+#define OPENLOG_READ_TIMEOUT_US 30000000
+
+// Bytes queued between the USART3 interrupt and OPENLOG_ReadAll's reader
+#define OPENLOG_READ_BUF_SIZE 256
+
+// Longest reply to a size command
+#define OPENLOG_SIZE_REPLY_LEN 16
+
+// Takes the next bytes of a file. Returns 1 to stop reading, 0 for more
+typedef uint8_t (*OPENLOG_READER)(uint8_t *data, uint32_t len);
+
 enum FILE_TYPE { ASCII=1, HEX=2, RAW=3};
-enum MODE { RST_SEQ, RDY, ENT_CMD, INIT_CMD, CMD_RDY, RM_RPLY };
+enum MODE { RST_SEQ, RDY, ENT_CMD, INIT_CMD, CMD_RDY, RM_RPLY, READ_RPLY };
 
 // Holds UART pin and baud rate information
 typedef struct {        // OpenLog pins
@@ -38,6 +53,24 @@ void OPENLOG_EnterCommandMode(void);
 void OPENLOG_NewFile(char* name);
 void OPENLOG_AppendFile(char* name, char* msg);
 void OPENLOG_RemoveFile(char* name);
+void OPENLOG_ReadFile(char* name, uint32_t start, uint32_t len, RINGBUF *sink);
+void OPENLOG_EndRead(void);
+void OPENLOG_WriteFile(char* name, uint32_t offset);
+void OPENLOG_WriteStr(char *s);
+void OPENLOG_EndWrite(void);
+void OPENLOG_WriteStrNow(char *s);
+void OPENLOG_EndWriteNow(void);
+void OPENLOG_AppendTo(char *name);
+void OPENLOG_EndAppend(void);
+void OPENLOG_EchoOff(void);
+int32_t OPENLOG_FileSize(char* name);
+void OPENLOG_AskSize(char* name);
+uint8_t OPENLOG_SizeReply(uint32_t *size);
+uint8_t OPENLOG_Rebooted(void);
+void OPENLOG_Resync(void);
+uint8_t OPENLOG_Quiet(void);
+uint32_t OPENLOG_ReadFrom(char *name, uint32_t start, uint32_t chunk, OPENLOG_READER reader);
+uint32_t OPENLOG_ReadAll(char *name, uint32_t chunk, OPENLOG_READER reader);
 
 // low level functions
 void OPENLOG_Init(void);
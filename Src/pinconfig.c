@@ -20,6 +20,55 @@ void configUserButton(void) {
 	GPIOA->PUPDR &= ~(1);
 }
 
+/*
+ * GPIOA Pin configuration function
+ * Pass in the pin number, x
+ * Configures pin to alternate function mode, push-pull output,
+ * low-speed, no pull-up/down resistors, and AF1
+ */
+void configPinA_AF1(uint8_t x) {
+    // Set to Alternate function mode, 10
+    GPIOA->MODER &= ~(1 << (2*x));
+    GPIOA->MODER |= (1 << ((2*x)+1));
+    // Set to Push-pull
+    GPIOA->OTYPER &= ~(1 << x);
+    // Set to Low speed
+    GPIOA->OSPEEDR &= ~((1 << (2*x)) | (1 << ((2*x)+1)));
+    // Set to no pull-up/down
+    GPIOA->PUPDR &= ~((1 << (2*x)) | (1 << ((2*x)+1)));
+    // Set alternate functon to AF1
+    if (x < 8) {  // use AFR low register
+        GPIOA->AFR[0] &= ~(0xF << (4*x));
+        GPIOA->AFR[0] |= (0x1 << (4*x));
+    }
+    else {  // use AFR high register
+        GPIOA->AFR[1] &= ~(0xF << (4*(x-8)));
+        GPIOA->AFR[1] |= (0x1 << (4*(x-8)));
+    }
+}
+
+/*
+ * GPIOA Pin configuration function
+ * Pass in the pin number, x
+ * Configures pin to alternate function mode, no pull-up/down resistors, and AF2
+ */
+void configPinA_AF2(uint8_t x) {
+    // Set to Alternate function mode, 10
+    GPIOA->MODER &= ~(1 << (2*x));
+    GPIOA->MODER |= (1 << ((2*x)+1));
+    // Set to no pull-up/down
+    GPIOA->PUPDR &= ~((1 << (2*x)) | (1 << ((2*x)+1)));
+    // Set alternate functon to AF2
+    if (x < 8) {  // use AFR low register
+        GPIOA->AFR[0] &= ~(0xF << (4*x));
+        GPIOA->AFR[0] |= (0x2 << (4*x));
+    }
+    else {  // use AFR high register
+        GPIOA->AFR[1] &= ~(0xF << (4*(x-8)));
+        GPIOA->AFR[1] |= (0x2 << (4*(x-8)));
+    }
+}
+
 /*
  * Generic GPIOB configuration function
  * Pass in the pin number, x, of the GPIO on PBx
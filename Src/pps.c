@@ -0,0 +1,137 @@
+/*
+ * File: pps.c
+ * Purpose: Defines the SAM-M8Q TIMEPULSE (PPS) input used to line up fix
+ *          sampling with the receiver's navigation epochs
+ */
+#include "pps.h"
+#include "timebase.h"
+#include "telemetry.h"
+#include "gps.h"
+
+HISTOGRAM ppsToParse;
+HISTOGRAM ppsToLog;
+
+volatile uint32_t ppsCount;     // pulses captured
+volatile uint32_t ppsLastTime;  // capture time of the latest pulse
+volatile uint32_t dueCount;     // acquisitions that have come due
+volatile uint32_t dueEpoch;     // ppsCount when the latest acquisition came due
+volatile uint32_t dueTime;      // pulse time of the latest acquisition
+
+uint32_t lastSampleDue;         // dueCount when the last fix was sampled
+
+/*
+ * Configure PA1 as the TIM2 CH2 input capture on the rising edge, and CH3 as a
+ * compare used to signal when the epoch's data can be read. TIMEBASE_Setup must
+ * have been called first
+ */
+void PPS_Setup(void) {
+    RCC->AHBENR |= RCC_AHBENR_GPIOAEN; // Enable GPIOA clock
+
+    ppsCount = 0;
+    ppsLastTime = 0;
+    dueCount = 0;
+    dueEpoch = 0;
+    dueTime = 0;
+    lastSampleDue = 0;
+    HIST_Reset(&ppsToParse);
+    HIST_Reset(&ppsToLog);
+
+    configPinA_AF2(PPS_PIN_A);
+
+    // CH2 mapped to TI2, filtered over 8 samples to reject glitches
+    TIM2->CCMR1 &= ~(TIM_CCMR1_CC2S_Msk | TIM_CCMR1_IC2F_Msk | TIM_CCMR1_IC2PSC_Msk);
+    TIM2->CCMR1 |= (0x1 << TIM_CCMR1_CC2S_Pos) | (0x3 << TIM_CCMR1_IC2F_Pos);
+    // rising edge
+    TIM2->CCER &= ~(TIM_CCER_CC2P_Msk | TIM_CCER_CC2NP_Msk);
+    TIM2->CCER |= TIM_CCER_CC2E_Msk;
+
+    // CH3 is a frozen output compare with no pin, only used for its interrupt
+    TIM2->CCMR2 &= ~(TIM_CCMR2_CC3S_Msk | TIM_CCMR2_OC3M_Msk);
+
+    TIM2->SR = ~(uint32_t) (TIM_SR_CC2IF_Msk | TIM_SR_CC3IF_Msk); // writing 1 leaves a flag as it is
+    TIM2->DIER |= TIM_DIER_CC2IE_Msk;
+}
+
+/*
+ * Compute when to acquire the epoch that started at capture
+ */
+uint32_t PPS_ScheduleAcquire(uint32_t capture) {
+    return capture + PPS_ACQUIRE_OFFSET_US;
+}
+
+/*
+ * TIM2 CH2 capture: a pulse arrived, schedule the acquisition for its epoch
+ */
+void PPS_CaptureInterrupt(void) {
+    if (!(TIM2->SR & TIM_SR_CC2IF_Msk)) return;
+    uint32_t capture = TIM2->CCR2; // reading CCR2 clears CC2IF
+
+    ppsLastTime = capture;
+    ppsCount++;
+
+    TIM2->CCR3 = PPS_ScheduleAcquire(capture);
+    TIM2->SR = ~(uint32_t) TIM_SR_CC3IF_Msk;
+    TIM2->DIER |= TIM_DIER_CC3IE_Msk;
+}
+
+/*
+ * TIM2 CH3 compare: the epoch's messages should now be available
+ */
+void PPS_CompareInterrupt(void) {
+    if (!(TIM2->DIER & TIM_DIER_CC3IE_Msk) || !(TIM2->SR & TIM_SR_CC3IF_Msk)) return;
+
+    TIM2->SR = ~(uint32_t) TIM_SR_CC3IF_Msk;
+    TIM2->DIER &= ~TIM_DIER_CC3IE_Msk;
+
+    dueEpoch = ppsCount;
+    dueTime = ppsLastTime;
+    dueCount++;
+}
+
+/*
+ * Sleep until the acquisition for the period'th pulse since the last sample is
+ * due, taking in what the receiver sends meanwhile, and fill in the pulse time. If the pulses don't arrive within timeout us,
+ * falls back to sampling then. Returns 1 if it fell back, 0 otherwise
+ */
+uint8_t PPS_WaitForEpoch(uint32_t period, uint32_t timeout, PPS_STAMP *stamp) {
+    uint32_t start = TIMEBASE_Now();
+
+    while (dueCount - lastSampleDue < period) {
+        if (TIMEBASE_Elapsed(start) > timeout) { // no receiver pulse
+            lastSampleDue = dueCount;
+            stamp->epoch = ppsCount;
+            stamp->ppsTime = TIMEBASE_Now();
+            stamp->synced = 0;
+            return 1;
+        }
+        __WFI(); // SysTick, TIM2 or USART2 will wake us
+        GPS_Serve();
+    }
+
+    __disable_irq();
+    // epochs that came due while the last fix was still being handled
+    telemetry.droppedEpochs += dueCount - lastSampleDue - period;
+    lastSampleDue = dueCount;
+    stamp->epoch = dueEpoch;
+    stamp->ppsTime = dueTime;
+    __enable_irq();
+    stamp->synced = 1;
+
+    return 0;
+}
+
+/*
+ * Timestamp the fix as parsed
+ */
+void PPS_MarkParsed(PPS_STAMP *stamp) {
+    stamp->parseTime = TIMEBASE_Now();
+    if (stamp->synced) HIST_Add(&ppsToParse, stamp->parseTime - stamp->ppsTime);
+}
+
+/*
+ * Timestamp the fix as logged
+ */
+void PPS_MarkLogged(PPS_STAMP *stamp) {
+    stamp->logTime = TIMEBASE_Now();
+    if (stamp->synced) HIST_Add(&ppsToLog, stamp->logTime - stamp->ppsTime);
+}
@@ -0,0 +1,44 @@
+/*
+ * File: pps.h
+ * Purpose: Declares the SAM-M8Q TIMEPULSE (PPS) input used to line up fix
+ *          sampling with the receiver's navigation epochs. The pulse is captured
+ *          on TIM2 CH2 (PA1, AF2) and acquisition is scheduled on TIM2 CH3 a fixed
+ *          offset after each pulse, once the epoch's messages have been output.
+ */
+#ifndef __PPS_H
+#define __PPS_H
+
+#include "utilities.h"
+#include "histogram.h"
+
+// TIM2_CH2 input on PA1
+#define PPS_PIN_A 1
+
+// Time from the pulse until the epoch's messages are ready to read
+#define PPS_ACQUIRE_OFFSET_US 500000
+// Nominal time between pulses
+#define PPS_PERIOD_US 1000000
+
+// Hardware timestamps of one logged fix, all in TIMEBASE microseconds
+typedef struct {
+    uint32_t epoch;     // number of pulses seen when the fix was sampled
+    uint32_t ppsTime;   // capture time of the pulse that started the epoch
+    uint32_t parseTime; // time the fix was parsed
+    uint32_t logTime;   // time the fix was handed to the log
+    uint8_t synced;     // 1 if ppsTime came from a captured pulse, 0 if the pulse timed out
+} PPS_STAMP;
+
+extern HISTOGRAM ppsToParse;
+extern HISTOGRAM ppsToLog;
+
+void PPS_Setup(void);
+uint8_t PPS_WaitForEpoch(uint32_t period, uint32_t timeout, PPS_STAMP *stamp);
+void PPS_MarkParsed(PPS_STAMP *stamp);
+void PPS_MarkLogged(PPS_STAMP *stamp);
+
+// scheduling, called from the TIM2 interrupt
+uint32_t PPS_ScheduleAcquire(uint32_t capture);
+void PPS_CaptureInterrupt(void);
+void PPS_CompareInterrupt(void);
+
+#endif /* __PPS_H */
@@ -0,0 +1,104 @@
+/*
+ * File: profile.c
+ * Purpose: Defines a lightweight hot-path profiler with per-stage min/max/mean
+ *          and log2 histograms, plus CPU load accounting
+ */
+#include "profile.h"
+#include "timebase.h"
+#include "lcd.h"
+#include <stdio.h>
+
+HISTOGRAM profStats[PROF_STAGE_COUNT];
+
+static uint32_t profStart[PROF_STAGE_COUNT];
+static uint32_t profWindowStart;
+
+static const char *profNames[PROF_STAGE_COUNT] = { "RD", "PRS", "FMT", "LOG", "LCD", "IDL" };
+
+// Characters of a diagnostics row the LCD shows
+#define PROF_LCD_CHARS 15
+
+/*
+ * Clear all stage statistics and start a new load accounting window
+ */
+void PROF_Reset(void) {
+    for (int i = 0; i < PROF_STAGE_COUNT; i++) HIST_Reset(&profStats[i]);
+    profWindowStart = TIMEBASE_Now();
+}
+
+/*
+ * Mark the start of stage
+ */
+void PROF_Begin(PROF_STAGE stage) {
+    profStart[stage] = TIMEBASE_Now();
+}
+
+/*
+ * Mark the end of stage and record how long it took
+ */
+void PROF_End(PROF_STAGE stage) {
+    HIST_Add(&profStats[stage], TIMEBASE_Elapsed(profStart[stage]));
+}
+
+/*
+ * Percentage of the window spent in the idle stage
+ */
+uint32_t PROF_IdlePercent(void) {
+    uint32_t window = TIMEBASE_Elapsed(profWindowStart);
+    if (window == 0) return 100;
+
+    uint64_t idle = profStats[PROF_IDLE].sum;
+    if (idle > window) idle = window;
+    return (uint32_t)((idle * 100) / window);
+}
+
+/*
+ * Percentage of the window spent doing work
+ */
+uint32_t PROF_LoadPercent(void) {
+    return 100 - PROF_IdlePercent();
+}
+
+/*
+ * Write every stage's statistics to the debug UART. Times are in microseconds,
+ * the mean is also given in cycles at the current clock
+ */
+void PROF_Dump(void) {
+    char line[192];
+    uint32_t mhz = HAL_RCC_GetHCLKFreq() / 1000000;
+
+    snprintf(line, sizeof(line), "PROF load=%lu%% idle=%lu%% clk=%luMHz\r\n",
+             (unsigned long) PROF_LoadPercent(), (unsigned long) PROF_IdlePercent(), (unsigned long) mhz);
+    USART1_SendStr(line);
+
+    for (int i = 0; i < PROF_STAGE_COUNT; i++) {
+        int len = snprintf(line, sizeof(line), "%s cyc=%lu ", profNames[i],
+                           (unsigned long) (HIST_Mean(&profStats[i]) * mhz));
+        HIST_Format(&profStats[i], &line[len], sizeof(line) - len - 2);
+        USART1_SendStr(line);
+        USART1_SendStr("\r\n");
+    }
+}
+
+/*
+ * Draw a diagnostics page: load on the first row, then the mean and max time of
+ * each work stage in microseconds
+ */
+void PROF_ShowLCD(void) {
+    char line[40]; // the widest values, cut to a row before printing
+
+    LCD_ClearDisplay();
+    snprintf(line, sizeof(line), "CPU%lu%% ID%lu%%",
+             (unsigned long) PROF_LoadPercent(), (unsigned long) PROF_IdlePercent());
+    line[PROF_LCD_CHARS] = '\0';
+    LCD_PrintString(line);
+
+    for (int i = 0; i < PROF_IDLE && i < 5; i++) {
+        LCD_SetY(i + 1);
+        LCD_SetX(0);
+        snprintf(line, sizeof(line), "%s %lu %lu", profNames[i],
+                 (unsigned long) HIST_Mean(&profStats[i]), (unsigned long) profStats[i].max);
+        line[PROF_LCD_CHARS] = '\0';
+        LCD_PrintString(line);
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ * File: profile.h
+ * Purpose: Declares a lightweight hot-path profiler. The Cortex-M0 has no DWT
+ *          cycle counter, so stages are timed against the 1 MHz TIM2 timebase.
+ *          Build with PROFILE_ENABLED defined to turn the markers on.
+ */
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include "utilities.h"
+#include "histogram.h"
+
+// Number of logged fixes between dumps of the statistics
+#define PROF_DUMP_PERIOD 12
+
+typedef enum {
+    PROF_GPS_READ,   // I2C transfers from the receiver and demultiplexing
+    PROF_NMEA_PARSE, // sentence parsing
+    PROF_FORMAT,     // draining the spool: track point formatting and handing them to USART3
+    PROF_LOG_WRITE,  // programming the track point into the spool
+    PROF_LCD_DRAW,   // redrawing the screen
+    PROF_IDLE,       // waiting for the next epoch or for a fix
+    PROF_STAGE_COUNT
+} PROF_STAGE;
+
+#ifdef PROFILE_ENABLED
+#define PROF_BEGIN(stage) PROF_Begin(stage)
+#define PROF_END(stage)   PROF_End(stage)
+#else
+#define PROF_BEGIN(stage)
+#define PROF_END(stage)
+#endif
+
+extern HISTOGRAM profStats[PROF_STAGE_COUNT];
+
+void PROF_Reset(void);
+void PROF_Begin(PROF_STAGE stage);
+void PROF_End(PROF_STAGE stage);
+uint32_t PROF_IdlePercent(void);
+uint32_t PROF_LoadPercent(void);
+
+void PROF_Dump(void);
+void PROF_ShowLCD(void);
+
+#endif /* __PROFILE_H */
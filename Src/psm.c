@@ -0,0 +1,100 @@
+/*
+ * File: psm.c
+ * Purpose: Receiver power save. After each sample the receiver is put in the
+ *          mode the next period calls for with CFG-PM2 and CFG-RXM, its update
+ *          period matched to the period so it only navigates for the fixes
+ *          that are sampled. In power save mode it only pulses with a fix, so
+ *          the MCU waits for one pulse instead of counting them. How long the
+ *          fix takes after each wake goes into psmWakeToFix
+ */
+#include "psm.h"
+#include "gps.h"
+#include "telemetry.h"
+
+HISTOGRAM psmWakeToFix;
+
+// Mode and update period in pulses the receiver last acknowledged
+static PSM_MODE mode;
+static uint32_t updatePeriod;
+
+// Time from the last sample's pulse to when the next update is due
+static uint32_t waitTime;
+
+// Pulse of the last sample, lastSynced is 0 if it had none
+static uint32_t lastPps;
+static uint8_t lastSynced;
+
+/*
+ * Start out continuous. Also undoes a power save mode the receiver kept
+ * through a reset of the MCU
+ */
+void PSM_Setup(void) {
+    mode = PSM_CONTINUOUS;
+    updatePeriod = 0;
+    lastSynced = 0;
+    HIST_Reset(&psmWakeToFix);
+
+    GPS_SetContinuous();
+}
+
+/*
+ * Mode the receiver is in
+ */
+PSM_MODE PSM_Mode(void) {
+    return mode;
+}
+
+/*
+ * Bring the receiver's mode in line with the sampling period. A mode that
+ * wasn't acknowledged is sent again after the next sample
+ */
+void PSM_Update(uint32_t period) {
+    PSM_MODE want = PSM_CONTINUOUS;
+    if (PSM_ENABLED && period >= PSM_ONOFF_MIN_PERIOD) want = PSM_ONOFF;
+    else if (PSM_ENABLED && period >= PSM_CYCLIC_MIN_PERIOD) want = PSM_CYCLIC;
+
+    uint32_t update = want == PSM_CONTINUOUS ? 0 : period;
+    if (want == mode && update == updatePeriod) return;
+
+    uint8_t failed;
+    if (want == PSM_CONTINUOUS) {
+        failed = GPS_SetContinuous();
+    }
+    else {
+        uint32_t flags = UBX_CFG_PM2_UPDATE_EPH | (want == PSM_CYCLIC ? UBX_CFG_PM2_MODE_CYCLIC : UBX_CFG_PM2_MODE_ONOFF);
+        failed = GPS_SetPowerSave(flags, update * (PPS_PERIOD_US / 1000), PSM_SEARCH_PERIOD_MS);
+    }
+    if (failed) return;
+
+    mode = want;
+    updatePeriod = update;
+    telemetry.psmChanges++;
+}
+
+/*
+ * Sleep until the receiver's next update for a sample period'th pulses from
+ * the last. Returns 1 if its pulse never came, 0 otherwise
+ */
+uint8_t PSM_WaitForEpoch(uint32_t period, PPS_STAMP *stamp) {
+    if (mode == PSM_CONTINUOUS) {
+        waitTime = period * PPS_PERIOD_US;
+        return PPS_WaitForEpoch(period, waitTime + PPS_ACQUIRE_OFFSET_US, stamp);
+    }
+
+    // one pulse, with the fix, and after a wait to reacquire for ON/OFF
+    waitTime = updatePeriod * PPS_PERIOD_US;
+    uint32_t timeout = waitTime + PPS_ACQUIRE_OFFSET_US + (mode == PSM_ONOFF ? PSM_ACQUIRE_MAX_US : 0);
+    return PPS_WaitForEpoch(1, timeout, stamp);
+}
+
+/*
+ * Time the fix from when the update was due, after PPS_MarkParsed
+ */
+void PSM_MarkParsed(PPS_STAMP *stamp) {
+    if (lastSynced && stamp->synced) {
+        int32_t late = stamp->parseTime - (lastPps + waitTime);
+        if (late >= 0) HIST_Add(&psmWakeToFix, late); // not if the mode changed under it
+    }
+    lastPps = stamp->ppsTime;
+    lastSynced = stamp->synced;
+}
@@ -0,0 +1,49 @@
+/*
+ * File: psm.h
+ * Purpose: Declares the receiver power save orchestration. The receiver's
+ *          operating mode follows the sampling period: continuous while every
+ *          pulse is sampled, cyclic tracking with an update per sample for
+ *          short periods and ON/OFF, off between fixes, for long ones. The
+ *          MCU sleeps until the pulse that comes with each update
+ */
+#ifndef __PSM_H
+#define __PSM_H
+
+#include "utilities.h"
+#include "histogram.h"
+#include "pps.h"
+
+// 0 keeps the receiver continuous whatever the period. Set with PSM_ENABLED
+// in the Makefile
+#ifndef PSM_ENABLED
+#define PSM_ENABLED 1
+#endif
+
+// Sampling periods, in time pulses, from which the receiver runs cyclic
+// tracking, and from which it switches off between fixes
+#define PSM_CYCLIC_MIN_PERIOD 2
+#define PSM_ONOFF_MIN_PERIOD  10
+
+// How often an ON/OFF receiver that can't get a fix tries again, in ms
+#define PSM_SEARCH_PERIOD_MS 30000
+
+// Longest an ON/OFF receiver gets to find the fix after it wakes before the
+// MCU samples anyway
+#define PSM_ACQUIRE_MAX_US 5000000
+
+typedef enum {
+    PSM_CONTINUOUS,     // full power, a solution every CFG-RATE
+    PSM_CYCLIC,         // tracking at low power, a solution every update period
+    PSM_ONOFF           // off between fixes, reacquiring each time it wakes
+} PSM_MODE;
+
+// Time from when the receiver's update was due to the fix being parsed
+extern HISTOGRAM psmWakeToFix;
+
+void PSM_Setup(void);
+PSM_MODE PSM_Mode(void);
+void PSM_Update(uint32_t period);
+uint8_t PSM_WaitForEpoch(uint32_t period, PPS_STAMP *stamp);
+void PSM_MarkParsed(PPS_STAMP *stamp);
+
+#endif /* __PSM_H */
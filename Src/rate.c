@@ -0,0 +1,113 @@
+/*
+ * File: rate.c
+ * Purpose: Adaptive sampling. Each sampled fix sets how long until the next:
+ *          long enough to cover RATE_SPACING_M at the current speed, short
+ *          enough that the course swings at most RATE_TURN_STEP_CDEG in a
+ *          turn. The period shrinks at once but only doubles per sample, so a
+ *          stop doesn't sleep through moving off again. The receiver
+ *          navigates about once per period, within its limits, so on a
+ *          straight or at rest it and the buses have less to do
+ */
+#include "rate.h"
+#include "gps.h"
+#include "pps.h"
+#include "rtc.h"
+#include "telemetry.h"
+
+static uint32_t period = RATE_MIN_PERIOD;
+
+// measRate the receiver last acknowledged, 0 if not known
+static uint16_t navRate;
+
+// Course and time of the last sample with a trustworthy course, for the rate
+// of turn. lastTime is 0 when there is none
+static uint16_t lastCourse;
+static uint32_t lastTime;
+
+/*
+ * Bring the receiver's navigation rate in line with the period. A rate that
+ * wasn't acknowledged is sent again after the next sample
+ */
+static void RATE_SetNav(void) {
+    uint32_t want = period * (PPS_PERIOD_US / 1000);
+
+    if (want < RATE_NAV_MIN_MS) want = RATE_NAV_MIN_MS;
+    if (want > RATE_NAV_MAX_MS) want = RATE_NAV_MAX_MS;
+    if (want == navRate) return;
+
+    if (GPS_SetNavRate(want)) {
+        navRate = 0;
+        return;
+    }
+    navRate = want;
+    telemetry.navRateChanges++;
+}
+
+/*
+ * Start sampling every pulse with the receiver navigating at its fastest.
+ * Also undoes a slow rate the receiver kept through a reset of the MCU
+ */
+void RATE_Setup(void) {
+    period = RATE_MIN_PERIOD;
+    lastTime = 0;
+    navRate = 0;
+    RATE_SetNav();
+}
+
+/*
+ * Time pulses to wait before the next sample
+ */
+uint32_t RATE_Period(void) {
+    return period;
+}
+
+/*
+ * True if the fix's course says which way the logger is heading. It doesn't
+ * when standing still or when the position is estimated or poor: a high HDOP
+ * from GGA, or RMC's navigational status saying unsafe or not valid
+ */
+static uint8_t RATE_HasCourse(FIX *fix) {
+    if ((fix->flags & (FIX_HAS_SPEED | FIX_HAS_COURSE)) != (FIX_HAS_SPEED | FIX_HAS_COURSE)) return 0;
+    if (fix->speed < RATE_STILL_CM_S) return 0;
+    if (fix->posmode == 'E' || fix->posmode == 'N') return 0;
+    if (fix->navstatus == 'U' || fix->navstatus == 'V') return 0;
+    if ((fix->flags & FIX_HAS_HDOP) && fix->hdop > RATE_POOR_HDOP) return 0;
+    return 1;
+}
+
+/*
+ * Work out the next period from a sampled, valid fix
+ */
+void RATE_Update(FIX *fix) {
+    uint32_t want = RATE_MAX_PERIOD;
+
+    if ((fix->flags & FIX_HAS_SPEED) && fix->speed > 0) {
+        uint32_t spaced = RATE_SPACING_M * 100 / fix->speed;
+        if (spaced < want) want = spaced;
+    }
+
+    uint32_t now = RTC_Seconds(fix->datetime);
+    if (RATE_HasCourse(fix) && now != 0) {
+        if (lastTime != 0 && now > lastTime) {
+            int32_t turn = (int32_t) fix->course - lastCourse;
+            if (turn > 18000) turn -= 36000;
+            if (turn < -18000) turn += 36000;
+            if (turn < 0) turn = -turn;
+
+            // centidegrees per second
+            uint32_t rate = turn / (now - lastTime);
+            if (rate > 0 && RATE_TURN_STEP_CDEG / rate < want) want = RATE_TURN_STEP_CDEG / rate;
+        }
+        lastCourse = fix->course;
+        lastTime = now;
+    }
+    else {
+        lastTime = 0;
+    }
+
+    if (want < RATE_MIN_PERIOD) want = RATE_MIN_PERIOD;
+    if (want > 2 * period) want = 2 * period;
+    period = want;
+
+    RATE_SetNav();
+}
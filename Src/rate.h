@@ -0,0 +1,39 @@
+/*
+ * File: rate.h
+ * Purpose: Declares the sampling rate controller. It sets the number of time
+ *          pulses between sampled fixes from the ground speed, the rate of
+ *          turn and the fix quality, and keeps the receiver's navigation rate
+ *          in step through CFG-RATE
+ */
+#ifndef __RATE_H
+#define __RATE_H
+
+#include "utilities.h"
+#include "fix.h"
+
+// Limits of the time pulses between samples
+#define RATE_MIN_PERIOD 1
+#define RATE_MAX_PERIOD 10
+
+// Distance wanted between samples on a straight, in meters
+#define RATE_SPACING_M 50
+
+// Most the course may swing between samples in a turn, in 0.01 degrees
+#define RATE_TURN_STEP_CDEG 1500
+
+// Below this ground speed the course is noise, in cm/s
+#define RATE_STILL_CM_S 50
+
+// Worst HDOP, in 0.01, whose course is trusted to detect a turn
+#define RATE_POOR_HDOP 500
+
+// Limits of the receiver's navigation rate, CFG-RATE measRate in ms. Samples
+// are taken on the pulses, so solutions faster than those would go unused
+#define RATE_NAV_MIN_MS 1000
+#define RATE_NAV_MAX_MS 5000
+
+void RATE_Setup(void);
+uint32_t RATE_Period(void);
+void RATE_Update(FIX *fix);
+
+#endif /* __RATE_H */
@@ -0,0 +1,115 @@
+/*
+ * File: rawlog.c
+ * Purpose: Raw log of the receiver's NMEA sentences. Each good sentence is
+ *          compressed into the block as the demultiplexer hands it over, from
+ *          the main loop like everything else here. BATCH_Flush appends
+ *          the block to the raw file after the track's records, in the same
+ *          burst, so it needs no time of its own on the link and is within the
+ *          hold-up time too. Appending takes the compressed bytes as they are,
+ *          where a write would take some of them for line editing. Blocks of
+ *          batches OpenLog lost may be on the card in part or not at all, what
+ *          they held is gone, and the compressor starts afresh so the next
+ *          don't depend on them. Sentences that come while the block is full
+ *          are dropped and counted
+ */
+#include "rawlog.h"
+#include "openlog.h"
+#include "nmea.h"
+#include "telemetry.h"
+#include <string.h>
+
+static char rawFile[MAX_FILE_NAME_LENGTH+1]; // empty while not logging
+static uint16_t rawSeq;                 // sequence number of the next block
+static uint8_t rawLine[NMEA_MAX_LEN+5]; // one with its checksum, <CR><LF>
+
+/*
+ * Start a new raw file, removing the last one. The first block appended
+ * creates it
+ */
+void RAWLOG_Open(char *name) {
+    OPENLOG_RemoveFile(name); // returns once OpenLog has answered
+
+    LZ_Reset();
+    rawSeq = 0;
+    strncpy(rawFile, name, MAX_FILE_NAME_LENGTH);
+    rawFile[MAX_FILE_NAME_LENGTH] = '\0';
+}
+
+/*
+ * Stop logging sentences, after BATCH_Close has written the last block
+ */
+void RAWLOG_Close(void) {
+    rawFile[0] = '\0';
+}
+
+/*
+ * Compress a good sentence and the <CR><LF> the receiver ended it with
+ */
+void RAWLOG_Frame(uint8_t *frame, uint32_t len) {
+    if (rawFile[0] == '\0') return;
+
+    uint8_t failed = 1;
+    if (len + 2 <= sizeof(rawLine)) {
+        memcpy(rawLine, frame, len);
+        rawLine[len++] = '\r';
+        rawLine[len++] = '\n';
+        failed = LZ_Compress(rawLine, len);
+    }
+
+    if (failed) telemetry.rawDropped++;
+    else telemetry.rawBytes += len;
+}
+
+/*
+ * Most bytes appending the block would take in the batch, with the append
+ * command and the ctrl-Z ending it. 0 if there is nothing to write
+ */
+uint32_t RAWLOG_Pending(void) {
+    uint32_t pending = LZ_Pending();
+    if (rawFile[0] == '\0' || pending == 0) return 0;
+
+    return strlen("append \r") + strlen(rawFile) + 2 + 2 * LZ_HEADER_LEN + pending + 3;
+}
+
+/*
+ * Append the block to the raw file in the held batch if it fits in room
+ * bytes, and start the next. Only from BATCH_Flush, between the track's
+ * write and the size command
+ */
+void RAWLOG_Write(uint32_t room) {
+    uint32_t pending = RAWLOG_Pending();
+    if (pending == 0 || pending > room) return;
+
+    uint32_t len, packed;
+    uint8_t header[2 + 2 * LZ_HEADER_LEN];
+    uint32_t headerLen = 0;
+
+    uint8_t *block = LZ_Finish(&len, &packed);
+
+    header[headerLen++] = LZ_ESC;
+    header[headerLen++] = LZ_MARK;
+    headerLen += LZ_Escape(rawSeq & 0xFF, &header[headerLen]);
+    headerLen += LZ_Escape(rawSeq >> 8, &header[headerLen]);
+    headerLen += LZ_Escape(packed & 0xFF, &header[headerLen]);
+    headerLen += LZ_Escape(packed >> 8, &header[headerLen]);
+
+    OPENLOG_AppendTo(rawFile);
+    for (uint32_t i = 0; i < headerLen; i++) USART3_SendChar(header[i]);
+    for (uint32_t i = 0; i < len; i++) USART3_SendChar(block[i]);
+    OPENLOG_EndAppend();
+
+    rawSeq++;
+    telemetry.rawPacked += headerLen + len;
+    LZ_Next();
+}
+
+/*
+ * OpenLog lost the batches after the last it confirmed, so the blocks that
+ * went with them may be cut off or missing. The block being filled may match
+ * against theirs, so it goes too, and the next starts afresh. The sequence
+ * numbers go on, so the decoder can tell the new blocks from what is left of
+ * the lost ones
+ */
+void RAWLOG_Rewind(void) {
+    LZ_Reset();
+}
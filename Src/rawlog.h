@@ -0,0 +1,29 @@
+/*
+ * File: rawlog.h
+ * Purpose: Declares the raw log, the receiver's NMEA output kept whole for
+ *          post-processing. Sentences are compressed as they arrive and the
+ *          blocks go out with the track batches into a file of their own,
+ *          which the host tools decode
+ */
+#ifndef __RAWLOG_H
+#define __RAWLOG_H
+
+#include "utilities.h"
+#include "lz.h"
+
+// 0 leaves the raw log out. Set with RAWLOG_ENABLED in the Makefile
+#ifndef RAWLOG_ENABLED
+#define RAWLOG_ENABLED 0
+#endif
+
+// A block this full is written without waiting for the track batch
+#define RAWLOG_FLUSH_AT (LZ_BLOCK_LEN * 3 / 4)
+
+void RAWLOG_Open(char *name);
+void RAWLOG_Close(void);
+void RAWLOG_Frame(uint8_t *frame, uint32_t len);
+uint32_t RAWLOG_Pending(void);
+void RAWLOG_Write(uint32_t room);
+void RAWLOG_Rewind(void);
+
+#endif /* __RAWLOG_H */
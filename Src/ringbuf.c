@@ -0,0 +1,221 @@
+/*
+ * File: ringbuf.c
+ * Purpose: Defines a lock-free single-producer/single-consumer byte queue used
+ *          to pass data between interrupt and thread context
+ */
+#include "ringbuf.h"
+#include <string.h>
+
+/*
+ * Update the high-water mark after the producer publishes new data
+ */
+static void RINGBUF_UpdateHighWater(RINGBUF *rb, uint32_t head) {
+    uint32_t used = head - rb->tail;
+    if (used > rb->highWater) rb->highWater = used;
+}
+
+/*
+ * Initialize the queue over buf. size must be a power of two.
+ * Returns 1 if the size is not usable, 0 otherwise
+ */
+uint8_t RINGBUF_Init(RINGBUF *rb, uint8_t *buf, uint32_t size) {
+    if (!RINGBUF_IS_POW2(size)) return 1; // FAILURE
+
+    rb->buf = buf;
+    rb->mask = size - 1;
+    RINGBUF_Reset(rb);
+
+    return 0;
+}
+
+/*
+ * Empty the queue and clear the statistics. Neither side may be using the queue
+ */
+void RINGBUF_Reset(RINGBUF *rb) {
+    rb->head = 0;
+    rb->tail = 0;
+    rb->highWater = 0;
+    rb->overflows = 0;
+}
+
+/*
+ * Total number of bytes the queue can hold
+ */
+uint32_t RINGBUF_Size(RINGBUF *rb) {
+    return rb->mask + 1;
+}
+
+/*
+ * Number of bytes waiting to be read. Indexes run free so unsigned wrap gives the count
+ */
+uint32_t RINGBUF_Count(RINGBUF *rb) {
+    return rb->head - rb->tail;
+}
+
+/*
+ * Number of bytes that can be written
+ */
+uint32_t RINGBUF_Free(RINGBUF *rb) {
+    return RINGBUF_Size(rb) - RINGBUF_Count(rb);
+}
+
+/*
+ * Queue a single byte. Returns 1 if the queue is full, 0 otherwise
+ */
+uint8_t RINGBUF_Push(RINGBUF *rb, uint8_t c) {
+    uint32_t head = rb->head;
+
+    if (head - rb->tail > rb->mask) {
+        rb->overflows++;
+        return 1; // FAILURE
+    }
+
+    // the slot must be seen as free before it is overwritten
+    RINGBUF_BARRIER();
+    rb->buf[head & rb->mask] = c;
+    // data must land before the consumer can see the new head
+    RINGBUF_BARRIER();
+    rb->head = head + 1;
+
+    RINGBUF_UpdateHighWater(rb, head + 1);
+    return 0;
+}
+
+/*
+ * Queue as many bytes of data as fit. Returns the number of bytes queued
+ */
+uint32_t RINGBUF_PushBulk(RINGBUF *rb, const uint8_t *data, uint32_t len) {
+    uint32_t queued = 0;
+
+    while (queued < len) {
+        uint8_t *span;
+        uint32_t n = RINGBUF_WriteSpan(rb, &span);
+        if (n == 0) break;
+        if (n > len - queued) n = len - queued;
+
+        memcpy(span, &data[queued], n);
+        RINGBUF_Commit(rb, n);
+        queued += n;
+    }
+
+    if (queued < len) rb->overflows += len - queued;
+    return queued;
+}
+
+/*
+ * Queue all len bytes of data or nothing at all. Keeps records from being split.
+ * Returns 1 if there was not enough room, 0 otherwise
+ */
+uint8_t RINGBUF_PushAll(RINGBUF *rb, const uint8_t *data, uint32_t len) {
+    if (RINGBUF_Free(rb) < len) {
+        rb->overflows += len;
+        return 1; // FAILURE
+    }
+
+    RINGBUF_PushBulk(rb, data, len);
+    return 0;
+}
+
+/*
+ * Get the largest contiguous free region in span. Returns its length.
+ * Fill it directly (ie: DMA or memcpy) then publish it with RINGBUF_Commit
+ */
+uint32_t RINGBUF_WriteSpan(RINGBUF *rb, uint8_t **span) {
+    uint32_t head = rb->head;
+    uint32_t free = RINGBUF_Size(rb) - (head - rb->tail);
+    uint32_t toEnd = RINGBUF_Size(rb) - (head & rb->mask);
+
+    // the region must be seen as free before the caller writes into it
+    RINGBUF_BARRIER();
+    *span = &rb->buf[head & rb->mask];
+    return free < toEnd ? free : toEnd;
+}
+
+/*
+ * Publish len bytes written into the span from RINGBUF_WriteSpan
+ */
+void RINGBUF_Commit(RINGBUF *rb, uint32_t len) {
+    uint32_t head = rb->head + len;
+
+    // data must land before the consumer can see the new head
+    RINGBUF_BARRIER();
+    rb->head = head;
+
+    RINGBUF_UpdateHighWater(rb, head);
+}
+
+/*
+ * Read a single byte into c. Returns 1 if the queue is empty, 0 otherwise
+ */
+uint8_t RINGBUF_Pop(RINGBUF *rb, uint8_t *c) {
+    uint32_t tail = rb->tail;
+
+    if (rb->head == tail) return 1; // FAILURE
+
+    // head must be read before the data it covers
+    RINGBUF_BARRIER();
+    *c = rb->buf[tail & rb->mask];
+    // data must be read before the slot is handed back to the producer
+    RINGBUF_BARRIER();
+    rb->tail = tail + 1;
+
+    return 0;
+}
+
+/*
+ * Read up to len bytes into data. Returns the number of bytes read
+ */
+uint32_t RINGBUF_PopBulk(RINGBUF *rb, uint8_t *data, uint32_t len) {
+    uint32_t read = 0;
+
+    while (read < len) {
+        uint8_t *span;
+        uint32_t n = RINGBUF_ReadSpan(rb, &span);
+        if (n == 0) break;
+        if (n > len - read) n = len - read;
+
+        memcpy(&data[read], span, n);
+        RINGBUF_Consume(rb, n);
+        read += n;
+    }
+
+    return read;
+}
+
+/*
+ * Look at the byte offset places from the front without removing it.
+ * Returns 1 if there are not that many bytes queued, 0 otherwise
+ */
+uint8_t RINGBUF_Peek(RINGBUF *rb, uint32_t offset, uint8_t *c) {
+    uint32_t tail = rb->tail;
+
+    if (rb->head - tail <= offset) return 1; // FAILURE
+
+    RINGBUF_BARRIER();
+    *c = rb->buf[(tail + offset) & rb->mask];
+    return 0;
+}
+
+/*
+ * Get the largest contiguous readable region in span. Returns its length.
+ * Release it with RINGBUF_Consume once done with the data
+ */
+uint32_t RINGBUF_ReadSpan(RINGBUF *rb, uint8_t **span) {
+    uint32_t tail = rb->tail;
+    uint32_t used = rb->head - tail;
+    uint32_t toEnd = RINGBUF_Size(rb) - (tail & rb->mask);
+
+    // head must be read before the data it covers
+    RINGBUF_BARRIER();
+    *span = &rb->buf[tail & rb->mask];
+    return used < toEnd ? used : toEnd;
+}
+
+/*
+ * Hand len bytes from the front of the queue back to the producer
+ */
+void RINGBUF_Consume(RINGBUF *rb, uint32_t len) {
+    // data must be read before the region is handed back to the producer
+    RINGBUF_BARRIER();
+    rb->tail += len;
+}
@@ -0,0 +1,56 @@
+/*
+ * File: ringbuf.h
+ * Purpose: Declares a lock-free single-producer/single-consumer byte queue used
+ *          to pass data between interrupt and thread context.
+ *          The Cortex-M0 has no LDREX/STREX, so the queue relies only on aligned
+ *          32-bit loads/stores being atomic plus a barrier between the data and
+ *          index updates. Exactly one context may push and exactly one may pop.
+ *          Any other has to do it with interrupts masked, while the one it
+ *          stands in for can't be running.
+ */
+#ifndef __RINGBUF_H
+#define __RINGBUF_H
+
+#include <stdint.h>
+
+#if defined(__arm__)
+#include "stm32f0xx.h"
+#define RINGBUF_BARRIER() __DMB()
+#else
+#define RINGBUF_BARRIER() __sync_synchronize()
+#endif
+
+// Size of storage must be a power of two so the indexes can wrap with a mask
+#define RINGBUF_IS_POW2(n) ((n) != 0 && (((n) & ((n) - 1)) == 0))
+
+typedef struct {
+    uint8_t *buf;                // backing storage, size bytes long
+    uint32_t mask;               // size - 1
+    volatile uint32_t head;      // free running write index, only changed by the producer
+    volatile uint32_t tail;      // free running read index, only changed by the consumer
+    volatile uint32_t highWater; // most bytes ever queued at once, updated by the producer
+    volatile uint32_t overflows; // bytes the producer could not queue, updated by the producer
+} RINGBUF;
+
+uint8_t RINGBUF_Init(RINGBUF *rb, uint8_t *buf, uint32_t size);
+void RINGBUF_Reset(RINGBUF *rb);
+
+uint32_t RINGBUF_Size(RINGBUF *rb);
+uint32_t RINGBUF_Count(RINGBUF *rb);
+uint32_t RINGBUF_Free(RINGBUF *rb);
+
+// producer side
+uint8_t RINGBUF_Push(RINGBUF *rb, uint8_t c);
+uint32_t RINGBUF_PushBulk(RINGBUF *rb, const uint8_t *data, uint32_t len);
+uint8_t RINGBUF_PushAll(RINGBUF *rb, const uint8_t *data, uint32_t len);
+uint32_t RINGBUF_WriteSpan(RINGBUF *rb, uint8_t **span);
+void RINGBUF_Commit(RINGBUF *rb, uint32_t len);
+
+// consumer side
+uint8_t RINGBUF_Pop(RINGBUF *rb, uint8_t *c);
+uint32_t RINGBUF_PopBulk(RINGBUF *rb, uint8_t *data, uint32_t len);
+uint8_t RINGBUF_Peek(RINGBUF *rb, uint32_t offset, uint8_t *c);
+uint32_t RINGBUF_ReadSpan(RINGBUF *rb, uint8_t **span);
+void RINGBUF_Consume(RINGBUF *rb, uint32_t len);
+
+#endif /* __RINGBUF_H */
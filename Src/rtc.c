@@ -0,0 +1,126 @@
+/*
+ * File: rtc.c
+ * Purpose: The RTC calendar on the LSI. Dates and times are packed as in the
+ *          fix record, see FIX_PACK_DATE and FIX_PACK_TIME
+ */
+#include "rtc.h"
+#include "fix.h"
+#include "timebase.h"
+
+static uint8_t rtcTrusted; // the calendar has run since it was last set
+
+// Days before each month in a common year
+static const uint16_t rtcMonthDays[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+static uint32_t RTC_ToBCD(uint32_t x) {
+    return ((x / 10) << 4) | (x % 10);
+}
+
+static uint32_t RTC_FromBCD(uint32_t x) {
+    return (x >> 4) * 10 + (x & 0xF);
+}
+
+/*
+ * Wait for flag in ISR to be set. Returns 1 on timeout, 0 otherwise
+ */
+static uint8_t RTC_WaitFlag(uint32_t flag) {
+    uint32_t start = TIMEBASE_Now();
+    while (!(RTC->ISR & flag)) {
+        if (TIMEBASE_Elapsed(start) > RTC_SYNC_TIMEOUT_US) return 1; // FAILURE
+    }
+    return 0;
+}
+
+/*
+ * Start the LSI and clock the RTC from it unless a clock was already chosen.
+ * The calendar is trusted if it was set and kept running: it always does on
+ * the LSE, on the LSI only when the reset wasn't a power-on reset.
+ * BACKUP_Setup must be called first
+ */
+void RTC_Setup(void) {
+    RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+
+    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_LSI;
+    RCC_OscInitStruct.LSIState = RCC_LSI_ON;
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK) {
+        return;
+    }
+
+    if (!(RCC->BDCR & RCC_BDCR_RTCSEL)) RCC->BDCR |= RCC_BDCR_RTCSEL_LSI;
+    RCC->BDCR |= RCC_BDCR_RTCEN;
+
+    uint8_t kept = (RCC->BDCR & RCC_BDCR_RTCSEL) == RCC_BDCR_RTCSEL_LSE || !(RCC->CSR & RCC_CSR_PORRSTF);
+    RCC->CSR |= RCC_CSR_RMVF; // clear the reset flags for next time
+
+    // the shadow registers need a fresh copy after a reset
+    RTC->ISR &= ~RTC_ISR_RSF;
+    rtcTrusted = (RTC->ISR & RTC_ISR_INITS) && kept && !RTC_WaitFlag(RTC_ISR_RSF);
+}
+
+/*
+ * Current date and time in datetime.
+ * Returns 1 if the calendar isn't trusted, 0 otherwise
+ */
+uint8_t RTC_Get(uint32_t *datetime) {
+    if (!rtcTrusted) return 1; // FAILURE
+
+    uint32_t tr = RTC->TR; // locks DR until it is read
+    uint32_t dr = RTC->DR;
+
+    *datetime = FIX_PACK_DATE(RTC_FromBCD((dr >> RTC_DR_YU_Pos) & 0xFF),
+                              RTC_FromBCD((dr >> RTC_DR_MU_Pos) & 0x1F),
+                              RTC_FromBCD((dr >> RTC_DR_DU_Pos) & 0x3F)) |
+                FIX_PACK_TIME(RTC_FromBCD((tr >> RTC_TR_HU_Pos) & 0x3F),
+                              RTC_FromBCD((tr >> RTC_TR_MNU_Pos) & 0x7F),
+                              RTC_FromBCD((tr >> RTC_TR_SU_Pos) & 0x7F));
+    return 0;
+}
+
+/*
+ * Set the calendar to datetime, in UTC
+ */
+void RTC_Set(uint32_t datetime) {
+    uint32_t weekday = (RTC_Seconds(datetime) / 86400 + 5) % 7 + 1; // 2000-01-01 was a Saturday, Monday is 1
+
+    RTC->WPR = 0xCA; // unlock the RTC registers
+    RTC->WPR = 0x53;
+
+    RTC->ISR |= RTC_ISR_INIT;
+    if (RTC_WaitFlag(RTC_ISR_INITF)) {
+        RTC->WPR = 0xFF;
+        return;
+    }
+
+    // PREDIV_S then PREDIV_A, in two writes
+    RTC->PRER = RTC_PREDIV_S;
+    RTC->PRER = (RTC_PREDIV_A << RTC_PRER_PREDIV_A_Pos) | RTC_PREDIV_S;
+
+    RTC->TR = (RTC_ToBCD(FIX_HOUR(datetime)) << RTC_TR_HU_Pos) | (RTC_ToBCD(FIX_MINUTE(datetime)) << RTC_TR_MNU_Pos) |
+              (RTC_ToBCD(FIX_SECOND(datetime)) << RTC_TR_SU_Pos);
+    RTC->DR = (RTC_ToBCD(FIX_YEAR(datetime)) << RTC_DR_YU_Pos) | (weekday << RTC_DR_WDU_Pos) |
+              (RTC_ToBCD(FIX_MONTH(datetime)) << RTC_DR_MU_Pos) | (RTC_ToBCD(FIX_DAY(datetime)) << RTC_DR_DU_Pos);
+    RTC->CR &= ~RTC_CR_FMT; // 24 hour
+
+    RTC->ISR &= ~RTC_ISR_INIT;
+    RTC->WPR = 0xFF;
+
+    rtcTrusted = 1;
+}
+
+/*
+ * Seconds from 2000-01-01 00:00:00 to datetime. Every year up to 2063 that
+ * divides by 4 is a leap year
+ */
+uint32_t RTC_Seconds(uint32_t datetime) {
+    uint32_t year = FIX_YEAR(datetime);
+    uint32_t month = FIX_MONTH(datetime);
+    uint32_t day = FIX_DAY(datetime);
+
+    if (month < 1 || month > 12 || day < 1) return 0;
+
+    uint32_t days = 365 * year + (year + 3) / 4 + rtcMonthDays[month-1] + (day - 1);
+    if (month > 2 && year % 4 == 0) days++;
+
+    return days * 86400 + FIX_HOUR(datetime) * 3600 + FIX_MINUTE(datetime) * 60 + FIX_SECOND(datetime);
+}
@@ -0,0 +1,28 @@
+/*
+ * File: rtc.h
+ * Purpose: Declares the RTC calendar, kept in UTC from valid fixes so the time
+ *          is known at the next boot. It runs on the LSI, which stops without
+ *          main power, so after a power-on reset the calendar isn't trusted
+ */
+#ifndef __RTC_H
+#define __RTC_H
+
+#include "utilities.h"
+
+// 40 kHz LSI divided to 1 Hz, PREDIV_A + 1 times PREDIV_S + 1
+#define RTC_PREDIV_A 99
+#define RTC_PREDIV_S 399
+
+// The LSI is specified from 30 to 50 kHz, so the calendar drifts by up to a
+// quarter of the time since it was set
+#define RTC_DRIFT_DIV 4
+
+// Longest wait for the calendar to synchronise, in RTCCLK periods at 30 kHz
+#define RTC_SYNC_TIMEOUT_US 1000
+
+void RTC_Setup(void);
+uint8_t RTC_Get(uint32_t *datetime);
+void RTC_Set(uint32_t datetime);
+uint32_t RTC_Seconds(uint32_t datetime);
+
+#endif /* __RTC_H */
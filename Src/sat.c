@@ -0,0 +1,279 @@
+/*
+ * File: sat.c
+ * Purpose: Satellite table kept from GSV and GSA sentences. GSV adds and
+ *          updates satellites as its parts arrive and ages the ones a whole
+ *          cycle left out, GSA marks which are used and carries the DOPs.
+ *          The handlers run from the demultiplexer, in the USART2 interrupt
+ *          on the UART port, so readers copy the summary with interrupts off
+ */
+#include "sat.h"
+#include "nmea.h"
+#include "lcd.h"
+#include <stdio.h>
+#include <string.h>
+
+// SAT_ENTRY.state bits
+#define SAT_USED     0x01   // in the navigation solution
+#define SAT_FRESH    0x02   // in the GSV cycle under way
+#define SAT_AGE_ONE  0x10   // cycles missed, in the top four bits
+#define SAT_AGE(s)   ((s) >> 4)
+
+// Characters across the LCD, 84 columns of 6 pixels
+#define SAT_LCD_CHARS 14
+
+typedef struct {
+    uint16_t sv;        // NMEA satellite number
+    uint16_t azim;      // degrees
+    uint8_t system;     // SAT_SYSTEM
+    uint8_t cno;        // dB-Hz, 0 if not tracked
+    int8_t elev;        // degrees
+    uint8_t state;      // SAT_USED, SAT_FRESH and the age
+} SAT_ENTRY;
+
+static SAT_ENTRY sats[SAT_MAX];
+static uint32_t satCount;
+static SAT_SUMMARY summary;
+
+// Bin labels for the LCD, for SAT_CNO_FIRST and SAT_CNO_STEP as they are
+static const char *satHistLabels[SAT_CNO_BINS] = { "<20", "20+", "30+", "40+" };
+
+/*
+ * Forget every satellite
+ */
+void SAT_Reset(void) {
+    satCount = 0;
+    memset(&summary, 0, sizeof(summary));
+}
+
+/*
+ * Constellation of a sentence's talker, -1 for GN or one not listed
+ */
+static int32_t SAT_Talker(char *sentence) {
+    char t0 = sentence[NMEA_MAX_LEN_START], t1 = sentence[NMEA_MAX_LEN_START+1];
+
+    if (t0 == 'G' && t1 == 'P') return SAT_GPS;
+    if (t0 == 'G' && t1 == 'L') return SAT_GLONASS;
+    if (t0 == 'G' && t1 == 'A') return SAT_GALILEO;
+    if ((t0 == 'G' && t1 == 'B') || (t0 == 'B' && t1 == 'D')) return SAT_BEIDOU;
+    return -1;
+}
+
+/*
+ * Step to the next field of a sentence, leaving *c on the ',' or '*' after
+ * it. Returns 1 if there are no more fields, 0 otherwise
+ */
+static uint8_t SAT_NextField(char **c, char **field, uint32_t *len) {
+    if (**c != ',') return 1;
+
+    *field = ++*c;
+    while (**c != ',' && **c != '*' && **c != '\0') (*c)++;
+    *len = *c - *field;
+    return 0;
+}
+
+/*
+ * Entry of a satellite, NULL if it isn't in the table
+ */
+static SAT_ENTRY *SAT_Find(uint8_t system, uint16_t sv) {
+    for (uint32_t i = 0; i < satCount; i++) {
+        if (sats[i].sv == sv && sats[i].system == system) return &sats[i];
+    }
+    return NULL;
+}
+
+/*
+ * Sum the table up for the accessors
+ */
+static void SAT_Summarize(void) {
+    summary.visible = satCount;
+    summary.tracked = 0;
+    summary.used = 0;
+    memset(summary.cno, 0, sizeof(summary.cno));
+
+    for (uint32_t i = 0; i < satCount; i++) {
+        if (sats[i].state & SAT_USED) summary.used++;
+        if (sats[i].cno == 0) continue;
+
+        summary.tracked++;
+        uint32_t bin = sats[i].cno < SAT_CNO_FIRST ? 0 : (sats[i].cno - SAT_CNO_FIRST) / SAT_CNO_STEP + 1;
+        summary.cno[bin < SAT_CNO_BINS ? bin : SAT_CNO_BINS - 1]++;
+    }
+}
+
+/*
+ * A GSV cycle of a constellation is complete. Its satellites that weren't in
+ * it age, and go once they are older than SAT_MAX_AGE
+ */
+static void SAT_EndCycle(uint8_t system) {
+    for (uint32_t i = 0; i < satCount; ) {
+        SAT_ENTRY *sat = &sats[i];
+        if (sat->system != system) {
+            i++;
+        }
+        else if (sat->state & SAT_FRESH) {
+            sat->state &= SAT_USED;
+            i++;
+        }
+        else if (SAT_AGE(sat->state) >= SAT_MAX_AGE) {
+            *sat = sats[--satCount]; // the last entry takes its place
+        }
+        else {
+            sat->state += SAT_AGE_ONE;
+            i++;
+        }
+    }
+    SAT_Summarize();
+}
+
+/*
+ * Update a satellite from its four GSV fields, adding it if there is room
+ */
+static void SAT_Update(uint8_t system, int32_t *values, uint8_t *empty) {
+    SAT_ENTRY *sat = SAT_Find(system, values[0]);
+    if (sat == NULL) {
+        if (satCount == SAT_MAX) return;
+        sat = &sats[satCount++];
+        sat->sv = values[0];
+        sat->system = system;
+        sat->state = 0;
+    }
+
+    sat->elev = empty[1] ? 0 : values[1];
+    sat->azim = empty[2] ? 0 : values[2];
+    sat->cno = empty[3] ? 0 : values[3];
+    sat->state = (sat->state & SAT_USED) | SAT_FRESH;
+}
+
+/*
+ * Take in one part of a GSV cycle:
+ * $xxGSV,numMsg,msgNum,numSV{,svid,elv,az,cno}[,signalId]*cs
+ */
+void SAT_HandleGSV(char *sentence) {
+    char *c = &sentence[NMEA_MAX_LEN_START+NMEA_MAX_LEN_ADDR];
+    char *field;
+    uint32_t len;
+    int32_t total, number;
+
+    int32_t system = SAT_Talker(sentence);
+    if (system < 0) return;
+
+    if (SAT_NextField(&c, &field, &len) || NMEA_Fixed(field, len, 0, &total)) return;
+    if (SAT_NextField(&c, &field, &len) || NMEA_Fixed(field, len, 0, &number)) return;
+    if (SAT_NextField(&c, &field, &len)) return; // in view, the table counts for itself
+
+    // four fields a satellite, NMEA 4.10 adds a lone signal id at the end
+    while (1) {
+        int32_t values[4];
+        uint8_t empty[4];
+        uint32_t got = 0;
+
+        while (got < 4 && !SAT_NextField(&c, &field, &len)) {
+            empty[got] = NMEA_Fixed(field, len, 0, &values[got]);
+            got++;
+        }
+        if (got < 4) break;
+        if (!empty[0]) SAT_Update(system, values, empty);
+    }
+
+    if (number == total) SAT_EndCycle(system);
+}
+
+/*
+ * Take in the satellites used and the DOPs of one constellation:
+ * $xxGSA,opMode,navMode{,svid}x12,PDOP,HDOP,VDOP[,systemId]*cs
+ */
+void SAT_HandleGSA(char *sentence) {
+    char *c = &sentence[NMEA_MAX_LEN_START+NMEA_MAX_LEN_ADDR];
+    char *field;
+    uint32_t len;
+    int32_t svs[12], dops[3], id;
+    uint32_t count = 0;
+
+    if (SAT_NextField(&c, &field, &len) || SAT_NextField(&c, &field, &len)) return;
+    for (uint32_t i = 0; i < 12; i++) {
+        if (SAT_NextField(&c, &field, &len)) return;
+        if (!NMEA_Fixed(field, len, 0, &svs[count])) count++;
+    }
+    for (uint32_t i = 0; i < 3; i++) {
+        if (SAT_NextField(&c, &field, &len)) return;
+        if (NMEA_Fixed(field, len, 2, &dops[i])) dops[i] = 0;
+    }
+
+    // NMEA 4.10 names the constellation, older GN sentences only by number
+    int32_t system = SAT_Talker(sentence);
+    if (!SAT_NextField(&c, &field, &len) && !NMEA_Fixed(field, len, 0, &id) && id >= 1 && id <= 5) {
+        system = id == 5 ? SAT_GPS : id - 1;
+    }
+    else if (system < 0 && count > 0) {
+        system = svs[0] >= 65 && svs[0] <= 96 ? SAT_GLONASS : SAT_GPS;
+    }
+
+    summary.pdop = dops[0];
+    summary.hdop = dops[1];
+    summary.vdop = dops[2];
+    if (system < 0) return;
+
+    for (uint32_t i = 0; i < satCount; i++) {
+        if (sats[i].system == system) sats[i].state &= ~SAT_USED;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        SAT_ENTRY *sat = SAT_Find(system, svs[i]);
+        if (sat != NULL) sat->state |= SAT_USED;
+    }
+    SAT_Summarize();
+}
+
+/*
+ * Satellites in the table
+ */
+uint32_t SAT_Visible(void) {
+    return summary.visible;
+}
+
+/*
+ * Satellites in the navigation solution
+ */
+uint32_t SAT_Used(void) {
+    return summary.used;
+}
+
+/*
+ * Copy the counts, DOPs and C/N0 histogram
+ */
+void SAT_GetSummary(SAT_SUMMARY *out) {
+    __disable_irq(); // USART2 interrupts may be updating it
+    *out = summary;
+    __enable_irq();
+}
+
+/*
+ * Show the counts, DOPs and a C/N0 bar chart on the LCD, a line each
+ */
+void SAT_ShowLCD(void) {
+    SAT_SUMMARY s;
+    char line[24];
+
+    SAT_GetSummary(&s);
+
+    LCD_ClearDisplay();
+    snprintf(line, sizeof(line), "SAT U%u T%u V%u", (unsigned) s.used, (unsigned) s.tracked, (unsigned) s.visible);
+    LCD_PrintString(line);
+
+    LCD_SetY(1);
+    LCD_SetX(0);
+    snprintf(line, sizeof(line), "DOP H%u.%u V%u.%u", (unsigned) (s.hdop / 100), (unsigned) (s.hdop / 10 % 10),
+             (unsigned) (s.vdop / 100), (unsigned) (s.vdop / 10 % 10));
+    LCD_PrintString(line);
+
+    // the strongest signals on top
+    for (uint32_t i = 0; i < SAT_CNO_BINS; i++) {
+        uint32_t bin = SAT_CNO_BINS - 1 - i;
+
+        LCD_SetY(2 + i);
+        LCD_SetX(0);
+        uint32_t n = snprintf(line, sizeof(line), "%s %2u ", satHistLabels[bin], (unsigned) s.cno[bin]);
+        for (uint32_t k = 0; k < s.cno[bin] && n < SAT_LCD_CHARS; k++) line[n++] = '#';
+        line[n] = '\0';
+        LCD_PrintString(line);
+    }
+}
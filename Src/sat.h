@@ -0,0 +1,60 @@
+/*
+ * File: sat.h
+ * Purpose: Declares the satellite table. GSV and GSA sentences update it in
+ *          place, an entry per satellite keyed by constellation and SV
+ *          number, and satellites that stop showing up in GSV age out. The
+ *          counts, DOPs and C/N0 histogram are summed up once per sentence,
+ *          so reading them is cheap
+ */
+#ifndef __SAT_H
+#define __SAT_H
+
+#include "utilities.h"
+
+// Most satellites in the table, more in view are left out
+#define SAT_MAX 32
+
+// GSV cycles a satellite may be missing from before it is dropped
+#define SAT_MAX_AGE 3
+
+// Fixes between polls of GSV and GSA. They aren't output periodically, so
+// the epochs only carry the RMC that is logged
+#define SAT_POLL_PERIOD 4
+
+// C/N0 histogram of the tracked satellites, bins SAT_CNO_STEP dB-Hz wide
+// from SAT_CNO_FIRST, the first and last bins are open ended
+#define SAT_CNO_BINS  4
+#define SAT_CNO_FIRST 20
+#define SAT_CNO_STEP  10
+
+// Every this many fixes the LCD shows the satellite page, halfway between
+// the trip pages
+#define SAT_PAGE_PERIOD 4
+
+typedef enum {
+    SAT_GPS,            // with SBAS and QZSS, which share the GP talker
+    SAT_GLONASS,
+    SAT_GALILEO,
+    SAT_BEIDOU,
+    SAT_SYSTEMS
+} SAT_SYSTEM;
+
+typedef struct {
+    uint8_t visible;    // satellites in the table
+    uint8_t tracked;    // of those, with a C/N0
+    uint8_t used;       // of those, in the navigation solution
+    uint8_t cno[SAT_CNO_BINS];
+    uint16_t pdop;      // dilution of precision in 0.01, 0 if not known
+    uint16_t hdop;
+    uint16_t vdop;
+} SAT_SUMMARY;
+
+void SAT_Reset(void);
+void SAT_HandleGSV(char *sentence);
+void SAT_HandleGSA(char *sentence);
+uint32_t SAT_Visible(void);
+uint32_t SAT_Used(void);
+void SAT_GetSummary(SAT_SUMMARY *summary);
+void SAT_ShowLCD(void);
+
+#endif /* __SAT_H */
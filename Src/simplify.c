@@ -0,0 +1,169 @@
+/*
+ * File: simplify.c
+ * Purpose: Streaming track simplification with an opening window. The last
+ *          logged fix anchors a straight segment to the newest fix. While
+ *          every fix since the anchor stays within the tolerance of that
+ *          segment they are held back; once one doesn't, the fix before it is
+ *          logged and becomes the next anchor. Positions are offsets from the
+ *          anchor in centimeters, so all of it is integer arithmetic
+ */
+#include "simplify.h"
+#include "geo.h"
+#include "rtc.h"
+#include "telemetry.h"
+
+#define SIMPLIFY_TOLERANCE_CM ((int64_t) SIMPLIFY_TOLERANCE_M * 100)
+#define SIMPLIFY_STILL_CM     ((int64_t) SIMPLIFY_STILL_M * 100)
+
+typedef enum {
+    SIMPLIFY_EMPTY,     // nothing logged yet
+    SIMPLIFY_ANCHORED,  // the anchor is the newest fix kept
+    SIMPLIFY_HOLDING    // a candidate fix is held back after the anchor
+} SIMPLIFY_STATE;
+
+typedef struct {
+    int32_t north;      // centimeters from the anchor
+    int32_t east;
+} SIMPLIFY_POINT;
+
+static uint8_t state = SIMPLIFY_EMPTY;
+static FIX anchor;
+static int32_t anchorCos;
+static uint32_t anchorTime;
+
+// Newest fix, held until the next one shows whether it must be logged
+static FIX candidate;
+static SIMPLIFY_POINT held;
+
+// Fixes between the anchor and the candidate that were left out, the segment
+// from the anchor to the next candidate must still pass within the tolerance
+static SIMPLIFY_POINT window[SIMPLIFY_WINDOW];
+static uint32_t windowLen;
+
+static const SIMPLIFY_POINT origin = { 0, 0 };
+
+/*
+ * Forget the track, the next fix pushed is logged
+ */
+void SIMPLIFY_Reset(void) {
+    state = SIMPLIFY_EMPTY;
+    windowLen = 0;
+}
+
+/*
+ * Make fix the start of the next segment
+ */
+static void SIMPLIFY_Anchor(FIX *fix) {
+    anchor = *fix;
+    anchorCos = GEO_CosLat(fix->lat);
+    anchorTime = RTC_Seconds(fix->datetime);
+    windowLen = 0;
+    state = SIMPLIFY_ANCHORED;
+}
+
+/*
+ * Squared distance between two points in cm^2
+ */
+static int64_t SIMPLIFY_Dist2(const SIMPLIFY_POINT *a, const SIMPLIFY_POINT *b) {
+    int64_t dn = (int64_t) a->north - b->north;
+    int64_t de = (int64_t) a->east - b->east;
+    return dn * dn + de * de;
+}
+
+/*
+ * True if q is within the tolerance of the segment from the anchor to p.
+ * len2 and len are p's squared and plain distance from the anchor
+ */
+static uint8_t SIMPLIFY_Near(SIMPLIFY_POINT *p, int64_t len2, int64_t len, SIMPLIFY_POINT *q) {
+    int64_t dot = (int64_t) p->north * q->north + (int64_t) p->east * q->east;
+
+    // beyond either end the nearest point of the segment is that end
+    if (dot <= 0) return SIMPLIFY_Dist2(q, &origin) <= SIMPLIFY_TOLERANCE_CM * SIMPLIFY_TOLERANCE_CM;
+    if (dot >= len2) return SIMPLIFY_Dist2(q, p) <= SIMPLIFY_TOLERANCE_CM * SIMPLIFY_TOLERANCE_CM;
+
+    // distance from the line is |p x q| / |p|
+    int64_t cross = (int64_t) p->north * q->east - (int64_t) p->east * q->north;
+    if (cross < 0) cross = -cross;
+    return cross <= SIMPLIFY_TOLERANCE_CM * len;
+}
+
+/*
+ * True if the anchor to p segment can stand in for every fix held back
+ */
+static uint8_t SIMPLIFY_Fits(SIMPLIFY_POINT *p) {
+    if (windowLen == SIMPLIFY_WINDOW) return 0;
+    if (p->north > SIMPLIFY_MAX_SPAN_CM || p->north < -SIMPLIFY_MAX_SPAN_CM ||
+        p->east > SIMPLIFY_MAX_SPAN_CM || p->east < -SIMPLIFY_MAX_SPAN_CM) return 0;
+
+    int64_t len2 = (int64_t) p->north * p->north + (int64_t) p->east * p->east;
+    int64_t len = GEO_Sqrt(len2);
+
+    if (!SIMPLIFY_Near(p, len2, len, &held)) return 0;
+    for (uint32_t i = 0; i < windowLen; i++) {
+        if (!SIMPLIFY_Near(p, len2, len, &window[i])) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Hand the simplifier the next valid fix. Returns 1 with out set to the fix
+ * to log, which is an earlier one than fix, or 0 if nothing is due yet
+ */
+uint8_t SIMPLIFY_Push(FIX *fix, FIX *out) {
+    if (SIMPLIFY_TOLERANCE_M == 0 || state == SIMPLIFY_EMPTY) {
+        SIMPLIFY_Anchor(fix);
+        *out = *fix;
+        return 1;
+    }
+
+    SIMPLIFY_POINT p;
+    GEO_Offset(anchor.lat, anchor.lon, anchorCos, fix->lat, fix->lon, &p.north, &p.east);
+
+    // time since the anchor, unknown without a date
+    uint32_t now = RTC_Seconds(fix->datetime);
+    uint8_t overdue = anchorTime != 0 && now != 0 && now - anchorTime >= SIMPLIFY_MAX_GAP_S;
+
+    // standing still, the receiver wanders around the true position
+    const SIMPLIFY_POINT *kept = state == SIMPLIFY_HOLDING ? &held : &origin;
+    uint8_t slow = (fix->flags & FIX_HAS_SPEED) == 0 || fix->speed < SIMPLIFY_STILL_CM_S;
+    if (!overdue && slow && SIMPLIFY_Dist2(&p, kept) <= SIMPLIFY_STILL_CM * SIMPLIFY_STILL_CM) {
+        telemetry.simplified++;
+        return 0;
+    }
+
+    if (state == SIMPLIFY_ANCHORED) {
+        candidate = *fix;
+        held = p;
+        state = SIMPLIFY_HOLDING;
+        return 0;
+    }
+
+    // the candidate can be left out if the segment to this fix covers it too
+    if (!overdue && SIMPLIFY_Fits(&p)) {
+        window[windowLen++] = held;
+        candidate = *fix;
+        held = p;
+        telemetry.simplified++;
+        return 0;
+    }
+
+    // it can't, log the candidate and start the next segment from it
+    *out = candidate;
+    SIMPLIFY_Anchor(&candidate);
+    GEO_Offset(anchor.lat, anchor.lon, anchorCos, fix->lat, fix->lon, &held.north, &held.east);
+    candidate = *fix;
+    state = SIMPLIFY_HOLDING;
+    return 1;
+}
+
+/*
+ * End of the track. Returns 1 with out set to the fix still held back, which
+ * must be logged to close the track, or 0 if there is none
+ */
+uint8_t SIMPLIFY_Flush(FIX *out) {
+    if (state != SIMPLIFY_HOLDING) return 0;
+
+    *out = candidate;
+    SIMPLIFY_Anchor(&candidate);
+    return 1;
+}
@@ -0,0 +1,41 @@
+/*
+ * File: simplify.h
+ * Purpose: Declares the streaming track simplifier between the fix source and
+ *          the log. It keeps a bounded window of fixes and only logs the ones
+ *          needed to hold every fix within a set distance of the logged track
+ */
+#ifndef __SIMPLIFY_H
+#define __SIMPLIFY_H
+
+#include "utilities.h"
+#include "fix.h"
+
+// Furthest a left out fix may be from the logged track, in meters. 0 logs
+// every fix. Set with SIMPLIFY_TOLERANCE_M in the Makefile
+#ifndef SIMPLIFY_TOLERANCE_M
+#define SIMPLIFY_TOLERANCE_M 5
+#endif
+
+// Fixes slower than this, and within SIMPLIFY_STILL_M of the last fix kept,
+// are receiver jitter around a standing position and are left out. Those are
+// then within SIMPLIFY_TOLERANCE_M + SIMPLIFY_STILL_M of the logged track
+#define SIMPLIFY_STILL_CM_S 50
+#define SIMPLIFY_STILL_M    SIMPLIFY_TOLERANCE_M
+
+// Most fixes held back at once. Each costs 8 bytes of RAM and one distance
+// check per new fix
+#define SIMPLIFY_WINDOW 32
+
+// A fix is logged at least this often, so time along the track and a standing
+// position stay visible
+#define SIMPLIFY_MAX_GAP_S 60
+
+// Longest straight stretch between logged fixes, keeps the window's
+// arithmetic within 64 bits
+#define SIMPLIFY_MAX_SPAN_CM 1000000L
+
+void SIMPLIFY_Reset(void);
+uint8_t SIMPLIFY_Push(FIX *fix, FIX *out);
+uint8_t SIMPLIFY_Flush(FIX *out);
+
+#endif /* __SIMPLIFY_H */
@@ -0,0 +1,71 @@
+/*
+ * File: spi.c
+ * Purpose: Define the utility functions pertaining to the SPI2 peripheral
+ */
+#include "utilities.h"
+
+// Fastest serial clock the attached device accepts, reapplied when the clock changes
+static uint32_t spi2MaxHz = 0;
+
+/*
+ * Configure SPI2 as a transmit only 8 bit master, mode 0, MSB first, with the
+ * serial clock no faster than max_hz. The pins must be set up by the caller
+ */
+void SPI2_Setup(uint32_t max_hz) {
+    RCC->APB1ENR |= RCC_APB1ENR_SPI2EN; //Enable SPI2 clock
+
+    spi2MaxHz = max_hz;
+
+    SPI2_ConfigClock();
+    SPI2->CR1 &= ~SPI_CR1_CPHA_Msk; // first clock transition is first data capture edge
+    SPI2->CR1 &= ~SPI_CR1_CPOL_Msk; // clock 0 when idle
+    SPI2->CR1 |= SPI_CR1_BIDIOE_Msk; // Output enabled
+    SPI2->CR1 &= ~SPI_CR1_LSBFIRST_Msk; // MSB transmitted first
+    SPI2->CR1 |= SPI_CR1_MSTR_Msk; // Master configuration
+
+    SPI2->CR2 |= 0x7 << SPI_CR2_DS_Pos; // 8 bit data messages
+    SPI2->CR2 |= SPI_CR2_SSOE_Msk;
+
+    SPI2->CR1 |= SPI_CR1_SPE_Msk; // SPI enbale
+}
+
+/*
+ * Set the SPI2 baud rate prescaler to the fastest rate the device supports at the
+ * current PCLK. BR = n divides PCLK by 2^(n+1)
+ */
+void SPI2_ConfigClock(void) {
+    uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+    uint32_t br = 0;
+
+    while (br < 7 && (pclk >> (br + 1)) > spi2MaxHz) br++;
+
+    SPI2->CR1 &= ~SPI_CR1_BR_Msk;
+    SPI2->CR1 |= br << SPI_CR1_BR_Pos;
+}
+
+/*
+ * Recompute the SPI2 prescaler after a clock change. BR can't be changed
+ * during a transfer, so wait for the bus to go idle first
+ */
+void SPI2_UpdateClock(void) {
+    if (!(SPI2->CR1 & SPI_CR1_SPE_Msk)) return; // not set up yet
+
+    while((SPI2->SR & SPI_SR_BSY_Msk) == SPI_SR_BSY_Msk);
+
+    SPI2->CR1 &= ~SPI_CR1_SPE_Msk;
+    SPI2_ConfigClock();
+    SPI2->CR1 |= SPI_CR1_SPE_Msk;
+}
+
+/*
+ * Send a byte on SPI2 and wait for it to be shifted out
+ */
+void SPI2_SendByte(uint8_t c) {
+    // wait until the transmit buffer is empty
+    while((SPI2->SR & SPI_SR_TXE_Msk) != SPI_SR_TXE_Msk);
+
+    *(uint8_t *)&(SPI2->DR) = c; // Make sure to do only an 8bit write, otherwise SPI assumes datapacking
+
+    // wait until the transmission is over
+    while((SPI2->SR & SPI_SR_BSY_Msk) == SPI_SR_BSY_Msk);
+}
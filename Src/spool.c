@@ -0,0 +1,306 @@
+/*
+ * File: spool.c
+ * Purpose: Track spool in internal flash. Records are numbered in the order
+ *          they were added and record n lives in slot n % SPOOL_SLOTS of page
+ *          n / SPOOL_SLOTS, which sits at that page number modulo SPOOL_PAGES.
+ *          The newest, the oldest OpenLog hasn't confirmed and the next to
+ *          hand to the batch are kept in RAM and found again at boot from the
+ *          page headers and record checks. The page ahead of the newest record
+ *          is erased from SPOOL_Drain, off the path from the pulse to the
+ *          logged fix and while neither OpenLog nor the receiver is sending,
+ *          as the erase stalls the CPU; a record OpenLog never got is lost
+ *          when it is
+ */
+#include "spool.h"
+#include "batch.h"
+#include "openlog.h"
+#include "gps.h"
+#include "gpx.h"
+#include "telemetry.h"
+
+static uint32_t spoolHead;      // number of the next record
+static uint32_t spoolTail;      // oldest record OpenLog hasn't confirmed
+static uint32_t spoolSend;      // next record to hand to the batch
+static uint32_t spoolReady;     // page number erased ahead for the head, SPOOL_NONE if none
+
+#define SPOOL_NONE 0xFFFFFFFF
+
+#define SPOOL_HALF(addr) (*(volatile uint16_t *) (uintptr_t) (addr))
+#define SPOOL_WORD(addr) (*(volatile uint32_t *) (uintptr_t) (addr))
+
+// Where page number page and record seq are in flash
+#define SPOOL_PAGE_ADDR(page) (SPOOL_START + ((page) % SPOOL_PAGES) * FLASH_PAGE_SIZE)
+#define SPOOL_RECORD_ADDR(seq) (SPOOL_PAGE_ADDR((seq) / SPOOL_SLOTS) + (1 + (seq) % SPOOL_SLOTS) * SPOOL_RECORD_LEN)
+
+/*
+ * Check over the first 7 halfwords of a record, never SPOOL_DRAINED
+ */
+static uint16_t SPOOL_Check(uint16_t *half) {
+    uint16_t check = 0;
+    for (uint32_t i = 0; i < 7; i++) check ^= half[i];
+    check = ~check;
+    return check == SPOOL_DRAINED ? 1 : check;
+}
+
+/*
+ * Whether page number page is the one in flash, active and not erased since
+ */
+static uint8_t SPOOL_Holds(uint32_t page) {
+    uint32_t addr = SPOOL_PAGE_ADDR(page);
+    return SPOOL_HALF(addr) == SPOOL_PAGE_ACTIVE && SPOOL_WORD(addr + 4) == page;
+}
+
+/*
+ * Oldest record the pages still hold, the page erased ahead of the head
+ * included as gone
+ */
+static uint32_t SPOOL_First(void) {
+    uint32_t page = spoolHead / SPOOL_SLOTS;
+    return page >= SPOOL_PAGES - 1 ? (page - (SPOOL_PAGES - 2)) * SPOOL_SLOTS : 0;
+}
+
+/*
+ * Read record seq into fix, its check in check.
+ * Returns 1 if it isn't there or was cut short by a power loss, 0 otherwise
+ */
+static uint8_t SPOOL_Read(uint32_t seq, FIX *fix, uint16_t *check) {
+    uint16_t half[8];
+    uint32_t addr = SPOOL_RECORD_ADDR(seq);
+
+    if (!SPOOL_Holds(seq / SPOOL_SLOTS)) return 1; // FAILURE
+    for (uint32_t i = 0; i < 8; i++) half[i] = SPOOL_HALF(addr + 2 * i);
+
+    *check = half[7];
+    if (*check != SPOOL_DRAINED && *check != SPOOL_Check(half)) return 1; // FAILURE
+
+    int16_t alt = (int16_t) half[6];
+    fix->lat = (int32_t) (half[0] | (uint32_t) half[1] << 16);
+    fix->lon = (int32_t) (half[2] | (uint32_t) half[3] << 16);
+    fix->datetime = half[4] | (uint32_t) half[5] << 16;
+    fix->alt = alt == SPOOL_NO_ALT ? 0 : alt * 1000;
+    fix->flags = FIX_HAS_POS | FIX_HAS_TIME | FIX_HAS_DATE | (alt == SPOOL_NO_ALT ? 0 : FIX_HAS_ALT);
+    fix->status = FIX_VALID;
+    return 0;
+}
+
+/*
+ * Erase page number page so the head can go into it. Whatever OpenLog never
+ * got of the records it held one round of the pages ago is lost.
+ * Returns 1 on failure, 0 otherwise
+ */
+static uint8_t SPOOL_Erase(uint32_t page) {
+    FLASH_EraseInitTypeDef erase = { FLASH_TYPEERASE_PAGES, SPOOL_PAGE_ADDR(page), 1 };
+    uint32_t pageError;
+
+    uint32_t gone = page >= SPOOL_PAGES ? (page - SPOOL_PAGES + 1) * SPOOL_SLOTS : 0;
+    if (spoolTail < gone) {
+        telemetry.spoolDropped += gone - spoolTail;
+        spoolTail = gone;
+    }
+    if (spoolSend < gone) spoolSend = gone;
+
+    spoolReady = page;
+    for (uint32_t off = 0; off < FLASH_PAGE_SIZE; off += 4) {
+        if (SPOOL_WORD(erase.PageAddress + off) != 0xFFFFFFFF) {
+            GPS_StallBegin();
+            uint8_t failed = HAL_FLASHEx_Erase(&erase, &pageError) != HAL_OK;
+            GPS_StallEnd();
+            return failed;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Mark the records up to seq as drained, OpenLog has them
+ */
+static void SPOOL_Confirm(uint32_t seq) {
+    HAL_FLASH_Unlock();
+    for (; spoolTail < seq && spoolTail < spoolHead; spoolTail++) {
+        if (SPOOL_Holds(spoolTail / SPOOL_SLOTS)) {
+            HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, SPOOL_RECORD_ADDR(spoolTail) + 14, SPOOL_DRAINED);
+        }
+    }
+    HAL_FLASH_Lock();
+}
+
+/*
+ * Find the newest page and the head in it, then the oldest record that
+ * wasn't drained
+ */
+void SPOOL_Setup(void) {
+    uint32_t newest = SPOOL_NONE;
+
+    for (uint32_t i = 0; i < SPOOL_PAGES; i++) {
+        uint32_t addr = SPOOL_START + i * FLASH_PAGE_SIZE;
+        uint32_t page = SPOOL_WORD(addr + 4);
+        if (SPOOL_HALF(addr) != SPOOL_PAGE_ACTIVE || page % SPOOL_PAGES != i) continue;
+        if (newest == SPOOL_NONE || (int32_t) (page - newest) > 0) newest = page;
+    }
+
+    spoolHead = 0;
+    spoolReady = SPOOL_NONE;
+    if (newest != SPOOL_NONE) {
+        uint32_t addr = SPOOL_PAGE_ADDR(newest);
+        uint32_t slot = 0;
+        for (; slot < SPOOL_SLOTS; slot++) {
+            uint32_t rec = addr + (1 + slot) * SPOOL_RECORD_LEN;
+            uint8_t blank = 1;
+            for (uint32_t off = 0; off < SPOOL_RECORD_LEN; off += 4) blank &= SPOOL_WORD(rec + off) == 0xFFFFFFFF;
+            if (blank) break;
+        }
+        spoolHead = newest * SPOOL_SLOTS + slot;
+    }
+
+    for (spoolTail = SPOOL_First(); spoolTail < spoolHead; spoolTail++) {
+        FIX fix;
+        uint16_t check;
+        if (!SPOOL_Read(spoolTail, &fix, &check) && check != SPOOL_DRAINED) break;
+    }
+    spoolSend = spoolTail;
+}
+
+/*
+ * Program fix as the newest record, moving on to the next page when this one
+ * is full. Only its position, time and altitude are kept.
+ * Returns 1 on failure, 0 otherwise
+ */
+uint8_t SPOOL_Add(FIX *fix) {
+    uint16_t half[8];
+    uint32_t page = spoolHead / SPOOL_SLOTS;
+    uint32_t addr = SPOOL_RECORD_ADDR(spoolHead);
+    uint8_t failed = 0;
+
+    int32_t alt = fix->alt >= 0 ? (fix->alt + 500) / 1000 : (fix->alt - 500) / 1000;
+    if (!(fix->flags & FIX_HAS_ALT) || alt <= SPOOL_NO_ALT || alt > INT16_MAX) alt = SPOOL_NO_ALT;
+
+    half[0] = (uint32_t) fix->lat & 0xFFFF;
+    half[1] = (uint32_t) fix->lat >> 16;
+    half[2] = (uint32_t) fix->lon & 0xFFFF;
+    half[3] = (uint32_t) fix->lon >> 16;
+    half[4] = fix->datetime & 0xFFFF;
+    half[5] = fix->datetime >> 16;
+    half[6] = (uint16_t) alt;
+    half[7] = SPOOL_Check(half);
+
+    HAL_FLASH_Unlock();
+    if (spoolHead % SPOOL_SLOTS == 0) {
+        // normally erased ahead already
+        if (spoolReady != page) failed |= SPOOL_Erase(page);
+
+        uint32_t base = SPOOL_PAGE_ADDR(page);
+        failed |= HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, base + 4, page & 0xFFFF) != HAL_OK;
+        failed |= HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, base + 6, page >> 16) != HAL_OK;
+        failed |= HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, base, SPOOL_PAGE_ACTIVE) != HAL_OK;
+    }
+    for (uint32_t i = 0; i < 8 && !failed; i++) {
+        failed = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, addr + 2 * i, half[i]) != HAL_OK;
+    }
+    HAL_FLASH_Lock();
+
+    spoolHead++; // a failed record is skipped like a torn one
+    return failed;
+}
+
+/*
+ * Records OpenLog hasn't confirmed yet
+ */
+uint32_t SPOOL_Pending(void) {
+    return spoolHead - spoolTail;
+}
+
+/*
+ * Take in what OpenLog confirmed, erase the page ahead of the head if it
+ * isn't yet, and hand the batch as many records as fit its queue, at most
+ * SPOOL_DRAIN_MAX. A batch that was lost is sent again from the oldest
+ * record OpenLog hasn't confirmed
+ */
+void SPOOL_Drain(void) {
+    uint32_t acked, kept;
+
+    if (BATCH_Lost(&kept)) spoolSend = kept > spoolTail ? kept : spoolTail;
+    if (BATCH_Acked(&acked)) SPOOL_Confirm(acked);
+
+    // SPOOL_Add erases it itself if the links never go quiet
+    uint32_t next = (spoolHead + SPOOL_SLOTS - 1) / SPOOL_SLOTS;
+    if (spoolReady != next && OPENLOG_Quiet() && GPS_Quiet()) {
+        HAL_FLASH_Unlock();
+        SPOOL_Erase(next);
+        HAL_FLASH_Lock();
+    }
+
+    for (uint32_t n = 0; n < SPOOL_DRAIN_MAX && spoolSend != spoolHead; n++) {
+        FIX fix;
+        uint16_t check;
+        char line[GPX_TRKPT_LEN];
+
+        if (SPOOL_Read(spoolSend, &fix, &check)) {
+            spoolSend++; // torn, nothing to send
+            continue;
+        }
+        int len = GPX_FormatTrackPoint(&fix, line, sizeof(line));
+        if (!BATCH_Room(len)) break;
+
+        BATCH_Add(line);
+        BATCH_Tag(++spoolSend);
+    }
+}
+
+/*
+ * Hand the batch everything still in the spool, giving up after
+ * SPOOL_FINISH_MS if OpenLog doesn't keep up
+ */
+void SPOOL_Finish(void) {
+    uint32_t start = HAL_GetTick();
+
+    while (spoolSend != spoolHead && HAL_GetTick() - start < SPOOL_FINISH_MS) {
+        SPOOL_Drain();
+        BATCH_Poll();
+        if (spoolSend != spoolHead) __WFI(); // until OpenLog answers or SysTick
+    }
+}
+
+/*
+ * Give up on the records the last track never got, it is written over by a
+ * new one. They are marked drained, so stay in flash for SPOOL_Dump but are
+ * not sent again after a reset
+ */
+void SPOOL_Abandon(void) {
+    telemetry.spoolDropped += spoolHead - spoolTail;
+    SPOOL_Confirm(spoolHead);
+    spoolSend = spoolHead;
+}
+
+/*
+ * Send every record the spool still holds as a GPX track on the USART1
+ * debug port, drained or not
+ */
+void SPOOL_Dump(void) {
+    USART1_SendStr("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                   "<gpx version=\"1.0\">\n"
+                   "\t<trk><name>spool</name><trkseg>\n");
+
+    for (uint32_t seq = SPOOL_First(); seq < spoolHead; seq++) {
+        FIX fix;
+        uint16_t check;
+        char line[GPX_TRKPT_LEN];
+
+        if (SPOOL_Read(seq, &fix, &check)) continue;
+        GPX_FormatTrackPoint(&fix, line, sizeof(line));
+        USART1_SendStr(line);
+    }
+
+    USART1_SendStr(GPX_TRAILER);
+}
+
+/*
+ * Background work while not recording: drain the spool as OpenLog confirms
+ * what it has, and dump it when SPOOL_DUMP_CMD is typed on the debug port
+ */
+void SPOOL_Serve(void) {
+    uint8_t c;
+
+    if (!USART1_Receive(&c) && c == SPOOL_DUMP_CMD) SPOOL_Dump();
+    SPOOL_Drain();
+    BATCH_Poll();
+}
@@ -0,0 +1,53 @@
+/*
+ * File: spool.h
+ * Purpose: Declares the track spool in internal flash. Every logged fix goes
+ *          into it first as a compact binary record, so logging never waits
+ *          on OpenLog, and drains from there into the track as OpenLog keeps
+ *          up. Records stay until OpenLog confirms them and survive a power
+ *          loss. The pages are used in a circle, erased one ahead of the
+ *          newest record
+ */
+#ifndef __SPOOL_H
+#define __SPOOL_H
+
+#include "utilities.h"
+#include "fix.h"
+#include "store.h"
+
+// Pages reserved below the key-value store, see the linker script
+#define SPOOL_PAGES 12
+#define SPOOL_START (STORE_START - SPOOL_PAGES * FLASH_PAGE_SIZE)
+
+// Page header: | state | 0xFFFF | sequence number |, padded to a record. A page
+// is in use once its state is programmed to SPOOL_PAGE_ACTIVE
+#define SPOOL_PAGE_ACTIVE 0x0000
+
+// Record: | lat | lon | datetime | alt | check |, the 32-bit values low
+// halfword first, alt in whole meters or SPOOL_NO_ALT. The check is
+// programmed last to commit the record and to 0x0000 once OpenLog has it
+#define SPOOL_RECORD_LEN 16
+#define SPOOL_SLOTS      (FLASH_PAGE_SIZE / SPOOL_RECORD_LEN - 1)
+#define SPOOL_NO_ALT     ((int16_t) 0x8000)
+#define SPOOL_DRAINED    0x0000
+
+// Most records handed to the batch by one SPOOL_Drain, as far as the USART3
+// queue has room for them
+#define SPOOL_DRAIN_MAX 8
+
+// How long the end of a recording waits for the spool to drain
+#define SPOOL_FINISH_MS 10000
+
+// Typed on the USART1 debug port while not recording, dumps the spool there
+// as a GPX track
+#define SPOOL_DUMP_CMD 'D'
+
+void SPOOL_Setup(void);
+uint8_t SPOOL_Add(FIX *fix);
+uint32_t SPOOL_Pending(void);
+void SPOOL_Drain(void);
+void SPOOL_Finish(void);
+void SPOOL_Abandon(void);
+void SPOOL_Dump(void);
+void SPOOL_Serve(void);
+
+#endif /* __SPOOL_H */
@@ -0,0 +1,174 @@
+/*
+ * File: store.c
+ * Purpose: Log-structured key-value store in internal flash. A RAM index holds
+ *          where the latest record for each key is, so reads don't scan.
+ *          Flash only programs halfwords from 0xFFFF, or anything to 0x0000,
+ *          so records are appended and pages only reused after an erase
+ */
+#include "store.h"
+#include "gps.h"
+
+static uint32_t storePage;      // address of the active page, 0 if there is none
+static uint32_t storeSeq;       // its sequence number, counting compactions
+static uint32_t storeNext;      // where the next record goes
+static uint16_t storeIndex[STORE_KEYS]; // offset of each key's latest record in the page, 0 if none
+
+#define STORE_HALF(addr) (*(volatile uint16_t *) (uintptr_t) (addr))
+#define STORE_WORD(addr) (*(volatile uint32_t *) (uintptr_t) (addr))
+
+/*
+ * Program a halfword. Returns 1 on failure, 0 otherwise
+ */
+static uint8_t STORE_Program(uint32_t addr, uint16_t data) {
+    return HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, addr, data) != HAL_OK;
+}
+
+/*
+ * Erase the page at addr unless it already is. Returns 1 on failure, 0 otherwise
+ */
+static uint8_t STORE_Erase(uint32_t addr) {
+    FLASH_EraseInitTypeDef erase = { FLASH_TYPEERASE_PAGES, addr, 1 };
+    uint32_t pageError;
+
+    for (uint32_t off = 0; off < FLASH_PAGE_SIZE; off += 4) {
+        if (STORE_WORD(addr + off) != 0xFFFFFFFF) {
+            GPS_StallBegin();
+            uint8_t failed = HAL_FLASHEx_Erase(&erase, &pageError) != HAL_OK;
+            GPS_StallEnd();
+            return failed;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Program a record at next. Returns 1 on failure, 0 otherwise
+ */
+static uint8_t STORE_Append(uint32_t next, uint8_t key, uint32_t value) {
+    if (STORE_Program(next, value & 0xFFFF)) return 1; // FAILURE
+    if (STORE_Program(next + 2, value >> 16)) return 1; // FAILURE
+    if (STORE_Program(next + 4, key)) return 1; // FAILURE
+    return STORE_Program(next + 6, STORE_CHECK(key, value));
+}
+
+/*
+ * Index the committed records on the page at addr and find the end of them.
+ * Records that were cut short by a power loss are skipped
+ */
+static void STORE_Scan(uint32_t addr) {
+    uint32_t off = STORE_HEADER_LEN;
+
+    for (uint8_t key = 0; key < STORE_KEYS; key++) storeIndex[key] = 0;
+
+    for (; off + STORE_RECORD_LEN <= FLASH_PAGE_SIZE; off += STORE_RECORD_LEN) {
+        uint32_t value = STORE_WORD(addr + off);
+        uint16_t key = STORE_HALF(addr + off + 4);
+        uint16_t check = STORE_HALF(addr + off + 6);
+
+        if (value == 0xFFFFFFFF && key == 0xFFFF && check == 0xFFFF) break; // never written
+        if (key < STORE_KEYS && check == STORE_CHECK(key, value)) storeIndex[key] = off;
+    }
+
+    storeNext = addr + off;
+}
+
+/*
+ * Find the active page, the newest if a compaction was cut short after it
+ * finished, and erase every other page that isn't erased already.
+ * Returns 1 if flash couldn't be erased, 0 otherwise
+ */
+uint8_t STORE_Setup(void) {
+    storePage = 0;
+
+    for (uint32_t i = 0; i < STORE_PAGES; i++) {
+        uint32_t addr = STORE_START + i * FLASH_PAGE_SIZE;
+        if (STORE_HALF(addr) != STORE_PAGE_ACTIVE) continue;
+
+        uint32_t seq = STORE_WORD(addr + 4);
+        if (storePage == 0 || (int32_t) (seq - storeSeq) > 0) {
+            storePage = addr;
+            storeSeq = seq;
+        }
+    }
+
+    HAL_FLASH_Unlock();
+    uint8_t failed = 0;
+    for (uint32_t i = 0; i < STORE_PAGES; i++) {
+        uint32_t addr = STORE_START + i * FLASH_PAGE_SIZE;
+        if (addr != storePage) failed |= STORE_Erase(addr);
+    }
+    HAL_FLASH_Lock();
+
+    if (storePage != 0) STORE_Scan(storePage);
+    return failed;
+}
+
+/*
+ * Latest value of key in value.
+ * Returns 1 if it was never set, 0 otherwise
+ */
+uint8_t STORE_Get(uint8_t key, uint32_t *value) {
+    if (storePage == 0 || key >= STORE_KEYS || storeIndex[key] == 0) return 1; // FAILURE
+
+    *value = STORE_WORD(storePage + storeIndex[key]);
+    return 0;
+}
+
+/*
+ * Copy the latest record of every key but skip to a fresh page followed by
+ * key = value, then make it the active page and erase the old one.
+ * Returns 1 on failure, 0 otherwise
+ */
+static uint8_t STORE_Compact(uint8_t skip, uint32_t value) {
+    uint32_t next = storePage == 0 ? STORE_START : storePage + FLASH_PAGE_SIZE;
+    if (next >= STORE_START + STORE_PAGES * FLASH_PAGE_SIZE) next = STORE_START;
+    uint32_t addr = next;
+    uint32_t seq = storeSeq + 1;
+
+    if (STORE_Erase(addr)) return 1; // FAILURE
+    if (STORE_Program(addr + 4, seq & 0xFFFF) || STORE_Program(addr + 6, seq >> 16)) return 1; // FAILURE
+    next += STORE_HEADER_LEN;
+
+    for (uint8_t key = 0; key < STORE_KEYS; key++) {
+        if (key == skip || storeIndex[key] == 0) continue;
+        if (STORE_Append(next, key, STORE_WORD(storePage + storeIndex[key]))) return 1; // FAILURE
+        next += STORE_RECORD_LEN;
+    }
+    if (STORE_Append(next, skip, value)) return 1; // FAILURE
+
+    // committed from here, the old page is only erased to be reused
+    if (STORE_Program(addr, STORE_PAGE_ACTIVE)) return 1; // FAILURE
+    uint32_t old = storePage;
+    storePage = addr;
+    storeSeq = seq;
+    STORE_Scan(storePage);
+
+    if (old != 0) STORE_Erase(old);
+    return 0;
+}
+
+/*
+ * Set key to value. Nothing is written if it already has that value. Only
+ * from the main loop, a compaction's erases stall the CPU for tens of ms.
+ * Returns 1 on failure, 0 otherwise
+ */
+uint8_t STORE_Set(uint8_t key, uint32_t value) {
+    uint32_t current;
+    uint8_t failed;
+
+    if (key >= STORE_KEYS) return 1; // FAILURE
+    if (!STORE_Get(key, &current) && current == value) return 0;
+
+    HAL_FLASH_Unlock();
+    if (storePage == 0 || storeNext + STORE_RECORD_LEN > storePage + FLASH_PAGE_SIZE) {
+        failed = STORE_Compact(key, value);
+    }
+    else {
+        failed = STORE_Append(storeNext, key, value);
+        if (!failed) storeIndex[key] = storeNext - storePage;
+        storeNext += STORE_RECORD_LEN; // a failed record is skipped like a torn one
+    }
+    HAL_FLASH_Lock();
+
+    return failed;
+}
@@ -0,0 +1,43 @@
+/*
+ * File: store.h
+ * Purpose: Declares the key-value store in the last pages of internal flash.
+ *          Updates are appended as records and the latest one for each key
+ *          wins; a full page is compacted into the next one. Either an update
+ *          is all there after a power loss or it isn't there at all
+ */
+#ifndef __STORE_H
+#define __STORE_H
+
+#include "utilities.h"
+
+// Pages reserved at the end of flash, see the linker script. Compaction moves
+// on to the next page each time so they wear evenly
+#define STORE_PAGES 2
+#define STORE_START (FLASH_BANK1_END + 1 - STORE_PAGES * FLASH_PAGE_SIZE)
+
+// Keys, each holding a 32-bit value
+#define STORE_KEYS          32
+#define STORE_SESSION       0   // recordings started
+#define STORE_FIX_LAT       1   // last fix when a recording ended, as the BACKUP_FIX_x registers
+#define STORE_FIX_LON       2
+#define STORE_FIX_ALT_ACC   3
+#define STORE_FIX_TIME      4
+
+// Page header: | state | 0xFFFF | sequence number |, then records to the end
+// of the page. A page is only in use once its state is programmed to
+// STORE_PAGE_ACTIVE, after everything else on it
+#define STORE_HEADER_LEN   8
+#define STORE_PAGE_ERASED  0xFFFF
+#define STORE_PAGE_ACTIVE  0x0000
+
+// Record: | value low | value high | key | check |, programmed in that order so
+// the check commits it
+#define STORE_RECORD_LEN   8
+#define STORE_RECORDS      ((FLASH_PAGE_SIZE - STORE_HEADER_LEN) / STORE_RECORD_LEN)
+#define STORE_CHECK(key, value) ((uint16_t) ~((key) ^ ((value) & 0xFFFF) ^ ((value) >> 16)))
+
+uint8_t STORE_Setup(void);
+uint8_t STORE_Get(uint8_t key, uint32_t *value);
+uint8_t STORE_Set(uint8_t key, uint32_t value);
+
+#endif /* __STORE_H */
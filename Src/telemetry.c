@@ -0,0 +1,133 @@
+/*
+ * File: telemetry.c
+ * Purpose: Defines the link-health counters for the GPS and SD card paths and
+ *          the compact summary record periodically written into the track
+ */
+#include "telemetry.h"
+#include "batch.h"
+#include <stdio.h>
+#include <string.h>
+
+TELEMETRY telemetry;
+
+/*
+ * Clear all counters
+ */
+void TELEM_Reset(void) {
+    telemetry.i2cNacks = 0;
+    telemetry.i2cTimeouts = 0;
+    telemetry.checksumErrors = 0;
+    telemetry.framerResyncs = 0;
+    telemetry.droppedEpochs = 0;
+    telemetry.txStalls = 0;
+    telemetry.rxOverruns = 0;
+    telemetry.rxLost = 0;
+    telemetry.nmeaBytes = 0;
+    telemetry.ubxBytes = 0;
+    telemetry.rtcmBytes = 0;
+    telemetry.nmeaFrames = 0;
+    telemetry.ubxFrames = 0;
+    telemetry.rtcmFrames = 0;
+    telemetry.oversizeFrames = 0;
+    telemetry.cfgRetries = 0;
+    telemetry.cfgFailures = 0;
+    telemetry.cfgReused = 0;
+    telemetry.assistSent = 0;
+    telemetry.assistAno = 0;
+    telemetry.ttff = 0;
+    telemetry.simplified = 0;
+    telemetry.navRateChanges = 0;
+    telemetry.fenceZones = 0;
+    telemetry.fenceRejects = 0;
+    telemetry.fenceEvents = 0;
+    telemetry.psmChanges = 0;
+    telemetry.batchWrites = 0;
+    telemetry.brownOuts = 0;
+    telemetry.gpxRecovered = 0;
+    telemetry.batchResends = 0;
+    telemetry.spoolDropped = 0;
+    telemetry.rawBytes = 0;
+    telemetry.rawPacked = 0;
+    telemetry.rawDropped = 0;
+}
+
+/*
+ * End a record of written characters formatted into buf, which had room for
+ * them and for the trailer after them. One cut short still ends the comment.
+ * Returns the number of characters in the record
+ */
+static int TELEM_End(char *buf, uint32_t room, int written) {
+    if (written < 0) written = 0;
+    if ((uint32_t) written >= room) written = room - 1;
+    strcpy(&buf[written], TELEM_END);
+    return written + sizeof(TELEM_END) - 1;
+}
+
+/*
+ * Write the link-health counters as a single XML comment line so the track
+ * stays valid GPX. Returns the number of characters written
+ */
+int TELEM_Format(char *buf, uint32_t len) {
+    if (len < sizeof(TELEM_END)) return 0;
+
+    uint32_t room = len - (sizeof(TELEM_END) - 1);
+    int written = snprintf(buf, room,
+        "\t<!-- telem t=%lu nack=%lu tmo=%lu cks=%lu rsy=%lu ovf=%lu lost=%lu/%lu drop=%lu stall=%lu "
+        "nmea=%lu ubx=%lu rtcm=%lu",
+        (unsigned long) HAL_GetTick(),
+        (unsigned long) telemetry.i2cNacks, (unsigned long) telemetry.i2cTimeouts,
+        (unsigned long) telemetry.checksumErrors, (unsigned long) telemetry.framerResyncs,
+        (unsigned long) usart3Tx.overflows,
+        (unsigned long) telemetry.rxOverruns, (unsigned long) telemetry.rxLost,
+        (unsigned long) telemetry.droppedEpochs, (unsigned long) telemetry.txStalls,
+        (unsigned long) telemetry.nmeaBytes, (unsigned long) telemetry.ubxBytes,
+        (unsigned long) telemetry.rtcmBytes);
+
+    return TELEM_End(buf, room, written);
+}
+
+/*
+ * Write the counters that change rarely, about the receiver's setup and the
+ * logging as a whole, as a single XML comment line. Returns the number of
+ * characters written
+ */
+int TELEM_FormatSession(char *buf, uint32_t len) {
+    if (len < sizeof(TELEM_END)) return 0;
+
+    uint32_t room = len - (sizeof(TELEM_END) - 1);
+    int written = snprintf(buf, room,
+        "\t<!-- session t=%lu cfg=%lu/%lu/%lu ast=%lx/%lu ttff=%lu simp=%lu nav=%lu fence=%lu/%lu/%lu psm=%lu "
+        "bat=%lu/%lu/%lu spool=%lu/%lu raw=%lu/%lu/%lu",
+        (unsigned long) HAL_GetTick(),
+        (unsigned long) telemetry.cfgRetries, (unsigned long) telemetry.cfgFailures,
+        (unsigned long) telemetry.cfgReused, (unsigned long) telemetry.assistSent,
+        (unsigned long) telemetry.assistAno, (unsigned long) telemetry.ttff,
+        (unsigned long) telemetry.simplified, (unsigned long) telemetry.navRateChanges,
+        (unsigned long) telemetry.fenceZones, (unsigned long) telemetry.fenceRejects,
+        (unsigned long) telemetry.fenceEvents, (unsigned long) telemetry.psmChanges,
+        (unsigned long) telemetry.batchWrites, (unsigned long) telemetry.brownOuts,
+        (unsigned long) telemetry.gpxRecovered,
+        (unsigned long) telemetry.batchResends, (unsigned long) telemetry.spoolDropped,
+        (unsigned long) telemetry.rawBytes, (unsigned long) telemetry.rawPacked,
+        (unsigned long) telemetry.rawDropped);
+
+    return TELEM_End(buf, room, written);
+}
+
+/*
+ * Write the link-health record into the log
+ */
+void TELEM_Log(void) {
+    char record[TELEM_RECORD_LEN];
+    TELEM_Format(record, sizeof(record));
+    BATCH_Add(record);
+}
+
+/*
+ * Write the session record into the log
+ */
+void TELEM_LogSession(void) {
+    char record[TELEM_SESSION_LEN];
+    TELEM_FormatSession(record, sizeof(record));
+    BATCH_Add(record);
+}
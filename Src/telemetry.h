@@ -0,0 +1,68 @@
+/*
+ * File: telemetry.h
+ * Purpose: Declares the link-health counters for the GPS and SD card paths and
+ *          the compact summary record periodically written into the track
+ */
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include "utilities.h"
+
+// Number of logged fixes between link-health records, and between session
+// records, which also end every track
+#define TELEM_PERIOD         12
+#define TELEM_SESSION_PERIOD 120
+
+// Records, long enough for every counter at its widest, and the end of the
+// comment they are written as
+#define TELEM_RECORD_LEN  224
+#define TELEM_SESSION_LEN 320
+#define TELEM_END         " -->\n"
+
+typedef struct {
+    uint32_t i2cNacks;        // I2C1 transfers the receiver did not acknowledge
+    uint32_t i2cTimeouts;     // I2C1 transfers that stalled and were aborted
+    uint32_t checksumErrors;  // sentences or frames that failed their checksum
+    uint32_t framerResyncs;   // times the reader had to skip bytes to find a frame start
+    uint32_t droppedEpochs;   // receiver epochs that came due without being sampled
+    uint32_t txStalls;        // times USART3 transmit had to wait for room in its queue
+    uint32_t rxOverruns;      // times OpenLog's bytes came faster than USART3 was read, one lost each
+    uint32_t rxLost;          // receiver bytes overwritten in the USART2 ring before being taken in
+    uint32_t nmeaBytes;       // bytes of good frames received per protocol
+    uint32_t ubxBytes;
+    uint32_t rtcmBytes;
+    uint32_t nmeaFrames;      // good frames received per protocol
+    uint32_t ubxFrames;
+    uint32_t rtcmFrames;
+    uint32_t oversizeFrames;  // frames too long to hand to their handler, UBX ones skipped unread
+    uint32_t cfgRetries;      // receiver configuration frames sent again after a NAK or no answer
+    uint32_t cfgFailures;     // receiver configuration frames never acknowledged
+    uint32_t cfgReused;       // 1 if the receiver kept its saved configuration and wasn't reconfigured
+    uint32_t assistSent;      // ASSIST_SENT_x bits for the hot start assistance sent at boot
+    uint32_t assistAno;       // AssistNow Offline frames loaded at boot
+    uint32_t ttff;            // receiver's time to first fix this boot in ms, 0 until known
+    uint32_t simplified;      // valid fixes the track simplifier left out of the log
+    uint32_t navRateChanges;  // receiver navigation rates set by the sampling rate controller
+    uint32_t fenceZones;      // geofence zones loaded at boot
+    uint32_t fenceRejects;    // lines of the geofence file that weren't loaded
+    uint32_t fenceEvents;     // geofence zones entered and left
+    uint32_t psmChanges;      // receiver power modes set to follow the sampling period
+    uint32_t batchWrites;     // batches of records written to OpenLog
+    uint32_t brownOuts;       // times the PVD interrupt flushed the batch as the supply failed
+    uint32_t gpxRecovered;    // tracks cut off by a power loss closed at boot
+    uint32_t batchResends;    // times OpenLog lost batches and they were written again
+    uint32_t spoolDropped;    // spooled fixes OpenLog never got, written over or given up on
+    uint32_t rawBytes;        // bytes of sentences put in the raw log
+    uint32_t rawPacked;       // and bytes it wrote for them, compressed
+    uint32_t rawDropped;      // sentences left out of the raw log, its block full
+} TELEMETRY;
+
+extern TELEMETRY telemetry;
+
+void TELEM_Reset(void);
+int TELEM_Format(char *buf, uint32_t len);
+int TELEM_FormatSession(char *buf, uint32_t len);
+void TELEM_Log(void);
+void TELEM_LogSession(void);
+
+#endif /* __TELEMETRY_H */
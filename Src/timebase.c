@@ -0,0 +1,73 @@
+/*
+ * File: timebase.c
+ * Purpose: Defines the free-running 1 MHz timebase on TIM2. The capture/compare
+ *          channels are handed to the modules that timestamp against it.
+ */
+#include "timebase.h"
+#include "pps.h"
+
+/*
+ * Get the TIM2 kernel clock. Timers run at twice PCLK when APB is divided
+ */
+static uint32_t TIMEBASE_GetClockFreq(void) {
+    uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE_Msk) != RCC_CFGR_PPRE_DIV1) pclk *= 2;
+    return pclk;
+}
+
+/*
+ * Start TIM2 counting up at 1 MHz over the full 32 bit range
+ */
+void TIMEBASE_Setup(void) {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN; // Enable TIM2 clock
+
+    TIM2->CR1 = 0;
+    TIM2->PSC = (TIMEBASE_GetClockFreq() / TIMEBASE_HZ) - 1;
+    TIM2->ARR = 0xFFFFFFFF;
+    TIM2->CNT = 0;
+    TIM2->EGR = TIM_EGR_UG; // load the prescaler
+    TIM2->SR = 0;
+
+    TIM2->CR1 |= TIM_CR1_CEN;
+
+    NVIC_EnableIRQ(TIM2_IRQn);
+    NVIC_SetPriority(TIM2_IRQn, 0);
+}
+
+/*
+ * Recompute the prescaler after a clock change. Loading the new prescaler
+ * clears the counter, so the count is carried across the update
+ */
+void TIMEBASE_UpdateClock(void) {
+    if (!(TIM2->CR1 & TIM_CR1_CEN)) return; // not set up yet
+
+    __disable_irq();
+    uint32_t cnt = TIM2->CNT;
+    TIM2->PSC = (TIMEBASE_GetClockFreq() / TIMEBASE_HZ) - 1;
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CNT = cnt;
+    TIM2->SR = ~(uint32_t) TIM_SR_UIF; // writing 1 leaves a pending capture as it is
+    __enable_irq();
+}
+
+/*
+ * Current time in microseconds
+ */
+uint32_t TIMEBASE_Now(void) {
+    return TIM2->CNT;
+}
+
+/*
+ * Microseconds since the timestamp since. Correct across one counter wrap
+ */
+uint32_t TIMEBASE_Elapsed(uint32_t since) {
+    return TIM2->CNT - since;
+}
+
+/*
+ * TIM2 interrupt handler
+ */
+void TIM2_IRQHandler(void) {
+    PPS_CaptureInterrupt();
+    PPS_CompareInterrupt();
+}
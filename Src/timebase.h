@@ -0,0 +1,21 @@
+/*
+ * File: timebase.h
+ * Purpose: Declares the free-running 1 MHz timebase on TIM2. TIM2 is 32 bit, so
+ *          timestamps wrap after about 71 minutes; compare them by subtraction.
+ */
+#ifndef __TIMEBASE_H
+#define __TIMEBASE_H
+
+#include "utilities.h"
+
+#define TIMEBASE_HZ 1000000
+
+void TIMEBASE_Setup(void);
+void TIMEBASE_UpdateClock(void);
+uint32_t TIMEBASE_Now(void);
+uint32_t TIMEBASE_Elapsed(uint32_t since);
+
+// TIM2 interrupt handler
+void TIM2_IRQHandler(void);
+
+#endif /* __TIMEBASE_H */
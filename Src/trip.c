@@ -0,0 +1,210 @@
+/*
+ * File: trip.c
+ * Purpose: Trip statistics kept up to date per fix. Each leg between fixes
+ *          is measured on a flat projection scaled by cos(latitude) from the
+ *          table in geo.c, so the per fix cost is a few integer multiplies
+ *          and a square root. Only legs longer than TRIP_FLAT_SPAN use the
+ *          soft-float great circle
+ */
+#include "trip.h"
+#include "geo.h"
+#include "lcd.h"
+#include "rtc.h"
+#include "batch.h"
+#include <math.h>
+#include <stdio.h>
+
+// Mean Earth radius in centimeters, the sphere GEO_CM_PER_E7_Q16 is for
+#define TRIP_EARTH_CM 637100880.0
+
+// Radians per 1e-7 degree
+#define TRIP_RAD_PER_E7 (3.14159265358979324 / 1800000000.0)
+
+TRIP trip;
+
+// Previous fix counted, lastTime is 0 if there is none
+static int32_t lastLat, lastLon;
+static uint32_t lastTime;
+
+// Altitude the climb and descent are measured from
+static int32_t altRef;
+
+/*
+ * Clear the totals, for a new track
+ */
+void TRIP_Reset(void) {
+    trip.distance = 0;
+    trip.distanceCm = 0;
+    trip.movingTime = 0;
+    trip.stoppedTime = 0;
+    trip.maxSpeed = 0;
+    trip.minAlt = 0;
+    trip.maxAlt = 0;
+    trip.altFixes = 0;
+    trip.climb = 0;
+    trip.descent = 0;
+    trip.fixes = 0;
+    lastTime = 0;
+}
+
+/*
+ * Length of the leg from lat0, lon0 to lat1, lon1 in centimeters
+ */
+uint32_t TRIP_Leg(int32_t lat0, int32_t lon0, int32_t lat1, int32_t lon1) {
+    int64_t dlat = (int64_t) lat1 - lat0;
+    int64_t dlon = (int64_t) lon1 - lon0;
+    if (dlon > GEO_HALF_TURN_E7) dlon -= 2 * (int64_t) GEO_HALF_TURN_E7;
+    else if (dlon < -GEO_HALF_TURN_E7) dlon += 2 * (int64_t) GEO_HALF_TURN_E7;
+
+    if (dlat > TRIP_FLAT_SPAN || dlat < -TRIP_FLAT_SPAN || dlon > TRIP_FLAT_SPAN || dlon < -TRIP_FLAT_SPAN) {
+        // haversine, rare enough that the soft-float cost doesn't matter
+        double sinLat = sin(dlat * TRIP_RAD_PER_E7 / 2);
+        double sinLon = sin(dlon * TRIP_RAD_PER_E7 / 2);
+        double h = sinLat * sinLat + cos(lat0 * TRIP_RAD_PER_E7) * cos(lat1 * TRIP_RAD_PER_E7) * sinLon * sinLon;
+        if (h > 1) h = 1;
+        return (uint32_t) (2 * TRIP_EARTH_CM * asin(sqrt(h)) + 0.5);
+    }
+
+    int32_t north, east;
+    GEO_Offset(lat0, lon0, GEO_CosLat(lat0 + (int32_t) (dlat / 2)), lat1, lon1, &north, &east);
+    return GEO_Sqrt((int64_t) north * north + (int64_t) east * east);
+}
+
+/*
+ * Bring the altitude range, climb and descent up to date
+ */
+static void TRIP_Altitude(int32_t alt) {
+    if (trip.altFixes++ == 0) {
+        trip.minAlt = alt;
+        trip.maxAlt = alt;
+        altRef = alt;
+        return;
+    }
+    if (alt < trip.minAlt) trip.minAlt = alt;
+    if (alt > trip.maxAlt) trip.maxAlt = alt;
+
+    if (alt > altRef + TRIP_CLIMB_STEP_MM) {
+        trip.climb += alt - altRef;
+        altRef = alt;
+    }
+    else if (alt < altRef - TRIP_CLIMB_STEP_MM) {
+        trip.descent += altRef - alt;
+        altRef = alt;
+    }
+}
+
+/*
+ * Count a sampled, valid fix. The leg from the previous one adds to the
+ * distance if the logger was moving, its time to the moving or stopped time
+ */
+void TRIP_Update(FIX *fix) {
+    if (!(fix->flags & FIX_HAS_POS)) return;
+    trip.fixes++;
+
+    if ((fix->flags & FIX_HAS_SPEED) && fix->speed > trip.maxSpeed) trip.maxSpeed = fix->speed;
+    if (fix->flags & FIX_HAS_ALT) TRIP_Altitude(fix->alt);
+
+    uint32_t now = RTC_Seconds(fix->datetime);
+    if (lastTime != 0 && now > lastTime) {
+        uint32_t elapsed = now - lastTime;
+        uint32_t leg = TRIP_Leg(lastLat, lastLon, fix->lat, fix->lon);
+
+        // without a reported speed, judge by how far the leg went
+        uint8_t moving = (fix->flags & FIX_HAS_SPEED) ? fix->speed >= TRIP_STILL_CM_S
+                                                      : leg >= TRIP_STILL_CM_S * elapsed;
+        if (moving) {
+            trip.movingTime += elapsed;
+            trip.distanceCm += leg % 100;
+            trip.distance += leg / 100 + trip.distanceCm / 100;
+            trip.distanceCm %= 100;
+        }
+        else {
+            trip.stoppedTime += elapsed;
+        }
+    }
+
+    lastLat = fix->lat;
+    lastLon = fix->lon;
+    lastTime = now;
+}
+
+/*
+ * Write the totals as an XML comment line for the track, the altitude ones
+ * only if some fix had an altitude. Returns the number of characters written
+ */
+int TRIP_Format(char *buf, uint32_t len) {
+    uint32_t average = trip.movingTime ? (trip.distance * 100 + trip.distanceCm) / trip.movingTime : 0;
+    char alt[64] = "";
+    if (trip.altFixes != 0) {
+        snprintf(alt, sizeof(alt), "alt=%ld..%ldm up=%lum down=%lum ",
+                 (long) (trip.minAlt / 1000), (long) (trip.maxAlt / 1000),
+                 (unsigned long) (trip.climb / 1000), (unsigned long) (trip.descent / 1000));
+    }
+
+    int written = snprintf(buf, len,
+        "\t<!-- trip dist=%lu.%02lum moving=%lus stopped=%lus vmax=%lu.%02lum/s vavg=%lu.%02lum/s "
+        "%sfixes=%lu -->\n",
+        (unsigned long) trip.distance, (unsigned long) trip.distanceCm,
+        (unsigned long) trip.movingTime, (unsigned long) trip.stoppedTime,
+        (unsigned long) (trip.maxSpeed / 100), (unsigned long) (trip.maxSpeed % 100),
+        (unsigned long) (average / 100), (unsigned long) (average % 100),
+        alt, (unsigned long) trip.fixes);
+
+    if (written < 0) return 0;
+    return (uint32_t) written < len ? written : (int)(len - 1);
+}
+
+/*
+ * Write the summary record into the track
+ */
+void TRIP_Log(void) {
+    char record[192];
+    TRIP_Format(record, sizeof(record));
+    BATCH_Add(record);
+}
+
+/*
+ * Show the totals on the LCD, a line each. Climb and descent only if some fix
+ * had an altitude
+ */
+void TRIP_ShowLCD(void) {
+    char line[24];
+    uint32_t average = trip.movingTime ? (trip.distance * 100 + trip.distanceCm) / trip.movingTime : 0;
+
+    LCD_ClearDisplay();
+    snprintf(line, sizeof(line), "DST %lu.%02lukm", (unsigned long) (trip.distance / 1000),
+             (unsigned long) (trip.distance % 1000 / 10));
+    LCD_PrintString(line);
+
+    LCD_SetY(1);
+    LCD_SetX(0);
+    snprintf(line, sizeof(line), "MOV %02lu:%02lu:%02lu", (unsigned long) (trip.movingTime / 3600),
+             (unsigned long) (trip.movingTime / 60 % 60), (unsigned long) (trip.movingTime % 60));
+    LCD_PrintString(line);
+
+    LCD_SetY(2);
+    LCD_SetX(0);
+    snprintf(line, sizeof(line), "STP %02lu:%02lu:%02lu", (unsigned long) (trip.stoppedTime / 3600),
+             (unsigned long) (trip.stoppedTime / 60 % 60), (unsigned long) (trip.stoppedTime % 60));
+    LCD_PrintString(line);
+
+    // cm/s to 0.1 km/h
+    LCD_SetY(3);
+    LCD_SetX(0);
+    snprintf(line, sizeof(line), "MAX %lu.%lukm/h", (unsigned long) (trip.maxSpeed * 36 / 1000),
+             (unsigned long) (trip.maxSpeed * 36 / 100 % 10));
+    LCD_PrintString(line);
+
+    LCD_SetY(4);
+    LCD_SetX(0);
+    snprintf(line, sizeof(line), "AVG %lu.%lukm/h", (unsigned long) (average * 36 / 1000),
+             (unsigned long) (average * 36 / 100 % 10));
+    LCD_PrintString(line);
+
+    if (trip.altFixes == 0) return;
+    LCD_SetY(5);
+    LCD_SetX(0);
+    snprintf(line, sizeof(line), "UP%lu DN%lum", (unsigned long) (trip.climb / 1000),
+             (unsigned long) (trip.descent / 1000));
+    LCD_PrintString(line);
+}
@@ -0,0 +1,52 @@
+/*
+ * File: trip.h
+ * Purpose: Declares the trip statistics. Running totals of distance, moving
+ *          and stopped time, top speed and altitude are brought up to date
+ *          with every sampled fix, shown on the LCD and written into the
+ *          track as a summary record when recording ends
+ */
+#ifndef __TRIP_H
+#define __TRIP_H
+
+#include "utilities.h"
+#include "fix.h"
+
+// Below this ground speed the logger counts as stopped, in cm/s
+#define TRIP_STILL_CM_S 50
+
+// Legs up to this far north or east, in 1e-7 degrees, are measured on a flat
+// projection around their middle latitude. Longer ones, after a gap in the
+// fixes, fall back to the great circle
+#define TRIP_FLAT_SPAN 10000000L
+
+// Altitude has to change this much before it adds to the climb or descent,
+// so receiver noise on level ground doesn't, in mm
+#define TRIP_CLIMB_STEP_MM 3000
+
+// Every this many fixes the LCD shows the trip page instead of the position
+#define TRIP_PAGE_PERIOD 4
+
+typedef struct {
+    uint32_t distance;      // meters travelled while moving
+    uint32_t distanceCm;    // and centimeters on top of that
+    uint32_t movingTime;    // seconds at or above TRIP_STILL_CM_S
+    uint32_t stoppedTime;   // seconds below it
+    uint32_t maxSpeed;      // cm/s
+    int32_t minAlt;         // mm above mean sea level, valid if altFixes isn't 0
+    int32_t maxAlt;
+    uint32_t altFixes;      // fixes with an altitude
+    uint32_t climb;         // mm of ascent and descent past TRIP_CLIMB_STEP_MM
+    uint32_t descent;
+    uint32_t fixes;         // fixes counted
+} TRIP;
+
+extern TRIP trip;
+
+void TRIP_Reset(void);
+void TRIP_Update(FIX *fix);
+uint32_t TRIP_Leg(int32_t lat0, int32_t lon0, int32_t lat1, int32_t lon1);
+int TRIP_Format(char *buf, uint32_t len);
+void TRIP_Log(void);
+void TRIP_ShowLCD(void);
+
+#endif /* __TRIP_H */
@@ -7,15 +7,27 @@
 #include "string.h"
 
 /*
- * Calculate checksum of data for UBX, 2 chars are put into buf
- * This is 8-bit Fletcher Algorithm
+ * Build a UBX frame around len bytes of payload in buf, which needs room for
+ * len + UBX_FRAME_OVERHEAD. The checksum is the 8-bit Fletcher Algorithm over
+ * class to the end of the payload. Returns the frame length
  */
-void UBX_checksum(char *buf, char* data) {
-    char ck_a = 0, ck_b = 0;
-    uint32_t len = strlen(data);
+uint32_t UBX_Frame(uint8_t *buf, uint8_t msgclass, uint8_t msgid, const uint8_t *payload, uint16_t len) {
+    uint8_t ck_a = 0, ck_b = 0;
 
-    for (int i = 0; i < len; i++) {
-        ck_a += data[i];
+    buf[0] = UBX_SYNC_1;
+    buf[1] = UBX_SYNC_2;
+    buf[2] = msgclass;
+    buf[3] = msgid;
+    buf[4] = len & 0xFF;
+    buf[5] = len >> 8;
+    if (len > 0) memcpy(&buf[6], payload, len);
+
+    for (uint32_t i = 2; i < 6 + (uint32_t) len; i++) {
+        ck_a += buf[i];
         ck_b += ck_a;
     }
+    buf[6+len] = ck_a;
+    buf[7+len] = ck_b;
+
+    return len + UBX_FRAME_OVERHEAD;
 }
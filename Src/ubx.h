@@ -13,6 +13,7 @@
 
 // length of some elements of UBX message
 #define UBX_MAX_LEN_MSGLEN 2
+#define UBX_FRAME_OVERHEAD 8    // sync, class, ID, length and checksum around the payload
 
 // Class value of the various message types
 #define UBX_CLASS_NAV  0x01
@@ -32,6 +33,20 @@
 #define UBX_CLASS_NMEA 0xF0
 
 // ID value of various message types
+// ACK messages
+#define UBX_ID_ACK_NAK 0x00
+#define UBX_ID_ACK_ACK 0x01
+// CFG messages
+#define UBX_ID_CFG_MSG 0x01
+#define UBX_ID_CFG_RATE 0x08
+#define UBX_ID_CFG_CFG 0x09
+#define UBX_ID_CFG_RXM 0x11
+#define UBX_ID_CFG_PM2 0x3B
+// NAV messages
+#define UBX_ID_NAV_STATUS 0x03
+// MGA messages
+#define UBX_ID_MGA_ANO 0x20
+#define UBX_ID_MGA_INI 0x40
 // NMEA messages
 #define UBX_ID_NMEA_DTM 0x0a
 #define UBX_ID_NMEA_GBQ 0x44
@@ -58,6 +73,75 @@
 #define UBX_ID_NMEA_PUBX_SVSTATUS 0x03
 #define UBX_ID_NMEA_PUBX_TIME     0x04
 
+// UBX-CFG-MSG setting the rate of one message on the port it arrives on
+// | sync | CFG | MSG | length 3 | msgClass | msgID | rate | CK_A | CK_B |
+#define UBX_CFG_MSG_LEN 11
+
+// Fletcher checksum over class to rate. Every byte is a constant so the
+// compiler works it out and the frame sits in flash ready to send
+#define UBX_CFG_MSG_CK_A(cls, id, rate) \
+    ((UBX_CLASS_CFG + UBX_ID_CFG_MSG + 3 + (cls) + (id) + (rate)) & 0xFF)
+#define UBX_CFG_MSG_CK_B(cls, id, rate) \
+    ((7*UBX_CLASS_CFG + 6*UBX_ID_CFG_MSG + 5*3 + 3*(cls) + 2*(id) + (rate)) & 0xFF)
+
+#define UBX_CFG_MSG(cls, id, rate) { UBX_SYNC_1, UBX_SYNC_2, UBX_CLASS_CFG, UBX_ID_CFG_MSG, 3, 0, \
+    (cls), (id), (rate), UBX_CFG_MSG_CK_A(cls, id, rate), UBX_CFG_MSG_CK_B(cls, id, rate) }
+
+typedef uint8_t UBX_CFG_MSG_FRAME[UBX_CFG_MSG_LEN];
+
+// UBX-CFG-MSG answering a poll with the rate on every port:
+// | sync | CFG | MSG | length 8 | msgClass | msgID | rate x 6 | CK_A | CK_B |
+#define UBX_CFG_MSG_POLL_LEN 16
+
+// UBX-CFG-CFG masks
+#define UBX_CFG_CFG_IOPORT  0x01    // port settings, including the UART rate
+#define UBX_CFG_CFG_MSGCONF 0x02    // message rates
+#define UBX_CFG_CFG_DEV_BBR 0x01    // battery backed RAM, all the SAM-M8Q has
+
+// UBX-CFG-RATE: | sync | CFG | RATE | length 6 | measRate | navRate | timeRef | CK_A | CK_B |,
+// a solution every measRate ms, output every navRate solutions
+#define UBX_CFG_RATE_LEN      14
+#define UBX_CFG_RATE_TIME_UTC 0
+#define UBX_CFG_RATE_TIME_GPS 1
+
+// UBX-CFG-RXM: | sync | CFG | RXM | length 2 | reserved | lpMode | CK_A | CK_B |
+#define UBX_CFG_RXM_LEN        10
+#define UBX_CFG_RXM_CONTINUOUS 0
+#define UBX_CFG_RXM_POWER_SAVE 1
+
+// UBX-CFG-PM2 version 1: | sync | CFG | PM2 | length 44 | version | reserved |
+// maxStartupStateDur | reserved | flags | updatePeriod | searchPeriod | gridOffset |
+// onTime | minAcqTime | reserved | CK_A | CK_B |, how power save mode operates.
+// Field offsets are into the payload
+#define UBX_CFG_PM2_LEN           52
+#define UBX_CFG_PM2_VERSION       0x01
+#define UBX_CFG_PM2_FLAGS         4
+#define UBX_CFG_PM2_UPDATE_PERIOD 8
+#define UBX_CFG_PM2_SEARCH_PERIOD 12
+#define UBX_CFG_PM2_ON_TIME       20
+#define UBX_CFG_PM2_UPDATE_EPH    (1UL << 12)  // wake to keep the ephemeris fresh
+#define UBX_CFG_PM2_MODE_ONOFF    (0UL << 17)  // off between fixes
+#define UBX_CFG_PM2_MODE_CYCLIC   (1UL << 17)  // tracking, at low power between fixes
+
+// UBX-NAV-STATUS: | sync | NAV | STATUS | length 16 | iTOW | gpsFix | flags | fixStat |
+// flags2 | ttff | msss | CK_A | CK_B |, the time to first fix in ms
+#define UBX_NAV_STATUS_LEN     24
+#define UBX_NAV_STATUS_FLAGS   11
+#define UBX_NAV_STATUS_TTFF    14
+#define UBX_NAV_STATUS_FIX_OK  0x01
+
+// UBX-MGA-ANO: | sync | MGA | ANO | length 76 | type | version | svId | gnssId |
+// year | month | day | reserved | data | reserved | CK_A | CK_B |, orbit data for a day
+#define UBX_MGA_ANO_LEN  84
+#define UBX_MGA_ANO_DATE 10
+
+// UBX-MGA-INI message types
+#define UBX_MGA_INI_POS_LLH  0x01
+#define UBX_MGA_INI_TIME_UTC 0x10
+
+// UBX-ACK-ACK/NAK: | sync | ACK | ACK or NAK | length 2 | clsID | msgID | CK_A | CK_B |
+#define UBX_ACK_LEN 10
+
 typedef struct {
     char msgclass;
     char msgid;
@@ -67,6 +151,6 @@ typedef struct {
 } UBX_MSG;
 
 
-void UBX_checksum(char *buf, char* data);
+uint32_t UBX_Frame(uint8_t *buf, uint8_t msgclass, uint8_t msgid, const uint8_t *payload, uint16_t len);
 
 #endif /* __UBX_H */
@@ -4,28 +4,132 @@
  */
  #include "utilities.h"
  #include "openlog.h"
+ #include "telemetry.h"
+ #include "gps.h"
 
+// Bytes waiting to go out on USART3, drained by the TXE interrupt. The main
+// loop is its only producer, an interrupt that has to send something goes
+// past it, see USART3_SendUpTo
+static uint8_t usart3TxStorage[USART3_TX_BUF_SIZE];
+RINGBUF usart3Tx;
+_Static_assert(RINGBUF_IS_POW2(USART3_TX_BUF_SIZE), "USART3_TX_BUF_SIZE must be a power of two");
+
+
+// Baud rate last requested, reapplied when the clock changes
+static uint32_t usart3Baud = 0;
+
+// Set while bytes are being collected for a burst, see USART3_Hold
+static volatile uint8_t usart3Held = 0;
+
+// Set once the queue stops at usart3Stop, see USART3_SendUpTo
+static volatile uint8_t usart3Stopped = 0;
+static volatile uint32_t usart3Stop;
+
+/*
+ * Start USART3 off at rate with an empty transmit queue, before it is enabled
+ */
+void USART3_Setup(uint32_t rate) {
+  RINGBUF_Init(&usart3Tx, usart3TxStorage, sizeof(usart3TxStorage));
+  USART3_SetBaudRate(rate);
+}
 
 /*
- * Set baud rate of USART3 to rate using the HCLK
+ * Set baud rate of USART3 to rate using PCLK, which clocks USART3
  */
 void USART3_SetBaudRate(uint32_t rate) {
-  uint32_t fclk = HAL_RCC_GetHCLKFreq();
-  uint16_t usartdiv = fclk / rate;
+  uint32_t fclk = HAL_RCC_GetPCLK1Freq();
+  uint16_t usartdiv = (fclk + rate/2) / rate; // round to nearest
+  usart3Baud = rate;
   USART3->BRR = usartdiv;
 }
 
+/*
+ * Recompute BRR after a clock change. BRR can only be written while the USART
+ * is disabled, so anything being sent is finished first, unless it stays the
+ * same
+ */
+void USART3_UpdateBaudRate(void) {
+  if (!(USART3->CR1 & USART_CR1_UE_Msk) || usart3Baud == 0) return; // not set up yet
+  if (USART3->BRR == (HAL_RCC_GetPCLK1Freq() + usart3Baud/2) / usart3Baud) return;
+
+  USART3_Flush();
+  USART3->CR1 &= ~USART_CR1_UE_Msk;
+  USART3_SetBaudRate(usart3Baud);
+  USART3->CR1 |= USART_CR1_UE_Msk;
+}
+
  /*
- * Send char on USART3
+ * Queue char to send on USART3. Only blocks if the transmit queue is full.
+ * Only from the main loop
  */
 void USART3_SendChar(char c) {
-	// wait until transmit data register is empty. bit 7 will be set when empty
-	while ((USART3->ISR & (1 << 7)) == 0) {}
-	
-	// Transmit data register is now empty, write new char to send
+	// wait for the interrupt to make room, a full queue goes out even if held.
+	// A stopped one doesn't, the byte is dropped
+	if (RINGBUF_Free(&usart3Tx) == 0 && !usart3Stopped) {
+		telemetry.txStalls++;
+		USART3->CR1 |= USART_CR1_TXEIE_Msk;
+		while (RINGBUF_Free(&usart3Tx) == 0) {}
+	}
+
+	RINGBUF_Push(&usart3Tx, c);
+
+	// Transmit data register empty interrupt will drain the queue
+	if (!usart3Held && !usart3Stopped) USART3->CR1 |= USART_CR1_TXEIE_Msk;
+}
+
+/*
+ * Keep what is queued from now on until USART3_Release, so it goes out in one
+ * burst. A burst already under way carries on and takes the new bytes along
+ */
+void USART3_Hold(void) {
+	usart3Held = 1;
+}
+
+/*
+ * Start sending what was held back
+ */
+void USART3_Release(void) {
+	usart3Held = 0;
+	if (RINGBUF_Count(&usart3Tx) != 0 && !usart3Stopped) USART3->CR1 |= USART_CR1_TXEIE_Msk;
+}
+
+/*
+ * Send what was queued before free running index head, held or not, and stop
+ * the queue there. Waits until it has gone. Nothing more goes out of the
+ * queue until USART3_Discard, so an interrupt can send the rest itself with
+ * USART3_SendNow without touching it. Returns the number of bytes sent
+ */
+uint32_t USART3_SendUpTo(uint32_t head) {
+	int32_t left = head - usart3Tx.tail;
+
+	usart3Stop = head;
+	usart3Stopped = 1;
+	if (left > 0) USART3->CR1 |= USART_CR1_TXEIE_Msk;
+	else USART3->CR1 &= ~USART_CR1_TXEIE_Msk; // already past it
+
+	USART3_Flush();
+	return left > 0 ? left : 0;
+}
+
+/*
+ * Send char on USART3 past the queue, blocking. Only once USART3_SendUpTo has
+ * stopped it
+ */
+void USART3_SendNow(char c) {
+	while ((USART3->ISR & USART_ISR_TXE_Msk) == 0) {}
 	USART3->TDR = c;
 }
 
+/*
+ * Drop everything queued and start the queue again after USART3_SendUpTo.
+ * Only with interrupts masked
+ */
+void USART3_Discard(void) {
+	RINGBUF_Consume(&usart3Tx, RINGBUF_Count(&usart3Tx));
+	usart3Stopped = 0;
+	usart3Held = 0;
+}
+
 
 /*
  * Send a null-terminated string on USART3
@@ -35,9 +139,222 @@ void USART3_SendStr(char* s) {
 	while (s[i] != '\0') USART3_SendChar(s[i++]);
 }
 
+/*
+ * Wait until everything being sent has been shifted out of USART3. Bytes that
+ * are held stay queued
+ */
+void USART3_Flush(void) {
+	if (!(USART3->CR1 & USART_CR1_UE_Msk)) return; // not set up yet
+
+	while (USART3->CR1 & USART_CR1_TXEIE_Msk) {} // cleared once the queue is empty
+	while ((USART3->ISR & USART_ISR_TC_Msk) == 0) {}
+}
+
+/*
+ * Move the next queued byte into the transmit data register
+ */
+void USART3_TransmitInterrupt(void) {
+    if (!(USART3->CR1 & USART_CR1_TXEIE_Msk) || !(USART3->ISR & USART_ISR_TXE_Msk)) return;
+
+    uint8_t c;
+    if ((usart3Stopped && (int32_t) (usart3Stop - usart3Tx.tail) <= 0) || RINGBUF_Pop(&usart3Tx, &c)) { // nothing left to send
+        USART3->CR1 &= ~USART_CR1_TXEIE_Msk;
+        return;
+    }
+
+    USART3->TDR = c;
+}
+
+// Baud rate of the USART1 debug port, reapplied when the clock changes
+static uint32_t usart1Baud = 0;
+
+/*
+ * Set up USART1 as the debug port, sending on PA(tx_pin) and taking single
+ * character commands on PA(rx_pin)
+ */
+void USART1_Setup(uint8_t tx_pin, uint8_t rx_pin, uint32_t rate) {
+    RCC->APB2ENR |= RCC_APB2ENR_USART1EN; // Enable USART1 clock
+    RCC->AHBENR |= RCC_AHBENR_GPIOAEN;    // Enable GPIOA clock
+
+    configPinA_AF1(tx_pin);
+    configPinA_AF1(rx_pin);
+
+    usart1Baud = rate;
+    USART1->BRR = (HAL_RCC_GetPCLK1Freq() + rate/2) / rate;
+    USART1->CR3 |= USART_CR3_OVRDIS; // commands typed while busy are dropped, not stuck
+    USART1->CR1 |= USART_CR1_TE_Msk | USART_CR1_RE_Msk | USART_CR1_UE_Msk;
+}
+
+/*
+ * Recompute BRR after a clock change, unless it stays the same
+ */
+void USART1_UpdateBaudRate(void) {
+    if (!(USART1->CR1 & USART_CR1_UE_Msk) || usart1Baud == 0) return; // not set up yet
+    if (USART1->BRR == (HAL_RCC_GetPCLK1Freq() + usart1Baud/2) / usart1Baud) return;
+
+    while ((USART1->ISR & USART_ISR_TC_Msk) == 0) {}
+    USART1->CR1 &= ~USART_CR1_UE_Msk;
+    USART1->BRR = (HAL_RCC_GetPCLK1Freq() + usart1Baud/2) / usart1Baud;
+    USART1->CR1 |= USART_CR1_UE_Msk;
+}
+
+/*
+ * Send char on the USART1 debug port, blocking
+ */
+void USART1_SendChar(char c) {
+    if (!(USART1->CR1 & USART_CR1_UE_Msk)) return; // debug port not in use
+
+    while ((USART1->ISR & USART_ISR_TXE_Msk) == 0) {}
+    USART1->TDR = c;
+}
+
+/*
+ * Send a null-terminated string on the USART1 debug port
+ */
+void USART1_SendStr(char* s) {
+    uint32_t i = 0;
+    while (s[i] != '\0') USART1_SendChar(s[i++]);
+}
+
+/*
+ * Character received on the USART1 debug port in c, without waiting.
+ * Returns 1 if there is none, 0 otherwise
+ */
+uint8_t USART1_Receive(uint8_t *c) {
+    if (!(USART1->ISR & USART_ISR_RXNE_Msk)) return 1; // FAILURE
+
+    *c = USART1->RDR;
+    return 0;
+}
+
+// Baud rate and receive buffer of the USART2 receiver link
+static uint32_t usart2Baud = 0;
+static uint32_t usart2RxSize = 0;
+
+/*
+ * BRR for rate on USART2, which oversamples by 8 so fast rates stay accurate
+ * at the low power clock
+ */
+static uint32_t USART2_Brr(uint32_t rate) {
+    uint32_t usartdiv = (2 * HAL_RCC_GetPCLK1Freq() + rate/2) / rate;
+    return (usartdiv & ~0xFUL) | ((usartdiv & 0xF) >> 1);
+}
+
+/*
+ * Set baud rate of USART2. BRR can only be written while the USART is
+ * disabled, which drops a byte being received
+ */
+void USART2_SetBaudRate(uint32_t rate) {
+    uint32_t enabled = USART2->CR1 & USART_CR1_UE_Msk;
+
+    usart2Baud = rate;
+    USART2->CR1 &= ~USART_CR1_UE_Msk;
+    USART2->BRR = USART2_Brr(rate);
+    USART2->CR1 |= enabled;
+}
+
+/*
+ * Set up USART2 on PA(tx_pin) and PA(rx_pin) for a receiver. Everything
+ * received is copied into the circular buffer rx of size bytes by DMA1
+ * channel 5, the idle line and half/full buffer interrupts tell the GPS
+ * module when there is something new
+ */
+void USART2_Setup(uint8_t tx_pin, uint8_t rx_pin, uint32_t rate, uint8_t *rx, uint32_t size) {
+    RCC->APB1ENR |= RCC_APB1ENR_USART2EN; // Enable USART2 clock
+    RCC->AHBENR |= RCC_AHBENR_GPIOAEN | RCC_AHBENR_DMAEN; // Enable GPIOA and DMA1 clocks
+
+    configPinA_AF1(tx_pin);
+    configPinA_AF1(rx_pin);
+
+    // peripheral to memory, bytes, memory increment, circular
+    usart2RxSize = size;
+    DMA1_Channel5->CCR = 0;
+    DMA1_Channel5->CPAR = (uint32_t) (uintptr_t) &USART2->RDR;
+    DMA1_Channel5->CMAR = (uint32_t) (uintptr_t) rx;
+    DMA1_Channel5->CNDTR = size;
+    DMA1_Channel5->CCR = DMA_CCR_MINC_Msk | DMA_CCR_CIRC_Msk | DMA_CCR_HTIE_Msk | DMA_CCR_TCIE_Msk | DMA_CCR_EN_Msk;
+
+    USART2->CR1 = USART_CR1_OVER8_Msk;
+    USART2_SetBaudRate(rate);
+    USART2->CR3 |= USART_CR3_DMAR_Msk | USART_CR3_OVRDIS_Msk;
+    USART2->CR1 |= USART_CR1_IDLEIE_Msk | USART_CR1_TE_Msk | USART_CR1_RE_Msk | USART_CR1_UE_Msk;
+
+    NVIC_EnableIRQ(USART2_IRQn);
+    NVIC_EnableIRQ(DMA1_Channel4_5_6_7_IRQn);
+}
+
+/*
+ * Recompute BRR after a clock change, unless it stays the same
+ */
+void USART2_UpdateBaudRate(void) {
+    if (!(USART2->CR1 & USART_CR1_UE_Msk) || usart2Baud == 0) return; // not set up yet
+    if (USART2->BRR == USART2_Brr(usart2Baud)) return;
+
+    USART2_Flush();
+    USART2_SetBaudRate(usart2Baud);
+}
+
+/*
+ * Send char on USART2, blocking. Only used for the few configuration messages
+ */
+void USART2_SendChar(char c) {
+    while ((USART2->ISR & USART_ISR_TXE_Msk) == 0) {}
+    USART2->TDR = c;
+}
+
+/*
+ * Send a null-terminated string on USART2
+ */
+void USART2_SendStr(char* s) {
+    uint32_t i = 0;
+    while (s[i] != '\0') USART2_SendChar(s[i++]);
+}
+
+/*
+ * Wait until everything sent has been shifted out of USART2
+ */
+void USART2_Flush(void) {
+    if (!(USART2->CR1 & USART_CR1_UE_Msk)) return; // not set up yet
+
+    while ((USART2->ISR & USART_ISR_TC_Msk) == 0) {}
+}
+
+/*
+ * Index in the receive buffer the DMA writes next
+ */
+uint32_t USART2_RxHead(void) {
+    uint32_t head = usart2RxSize - DMA1_Channel5->CNDTR;
+    return head < usart2RxSize ? head : 0;
+}
+
+/*
+ * USART2 interrupt handler, the line went idle after a burst
+ */
+void USART2_IRQHandler(void) {
+    USART2->ICR = USART_ICR_IDLECF_Msk;
+    GPS_USART2ReceivedInterrupt();
+}
+
+/*
+ * DMA1 channels 4 to 7 interrupt handler, channel 5 filled half or all of
+ * the receive buffer in the middle of a burst
+ */
+void DMA1_Channel4_5_6_7_IRQHandler(void) {
+    DMA1->IFCR = DMA_IFCR_CHTIF5_Msk | DMA_IFCR_CTCIF5_Msk;
+    GPS_USART2ReceivedInterrupt();
+}
+
 /*
  * USART3 and 4 interrupt handler
  */
 void USART3_4_IRQHandler(void) {
+    // a byte that came before the last was read, while a flash erase stalled
+    // the CPU, is lost. ORE keeps the interrupt pending until it is cleared
+    if (USART3->ISR & USART_ISR_ORE_Msk) {
+        USART3->ICR = USART_ICR_ORECF_Msk;
+        telemetry.rxOverruns++;
+    }
+
+    USART3_TransmitInterrupt();
     OPENLOG_USART3ReceivedInterrupt();
 }
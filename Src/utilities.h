@@ -6,6 +6,7 @@
 #define __UTILITIES_H
 
 #include "stm32f0xx_hal.h"
+#include "ringbuf.h"
 
 
 // LED Pins on GPIOC
@@ -14,6 +15,16 @@
 #define ORANGE_LED 8
 #define GREEN_LED 9
 
+// Size of the USART3 transmit queue, must be a power of two. The track is
+// collected in it between bursts, see batch.h
+#define USART3_TX_BUF_SIZE 1024
+
+// I2C1 timing is built from a 250 ns prescaled clock
+#define I2C_TIMING_TPRESC_HZ 4000000
+
+// Longest a single I2C1 byte may take before the transfer is aborted
+#define I2C_TIMEOUT_US 10000
+
 // I2C rd/wr directions
 #define READ 1
 #define WRITE 0
@@ -40,22 +51,57 @@ void floatToStr(char* buf, float num, int numplaces);
 void configUserButtonInterrupt(void);
 
 // usart.c
+extern RINGBUF usart3Tx;
+void USART3_Setup(uint32_t rate);
 void USART3_SetBaudRate(uint32_t rate);
+void USART3_UpdateBaudRate(void);
 void USART3_SendChar(char c);
 void USART3_SendStr(char* str);
+void USART3_Hold(void);
+void USART3_Release(void);
+uint32_t USART3_SendUpTo(uint32_t head);
+void USART3_SendNow(char c);
+void USART3_Discard(void);
+void USART3_Flush(void);
+void USART3_TransmitInterrupt(void);
+void USART1_Setup(uint8_t tx_pin, uint8_t rx_pin, uint32_t rate);
+void USART1_UpdateBaudRate(void);
+void USART1_SendChar(char c);
+void USART1_SendStr(char* str);
+uint8_t USART1_Receive(uint8_t *c);
+void USART2_SetBaudRate(uint32_t rate);
+void USART2_Setup(uint8_t tx_pin, uint8_t rx_pin, uint32_t rate, uint8_t *rx, uint32_t size);
+void USART2_UpdateBaudRate(void);
+void USART2_SendChar(char c);
+void USART2_SendStr(char* str);
+void USART2_Flush(void);
+uint32_t USART2_RxHead(void);
 
 // i2c.c
+uint32_t I2C1_GetClockFreq(void);
 void I2C1_Config(void);
+void I2C1_UpdateTiming(void);
+void I2C1_Recover(void);
+uint8_t I2C1_WaitFlag(uint32_t flag);
 void I2C1_TransactionSetup(uint8_t addr, uint8_t bytes, uint8_t rdwr);
 void I2C1_SendStopCondition(void);
 void I2C1_SendChar(char c);
 uint8_t I2C1_WriteStr(uint32_t addr, uint8_t reg, char *str);
+uint8_t I2C1_WriteNoReg(uint32_t addr, uint8_t *data, uint32_t len);
 uint8_t I2C1_WriteStrNoReg(uint32_t addr, char *str);
 uint8_t I2C1_ReadStr(uint32_t addr, uint8_t reg, char str[], uint8_t bytes);
 
+// spi.c
+void SPI2_Setup(uint32_t max_hz);
+void SPI2_ConfigClock(void);
+void SPI2_UpdateClock(void);
+void SPI2_SendByte(uint8_t c);
+
 // pincofing.c
 // GPIOA pins
 void configUserButton(void); // PA0
+void configPinA_AF1(uint8_t x);
+void configPinA_AF2(uint8_t x);
 // GPIOB pins
 void configGPIOB_output(uint8_t pin);
 void configPinB_AF0(uint8_t x);